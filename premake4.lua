@@ -117,7 +117,112 @@ project "LuaInject"
         flags { "Optimize" }
         targetdir "bin/release"				
 		links { "tinyxml_STL" }
-		
+
+-- Measures the cost of the debug hook. The backend is built against stand-ins
+-- for the Lua interfaces and the channel to the frontend so it can run without
+-- a Lua library or a debugger, and against a subset of the Win32 API on other
+-- platforms.
+project "HookBenchmark"
+    kind "ConsoleApp"
+    location "build"
+    language "C++"
+	defines { "TIXML_USE_STL" }
+    files {
+		"src/HookBenchmark/*.h",
+		"src/HookBenchmark/*.cpp",
+		"src/LuaInject/DebugBackend.h",
+		"src/LuaInject/DebugBackend.cpp",
+		"src/LuaInject/LuaCheckStack.h",
+		"src/LuaInject/LuaCheckStack.cpp",
+		"src/LuaInject/XmlUtility.h",
+		"src/LuaInject/XmlUtility.cpp",
+		"src/Shared/*.h",
+		"src/Shared/*.cpp",
+	}
+	excludes {
+		"src/Shared/Channel.cpp",
+	}
+    includedirs {
+		"src/Shared",
+		"src/LuaInject",
+		"libs/LuaPlus/include",
+		"libs/tinyxml/include",
+	}
+
+	configuration "windows"
+		files {
+			"src/LuaInject/DebugHelp.h",
+			"src/LuaInject/DebugHelp.cpp",
+		}
+		includedirs { "libs/dbghlp/include" }
+		libdirs {
+			"libs/tinyxml/lib",
+			"libs/dbghlp/lib",
+		}
+		links { "psapi" }
+
+	configuration "not windows"
+		files {
+			"src/HookBenchmark/Posix/*.h",
+			"src/HookBenchmark/Posix/*.cpp",
+		}
+		includedirs { "src/HookBenchmark/Posix" }
+		buildoptions { "-std=gnu++11", "-fpermissive" }
+		links { "pthread" }
+
+    configuration "Debug"
+        defines { "DEBUG" }
+        flags { "Symbols" }
+        targetdir "bin/debug"
+
+    configuration "Release"
+        defines { "NDEBUG" }
+        flags { "Optimize" }
+        targetdir "bin/release"
+
+	configuration { "windows", "Debug" }
+		links { "tinyxmld_STL" }
+
+	configuration { "windows", "Release" }
+		links { "tinyxml_STL" }
+
+project "ChannelBenchmark"
+    kind "ConsoleApp"
+    location "build"
+    language "C++"
+    files {
+		"src/ChannelBenchmark/*.cpp",
+		"src/Shared/Channel.h",
+		"src/Shared/Channel.cpp",
+		"src/Shared/CriticalSection.h",
+		"src/Shared/CriticalSection.cpp",
+		"src/Shared/CriticalSectionLock.h",
+		"src/Shared/CriticalSectionLock.cpp",
+		"src/Shared/Protocol.h",
+	}
+    includedirs {
+		"src/Shared",
+	}
+
+	configuration "not windows"
+		files {
+			"src/HookBenchmark/Posix/windows.h",
+			"src/HookBenchmark/Posix/Windows.cpp",
+		}
+		includedirs { "src/HookBenchmark/Posix" }
+		buildoptions { "-std=gnu++11", "-fpermissive" }
+		links { "pthread" }
+
+    configuration "Debug"
+        defines { "DEBUG" }
+        flags { "Symbols" }
+        targetdir "bin/debug"
+
+    configuration "Release"
+        defines { "NDEBUG" }
+        flags { "Optimize" }
+        targetdir "bin/release"
+
 project "Shared"
     kind "StaticLib"
     location "build"
@@ -0,0 +1,249 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc.
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Measures how many events a channel can carry per second. One thread writes
+// events the way the backend does and another reads them the way the frontend
+// does, over a real pipe. Break events are written a field at a time with a
+// call stack of s_numFrames frames, and messages are a few fields long.
+
+#include "Channel.h"
+#include "Protocol.h"
+
+#include <stdio.h>
+#include <chrono>
+#include <string>
+
+static const unsigned int   s_numFrames     = 50;       // Call stack depth of the break events.
+static const unsigned int   s_numRuns       = 5;        // Times each kind of event is timed.
+
+static const char*  s_message       = "Logpoint hit in benchmark/script1.lua on line 42";
+static const char*  s_functionName  = "Benchmark.UpdateEntity";
+
+/**
+ * Kind of event sent through the channel.
+ */
+struct Workload
+{
+    const char*     name;
+    unsigned int    numEvents;
+    bool            isBreak;
+};
+
+/**
+ * State shared with the reading thread.
+ */
+struct ReaderArgs
+{
+    Channel*        channel;
+    const Workload* workload;
+    unsigned int    numEventsRead;
+};
+
+static void WriteEvent(Channel& channel, const Workload& workload)
+{
+
+    if (workload.isBreak)
+    {
+
+        channel.WriteUInt32(EventId_Break);
+        channel.WriteUInt32(0);
+        channel.WriteUInt32(s_numFrames);
+
+        for (unsigned int i = 0; i < s_numFrames; ++i)
+        {
+            channel.WriteUInt32(i % 8);
+            channel.WriteUInt32(i * 10);
+            channel.WriteString(s_functionName);
+        }
+
+    }
+    else
+    {
+        channel.WriteUInt32(EventId_Message);
+        channel.WriteUInt32(0);
+        channel.WriteUInt32(MessageType_Normal);
+        channel.WriteString(s_message);
+    }
+
+    channel.Flush();
+
+}
+
+static bool ReadEvent(Channel& channel, const Workload& workload)
+{
+
+    unsigned int eventId;
+    unsigned int vm;
+    std::string  text;
+
+    if (!channel.ReadUInt32(eventId) || !channel.ReadUInt32(vm))
+    {
+        return false;
+    }
+
+    if (workload.isBreak)
+    {
+
+        unsigned int numFrames;
+
+        if (eventId != EventId_Break || !channel.ReadUInt32(numFrames))
+        {
+            return false;
+        }
+
+        for (unsigned int i = 0; i < numFrames; ++i)
+        {
+            unsigned int scriptIndex;
+            unsigned int line;
+            if (!channel.ReadUInt32(scriptIndex) || !channel.ReadUInt32(line) || !channel.ReadString(text))
+            {
+                return false;
+            }
+        }
+
+        return text == s_functionName;
+
+    }
+    else
+    {
+
+        unsigned int type;
+
+        if (eventId != EventId_Message || !channel.ReadUInt32(type) || !channel.ReadString(text))
+        {
+            return false;
+        }
+
+        return text == s_message;
+
+    }
+
+}
+
+static DWORD WINAPI ReaderThreadProc(LPVOID param)
+{
+
+    ReaderArgs* args = static_cast<ReaderArgs*>(param);
+
+    while (args->numEventsRead < args->workload->numEvents && ReadEvent(*args->channel, *args->workload))
+    {
+        ++args->numEventsRead;
+    }
+
+    return 0;
+
+}
+
+/**
+ * Sends the events of the workload through a new pair of channels and
+ * returns the number of seconds it took for them all to be read, or a
+ * negative number if they weren't.
+ */
+static double Run(const Workload& workload, unsigned int run)
+{
+
+    char name[256];
+    _snprintf(name, 256, "Decoda.Benchmark.%x.%s.%u", GetCurrentProcessId(), workload.name, run);
+
+    Channel reader;
+    Channel writer;
+
+    if (!reader.Create(name) || !writer.Connect(name) || !reader.WaitForConnection())
+    {
+        return -1.0;
+    }
+
+    ReaderArgs args;
+    args.channel        = &reader;
+    args.workload       = &workload;
+    args.numEventsRead  = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    DWORD threadId;
+    HANDLE thread = CreateThread(NULL, 0, ReaderThreadProc, &args, 0, &threadId);
+
+    for (unsigned int i = 0; i < workload.numEvents; ++i)
+    {
+        WriteEvent(writer, workload);
+    }
+
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    writer.Destroy();
+    reader.Destroy();
+
+    if (args.numEventsRead != workload.numEvents)
+    {
+        return -1.0;
+    }
+
+    return std::chrono::duration_cast<std::chrono::duration<double> >(end - start).count();
+
+}
+
+int main(int argc, char* argv[])
+{
+
+    static const Workload workloads[] =
+        {
+            { "Message", 100000, false },
+            { "Break",    10000, true  },
+        };
+
+    printf("%8s %8s %14s\n", "Event", "Events", "Events/second");
+
+    for (unsigned int w = 0; w < sizeof(workloads) / sizeof(workloads[0]); ++w)
+    {
+
+        const Workload& workload = workloads[w];
+
+        double seconds = 0.0;
+
+        for (unsigned int run = 0; run < s_numRuns; ++run)
+        {
+
+            double runSeconds = Run(workload, run);
+
+            if (runSeconds < 0.0)
+            {
+                fprintf(stderr, "Couldn't send the %s events through the channel\n", workload.name);
+                return 1;
+            }
+
+            if (run == 0 || runSeconds < seconds)
+            {
+                seconds = runSeconds;
+            }
+
+        }
+
+        printf("%8s %8u %14.0f\n", workload.name, workload.numEvents, workload.numEvents / seconds);
+
+    }
+
+    return 0;
+
+}
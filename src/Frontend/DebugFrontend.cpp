@@ -52,12 +52,14 @@ DebugFrontend::DebugFrontend()
     m_eventHandler  = NULL;
     m_eventThread   = NULL;
     m_state         = State_Inactive;
+    m_profiling     = false;
 }
 
 DebugFrontend::~DebugFrontend()
 {
     Stop(false);
     ClearVector(m_scripts);
+    m_sourceStore.Clear();
 }
 
 void DebugFrontend::SetEventHandler(wxEvtHandler* eventHandler)
@@ -514,14 +516,23 @@ void DebugFrontend::EventThreadProc()
 
             Script* script = new Script;
 
+            // The source isn't sent with the script, it's requested when we need it.
+            script->source = NULL;
+
             m_eventChannel.ReadString(script->name);
-            m_eventChannel.ReadString(script->source);
+            m_eventChannel.ReadUInt64(script->hash);
+            m_eventChannel.ReadUInt32(script->size);
 
             unsigned int codeState;
             m_eventChannel.ReadUInt32(codeState);
 
             script->state = static_cast<CodeState>(codeState);
 
+            bool waitForLoad;
+            m_eventChannel.ReadBool(waitForLoad);
+
+            event.SetEnabled(waitForLoad);
+
             // If the debuggee does wacky things when it specifies the file name
             // we need to correct for that or it can make trying to access the
             // file bad.
@@ -626,6 +637,38 @@ void DebugFrontend::EventThreadProc()
             
             event.SetMessage(message);            
 
+        }
+        else if (eventId == EventId_ProfileSamples)
+        {
+
+            unsigned int numStacks;
+            m_eventChannel.ReadUInt32(numStacks);
+
+            std::vector<ProfileStack> stacks(numStacks);
+
+            for (unsigned int i = 0; i < numStacks; ++i)
+            {
+
+                m_eventChannel.ReadUInt32(stacks[i].count);
+
+                unsigned int numFrames;
+                m_eventChannel.ReadUInt32(numFrames);
+                stacks[i].frames.resize(numFrames);
+
+                for (unsigned int j = 0; j < numFrames; ++j)
+                {
+                    ProfileFrame& frame = stacks[i].frames[j];
+                    m_eventChannel.ReadUInt32(frame.scriptIndex);
+                    m_eventChannel.ReadUInt32(frame.line);
+                    m_eventChannel.ReadString(frame.function);
+                }
+
+            }
+
+            // The stacks are picked up by the UI when it handles the event.
+            CriticalSectionLock lock(m_criticalSection);
+            m_profileStacks.insert(m_profileStacks.end(), stacks.begin(), stacks.end());
+
         }
 
         // Dispatch the message to the UI.
@@ -648,10 +691,13 @@ void DebugFrontend::EventThreadProc()
 void DebugFrontend::Shutdown()
 {
 
-    m_state = State_Inactive;
+    m_state     = State_Inactive;
+    m_profiling = false;
+    m_profileStacks.clear();
 
     // Clean up the scripts.
     ClearVector(m_scripts);
+    m_sourceStore.Clear();
 
     // Clean up.
     CloseHandle(m_process);
@@ -692,6 +738,14 @@ void DebugFrontend::StepOver(unsigned int vm)
     m_commandChannel.Flush();
 }
 
+void DebugFrontend::StepOut(unsigned int vm)
+{
+    m_state = State_Running;
+    m_commandChannel.WriteUInt32(CommandId_StepOut);
+    m_commandChannel.WriteUInt32(vm);
+    m_commandChannel.Flush();
+}
+
 void DebugFrontend::StepInto(unsigned int vm)
 {
     m_state = State_Running;
@@ -707,6 +761,95 @@ void DebugFrontend::DoneLoadingScript(unsigned int vm)
     m_commandChannel.Flush();
 }
 
+bool DebugFrontend::LoadScriptSource(unsigned int scriptIndex)
+{
+
+    Script* script = GetScript(scriptIndex);
+
+    if (script == NULL)
+    {
+        return false;
+    }
+
+    if (script->source == NULL)
+    {
+
+        m_commandChannel.WriteUInt32(CommandId_GetSource);
+        m_commandChannel.WriteUInt32(scriptIndex);
+        m_commandChannel.WriteBool(true);
+        m_commandChannel.Flush();
+
+        unsigned int success;
+        std::string source;
+
+        // The backend fails if the index isn't valid or it's already given
+        // us the source.
+        if (!m_commandChannel.ReadUInt32(success) || !m_commandChannel.ReadString(source) || !success)
+        {
+            return false;
+        }
+
+        SetScriptSource(scriptIndex, source);
+
+    }
+
+    return true;
+
+}
+
+void DebugFrontend::SetScriptSource(unsigned int scriptIndex, const std::string& source)
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    Script* script = m_scripts[scriptIndex];
+
+    m_sourceStore.Release(script->source);
+    script->source = m_sourceStore.Acquire(source);
+
+}
+
+void DebugFrontend::SetBreakpointFiles(const std::vector<std::string>& fileNames)
+{
+
+    m_commandChannel.WriteUInt32(CommandId_SetBreakpointFiles);
+    m_commandChannel.WriteUInt32(fileNames.size());
+
+    for (unsigned int i = 0; i < fileNames.size(); ++i)
+    {
+        m_commandChannel.WriteString(fileNames[i]);
+    }
+
+    m_commandChannel.Flush();
+
+}
+
+void DebugFrontend::SetExclusionRules(const std::vector<std::string>& patterns, bool excludeStringScripts, unsigned int maxSize)
+{
+
+    m_commandChannel.WriteUInt32(CommandId_SetExclusionRules);
+    m_commandChannel.WriteUInt32(patterns.size());
+
+    for (unsigned int i = 0; i < patterns.size(); ++i)
+    {
+        m_commandChannel.WriteString(patterns[i]);
+    }
+
+    m_commandChannel.WriteBool(excludeStringScripts);
+    m_commandChannel.WriteUInt32(maxSize);
+    m_commandChannel.Flush();
+
+}
+
+void DebugFrontend::SetEvaluateLimits(unsigned int instructions, unsigned int time, unsigned int size)
+{
+    m_commandChannel.WriteUInt32(CommandId_SetEvaluateLimits);
+    m_commandChannel.WriteUInt32(instructions);
+    m_commandChannel.WriteUInt32(time);
+    m_commandChannel.WriteUInt32(size);
+    m_commandChannel.Flush();
+}
+
 bool DebugFrontend::Evaluate(unsigned int vm, const char* expression, unsigned int stackLevel, std::string& result)
 {
 
@@ -729,6 +872,63 @@ bool DebugFrontend::Evaluate(unsigned int vm, const char* expression, unsigned i
 
 }
 
+bool DebugFrontend::EvaluateMultiple(unsigned int vm, const std::vector<std::string>& expressions, unsigned int stackLevel, std::vector<std::string>& results)
+{
+
+    results.clear();
+    results.resize(expressions.size());
+
+    if (vm == 0 || expressions.empty())
+    {
+        return false;
+    }
+
+    m_commandChannel.WriteUInt32(CommandId_EvaluateMultiple);
+    m_commandChannel.WriteUInt32(vm);
+    m_commandChannel.WriteUInt32(expressions.size());
+
+    for (unsigned int i = 0; i < expressions.size(); ++i)
+    {
+        m_commandChannel.WriteString(expressions[i]);
+    }
+
+    m_commandChannel.WriteUInt32(stackLevel);
+    m_commandChannel.Flush();
+
+    for (unsigned int i = 0; i < expressions.size(); ++i)
+    {
+        unsigned int success;
+        m_commandChannel.ReadUInt32(success);
+        m_commandChannel.ReadString(results[i]);
+    }
+
+    return true;
+
+}
+
+bool DebugFrontend::ExpandValue(unsigned int vm, unsigned int handle, unsigned int offset, unsigned int limit, std::string& result)
+{
+
+    if (vm == 0)
+    {
+        return false;
+    }
+
+    m_commandChannel.WriteUInt32(CommandId_ExpandValue);
+    m_commandChannel.WriteUInt32(vm);
+    m_commandChannel.WriteUInt32(handle);
+    m_commandChannel.WriteUInt32(offset);
+    m_commandChannel.WriteUInt32(limit);
+    m_commandChannel.Flush();
+
+    unsigned int success;
+    m_commandChannel.ReadUInt32(success);
+    m_commandChannel.ReadString(result);
+
+    return success != 0;
+
+}
+
 void DebugFrontend::ToggleBreakpoint(unsigned int vm, unsigned int scriptIndex, unsigned int line)
 {
 
@@ -740,6 +940,42 @@ void DebugFrontend::ToggleBreakpoint(unsigned int vm, unsigned int scriptIndex,
 
 }
 
+void DebugFrontend::SetBreakpointCondition(unsigned int vm, unsigned int scriptIndex, unsigned int line, const std::string& condition, unsigned int hitCount)
+{
+
+    m_commandChannel.WriteUInt32(CommandId_SetBreakpointCondition);
+    m_commandChannel.WriteUInt32(vm);
+    m_commandChannel.WriteUInt32(scriptIndex);
+    m_commandChannel.WriteUInt32(line);
+    m_commandChannel.WriteString(condition);
+    m_commandChannel.WriteUInt32(hitCount);
+    m_commandChannel.Flush();
+
+}
+
+void DebugFrontend::ClearBreakpointCondition(unsigned int vm, unsigned int scriptIndex, unsigned int line)
+{
+
+    m_commandChannel.WriteUInt32(CommandId_ClearBreakpointCondition);
+    m_commandChannel.WriteUInt32(vm);
+    m_commandChannel.WriteUInt32(scriptIndex);
+    m_commandChannel.WriteUInt32(line);
+    m_commandChannel.Flush();
+
+}
+
+void DebugFrontend::SetLogpoint(unsigned int vm, unsigned int scriptIndex, unsigned int line, const std::string& message)
+{
+
+    m_commandChannel.WriteUInt32(CommandId_SetLogpoint);
+    m_commandChannel.WriteUInt32(vm);
+    m_commandChannel.WriteUInt32(scriptIndex);
+    m_commandChannel.WriteUInt32(line);
+    m_commandChannel.WriteString(message);
+    m_commandChannel.Flush();
+
+}
+
 void DebugFrontend::RemoveAllBreakPoints(unsigned int vm)
 {
 
@@ -955,6 +1191,33 @@ void DebugFrontend::IgnoreException(const std::string& message)
     m_commandChannel.Flush();
 }
 
+void DebugFrontend::StartProfiling(unsigned int interval)
+{
+    m_profiling = true;
+    m_commandChannel.WriteUInt32(CommandId_StartProfile);
+    m_commandChannel.WriteUInt32(interval);
+    m_commandChannel.Flush();
+}
+
+void DebugFrontend::StopProfiling()
+{
+    m_profiling = false;
+    m_commandChannel.WriteUInt32(CommandId_StopProfile);
+    m_commandChannel.Flush();
+}
+
+bool DebugFrontend::GetIsProfiling() const
+{
+    return m_profiling;
+}
+
+void DebugFrontend::GetProfileStacks(std::vector<ProfileStack>& stacks)
+{
+    CriticalSectionLock lock(m_criticalSection);
+    stacks.clear();
+    stacks.swap(m_profileStacks);
+}
+
 char* DebugFrontend::RemoteStrDup(HANDLE process, const char* string)
 {
     
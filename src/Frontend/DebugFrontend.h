@@ -33,6 +33,7 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 #include "Protocol.h"
 #include "CriticalSection.h"
 #include "LineMapper.h"
+#include "SourceStore.h"
 
 /**
  * Frontend for the debugger.
@@ -45,7 +46,9 @@ public:
     struct Script
     {
         std::string     name;       // Identifying name of the script (usually a file name)
-        std::string     source;     // Source code for the script
+        const SourceStore::Source* source;  // Source code for the script, NULL until it's been loaded
+        ULONGLONG       hash;       // Hash of the source code in the backend
+        unsigned int    size;       // Length of the source code in the backend
         CodeState       state;
         LineMapper      lineMapper; // Current mapping from lines in the local file to backend script lines.
     };
@@ -57,6 +60,23 @@ public:
         std::string     function;
     };
 
+    struct ProfileFrame
+    {
+        unsigned int    scriptIndex;
+        unsigned int    line;       // Line the function was defined on.
+        std::string     function;
+    };
+
+    /**
+     * Call stack recorded by the profiler and the number of times it was
+     * sampled. Frame 0 is the top of the stack.
+     */
+    struct ProfileStack
+    {
+        unsigned int                count;
+        std::vector<ProfileFrame>   frames;
+    };
+
     enum State
     {
         State_Inactive,         // Not debugging.
@@ -132,6 +152,12 @@ public:
      */
     void StepOver(unsigned int vm);
 
+    /**
+     * Instructs the debugger to continue until the current function returns
+     * and then break on the next line in the calling function.
+     */
+    void StepOut(unsigned int vm);
+
     /**
      * Instructs the debugger to step to the next line. If the current line
      * is a function this will step into the function.
@@ -140,19 +166,93 @@ public:
 
     /**
      * Signals to the debugger that we've finished the processing we needed to
-     * do in response to a load script event.
+     * do in response to a load script event. This should only be called if the
+     * backend is waiting for it (the event is enabled).
      */
     void DoneLoadingScript(unsigned int vm);
 
+    /**
+     * Requests the source code for the script from the backend if we don't
+     * have it already. The backend frees its copy once we have it. Returns
+     * false if the source couldn't be retrieved.
+     */
+    bool LoadScriptSource(unsigned int scriptIndex);
+
+    /**
+     * Sets the source code for the script. This is used when we have the source
+     * from somewhere other than the backend, like a file that matches it.
+     */
+    void SetScriptSource(unsigned int scriptIndex, const std::string& source);
+
+    /**
+     * Tells the backend which files we have breakpoints in that haven't been
+     * loaded yet. The backend only waits for us to send the breakpoints when
+     * one of these files is loaded. The names should be in lower case without
+     * a path.
+     */
+    void SetBreakpointFiles(const std::vector<std::string>& fileNames);
+
+    /**
+     * Sets the rules for the scripts the backend doesn't debug. Excluded scripts
+     * aren't sent to us and the debugger never stops in them. The patterns
+     * are the same as the ones in the project settings. A maxSize of 0 means
+     * there's no size limit.
+     */
+    void SetExclusionRules(const std::vector<std::string>& patterns, bool excludeStringScripts, unsigned int maxSize);
+
+    /**
+     * Sets the limits for evaluating expressions. Evaluation is stopped after
+     * the number of instructions or the time in milliseconds, and values are
+     * truncated once they are larger than size bytes. Limits of 0 mean there
+     * is no limit.
+     */
+    void SetEvaluateLimits(unsigned int instructions, unsigned int time, unsigned int size);
+
     /**
      * Evaluates the expression in the current context.
      */
     bool Evaluate(unsigned int vm, const char* expression, unsigned int stackLevel, std::string& result);
 
+    /**
+     * Evaluates a list of expressions in the current context with a single
+     * request to the backend. The results are in the same order as the
+     * expressions and are empty for the ones that couldn't be evaluated.
+     */
+    bool EvaluateMultiple(unsigned int vm, const std::vector<std::string>& expressions, unsigned int stackLevel, std::vector<std::string>& results);
+
+    /**
+     * Gets the elements of a table that wasn't fully sent with the result of an
+     * evaluation. The handle comes from the evaluation result and is only valid
+     * until execution continues. The result is a table with up to limit elements
+     * starting at offset.
+     */
+    bool ExpandValue(unsigned int vm, unsigned int handle, unsigned int offset, unsigned int limit, std::string& result);
+
     /**
      * Toggles a breakpoint on the specified line.
      */
     void ToggleBreakpoint(unsigned int vm, unsigned int scriptIndex, unsigned int line);
+
+    /**
+     * Sets the condition and hit count for the breakpoint on the specified line,
+     * adding the breakpoint if there isn't one. The condition is evaluated in the
+     * backend each time the line is reached and execution only stops when it's
+     * true and it has been true at least hitCount times.
+     */
+    void SetBreakpointCondition(unsigned int vm, unsigned int scriptIndex, unsigned int line, const std::string& condition, unsigned int hitCount);
+
+    /**
+     * Removes the condition, hit count and log message from the breakpoint on the
+     * specified line.
+     */
+    void ClearBreakpointCondition(unsigned int vm, unsigned int scriptIndex, unsigned int line);
+
+    /**
+     * Makes the breakpoint on the specified line log a message instead of stopping,
+     * adding the breakpoint if there isn't one. Expressions in braces in the message
+     * are replaced with their values. An empty message makes it a normal breakpoint.
+     */
+    void SetLogpoint(unsigned int vm, unsigned int scriptIndex, unsigned int line, const std::string& message);
     
     /**
      * Removes all breakpoints set this will also disable the line hook if the debug mode is set to continue
@@ -197,6 +297,28 @@ public:
      */
     void IgnoreException(const std::string& message);
 
+    /**
+     * Instructs the backend to start sampling the call stacks of the virtual
+     * machines once every interval instructions.
+     */
+    void StartProfiling(unsigned int interval);
+
+    /**
+     * Instructs the backend to stop sampling the call stacks.
+     */
+    void StopProfiling();
+
+    /**
+     * Returns true if the backend is currently profiling.
+     */
+    bool GetIsProfiling() const;
+
+    /**
+     * Moves the call stacks received from the profiler since the last call
+     * into stacks.
+     */
+    void GetProfileStacks(std::vector<ProfileStack>& stacks);
+
 private:
 
     struct ExeInfo
@@ -331,11 +453,15 @@ private:
 
     mutable CriticalSection     m_criticalSection;
     std::vector<Script*>        m_scripts;
+    SourceStore                 m_sourceStore;
 
     std::vector<StackFrame>     m_stackFrames;
 
     State                       m_state;
 
+    bool                        m_profiling;
+    std::vector<ProfileStack>   m_profileStacks;
+
 };
 
 #endif
\ No newline at end of file
@@ -30,6 +30,7 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 #include "WatchWindow.h"
 #include "OutputWindow.h"
 #include "BreakpointsWindow.h"
+#include "ProfileWindow.h"
 #include "SearchWindow.h"
 #include "ProjectExplorerWindow.h"
 #include "ExternalTool.h"
@@ -37,6 +38,7 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 #include "CodeEdit.h"
 #include "FileUtility.h"
 #include "StlUtility.h"
+#include "Hash.h"
 #include "XmlUtility.h"
 #include "XmlConfig.h"
 #include "Project.h"
@@ -73,6 +75,7 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 #include <wx/string.h>
 #include <wx/numdlg.h>
 #include <wx/sstream.h>
+#include <wx/tokenzr.h>
 
 #include <shlobj.h>
 
@@ -169,11 +172,21 @@ BEGIN_EVENT_TABLE(MainFrame, wxFrame)
     EVT_UPDATE_UI(ID_DebugStepInto,                 MainFrame::OnUpdateDebugStepInto)
     EVT_MENU(ID_DebugStepOver,                      MainFrame::OnDebugStepOver)
     EVT_UPDATE_UI(ID_DebugStepOver,                 MainFrame::EnableWhenBroken)
+    EVT_MENU(ID_DebugStepOut,                       MainFrame::OnDebugStepOut)
+    EVT_UPDATE_UI(ID_DebugStepOut,                  MainFrame::EnableWhenBroken)
     EVT_MENU(ID_DebugQuickWatch,                    MainFrame::OnDebugQuickWatch)
     EVT_UPDATE_UI(ID_DebugQuickWatch,               MainFrame::EnableWhenBroken)
     EVT_MENU(ID_DebugToggleBreakpoint,              MainFrame::OnDebugToggleBreakpoint)
     EVT_UPDATE_UI(ID_DebugToggleBreakpoint,         MainFrame::EnableWhenFileIsOpen)
     EVT_MENU(ID_DebugDeleteAllBreakpoints,          MainFrame::OnDebugDeleteAllBreakpoints)
+    EVT_MENU(ID_DebugBreakpointCondition,           MainFrame::OnDebugBreakpointCondition)
+    EVT_UPDATE_UI(ID_DebugBreakpointCondition,      MainFrame::OnUpdateDebugBreakpointCondition)
+    EVT_MENU(ID_DebugLogpoint,                      MainFrame::OnDebugLogpoint)
+    EVT_UPDATE_UI(ID_DebugLogpoint,                 MainFrame::OnUpdateDebugBreakpointCondition)
+    EVT_MENU(ID_DebugStartProfiling,                MainFrame::OnDebugStartProfiling)
+    EVT_UPDATE_UI(ID_DebugStartProfiling,           MainFrame::OnUpdateDebugStartProfiling)
+    EVT_MENU(ID_DebugStopProfiling,                 MainFrame::OnDebugStopProfiling)
+    EVT_UPDATE_UI(ID_DebugStopProfiling,            MainFrame::OnUpdateDebugStopProfiling)
 
     // Tools menu events.
     EVT_MENU(ID_ToolsExternalTools,                 MainFrame::OnToolsExternalTools)
@@ -187,6 +200,7 @@ BEGIN_EVENT_TABLE(MainFrame, wxFrame)
     EVT_MENU(ID_WindowWatch,                        MainFrame::OnWindowWatch)
     EVT_MENU(ID_WindowVirtualMachines,              MainFrame::OnWindowVirtualMachines)
     EVT_MENU(ID_WindowBreakpoints,                  MainFrame::OnWindowBreakpoints)
+    EVT_MENU(ID_WindowProfiler,                     MainFrame::OnWindowProfiler)
     EVT_MENU(ID_WindowNextDocument,                 MainFrame::OnWindowNextDocument)
     EVT_MENU(ID_WindowPreviousDocument,             MainFrame::OnWindowPreviousDocument)
     EVT_MENU(ID_WindowClose,                        MainFrame::OnWindowClose)
@@ -379,6 +393,8 @@ MainFrame::MainFrame(const wxString& title, int openFilesMessage, const wxPoint&
 
     m_searchWindow = new SearchWindow(this, ID_Search);
 
+    m_profileWindow = new ProfileWindow(this, ID_Profiler);
+
     // Create the notebook that holds all of the open scripts.
     m_notebook = new wxAuiNotebook(this, ID_Notebook, wxDefaultPosition, wxDefaultSize, wxAUI_NB_WINDOWLIST_BUTTON | wxAUI_NB_DEFAULT_STYLE);
         
@@ -405,6 +421,9 @@ MainFrame::MainFrame(const wxString& title, int openFilesMessage, const wxPoint&
     m_mgr.AddPane(m_searchWindow, wxBOTTOM, wxT("Search Results"));
     m_mgr.GetPane(m_searchWindow).Name("search");
 
+    m_mgr.AddPane(m_profileWindow, wxBOTTOM, wxT("Profiler"));
+    m_mgr.GetPane(m_profileWindow).Name("profiler");
+
     m_mgr.AddPane(m_notebook, wxCENTER);
     m_mgr.GetPane(m_notebook).Name("notebook");
 
@@ -422,6 +441,7 @@ MainFrame::MainFrame(const wxString& title, int openFilesMessage, const wxPoint&
     m_mgr.GetPane(m_watch).Show(false);
     m_mgr.GetPane(m_callStack).Show(false);
     m_mgr.GetPane(m_vmList).Show(false);
+    m_mgr.GetPane(m_profileWindow).Show(false);
     m_modeLayout[Mode_Editing] = m_mgr.SavePerspective();
 
     // Since the options contain the layout, load them after we've setup the panes.
@@ -659,10 +679,16 @@ void MainFrame::InitializeMenu()
     menuDebug->AppendSeparator();
     menuDebug->Append(ID_DebugStepInto,                 _("Step &Into"));
     menuDebug->Append(ID_DebugStepOver,                 _("Step &Over"));
+    menuDebug->Append(ID_DebugStepOut,                  _("Step Ou&t"));
     menuDebug->Append(ID_DebugQuickWatch,               _("&Quick Watch..."));
     menuDebug->AppendSeparator();
     menuDebug->Append(ID_DebugToggleBreakpoint,         _("To&ggle Breakpoint"),        _("Toggles a breakpoint on the current line"));
+    menuDebug->Append(ID_DebugBreakpointCondition,      _("Breakpoint Co&ndition..."),  _("Sets the condition and hit count for the breakpoint on the current line"));
+    menuDebug->Append(ID_DebugLogpoint,                 _("&Logpoint..."),              _("Logs a message when the current line is reached instead of breaking"));
     menuDebug->Append(ID_DebugDeleteAllBreakpoints,     _("&Delete All Breakpoints"),   _("Removes all breakpoints from the project"));
+    menuDebug->AppendSeparator();
+    menuDebug->Append(ID_DebugStartProfiling,           _("Start &Profiling"),          _("Periodically samples the call stacks of the running scripts"));
+    menuDebug->Append(ID_DebugStopProfiling,            _("Stop P&rofiling"));
 
     // Tools menu.
 
@@ -687,6 +713,7 @@ void MainFrame::InitializeMenu()
     menuWindow->Append(ID_WindowWatch,                  _("&Watch"));
     menuWindow->Append(ID_WindowVirtualMachines,        _("&Virtual Machines"));
     menuWindow->Append(ID_WindowBreakpoints,            _("&Breakpoints"));
+    menuWindow->Append(ID_WindowProfiler,               _("P&rofiler"));
         
     // Help menu.
 
@@ -1483,6 +1510,12 @@ void MainFrame::OnDebugStepOver(wxCommandEvent& WXUNUSED(event))
     UpdateForNewState();
 }
 
+void MainFrame::OnDebugStepOut(wxCommandEvent& WXUNUSED(event))
+{
+    DebugFrontend::Get().StepOut(m_vm);
+    UpdateForNewState();
+}
+
 void MainFrame::OnDebugQuickWatch(wxCommandEvent& WXUNUSED(event))
 {
 
@@ -1530,6 +1563,9 @@ void MainFrame::OnDebugProcess(wxCommandEvent& event)
         {
             SetMode(Mode_Debugging);
             m_output->OutputMessage("Debugging session started");
+            UpdateExclusionRules();
+            UpdateEvaluateLimits();
+            UpdateBreakpointFiles();
             if (m_attachToHost)
             {
                 DebugFrontend::Get().AttachDebuggerToHost();
@@ -1564,6 +1600,128 @@ void MainFrame::OnDebugDeleteAllBreakpoints(wxCommandEvent& event)
     DeleteAllBreakpoints();
 }
 
+void MainFrame::OnDebugBreakpointCondition(wxCommandEvent& WXUNUSED(event))
+{
+
+    unsigned int scriptIndex;
+    unsigned int oldLine;
+
+    if (!GetCurrentBackendLine(scriptIndex, oldLine))
+    {
+        return;
+    }
+
+    wxTextEntryDialog conditionDialog(this, _("Break when this expression is true (leave empty to always break):"), _("Breakpoint Condition"));
+
+    if (conditionDialog.ShowModal() != wxID_OK)
+    {
+        return;
+    }
+
+    long hitCount = wxGetNumberFromUser(_("Break once the condition has been true this many times (0 to always break):"), "", _("Breakpoint Hit Count"), 0, 0, 1000000, this);
+
+    if (hitCount == -1)
+    {
+        return;
+    }
+
+    // An empty condition with a hit count of 0 is the same as having no
+    // condition. Setting it rather than clearing it keeps any log message.
+    wxString condition = conditionDialog.GetValue().Trim().Trim(false);
+    DebugFrontend::Get().SetBreakpointCondition(m_vm, scriptIndex, oldLine, condition.ToAscii(), hitCount);
+
+}
+
+void MainFrame::OnUpdateDebugBreakpointCondition(wxUpdateUIEvent& event)
+{
+    bool running = (DebugFrontend::Get().GetState() != DebugFrontend::State_Inactive);
+    event.Enable(running && GetSelectedPage() != -1);
+}
+
+void MainFrame::OnDebugLogpoint(wxCommandEvent& WXUNUSED(event))
+{
+
+    unsigned int scriptIndex;
+    unsigned int oldLine;
+
+    if (!GetCurrentBackendLine(scriptIndex, oldLine))
+    {
+        return;
+    }
+
+    wxTextEntryDialog dialog(this, _("Message to log instead of breaking. Expressions in braces are replaced with their values, e.g. x = {x}\n(leave empty to break normally):"), _("Logpoint"));
+
+    if (dialog.ShowModal() == wxID_OK)
+    {
+        DebugFrontend::Get().SetLogpoint(m_vm, scriptIndex, oldLine, dialog.GetValue().ToAscii());
+    }
+
+}
+
+bool MainFrame::GetCurrentBackendLine(unsigned int& scriptIndex, unsigned int& line)
+{
+
+    int pageIndex = GetSelectedPage();
+
+    if (pageIndex == -1)
+    {
+        return false;
+    }
+
+    OpenFile* openFile = m_openFiles[pageIndex];
+    Project::File* file = openFile->file;
+
+    // Breakpoint options are only stored in the backend, so the script needs
+    // to have been loaded by the debugger.
+
+    scriptIndex = file->scriptIndex;
+    line = LineMapper::s_invalidLine;
+
+    if (scriptIndex != -1)
+    {
+        line = NewToOldLine(file, openFile->edit->GetCurrentLine());
+    }
+
+    if (line == LineMapper::s_invalidLine)
+    {
+        wxMessageBox(_("Breakpoint options can only be set on lines of scripts that have been loaded by the debugger."), s_applicationName, wxOK | wxICON_INFORMATION, this);
+        return false;
+    }
+
+    return true;
+
+}
+
+void MainFrame::OnDebugStartProfiling(wxCommandEvent& WXUNUSED(event))
+{
+
+    // Take a sample every this many instructions.
+    const unsigned int interval = 1000;
+
+    m_profileWindow->Clear();
+    DebugFrontend::Get().StartProfiling(interval);
+
+    m_mgr.GetPane(m_profileWindow).Show();
+    m_mgr.Update();
+
+}
+
+void MainFrame::OnUpdateDebugStartProfiling(wxUpdateUIEvent& event)
+{
+    bool running = (DebugFrontend::Get().GetState() != DebugFrontend::State_Inactive);
+    event.Enable(running && !DebugFrontend::Get().GetIsProfiling());
+}
+
+void MainFrame::OnDebugStopProfiling(wxCommandEvent& WXUNUSED(event))
+{
+    DebugFrontend::Get().StopProfiling();
+}
+
+void MainFrame::OnUpdateDebugStopProfiling(wxUpdateUIEvent& event)
+{
+    event.Enable(DebugFrontend::Get().GetIsProfiling());
+}
+
 void MainFrame::OnWindowProjectExplorer(wxCommandEvent& WXUNUSED(event))
 {
     m_mgr.GetPane(m_projectExplorer).Show();
@@ -1603,6 +1761,12 @@ void MainFrame::OnWindowBreakpoints(wxCommandEvent& WXUNUSED(event))
     m_mgr.Update();
 }
 
+void MainFrame::OnWindowProfiler(wxCommandEvent& WXUNUSED(event))
+{
+    m_mgr.GetPane(m_profileWindow).Show();
+    m_mgr.Update();
+}
+
 void MainFrame::OnWindowNextDocument(wxCommandEvent& event)
 {
 
@@ -1736,9 +1900,26 @@ void MainFrame::OnMenu(wxCommandEvent& event)
 }
 
 
-void MainFrame::UpdateScriptLineMappingFromFile(const Project::File* file, DebugFrontend::Script* script)
+void MainFrame::LoadScriptSource(Project::File* file)
 {
 
+    DebugFrontend::Script* script = DebugFrontend::Get().GetScript(file->scriptIndex);
+
+    if (script == NULL || script->source != NULL)
+    {
+        return;
+    }
+
+    if (script->state != CodeState_Normal)
+    {
+        // There's no source code to show or map lines with.
+        DebugFrontend::Get().SetScriptSource(file->scriptIndex, std::string());
+        return;
+    }
+
+    std::string diskFileSource;
+    bool haveDiskFile = false;
+
     if (file->fileName.FileExists())
     {
 
@@ -1749,21 +1930,109 @@ void MainFrame::UpdateScriptLineMappingFromFile(const Project::File* file, Debug
         {
         
             unsigned int diskFileSize = file->fileName.GetSize().GetLo();
-            char* diskFileSource = new char[diskFileSize + 1];
+            char* buffer = new char[diskFileSize + 1];
 
-            diskFileSize = diskFile.Read(diskFileSource, diskFileSize);
-            diskFileSource[diskFileSize] = 0; 
-            
-            script->lineMapper.Update(script->source, diskFileSource);
+            diskFileSize = diskFile.Read(buffer, diskFileSize);
+            diskFileSource.assign(buffer, diskFileSize);
+
+            delete [] buffer;
+            buffer = NULL;
+
+            haveDiskFile = true;
 
-            delete [] diskFileSource;
-            diskFileSource = NULL;
+        }
+    }
 
+    if (haveDiskFile && diskFileSource.length() == script->size &&
+        HashData(diskFileSource.c_str(), diskFileSource.length()) == script->hash)
+    {
+        // The file on disk is what was loaded, so we don't need to transfer the
+        // source and the lines map one to one.
+        DebugFrontend::Get().SetScriptSource(file->scriptIndex, diskFileSource);
+    }
+    else if (DebugFrontend::Get().LoadScriptSource(file->scriptIndex))
+    {
+        if (haveDiskFile)
+        {
+            // Map lines in case the loaded script is different than what we have on disk.
+            script->lineMapper.Update(script->source->text, diskFileSource);
+        }
+        else
+        {
+            // The symbols for the file come from the source, which we didn't have
+            // when it was first parsed.
+            m_symbolParser->QueueForParsing(file);
         }
     }
 
 }
 
+void MainFrame::UpdateBreakpointFiles()
+{
+
+    if (DebugFrontend::Get().GetState() == DebugFrontend::State_Inactive)
+    {
+        return;
+    }
+
+    // Files that are already mapped to scripts have their breakpoints set
+    // in the backend, so only the others need to stop the load.
+
+    std::vector<std::string> fileNames;
+
+    for (unsigned int i = 0; i < m_project->GetNumFiles(); ++i)
+    {
+
+        const Project::File* file = m_project->GetFile(i);
+        
+        if (file->scriptIndex == -1 && !file->breakpoints.empty())
+        {
+            fileNames.push_back(file->fileName.GetFullName().Lower().c_str());
+        }
+
+    }
+
+    DebugFrontend::Get().SetBreakpointFiles(fileNames);
+
+}
+
+void MainFrame::UpdateExclusionRules()
+{
+
+    if (DebugFrontend::Get().GetState() == DebugFrontend::State_Inactive)
+    {
+        return;
+    }
+
+    std::vector<std::string> patterns;
+    wxStringTokenizer tokenizer(m_project->GetExcludedScripts(), ";");
+
+    while (tokenizer.HasMoreTokens())
+    {
+        wxString pattern = tokenizer.GetNextToken().Trim().Trim(false);
+        if (!pattern.IsEmpty())
+        {
+            patterns.push_back(pattern.c_str());
+        }
+    }
+
+    DebugFrontend::Get().SetExclusionRules(patterns, m_project->GetExcludeStringScripts(), m_project->GetMaxScriptSize() * 1024);
+
+}
+
+void MainFrame::UpdateEvaluateLimits()
+{
+
+    if (DebugFrontend::Get().GetState() == DebugFrontend::State_Inactive)
+    {
+        return;
+    }
+
+    DebugFrontend::Get().SetEvaluateLimits(m_systemSettings.GetEvaluateInstructionLimit(),
+        m_systemSettings.GetEvaluateTimeLimit(), m_systemSettings.GetEvaluateSizeLimit() * 1024);
+
+}
+
 void MainFrame::SetMostRecentlyUsedPage(int pageIndex)
 {
 
@@ -1842,14 +2111,7 @@ void MainFrame::OnDebugEvent(wxDebugEvent& event)
             {
                 // Check to see if one of the existing files' contents match this script.
                 DebugFrontend::Script* script = DebugFrontend::Get().GetScript(scriptIndex);
-                file = GetFileMatchingSource( wxFileName(DebugFrontend::Get().GetScript(scriptIndex)->name), script->source );
-            
-                if (file != NULL)
-                {
-                    // Map lines in case the loaded script is different than what we have on disk.
-                    UpdateScriptLineMappingFromFile(file, script);
-                }
-
+                file = GetFileMatchingSource( wxFileName(script->name) );
             }
 
             if (file == NULL)
@@ -1882,6 +2144,13 @@ void MainFrame::OnDebugEvent(wxDebugEvent& event)
                 DebugFrontend::Script* script = DebugFrontend::Get().GetScript(scriptIndex);
                 
                 file->scriptIndex = scriptIndex;
+
+                if (!breakpoints.empty())
+                {
+                    // Map lines in case the loaded script is different than what we have on disk.
+                    LoadScriptSource(file);
+                }
+
                 for (unsigned int i = 0; i < breakpoints.size(); ++i)
                 {
                     unsigned int newLine = breakpoints[i];
@@ -1897,8 +2166,12 @@ void MainFrame::OnDebugEvent(wxDebugEvent& event)
 
             }
 
-            // Tell the backend we're done processing this script for loading.
-            DebugFrontend::Get().DoneLoadingScript(event.GetVm());
+            // Tell the backend we're done processing this script for loading. It
+            // only waits for scripts we had breakpoints in.
+            if (event.GetEnabled())
+            {
+                DebugFrontend::Get().DoneLoadingScript(event.GetVm());
+            }
 
         }
         break;
@@ -1973,6 +2246,14 @@ void MainFrame::OnDebugEvent(wxDebugEvent& event)
         SetVmName(event.GetVm(), event.GetMessage());
         break;
 
+    case EventId_ProfileSamples:
+        {
+            std::vector<DebugFrontend::ProfileStack> stacks;
+            DebugFrontend::Get().GetProfileStacks(stacks);
+            m_profileWindow->AddStacks(stacks);
+        }
+        break;
+
     }
 
 }
@@ -2026,6 +2307,7 @@ void MainFrame::OnToolsSettings(wxCommandEvent& event)
         m_systemSettings    = systemSettings->GetSettings();
 
         UpdateEditorOptions();
+        UpdateEvaluateLimits();
         
     }
 
@@ -2319,19 +2601,15 @@ void MainFrame::OnCodeEditDwellStart(wxScintillaEvent& event)
             if (DebugFrontend::Get().Evaluate(m_vm, expression, m_stackLevel, result))
             {
 
-                wxStringInputStream stream(result.c_str());
-                wxXmlDocument document;
-
-                wxLogNull logNo;
+                wxString value;
         
-                if (document.Load(stream))
+                if (WatchCtrl::GetResultAsText(result, value))
                 {
                     wxString text;
-                    wxString type;
                     
                     text += expression;
                     text += " = ";
-                    text += WatchCtrl::GetNodeAsText(document.GetRoot(), type);
+                    text += value;
 
                     edit->ShowToolTip(event.GetPosition(), text);
                 }
@@ -2439,6 +2717,10 @@ void MainFrame::UpdateLineMappingIfNecessary(Project::File* file)
     
     DebugFrontend::Script* script = DebugFrontend::Get().GetScript(file->scriptIndex);
 
+    // Make sure the mapping from the disk file is up to date before we apply
+    // the changes made in the editor.
+    LoadScriptSource(file);
+
     // Check if the file is open in the editor.
 
     unsigned int openFileIndex = GetOpenFileIndex(file);
@@ -2448,9 +2730,9 @@ void MainFrame::UpdateLineMappingIfNecessary(Project::File* file)
 
         OpenFile* openFile = m_openFiles[openFileIndex];
         
-        if (openFile->edit->GetIsLineMappingDirty())
+        if (script->source != NULL && openFile->edit->GetIsLineMappingDirty())
         {
-            script->lineMapper.Update( script->source, std::string(openFile->edit->GetText()) );
+            script->lineMapper.Update( script->source->text, std::string(openFile->edit->GetText()) );
             openFile->edit->SetIsLineMappingDirty(false);
         }
 
@@ -4341,10 +4623,16 @@ MainFrame::OpenFile* MainFrame::OpenProjectFile(Project::File* file)
     else if (file->scriptIndex != -1)
     {
     
+        LoadScriptSource(file);
+
         const DebugFrontend::Script* script = DebugFrontend::Get().GetScript(file->scriptIndex);
     
+        if (script->source != NULL)
+        {
+            openFile->edit->SetText(script->source->text.c_str());
+        }
+
         // Set a save point so that the editor doesn't think we need to save this file.
-        openFile->edit->SetText(script->source.c_str());
         openFile->edit->SetSavePoint();
         openFile->edit->EmptyUndoBuffer();
 
@@ -4717,6 +5005,7 @@ void MainFrame::SetDefaultHotKeys()
     m_keyBinder.SetShortcut(ID_DebugStartWithoutDebugging,  wxT("Ctrl+F5"));
     m_keyBinder.SetShortcut(ID_DebugStepInto,               wxT("F11"));
     m_keyBinder.SetShortcut(ID_DebugStepOver,               wxT("F10"));
+    m_keyBinder.SetShortcut(ID_DebugStepOut,                wxT("Shift+F11"));
     m_keyBinder.SetShortcut(ID_DebugQuickWatch,             wxT("Shift+F9"));
     m_keyBinder.SetShortcut(ID_DebugToggleBreakpoint,       wxT("F9"));
     m_keyBinder.SetShortcut(ID_DebugDeleteAllBreakpoints,   wxT("Ctrl+Shift+F9"));
@@ -4819,6 +5108,8 @@ void MainFrame::ToggleBreakpoint(Project::File* file, unsigned int newLine)
     // we'll send it the break points.
     bool set = m_project->ToggleBreakpoint(file, newLine);
     m_breakpointsWindow->UpdateBreakpoints();
+
+    UpdateBreakpointFiles();
     
     if (openFile != NULL)
     {
@@ -4870,6 +5161,7 @@ void MainFrame::DeleteAllBreakpoints()
     }
 
     DebugFrontend::Get().RemoveAllBreakPoints(0);
+    UpdateBreakpointFiles();
 
     m_breakpointsWindow->UpdateBreakpoints();
 
@@ -5485,6 +5777,9 @@ void MainFrame::StartProcess(const wxString& command, const wxString& commandArg
     {
         SetMode(Mode_Debugging);
         m_output->OutputMessage("Debugging session started");
+        UpdateExclusionRules();
+        UpdateEvaluateLimits();
+        UpdateBreakpointFiles();
         if (m_attachToHost)
         {
             DebugFrontend::Get().AttachDebuggerToHost();
@@ -5775,6 +6070,9 @@ bool MainFrame::ShowProjectSettingsDialog()
     dialog.SetCommandArguments(m_project->GetCommandArguments());
     dialog.SetWorkingDirectory(m_project->GetWorkingDirectory());
     dialog.SetSymbolsDirectory(m_project->GetSymbolsDirectory());
+    dialog.SetExcludedScripts(m_project->GetExcludedScripts());
+    dialog.SetExcludeStringScripts(m_project->GetExcludeStringScripts());
+    dialog.SetMaxScriptSize(m_project->GetMaxScriptSize());
 
     dialog.SetSccProvider(m_project->GetSccProvider());
     dialog.SetSccUser(m_project->GetSccUser());
@@ -5789,6 +6087,11 @@ bool MainFrame::ShowProjectSettingsDialog()
         m_project->SetCommandArguments(dialog.GetCommandArguments());
         m_project->SetWorkingDirectory(dialog.GetWorkingDirectory());
         m_project->SetSymbolsDirectory(dialog.GetSymbolsDirectory());
+        m_project->SetExcludedScripts(dialog.GetExcludedScripts());
+        m_project->SetExcludeStringScripts(dialog.GetExcludeStringScripts());
+        m_project->SetMaxScriptSize(dialog.GetMaxScriptSize());
+
+        UpdateExclusionRules();
     
         m_project->SetSccProvider(dialog.GetSccProvider());
         m_project->SetSccUser(dialog.GetSccUser());
@@ -6028,7 +6331,7 @@ void MainFrame::BringToFront()
 
 }
 
-Project::File* MainFrame::GetFileMatchingSource(const wxFileName& fileName, const std::string& source) const
+Project::File* MainFrame::GetFileMatchingSource(const wxFileName& fileName) const
 {
 
     for (unsigned int i = 0; i < m_project->GetNumFiles(); ++i)
@@ -59,6 +59,7 @@ class ExternalTool;
 class WatchWindow;
 class OutputWindow;
 class BreakpointsWindow;
+class ProfileWindow;
 class SearchWindow;
 class ProjectExplorerWindow;
 class wxXmlNode;
@@ -315,6 +316,8 @@ public:
 
     void OnDebugStepOver(wxCommandEvent& event);
 
+    void OnDebugStepOut(wxCommandEvent& event);
+
     void OnDebugQuickWatch(wxCommandEvent& event);
 
     /**
@@ -332,6 +335,44 @@ public:
      */
     void OnDebugDeleteAllBreakpoints(wxCommandEvent& event);
 
+    /**
+     * Called when the user selects Debug/Breakpoint Condition from the menu.
+     */
+    void OnDebugBreakpointCondition(wxCommandEvent& event);
+
+    /**
+     * Called when the Debug/Breakpoint Condition menu item needs to be updated
+     * to reflect the current status.
+     */
+    void OnUpdateDebugBreakpointCondition(wxUpdateUIEvent& event);
+
+    /**
+     * Called when the user selects Debug/Logpoint from the menu.
+     */
+    void OnDebugLogpoint(wxCommandEvent& event);
+
+    /**
+     * Called when the user selects Debug/Start Profiling from the menu.
+     */
+    void OnDebugStartProfiling(wxCommandEvent& event);
+
+    /**
+     * Called when the Debug/Start Profiling menu item needs to be updated to
+     * reflect the current status.
+     */
+    void OnUpdateDebugStartProfiling(wxUpdateUIEvent& event);
+
+    /**
+     * Called when the user selects Debug/Stop Profiling from the menu.
+     */
+    void OnDebugStopProfiling(wxCommandEvent& event);
+
+    /**
+     * Called when the Debug/Stop Profiling menu item needs to be updated to
+     * reflect the current status.
+     */
+    void OnUpdateDebugStopProfiling(wxUpdateUIEvent& event);
+
     /**
      * Called when the user selects Tools/Settings from the menu.
      */
@@ -377,6 +418,11 @@ public:
      */
     void OnWindowBreakpoints(wxCommandEvent& event);
 
+    /**
+     * Called when the user selects Window/Profiler from the menu.
+     */
+    void OnWindowProfiler(wxCommandEvent& event);
+
     /**
      * Called when the user selects Window/Next Document from the menu.
      */
@@ -1192,6 +1238,13 @@ private:
      */
     void CleanUpTemporaryFiles();
 
+    /**
+     * Gets the script index and backend line for the current line of the selected
+     * file. If the line doesn't exist in the backend, a message is shown to the
+     * user and the method returns false.
+     */
+    bool GetCurrentBackendLine(unsigned int& scriptIndex, unsigned int& line);
+
     /**
      * Returns the index into the open files array for the specified project file. If
      * the project file is not open, the method returns -1.
@@ -1308,7 +1361,7 @@ private:
     /**
      * Matches up a project file to a script file.
      */
-    Project::File* GetFileMatchingSource(const wxFileName& fileName, const std::string& source) const;
+    Project::File* GetFileMatchingSource(const wxFileName& fileName) const;
 
     /**
      * Called when a new file is added to the project.
@@ -1327,9 +1380,29 @@ private:
     void SetFileStatus(Project::File* file, SourceControl::Status status);
 
     /**
-     * Updates the line mapping for script file source based on the a diff with a disk file.
+     * Gets the source for the script the file is mapped to if we don't have it
+     * yet and updates the line mapping based on a diff with the disk file. If
+     * the disk file matches the script's hash the source isn't transferred.
      */
-    void UpdateScriptLineMappingFromFile(const Project::File* file, DebugFrontend::Script* script);
+    void LoadScriptSource(Project::File* file);
+
+    /**
+     * Sends the names of the files with breakpoints that haven't been loaded
+     * by the debugger yet to the backend.
+     */
+    void UpdateBreakpointFiles();
+
+    /**
+     * Sends the rules for the scripts that aren't debugged from the project
+     * settings to the backend.
+     */
+    void UpdateExclusionRules();
+
+    /**
+     * Sends the limits for evaluating expressions from the system settings to
+     * the backend.
+     */
+    void UpdateEvaluateLimits();
 
     /**
      * Marks the specified page as 'most recently used', i.e. moves it to the front of m_tabOrder.
@@ -1445,6 +1518,15 @@ private:
 
         ID_Search                           = 86,
         ID_WindowSearch                     = 87,
+
+        ID_Profiler                         = 88,
+        ID_WindowProfiler                   = 89,
+        ID_DebugStartProfiling              = 90,
+        ID_DebugStopProfiling               = 91,
+
+        ID_DebugBreakpointCondition         = 92,
+        ID_DebugLogpoint                    = 93,
+        ID_DebugStepOut                     = 94,
         
         ID_FirstExternalTool                = 1000,
         ID_FirstRecentFile                  = 2000,
@@ -1480,6 +1562,7 @@ private:
     WatchWindow*                    m_watch;
     BreakpointsWindow*              m_breakpointsWindow;
     SearchWindow*                   m_searchWindow;
+    ProfileWindow*                  m_profileWindow;
 
     unsigned int                    m_vm;
     std::vector<unsigned int>       m_vms;
@@ -112,6 +112,33 @@ NewProcessDialog::NewProcessDialog( wxWindow* parent )
 	fgSizer1->Add( m_button21, 0, wxALL, 5 );
 
 #endif
+
+    // Script exclusion controls.
+
+	staticText = new wxStaticText( this, wxID_ANY, wxT("Excluded Scripts:"), wxDefaultPosition, wxSize( 90,-1 ), 0 );
+	fgSizer1->Add( staticText, 0, wxALL, 5 );
+	
+	m_excludedScriptsBox = new wxTextCtrl( this, wxID_ANY, wxEmptyString, wxDefaultPosition, wxSize(textBoxSize, -1), 0 );
+    m_excludedScriptsBox->SetToolTip( wxT("Scripts that aren't debugged, separated by semicolons. Patterns ending in a slash exclude a directory, others can use * and ? wildcards.") );
+	fgSizer1->Add( m_excludedScriptsBox, 0, wxALL|wxEXPAND, 5 );
+	
+	fgSizer1->Add( 0, 0, 1, wxEXPAND, 0 );
+
+	staticText = new wxStaticText( this, wxID_ANY, wxT("Max Script Size (KB):"), wxDefaultPosition, wxSize( 110,-1 ), 0 );
+	fgSizer1->Add( staticText, 0, wxALL, 5 );
+	
+	m_maxScriptSizeBox = new wxTextCtrl( this, wxID_ANY, wxEmptyString, wxDefaultPosition, wxSize(textBoxSize, -1), 0, wxTextValidator(wxFILTER_NUMERIC) );
+    m_maxScriptSizeBox->SetToolTip( wxT("Scripts larger than this aren't debugged. Leave empty for no limit.") );
+	fgSizer1->Add( m_maxScriptSizeBox, 0, wxALL|wxEXPAND, 5 );
+	
+	fgSizer1->Add( 0, 0, 1, wxEXPAND, 0 );
+
+	fgSizer1->Add( 0, 0, 1, wxEXPAND, 0 );
+
+	m_excludeStringScriptsCheck = new wxCheckBox( this, wxID_ANY, wxT("Exclude scripts loaded from strings"), wxDefaultPosition, wxDefaultSize, 0 );
+	fgSizer1->Add( m_excludeStringScriptsCheck, 0, wxALL, 5 );
+
+	fgSizer1->Add( 0, 0, 1, wxEXPAND, 0 );
 	
 	sbSizer1->Add( fgSizer1, 1, wxEXPAND, 5 );
 	
@@ -286,6 +313,48 @@ wxString NewProcessDialog::GetSymbolsDirectory() const
     return wxEmptyString;
 }
 
+void NewProcessDialog::SetExcludedScripts(const wxString& excludedScripts)
+{
+    m_excludedScriptsBox->SetValue(excludedScripts);
+}
+
+wxString NewProcessDialog::GetExcludedScripts() const
+{
+    return m_excludedScriptsBox->GetValue();
+}
+
+void NewProcessDialog::SetExcludeStringScripts(bool excludeStringScripts)
+{
+    m_excludeStringScriptsCheck->SetValue(excludeStringScripts);
+}
+
+bool NewProcessDialog::GetExcludeStringScripts() const
+{
+    return m_excludeStringScriptsCheck->GetValue();
+}
+
+void NewProcessDialog::SetMaxScriptSize(unsigned int maxScriptSize)
+{
+    if (maxScriptSize > 0)
+    {
+        m_maxScriptSizeBox->SetValue(wxString::Format("%u", maxScriptSize));
+    }
+    else
+    {
+        m_maxScriptSizeBox->SetValue(wxEmptyString);
+    }
+}
+
+unsigned int NewProcessDialog::GetMaxScriptSize() const
+{
+    unsigned long maxScriptSize;
+    if (m_maxScriptSizeBox->GetValue().ToULong(&maxScriptSize))
+    {
+        return maxScriptSize;
+    }
+    return 0;
+}
+
 wxString NewProcessDialog::GetSccProvider() const
 {
     
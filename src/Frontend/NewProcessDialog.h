@@ -104,6 +104,37 @@ public:
      */
     wxString GetSymbolsDirectory() const;
 
+    /**
+     * Sets the patterns for the excluded scripts that are displayed in the dialog.
+     */
+    void SetExcludedScripts(const wxString& excludedScripts);
+
+    /**
+     * Returns the patterns for the excluded scripts set in the dialog.
+     */
+    wxString GetExcludedScripts() const;
+
+    /**
+     * Sets whether or not scripts loaded from strings are excluded.
+     */
+    void SetExcludeStringScripts(bool excludeStringScripts);
+
+    /**
+     * Returns true if scripts loaded from strings are excluded.
+     */
+    bool GetExcludeStringScripts() const;
+
+    /**
+     * Sets the size in kilobytes above which scripts are excluded.
+     */
+    void SetMaxScriptSize(unsigned int maxScriptSize);
+
+    /**
+     * Returns the size in kilobytes above which scripts are excluded, or 0
+     * if there is no limit.
+     */
+    unsigned int GetMaxScriptSize() const;
+
     /**
      * Returns the name of the source control provider.
      */
@@ -179,6 +210,9 @@ private:
     wxTextCtrl*                 m_commandArgumentsBox;
 	wxTextCtrl*                 m_workingDirectoryBox;
     wxTextCtrl*                 m_symbolsDirectoryBox;
+    wxTextCtrl*                 m_excludedScriptsBox;
+    wxTextCtrl*                 m_maxScriptSizeBox;
+    wxCheckBox*                 m_excludeStringScriptsCheck;
     wxChoice*                   m_sccProviderChoice;
     wxTextCtrl*                 m_sccProjectBox;
 
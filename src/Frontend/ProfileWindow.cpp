@@ -0,0 +1,408 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ProfileWindow.h"
+#include "ListView.h"
+#include "treelistctrl.h"
+
+#include <wx/filename.h>
+#include <wx/file.h>
+
+#include <algorithm>
+#include <set>
+
+BEGIN_EVENT_TABLE( ProfileWindow, wxPanel )
+
+    EVT_BUTTON(                 ID_Clear,                   ProfileWindow::OnClear )
+    EVT_BUTTON(                 ID_Export,                  ProfileWindow::OnExport )
+
+END_EVENT_TABLE()
+
+/**
+ * Orders functions so that the ones with the most samples come first.
+ */
+struct CompareFunctionSamples
+{
+
+    CompareFunctionSamples(const std::vector<unsigned int>& selfSamples, const std::vector<unsigned int>& totalSamples)
+        : m_selfSamples(selfSamples), m_totalSamples(totalSamples)
+    {
+    }
+
+    bool operator()(unsigned int a, unsigned int b) const
+    {
+        if (m_selfSamples[a] != m_selfSamples[b])
+        {
+            return m_selfSamples[a] > m_selfSamples[b];
+        }
+        return m_totalSamples[a] > m_totalSamples[b];
+    }
+
+    const std::vector<unsigned int>&    m_selfSamples;
+    const std::vector<unsigned int>&    m_totalSamples;
+
+};
+
+ProfileWindow::CallTreeNode::CallTreeNode()
+{
+    function        = 0;
+    selfSamples     = 0;
+    totalSamples    = 0;
+}
+
+ProfileWindow::CallTreeNode::~CallTreeNode()
+{
+    std::map<unsigned int, CallTreeNode*>::iterator iterator = children.begin();
+    while (iterator != children.end())
+    {
+        delete iterator->second;
+        ++iterator;
+    }
+}
+
+ProfileWindow::ProfileWindow(wxWindow* parent, wxWindowID winid)
+    : wxPanel(parent, winid)
+{
+
+    wxButton* clearButton  = new wxButton(this, ID_Clear, _("Clear"));
+    wxButton* exportButton = new wxButton(this, ID_Export, _("Export..."));
+
+    m_summary = new wxStaticText(this, wxID_ANY, wxEmptyString);
+
+    wxNotebook* notebook = new wxNotebook(this, wxID_ANY);
+
+    // Create the flat list of functions.
+
+    m_functionList = new ListView(notebook, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxLC_REPORT | wxLC_SINGLE_SEL);
+    m_functionList->InsertColumn(0, _("Function"));
+    m_functionList->InsertColumn(1, _("Self"));
+    m_functionList->InsertColumn(2, _("Total"));
+
+    // Create the call tree.
+
+    m_callTree = new wxTreeListCtrl(notebook, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxTR_DEFAULT_STYLE | wxTR_HIDE_ROOT);
+    m_callTree->AddColumn(_("Function"), 300, wxALIGN_LEFT);
+    m_callTree->AddColumn(_("Total"), 100, wxALIGN_LEFT);
+    m_callTree->AddColumn(_("Self"), 100, wxALIGN_LEFT);
+    m_callTreeRoot = m_callTree->AddRoot(_T("Root"));
+
+    notebook->AddPage(m_functionList, _("Functions"));
+    notebook->AddPage(m_callTree, _("Call Tree"));
+
+    m_totalSamples = 0;
+
+    // Setup the layout.
+
+    wxBoxSizer* buttonSizer = new wxBoxSizer(wxHORIZONTAL);
+    buttonSizer->Add( clearButton, 0, wxALL, 3 );
+    buttonSizer->Add( exportButton, 0, wxALL, 3 );
+    buttonSizer->Add( m_summary, 1, wxALL|wxALIGN_CENTER_VERTICAL, 3 );
+
+	wxFlexGridSizer* fgSizer1;
+
+	fgSizer1 = new wxFlexGridSizer( 2, 1, 0, 0 );
+	fgSizer1->AddGrowableCol( 0 );
+	fgSizer1->AddGrowableRow( 1 );
+	fgSizer1->SetFlexibleDirection( wxBOTH );
+	fgSizer1->SetNonFlexibleGrowMode( wxFLEX_GROWMODE_SPECIFIED );
+	
+	fgSizer1->Add( buttonSizer, 0, wxEXPAND, 0 );
+	fgSizer1->Add( notebook, 0, wxALL|wxEXPAND, 0 );
+	
+	SetSizer( fgSizer1 );
+	Layout();
+
+    UpdateViews();
+
+}
+
+ProfileWindow::~ProfileWindow()
+{
+}
+
+void ProfileWindow::AddStacks(const std::vector<DebugFrontend::ProfileStack>& stacks)
+{
+
+    if (stacks.empty())
+    {
+        return;
+    }
+
+    std::vector<unsigned int> functions;
+    std::set<unsigned int> functionsInStack;
+
+    for (unsigned int i = 0; i < stacks.size(); ++i)
+    {
+
+        const DebugFrontend::ProfileStack& stack = stacks[i];
+
+        if (stack.frames.empty())
+        {
+            continue;
+        }
+
+        functions.clear();
+        functionsInStack.clear();
+
+        for (unsigned int j = 0; j < stack.frames.size(); ++j)
+        {
+            functions.push_back(GetFunction(stack.frames[j]));
+        }
+
+        // Update the flat view. Recursive functions only count once towards
+        // the total for a sample.
+
+        m_functions[functions[0]].selfSamples += stack.count;
+
+        for (unsigned int j = 0; j < functions.size(); ++j)
+        {
+            if (functionsInStack.insert(functions[j]).second)
+            {
+                m_functions[functions[j]].totalSamples += stack.count;
+            }
+        }
+
+        // Update the call tree and the collapsed stacks, which both go from
+        // the bottom of the stack to the top.
+
+        CallTreeNode* node = &m_root;
+        node->totalSamples += stack.count;
+
+        wxString collapsed;
+
+        for (int j = static_cast<int>(functions.size()) - 1; j >= 0; --j)
+        {
+
+            CallTreeNode*& child = node->children[functions[j]];
+
+            if (child == NULL)
+            {
+                child = new CallTreeNode;
+                child->function = functions[j];
+            }
+
+            node = child;
+            node->totalSamples += stack.count;
+
+            if (!collapsed.empty())
+            {
+                collapsed += wxT(";");
+            }
+
+            // Semicolons separate the frames in the collapsed format.
+            wxString name = m_functions[functions[j]].name;
+            name.Replace(wxT(";"), wxT(":"));
+            collapsed += name;
+
+        }
+
+        node->selfSamples += stack.count;
+
+        m_collapsedStacks[collapsed] += stack.count;
+        m_totalSamples += stack.count;
+
+    }
+
+    UpdateViews();
+
+}
+
+void ProfileWindow::Clear()
+{
+
+    m_functions.clear();
+    m_functionMap.clear();
+    m_collapsedStacks.clear();
+    m_totalSamples = 0;
+
+    std::map<unsigned int, CallTreeNode*>::iterator iterator = m_root.children.begin();
+    while (iterator != m_root.children.end())
+    {
+        delete iterator->second;
+        ++iterator;
+    }
+
+    m_root.children.clear();
+    m_root.totalSamples = 0;
+    m_root.selfSamples  = 0;
+
+    m_callTree->DeleteChildren(m_callTreeRoot);
+
+    UpdateViews();
+
+}
+
+void ProfileWindow::OnClear(wxCommandEvent& event)
+{
+    Clear();
+}
+
+void ProfileWindow::OnExport(wxCommandEvent& event)
+{
+
+    wxFileDialog dialog(this, _("Export collapsed stacks"), "", "profile.txt", _("Text files (*.txt)|*.txt|All files (*.*)|*.*"), wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+
+    if (dialog.ShowModal() != wxID_OK)
+    {
+        return;
+    }
+
+    wxFile file;
+
+    if (!file.Open(dialog.GetPath(), wxFile::write))
+    {
+        wxMessageBox(_("Error writing the profile"), _("Export collapsed stacks"), wxOK | wxICON_ERROR, this);
+        return;
+    }
+
+    // Write one line per call stack in the format used by flame graph tools:
+    // the functions from the bottom of the stack up separated by semicolons,
+    // followed by the number of samples.
+
+    std::map<wxString, unsigned int>::const_iterator iterator = m_collapsedStacks.begin();
+
+    while (iterator != m_collapsedStacks.end())
+    {
+        file.Write(wxString::Format(wxT("%s %u\n"), iterator->first.c_str(), iterator->second));
+        ++iterator;
+    }
+
+}
+
+unsigned int ProfileWindow::GetFunction(const DebugFrontend::ProfileFrame& frame)
+{
+
+    wxString name = frame.function.c_str();
+
+    DebugFrontend::Script* script = DebugFrontend::Get().GetScript(frame.scriptIndex);
+
+    if (script != NULL)
+    {
+        wxFileName fileName(script->name.c_str());
+        name += wxString::Format(wxT(" (%s:%u)"), fileName.GetFullName().c_str(), frame.line + 1);
+    }
+    else
+    {
+        name += wxT(" [C]");
+    }
+
+    std::map<wxString, unsigned int>::iterator iterator = m_functionMap.find(name);
+
+    if (iterator != m_functionMap.end())
+    {
+        return iterator->second;
+    }
+
+    Function function;
+    function.name           = name;
+    function.selfSamples    = 0;
+    function.totalSamples   = 0;
+
+    unsigned int index = m_functions.size();
+    
+    m_functions.push_back(function);
+    m_functionMap.insert(std::make_pair(name, index));
+
+    return index;
+
+}
+
+void ProfileWindow::UpdateViews()
+{
+
+    m_summary->SetLabel(wxString::Format(_("%u samples"), m_totalSamples));
+
+    // Update the list of functions.
+
+    std::vector<unsigned int> selfSamples(m_functions.size());
+    std::vector<unsigned int> totalSamples(m_functions.size());
+    std::vector<unsigned int> order(m_functions.size());
+
+    for (unsigned int i = 0; i < m_functions.size(); ++i)
+    {
+        selfSamples[i]  = m_functions[i].selfSamples;
+        totalSamples[i] = m_functions[i].totalSamples;
+        order[i]        = i;
+    }
+
+    std::sort(order.begin(), order.end(), CompareFunctionSamples(selfSamples, totalSamples));
+
+    m_functionList->Freeze();
+    m_functionList->DeleteAllItems();
+
+    for (unsigned int i = 0; i < order.size(); ++i)
+    {
+        const Function& function = m_functions[order[i]];
+        long item = m_functionList->InsertItem(i, function.name);
+        m_functionList->SetItem(item, 1, FormatSamples(function.selfSamples));
+        m_functionList->SetItem(item, 2, FormatSamples(function.totalSamples));
+    }
+
+    m_functionList->Thaw();
+
+    // Update the call tree. Existing items are updated in place so that the
+    // parts of the tree the user has expanded stay expanded.
+
+    m_callTree->Freeze();
+    UpdateCallTreeNode(&m_root, m_callTreeRoot);
+    m_callTree->Thaw();
+
+}
+
+void ProfileWindow::UpdateCallTreeNode(CallTreeNode* node, const wxTreeItemId& parent)
+{
+
+    std::map<unsigned int, CallTreeNode*>::iterator iterator = node->children.begin();
+
+    while (iterator != node->children.end())
+    {
+
+        CallTreeNode* child = iterator->second;
+
+        if (!child->item.IsOk())
+        {
+            child->item = m_callTree->AppendItem(parent, m_functions[child->function].name);
+        }
+
+        m_callTree->SetItemText(child->item, 1, FormatSamples(child->totalSamples));
+        m_callTree->SetItemText(child->item, 2, FormatSamples(child->selfSamples));
+
+        UpdateCallTreeNode(child, child->item);
+        ++iterator;
+
+    }
+
+}
+
+wxString ProfileWindow::FormatSamples(unsigned int samples) const
+{
+
+    double percent = 0.0;
+
+    if (m_totalSamples > 0)
+    {
+        percent = 100.0 * samples / m_totalSamples;
+    }
+
+    return wxString::Format(wxT("%u (%.1f%%)"), samples, percent);
+
+}
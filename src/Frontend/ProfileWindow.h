@@ -0,0 +1,152 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef PROFILE_WINDOW_H
+#define PROFILE_WINDOW_H
+
+#include "DebugFrontend.h"
+
+#include <wx/wx.h>
+#include <wx/notebook.h>
+#include <wx/treebase.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+//
+// Forward declarations.
+//
+
+class ListView;
+class wxTreeListCtrl;
+
+/**
+ * Window that displays the results of the sampling profiler as a flat list
+ * of functions and as a call tree.
+ */
+class ProfileWindow : public wxPanel
+{
+
+    DECLARE_EVENT_TABLE()
+
+public:
+
+    /**
+     * Constructor.
+     */
+    ProfileWindow(wxWindow* parent, wxWindowID winid);
+
+    /**
+     * Destructor.
+     */
+    virtual ~ProfileWindow();
+
+    /**
+     * Adds call stacks received from the profiler and updates the views.
+     */
+    void AddStacks(const std::vector<DebugFrontend::ProfileStack>& stacks);
+
+    /**
+     * Removes all of the samples.
+     */
+    void Clear();
+
+    /**
+     * Called when the clear button is pressed.
+     */
+    void OnClear(wxCommandEvent& event);
+
+    /**
+     * Called when the export button is pressed.
+     */
+    void OnExport(wxCommandEvent& event);
+
+private:
+
+    enum
+    {
+        ID_Clear,
+        ID_Export,
+    };
+
+    struct Function
+    {
+        wxString        name;           // Function name along with the script and line.
+        unsigned int    selfSamples;    // Samples where the function was at the top of the stack.
+        unsigned int    totalSamples;   // Samples where the function was anywhere on the stack.
+    };
+
+    struct CallTreeNode
+    {
+
+        CallTreeNode();
+        ~CallTreeNode();
+
+        unsigned int                            function;
+        unsigned int                            selfSamples;
+        unsigned int                            totalSamples;
+        wxTreeItemId                            item;
+        std::map<unsigned int, CallTreeNode*>   children;   // Keyed by function index.
+
+    };
+
+    /**
+     * Returns the index of the function for the stack frame, adding it if
+     * it hasn't been seen before.
+     */
+    unsigned int GetFunction(const DebugFrontend::ProfileFrame& frame);
+
+    /**
+     * Updates the list of functions and the call tree to show the current
+     * samples.
+     */
+    void UpdateViews();
+
+    /**
+     * Updates the tree items for the node and its children, creating any
+     * that don't exist yet.
+     */
+    void UpdateCallTreeNode(CallTreeNode* node, const wxTreeItemId& parent);
+
+    /**
+     * Formats a sample count along with the percentage of the total.
+     */
+    wxString FormatSamples(unsigned int samples) const;
+
+private:
+
+    wxStaticText*                       m_summary;
+    ListView*                           m_functionList;
+    wxTreeListCtrl*                     m_callTree;
+    wxTreeItemId                        m_callTreeRoot;
+
+    std::vector<Function>               m_functions;
+    std::map<wxString, unsigned int>    m_functionMap;
+    CallTreeNode                        m_root;
+
+    std::map<wxString, unsigned int>    m_collapsedStacks;  // Counts for each stack in flame graph format.
+    unsigned int                        m_totalSamples;
+
+};
+
+#endif
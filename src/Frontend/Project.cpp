@@ -65,6 +65,8 @@ Project::Project()
     m_needsSave     = false;
     m_needsUserSave = false;
     m_tempIndex = 0;
+    m_excludeStringScripts  = false;
+    m_maxScriptSize         = 0;
 }
 
 Project::~Project()
@@ -216,6 +218,39 @@ void Project::SetSymbolsDirectory(const wxString& symbolsDirectory)
     m_needsUserSave = true;
 }
 
+const wxString& Project::GetExcludedScripts() const
+{
+    return m_excludedScripts;
+}
+
+void Project::SetExcludedScripts(const wxString& excludedScripts)
+{
+    m_excludedScripts = excludedScripts;
+    m_needsUserSave = true;
+}
+
+bool Project::GetExcludeStringScripts() const
+{
+    return m_excludeStringScripts;
+}
+
+void Project::SetExcludeStringScripts(bool excludeStringScripts)
+{
+    m_excludeStringScripts = excludeStringScripts;
+    m_needsUserSave = true;
+}
+
+unsigned int Project::GetMaxScriptSize() const
+{
+    return m_maxScriptSize;
+}
+
+void Project::SetMaxScriptSize(unsigned int maxScriptSize)
+{
+    m_maxScriptSize = maxScriptSize;
+    m_needsUserSave = true;
+}
+
 const wxString& Project::GetSccProvider() const
 {
     return m_sccProvider;
@@ -786,6 +821,9 @@ bool Project::SaveUserSettings(const wxString& fileName)
     root->AddChild(WriteXmlNode("symbols_directory",    m_symbolsDirectory));
 #endif
     root->AddChild(WriteXmlNode("command_arguments",    m_commandArguments));
+    root->AddChild(WriteXmlNode("excluded_scripts",     m_excludedScripts));
+    root->AddChild(WriteXmlNodeBool("exclude_string_scripts", m_excludeStringScripts));
+    root->AddChild(WriteXmlNode("max_script_size",      static_cast<int>(m_maxScriptSize)));
 
     // Add the source control settings.
     
@@ -854,6 +892,9 @@ bool Project::LoadUserSettings(const wxString& fileName)
     {
 
            ReadXmlNode(node, "command_arguments",   m_commandArguments)
+        || ReadXmlNode(node, "excluded_scripts",    m_excludedScripts)
+        || ReadXmlNode(node, "exclude_string_scripts", m_excludeStringScripts)
+        || ReadXmlNode(node, "max_script_size",     m_maxScriptSize)
 #ifndef DEDICATED_PRODUCT_VERSION
         || ReadXmlNode(node, "command",             m_commandLine)
         || ReadXmlNode(node, "working_directory",   m_workingDirectory)
@@ -159,6 +159,41 @@ public:
      */
     void SetSymbolsDirectory(const wxString& symbolsDirectory);
 
+    /**
+     * Returns the patterns for the scripts that aren't debugged, separated by
+     * semicolons. A pattern ending in a slash excludes the scripts in that
+     * directory, other patterns are matched against the script name and can
+     * contain * and ? wildcards.
+     */
+    const wxString& GetExcludedScripts() const;
+
+    /**
+     * Sets the patterns for the scripts that aren't debugged.
+     */
+    void SetExcludedScripts(const wxString& excludedScripts);
+
+    /**
+     * Returns true if scripts that were loaded from strings rather than files
+     * aren't debugged.
+     */
+    bool GetExcludeStringScripts() const;
+
+    /**
+     * Sets whether or not scripts that were loaded from strings are debugged.
+     */
+    void SetExcludeStringScripts(bool excludeStringScripts);
+
+    /**
+     * Returns the size in kilobytes above which scripts aren't debugged, or 0
+     * if there is no limit.
+     */
+    unsigned int GetMaxScriptSize() const;
+
+    /**
+     * Sets the size in kilobytes above which scripts aren't debugged.
+     */
+    void SetMaxScriptSize(unsigned int maxScriptSize);
+
     /**
      * Returns the name of the source control provider.
      */
@@ -374,6 +409,10 @@ private:
     wxString                m_workingDirectory;
     wxString                m_symbolsDirectory;
 
+    wxString                m_excludedScripts;
+    bool                    m_excludeStringScripts;
+    unsigned int            m_maxScriptSize;
+
     std::vector<File*>      m_files;
 
     unsigned int            m_tempIndex;
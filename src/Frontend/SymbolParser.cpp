@@ -87,10 +87,11 @@ void SymbolParser::QueueForParsing(Project::File* file)
 
         wxString code;
 
-        if (file->scriptIndex != -1)
+        const DebugFrontend::Script* script = DebugFrontend::Get().GetScript(file->scriptIndex);
+
+        if (script != NULL && script->source != NULL)
         {
-            const DebugFrontend::Script* script = DebugFrontend::Get().GetScript(file->scriptIndex);
-            code = script->source.c_str();
+            code = script->source->text.c_str();
         }
         else if (wxFileExists(file->fileName.GetFullPath()))
         {
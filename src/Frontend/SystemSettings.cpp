@@ -29,6 +29,9 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 SystemSettings::SystemSettings()
 {
     m_checkForUpdates = true;
+    m_evaluateInstructionLimit  = 10000000;
+    m_evaluateTimeLimit         = 1000;
+    m_evaluateSizeLimit         = 1024;
 }
 
 bool SystemSettings::GetCheckForUpdates() const
@@ -41,11 +44,44 @@ void SystemSettings::SetCheckForUpdates(bool checkForUpdates)
     m_checkForUpdates = checkForUpdates;
 }
 
+unsigned int SystemSettings::GetEvaluateInstructionLimit() const
+{
+    return m_evaluateInstructionLimit;
+}
+
+void SystemSettings::SetEvaluateInstructionLimit(unsigned int instructionLimit)
+{
+    m_evaluateInstructionLimit = instructionLimit;
+}
+
+unsigned int SystemSettings::GetEvaluateTimeLimit() const
+{
+    return m_evaluateTimeLimit;
+}
+
+void SystemSettings::SetEvaluateTimeLimit(unsigned int timeLimit)
+{
+    m_evaluateTimeLimit = timeLimit;
+}
+
+unsigned int SystemSettings::GetEvaluateSizeLimit() const
+{
+    return m_evaluateSizeLimit;
+}
+
+void SystemSettings::SetEvaluateSizeLimit(unsigned int sizeLimit)
+{
+    m_evaluateSizeLimit = sizeLimit;
+}
+
 wxXmlNode* SystemSettings::Save(const wxString& tag) const
 {
 
     wxXmlNode* root = new wxXmlNode(wxXML_ELEMENT_NODE, tag);    
     root->AddChild( WriteXmlNodeBool("check_for_updates", m_checkForUpdates) );
+    root->AddChild( WriteXmlNode("evaluate_instruction_limit", static_cast<int>(m_evaluateInstructionLimit)) );
+    root->AddChild( WriteXmlNode("evaluate_time_limit", static_cast<int>(m_evaluateTimeLimit)) );
+    root->AddChild( WriteXmlNode("evaluate_size_limit", static_cast<int>(m_evaluateSizeLimit)) );
     return root;
 
 }
@@ -57,7 +93,10 @@ void SystemSettings::Load(wxXmlNode* root)
 
     while (node != NULL)
     {
-        ReadXmlNode(node, "check_for_updates", m_checkForUpdates);
+        ReadXmlNode(node, "check_for_updates", m_checkForUpdates)
+            || ReadXmlNode(node, "evaluate_instruction_limit", m_evaluateInstructionLimit)
+            || ReadXmlNode(node, "evaluate_time_limit", m_evaluateTimeLimit)
+            || ReadXmlNode(node, "evaluate_size_limit", m_evaluateSizeLimit);
         node = node->GetNext();
     }
 
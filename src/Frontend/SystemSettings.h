@@ -53,6 +53,40 @@ public:
      */
     void SetCheckForUpdates(bool checkForUpdates);
 
+    /**
+     * Returns the number of instructions evaluating an expression can run
+     * before it's stopped, or 0 for no limit.
+     */
+    unsigned int GetEvaluateInstructionLimit() const;
+
+    /**
+     * Sets the number of instructions evaluating an expression can run.
+     */
+    void SetEvaluateInstructionLimit(unsigned int instructionLimit);
+
+    /**
+     * Returns the number of milliseconds evaluating an expression can take
+     * before it's stopped, or 0 for no limit.
+     */
+    unsigned int GetEvaluateTimeLimit() const;
+
+    /**
+     * Sets the number of milliseconds evaluating an expression can take.
+     */
+    void SetEvaluateTimeLimit(unsigned int timeLimit);
+
+    /**
+     * Returns the size in kilobytes after which the value of an expression is
+     * truncated, or 0 for no limit.
+     */
+    unsigned int GetEvaluateSizeLimit() const;
+
+    /**
+     * Sets the size in kilobytes after which the value of an expression is
+     * truncated.
+     */
+    void SetEvaluateSizeLimit(unsigned int sizeLimit);
+
     /**
      * Saves the font and color settings in XML format. The tag is the name that is given
      * to the root node.
@@ -66,7 +100,11 @@ public:
 
 private:
 
-    bool    m_checkForUpdates;
+    bool            m_checkForUpdates;
+
+    unsigned int    m_evaluateInstructionLimit;
+    unsigned int    m_evaluateTimeLimit;
+    unsigned int    m_evaluateSizeLimit;
 
 };
 
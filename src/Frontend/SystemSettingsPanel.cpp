@@ -27,13 +27,14 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 
 BEGIN_EVENT_TABLE(SystemSettingsPanel, wxPanel)
     EVT_CHECKBOX(       SystemSettingsPanel::ID_CheckForUpdates,    SystemSettingsPanel::OnCheckForUpdates)
+    EVT_TEXT(           SystemSettingsPanel::ID_EvaluateLimit,      SystemSettingsPanel::OnEvaluateLimit)
 END_EVENT_TABLE()
 
 SystemSettingsPanel::SystemSettingsPanel( wxWindow* parent, int id, wxPoint pos, wxSize size, int style ) : wxPanel( parent, id, pos, size, style )
 {
 
 	wxFlexGridSizer* fgSizer4;
-	fgSizer4 = new wxFlexGridSizer( 2, 1, 0, 0 );
+	fgSizer4 = new wxFlexGridSizer( 3, 1, 0, 0 );
 	fgSizer4->AddGrowableCol( 0 );
 	fgSizer4->AddGrowableRow( 0 );
 	fgSizer4->SetFlexibleDirection( wxBOTH );
@@ -65,6 +66,32 @@ SystemSettingsPanel::SystemSettingsPanel( wxWindow* parent, int id, wxPoint pos,
 	m_checkForUpdates = new wxCheckBox( this, ID_CheckForUpdates, wxT("Automatically check for updates to Decoda"), wxDefaultPosition, wxDefaultSize, 0 );
 	sbSizer4->Add( m_checkForUpdates, 0, wxALL, 5 );
     fgSizer4->Add (sbSizer4, 0, wxEXPAND | wxALL, 5);
+
+	wxStaticBoxSizer* sbSizer5;
+	sbSizer5 = new wxStaticBoxSizer( new wxStaticBox( this, -1, wxT("Watches") ), wxVERTICAL );
+
+	wxFlexGridSizer* fgSizer8;
+	fgSizer8 = new wxFlexGridSizer( 3, 2, 0, 0 );
+	fgSizer8->AddGrowableCol( 1 );
+	fgSizer8->SetFlexibleDirection( wxHORIZONTAL );
+
+	fgSizer8->Add( new wxStaticText( this, wxID_ANY, wxT("Time limit (ms):") ), 0, wxALL|wxALIGN_CENTER_VERTICAL, 5 );
+	m_evaluateTimeLimitBox = new wxTextCtrl( this, ID_EvaluateLimit, wxEmptyString, wxDefaultPosition, wxDefaultSize, 0, wxTextValidator(wxFILTER_NUMERIC) );
+	m_evaluateTimeLimitBox->SetToolTip( wxT("Expressions that take longer than this to evaluate are stopped. Leave empty for no limit.") );
+	fgSizer8->Add( m_evaluateTimeLimitBox, 0, wxALL|wxEXPAND, 5 );
+
+	fgSizer8->Add( new wxStaticText( this, wxID_ANY, wxT("Instruction limit:") ), 0, wxALL|wxALIGN_CENTER_VERTICAL, 5 );
+	m_evaluateInstructionLimitBox = new wxTextCtrl( this, ID_EvaluateLimit, wxEmptyString, wxDefaultPosition, wxDefaultSize, 0, wxTextValidator(wxFILTER_NUMERIC) );
+	m_evaluateInstructionLimitBox->SetToolTip( wxT("Expressions that run more Lua instructions than this are stopped. Leave empty for no limit.") );
+	fgSizer8->Add( m_evaluateInstructionLimitBox, 0, wxALL|wxEXPAND, 5 );
+
+	fgSizer8->Add( new wxStaticText( this, wxID_ANY, wxT("Size limit (KB):") ), 0, wxALL|wxALIGN_CENTER_VERTICAL, 5 );
+	m_evaluateSizeLimitBox = new wxTextCtrl( this, ID_EvaluateLimit, wxEmptyString, wxDefaultPosition, wxDefaultSize, 0, wxTextValidator(wxFILTER_NUMERIC) );
+	m_evaluateSizeLimitBox->SetToolTip( wxT("Values larger than this are truncated. Leave empty for no limit.") );
+	fgSizer8->Add( m_evaluateSizeLimitBox, 0, wxALL|wxEXPAND, 5 );
+
+	sbSizer5->Add( fgSizer8, 1, wxEXPAND | wxALL, 5 );
+    fgSizer4->Add (sbSizer5, 0, wxEXPAND | wxALL, 5);
 	
 	this->SetSizer( fgSizer4 );
 	this->Layout();
@@ -89,6 +116,30 @@ void SystemSettingsPanel::Initialize()
 
     m_checkForUpdates->SetValue(m_settings.GetCheckForUpdates());
 
+    // Read the limits before setting any of the boxes, since that changes the
+    // settings from the boxes that haven't been set yet.
+
+    unsigned int limits[] =
+        {
+            m_settings.GetEvaluateTimeLimit(),
+            m_settings.GetEvaluateInstructionLimit(),
+            m_settings.GetEvaluateSizeLimit(),
+        };
+
+    wxTextCtrl* boxes[] = { m_evaluateTimeLimitBox, m_evaluateInstructionLimitBox, m_evaluateSizeLimitBox };
+
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        if (limits[i] > 0)
+        {
+            boxes[i]->SetValue(wxString::Format("%u", limits[i]));
+        }
+        else
+        {
+            boxes[i]->SetValue(wxEmptyString);
+        }
+    }
+
 }
 
 void SystemSettingsPanel::AddFileType(const wxString& ext, int icon)
@@ -186,6 +237,35 @@ void SystemSettingsPanel::OnCheckForUpdates(wxCommandEvent& event)
     m_settings.SetCheckForUpdates(m_checkForUpdates->GetValue());
 }
 
+void SystemSettingsPanel::OnEvaluateLimit(wxCommandEvent& event)
+{
+
+    // Empty or invalid values mean there's no limit.
+
+    unsigned long timeLimit;
+    if (!m_evaluateTimeLimitBox->GetValue().ToULong(&timeLimit))
+    {
+        timeLimit = 0;
+    }
+
+    unsigned long instructionLimit;
+    if (!m_evaluateInstructionLimitBox->GetValue().ToULong(&instructionLimit))
+    {
+        instructionLimit = 0;
+    }
+
+    unsigned long sizeLimit;
+    if (!m_evaluateSizeLimitBox->GetValue().ToULong(&sizeLimit))
+    {
+        sizeLimit = 0;
+    }
+
+    m_settings.SetEvaluateTimeLimit(timeLimit);
+    m_settings.SetEvaluateInstructionLimit(instructionLimit);
+    m_settings.SetEvaluateSizeLimit(sizeLimit);
+
+}
+
 bool SystemSettingsPanel::GetIsRegistered(const wxString& ext, const wxString& openCommand) const
 {
 
@@ -72,6 +72,11 @@ public:
      * Called when the user changes the check for updates check box.
      */
     void OnCheckForUpdates(wxCommandEvent& event);
+
+    /**
+     * Called when the user changes one of the limits for evaluating expressions.
+     */
+    void OnEvaluateLimit(wxCommandEvent& event);
     
     DECLARE_EVENT_TABLE()
 
@@ -92,6 +97,7 @@ private:
     enum ID
     {
         ID_CheckForUpdates = 1,
+        ID_EvaluateLimit,
     };
 
     struct FileType
@@ -105,6 +111,10 @@ private:
 
     wxCheckBox*             m_checkForUpdates;
 
+    wxTextCtrl*             m_evaluateTimeLimitBox;
+    wxTextCtrl*             m_evaluateInstructionLimitBox;
+    wxTextCtrl*             m_evaluateSizeLimitBox;
+
     SystemSettings          m_settings;
 
 };
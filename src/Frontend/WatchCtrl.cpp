@@ -24,6 +24,7 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 #include "Tokenizer.h"
 #include "DebugFrontend.h"
 #include "XmlUtility.h"
+#include "ValueEncoding.h"
 
 #include <wx/sstream.h>
 #include <wx/xml/xml.h>
@@ -31,6 +32,7 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 BEGIN_EVENT_TABLE(WatchCtrl, wxTreeListCtrl)
     EVT_SIZE(                               WatchCtrl::OnSize)
     EVT_LIST_COL_END_DRAG(wxID_ANY,         WatchCtrl::OnColumnEndDrag)
+    EVT_TREE_ITEM_EXPANDING(wxID_ANY,       WatchCtrl::OnItemExpanding)
 END_EVENT_TABLE()
 
 WatchCtrl::WatchCtrl(wxWindow *parent, wxWindowID id, const wxPoint& pos, const wxSize& size, long style, const wxValidator &validator, const wxString& name)
@@ -138,12 +140,9 @@ void WatchCtrl::GetColumnSizes(int totalSize, int columnSize[s_numColumns]) cons
 
 }
 
-bool WatchCtrl::AddCompoundExpression(wxTreeItemId item, wxXmlNode* root)
+void WatchCtrl::SetItemValue(wxTreeItemId item, wxString text, const wxString& type)
 {
 
-    wxString type;
-    wxString text = GetNodeAsText(root, type);
-    
     // Remove any embedded zeros in the text. This happens if we're displaying a wide
     // string. Since we aren't using wide character wxWidgets, we cant' display that
     // properly, so we just hack it for roman text.
@@ -173,13 +172,482 @@ bool WatchCtrl::AddCompoundExpression(wxTreeItemId item, wxXmlNode* root)
     SetItemText(item, 1, text);
     SetItemText(item, 2, type);
 
+}
+
+bool WatchCtrl::AddValue(wxTreeItemId item, ValueReader& reader, ValueTag tag)
+{
+
+    if (tag == ValueTag_Table)
+    {
+
+        unsigned int id;
+        std::string type;
+
+        if (!reader.ReadUInt32(id) || !reader.ReadString(type))
+        {
+            return false;
+        }
+
+        // Remember the item so that later references to the table can link to it.
+        if (id != 0)
+        {
+            m_tableItems[id] = item;
+        }
+
+        wxString text;
+
+        if (!AddTableElements(item, reader, wxTreeItemId(), text))
+        {
+            return false;
+        }
+
+        SetItemValue(item, text, type.c_str());
+        return true;
+
+    }
+    else if (tag == ValueTag_Values)
+    {
+
+        wxString text;
+        unsigned int i = 1;
+
+        ValueTag childTag = ValueTag_Value;
+
+        while (reader.ReadTag(childTag) && childTag != ValueTag_End)
+        {
+
+            wxTreeItemId child = AppendItem(item, wxString::Format("%d", i));
+            SetItemFont(child, m_valueFont);
+
+            if (!AddValue(child, reader, childTag))
+            {
+                return false;
+            }
+
+            if (!text.IsEmpty())
+            {
+                text += ", ";
+            }
+
+            text += GetItemText(child, 1);
+            ++i;
+
+        }
+
+        SetItemValue(item, text, "");
+        return childTag == ValueTag_End;
+
+    }
+    else if (tag == ValueTag_Reference)
+    {
+
+        unsigned int id;
+        std::string type;
+
+        if (!reader.ReadUInt32(id) || !reader.ReadString(type))
+        {
+            return false;
+        }
+
+        // The table was already displayed, so we link to that item. The
+        // reference can still be expanded in place using the id as a handle.
+
+        std::map<unsigned int, wxTreeItemId>::const_iterator iterator = m_tableItems.find(id);
+
+        wxString text = "{...}";
+
+        if (iterator != m_tableItems.end())
+        {
+            text = "-> " + GetItemPath(iterator->second);
+        }
+
+        SetItemValue(item, text, type.c_str());
+        SetItemHandle(item, id, 0);
+
+        return true;
+
+    }
+    else
+    {
+
+        wxString text;
+        wxString type;
+
+        if (!ReadValueAsText(reader, tag, text, type))
+        {
+            return false;
+        }
+
+        SetItemValue(item, text, type);
+        return true;
+
+    }
+
+}
+
+bool WatchCtrl::AddTableElements(wxTreeItemId item, ValueReader& reader, wxTreeItemId first, wxString& text)
+{
+
+    // The text for a table shows the first few elements.
+    const unsigned int maxElements = 4;
+
+    unsigned int numElements = 0;
+
+    text = "{";
+
+    ValueTag keyTag = ValueTag_Value;
+
+    while (reader.ReadTag(keyTag) && keyTag != ValueTag_End)
+    {
+
+        wxString key;
+        wxString type;
+
+        ValueTag dataTag;
+
+        if (!ReadValueAsText(reader, keyTag, key, type) || !reader.ReadTag(dataTag))
+        {
+            return false;
+        }
+
+        wxTreeItemId child;
+
+        if (first.IsOk())
+        {
+            child = first;
+            first = wxTreeItemId();
+            SetItemText(child, key);
+        }
+        else
+        {
+            child = AppendItem(item, key);
+        }
+
+        SetItemFont(child, m_valueFont);
+
+        if (!AddValue(child, reader, dataTag))
+        {
+            return false;
+        }
+
+        if (numElements < maxElements)
+        {
+            text += key + "=" + GetItemText(child, 1) + " ";
+        }
+        else if (numElements == maxElements)
+        {
+            text += "...";
+        }
+
+        ++numElements;
+
+    }
+
+    unsigned int handle;
+    unsigned int offset;
+
+    if (keyTag != ValueTag_End || !reader.ReadUInt32(handle) || !reader.ReadUInt32(offset))
+    {
+        return false;
+    }
+
+    if (handle != 0)
+    {
+        if (numElements > 0)
+        {
+            // Add an item the user can expand to get the next page of elements.
+            wxTreeItemId more = AppendItem(item, "...");
+            SetItemFont(more, m_valueFont);
+            SetItemHandle(more, handle, offset);
+        }
+        else
+        {
+            SetItemHandle(item, handle, offset);
+        }
+        if (numElements <= maxElements)
+        {
+            text += "...";
+        }
+    }
+
+    text += "}";
+
+    return true;
+
+}
+
+bool WatchCtrl::ReadValueAsText(ValueReader& reader, ValueTag tag, wxString& text, wxString& type)
+{
+
+    if (tag == ValueTag_Value)
+    {
+
+        std::string data;
+        std::string typeName;
+
+        if (!reader.ReadString(data) || !reader.ReadString(typeName))
+        {
+            return false;
+        }
+
+        text = wxString(data.c_str(), data.length());
+        type = typeName.c_str();
+
+    }
+    else if (tag == ValueTag_Function)
+    {
+
+        unsigned int scriptIndex;
+        unsigned int lineNumber;
+
+        if (!reader.ReadUInt32(scriptIndex) || !reader.ReadUInt32(lineNumber))
+        {
+            return false;
+        }
+
+        text = GetFunctionAsText(scriptIndex, lineNumber);
+        type = "function";
+
+    }
+    else if (tag == ValueTag_Error)
+    {
+
+        std::string message;
+
+        if (!reader.ReadString(message))
+        {
+            return false;
+        }
+
+        text = message.c_str();
+
+    }
+    else if (tag == ValueTag_Table)
+    {
+
+        unsigned int id;
+        std::string typeName;
+
+        if (!reader.ReadUInt32(id) || !reader.ReadString(typeName))
+        {
+            return false;
+        }
+
+        type = typeName.c_str();
+
+        const unsigned int maxElements = 4;
+        unsigned int numElements = 0;
+
+        text = "{";
+
+        ValueTag keyTag = ValueTag_Value;
+
+        while (reader.ReadTag(keyTag) && keyTag != ValueTag_End)
+        {
+
+            wxString key;
+            wxString data;
+            wxString dummy;
+
+            ValueTag dataTag;
+
+            if (!ReadValueAsText(reader, keyTag, key, dummy) || !reader.ReadTag(dataTag) ||
+                !ReadValueAsText(reader, dataTag, data, dummy))
+            {
+                return false;
+            }
+
+            if (numElements < maxElements)
+            {
+                text += key + "=" + data + " ";
+            }
+            else if (numElements == maxElements)
+            {
+                text += "...";
+            }
+
+            ++numElements;
+
+        }
+
+        unsigned int handle;
+        unsigned int offset;
+
+        if (keyTag != ValueTag_End || !reader.ReadUInt32(handle) || !reader.ReadUInt32(offset))
+        {
+            return false;
+        }
+
+        if (handle != 0 && numElements <= maxElements)
+        {
+            text += "...";
+        }
+
+        text += "}";
+
+    }
+    else if (tag == ValueTag_Reference)
+    {
+
+        unsigned int id;
+        std::string typeName;
+
+        if (!reader.ReadUInt32(id) || !reader.ReadString(typeName))
+        {
+            return false;
+        }
+
+        // Without the tree there's nothing to link to, so this is displayed
+        // the same as a table that wasn't expanded.
+        text = "{...}";
+        type = typeName.c_str();
+
+    }
+    else if (tag == ValueTag_Values)
+    {
+
+        ValueTag childTag = ValueTag_Value;
+
+        while (reader.ReadTag(childTag) && childTag != ValueTag_End)
+        {
+
+            wxString childText;
+            wxString dummy;
+
+            if (!ReadValueAsText(reader, childTag, childText, dummy))
+            {
+                return false;
+            }
+
+            if (!text.IsEmpty())
+            {
+                text += ", ";
+            }
+
+            text += childText;
+
+        }
+
+        return childTag == ValueTag_End;
+
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+
+}
+
+bool WatchCtrl::GetResultAsText(const std::string& result, wxString& text)
+{
+
+    wxString type;
+
+    if (!result.empty() && result[0] == '<')
+    {
+
+        // XML is only sent by backends built for debugging.
+
+        wxStringInputStream stream(result.c_str());
+        wxXmlDocument document;
+
+        wxLogNull logNo;
+
+        if (!document.Load(stream))
+        {
+            return false;
+        }
+
+        text = GetNodeAsText(document.GetRoot(), type);
+        return true;
+
+    }
+
+    ValueReader reader(result.c_str(), result.length());
+    ValueTag tag;
+
+    return reader.ReadTag(tag) && ReadValueAsText(reader, tag, text, type);
+
+}
+
+wxString WatchCtrl::GetItemPath(wxTreeItemId item) const
+{
+
+    wxString path;
+    wxTreeItemId root = GetRootItem();
+
+    while (item.IsOk() && item != root)
+    {
+
+        wxString name = GetItemText(item);
+        item = GetItemParent(item);
+
+        if (!item.IsOk() || item == root)
+        {
+            // This is the expression for the watch.
+            path = name + path;
+        }
+        else
+        {
+
+            bool identifier = !name.IsEmpty() && (wxIsalpha(name[0]) || name[0] == '_');
+
+            for (unsigned int i = 1; i < name.Length() && identifier; ++i)
+            {
+                identifier = wxIsalnum(name[i]) || name[i] == '_';
+            }
+
+            if (identifier)
+            {
+                path = "." + name + path;
+            }
+            else
+            {
+                path = "[" + name + "]" + path;
+            }
+
+        }
+
+    }
+
+    return path;
+
+}
+
+wxString WatchCtrl::GetFunctionAsText(unsigned int scriptIndex, unsigned int lineNumber)
+{
+
+    wxString text = "function";
+
+    DebugFrontend::Script* script = DebugFrontend::Get().GetScript(scriptIndex);
+
+    if (script != NULL)
+    {
+        text += " defined at ";
+        text += script->name;
+        text += ":";
+        text += wxString::Format("%d", lineNumber + 1);
+    }
+
+    return text;
+
+}
+
+bool WatchCtrl::AddCompoundExpression(wxTreeItemId item, wxXmlNode* root)
+{
+
+    wxString type;
+    wxString text = GetNodeAsText(root, type);
+    
+    SetItemValue(item, text, type);
+
     if (root != NULL)
     {
         if (root->GetName() == "table")
         {
 
-            // Add the elements of the table as tree children.
-
             wxXmlNode* node = root->GetChildren();
             while (node != NULL)
             {
@@ -190,29 +658,32 @@ bool WatchCtrl::AddCompoundExpression(wxTreeItemId item, wxXmlNode* root)
                 {
                     SetItemText(item, 2, typeName);
                 }
-                else if (node->GetName() == "element")
-                {
 
-                    wxXmlNode* keyNode  = FindChildNode(node, "key");
-                    wxXmlNode* dataNode = FindChildNode(node, "data");
-
-                    if (keyNode != NULL && dataNode != NULL)
-                    {
+                node = node->GetNext();
 
-                        wxString type;
-                        wxString key  = GetNodeAsText(keyNode->GetChildren(), type);
+            }
 
-                        wxTreeItemId child = AppendItem(item, key);
-                        SetItemFont(child, m_valueFont);
+            // Add the elements of the table as tree children.
+            AddTableElements(item, root, wxTreeItemId());
 
-                        AddCompoundExpression(child, dataNode->GetChildren());
+        }
+        else if (root->GetName() == "reference")
+        {
 
-                    }
+            // References can be expanded using the id of the table.
 
-                }
+            unsigned int id = 0;
 
+            wxXmlNode* node = root->GetChildren();
+            while (node != NULL)
+            {
+                ReadXmlNode(node, "id", id);
                 node = node->GetNext();
+            }
 
+            if (id != 0)
+            {
+                SetItemHandle(item, id, 0);
             }
 
         }
@@ -249,49 +720,307 @@ void WatchCtrl::UpdateItem(wxTreeItemId item)
     {
 
         wxString expression = GetItemText(item);
-        wxString result;
+        std::string result;
 
         if (!expression.empty())
         {
-            std::string temp;
-            DebugFrontend::Get().Evaluate(m_vm, expression, m_stackLevel, temp);
-            result = temp.c_str();
+            DebugFrontend::Get().Evaluate(m_vm, expression, m_stackLevel, result);
         }
 
+        SetItemResult(item, result);
+
+    }
+    else
+    {
+        SetItemText(item, 1, "");
+        SetItemText(item, 2, "");
         DeleteChildren(item);
-        SetItemFont(item, m_valueFont);
+        ClearItemHandle(item);
+    }
+
+}
+
+void WatchCtrl::UpdateItems(const std::vector<wxTreeItemId>& items)
+{
+
+    if (m_vm != 0)
+    {
+
+        // Only send the items that have expressions.
+
+        std::vector<std::string> expressions;
+        std::vector<unsigned int> indices;
 
-        if (result.IsEmpty())
+        for (unsigned int i = 0; i < items.size(); ++i)
         {
-            SetItemText(item, 1, "");
-            SetItemText(item, 2, "");
+            wxString expression = GetItemText(items[i]);
+            if (!expression.empty())
+            {
+                expressions.push_back(expression.c_str());
+                indices.push_back(i);
+            }
         }
-        else
+
+        std::vector<std::string> results;
+        DebugFrontend::Get().EvaluateMultiple(m_vm, expressions, m_stackLevel, results);
+
+        std::vector<std::string> itemResults(items.size());
+
+        for (unsigned int i = 0; i < indices.size(); ++i)
         {
+            itemResults[indices[i]].swap(results[i]);
+        }
 
-            wxStringInputStream stream(result);
-            wxXmlDocument document;
+        for (unsigned int i = 0; i < items.size(); ++i)
+        {
+            SetItemResult(items[i], itemResults[i]);
+        }
 
-            wxLogNull logNo;
-            
-            if (document.Load(stream))
-            {
-                AddCompoundExpression(item, document.GetRoot());
-            }
-            else
+    }
+    else
+    {
+        for (unsigned int i = 0; i < items.size(); ++i)
+        {
+            SetItemText(items[i], 1, "");
+            SetItemText(items[i], 2, "");
+            DeleteChildren(items[i]);
+            ClearItemHandle(items[i]);
+        }
+    }
+
+}
+
+void WatchCtrl::AddTableElements(wxTreeItemId item, wxXmlNode* root, wxTreeItemId first)
+{
+
+    unsigned int handle = 0;
+    unsigned int offset = 0;
+
+    bool haveElements = false;
+
+    wxXmlNode* node = root->GetChildren();
+    while (node != NULL)
+    {
+
+        ReadXmlNode(node, "handle", handle);
+        ReadXmlNode(node, "offset", offset);
+
+        if (node->GetName() == "element")
+        {
+
+            wxXmlNode* keyNode  = FindChildNode(node, "key");
+            wxXmlNode* dataNode = FindChildNode(node, "data");
+
+            if (keyNode != NULL && dataNode != NULL)
             {
-                SetItemText(item, 1, "Improperly formatted XML data");
-                SetItemText(item, 2, "");
+
+                wxString type;
+                wxString key  = GetNodeAsText(keyNode->GetChildren(), type);
+
+                wxTreeItemId child;
+
+                if (first.IsOk())
+                {
+                    child = first;
+                    first = wxTreeItemId();
+                    SetItemText(child, key);
+                }
+                else
+                {
+                    child = AppendItem(item, key);
+                }
+
+                SetItemFont(child, m_valueFont);
+                AddCompoundExpression(child, dataNode->GetChildren());
+
+                haveElements = true;
+
             }
-    
+
         }
 
+        node = node->GetNext();
+
     }
-    else
+
+    if (handle != 0)
+    {
+        if (haveElements)
+        {
+            // Add an item the user can expand to get the next page of elements.
+            wxTreeItemId more = AppendItem(item, "...");
+            SetItemFont(more, m_valueFont);
+            SetItemHandle(more, handle, offset);
+        }
+        else
+        {
+            SetItemHandle(item, handle, offset);
+        }
+    }
+
+}
+
+void WatchCtrl::SetItemHandle(wxTreeItemId item, unsigned int handle, unsigned int offset)
+{
+
+    ItemData* data = new ItemData;
+    data->handle = handle;
+    data->offset = offset;
+
+    // The tree doesn't delete the old data when it's replaced.
+    delete GetItemData(item);
+    SetItemData(item, data);
+
+    SetItemHasChildren(item, true);
+
+}
+
+void WatchCtrl::ClearItemHandle(wxTreeItemId item)
+{
+
+    delete GetItemData(item);
+    SetItemData(item, NULL);
+
+    SetItemHasChildren(item, false);
+
+}
+
+void WatchCtrl::OnItemExpanding(wxTreeEvent& event)
+{
+
+    wxTreeItemId item = event.GetItem();
+    ItemData* data = static_cast<ItemData*>(GetItemData(item));
+
+    if (data == NULL)
+    {
+        return;
+    }
+
+    unsigned int handle = data->handle;
+    unsigned int offset = data->offset;
+
+    ClearItemHandle(item);
+
+    std::string result;
+
+    if (m_vm == 0 || !DebugFrontend::Get().ExpandValue(m_vm, handle, offset, s_tablePageSize, result))
+    {
+        event.Veto();
+        return;
+    }
+
+    wxTreeItemId parent = item;
+    wxTreeItemId first;
+
+    if (offset != 0)
+    {
+        // This is the item for the rest of the elements of its parent, so it's
+        // replaced by the next page of them.
+        event.Veto();
+        parent = GetItemParent(item);
+        first  = item;
+    }
+
+    if (!AddTablePage(parent, result, first))
+    {
+        event.Veto();
+    }
+
+}
+
+bool WatchCtrl::AddTablePage(wxTreeItemId item, const std::string& result, wxTreeItemId first)
+{
+
+    if (!result.empty() && result[0] == '<')
+    {
+
+        // XML is only sent by backends built for debugging.
+
+        wxStringInputStream stream(result.c_str());
+        wxXmlDocument document;
+
+        wxLogNull logNo;
+
+        if (!document.Load(stream))
+        {
+            return false;
+        }
+
+        AddTableElements(item, document.GetRoot(), first);
+        return true;
+
+    }
+
+    ValueReader reader(result.c_str(), result.length());
+
+    ValueTag tag;
+    unsigned int id;
+    std::string type;
+    wxString text;
+
+    if (!reader.ReadTag(tag) || tag != ValueTag_Table || !reader.ReadUInt32(id) || !reader.ReadString(type))
+    {
+        return false;
+    }
+
+    // The ids are only meaningful within a single result.
+    m_tableItems.clear();
+    m_tableItems[id] = item;
+
+    return AddTableElements(item, reader, first, text);
+
+}
+
+void WatchCtrl::SetItemResult(wxTreeItemId item, const std::string& result)
+{
+
+    DeleteChildren(item);
+    ClearItemHandle(item);
+    SetItemFont(item, m_valueFont);
+
+    if (result.empty())
     {
         SetItemText(item, 1, "");
         SetItemText(item, 2, "");
-        DeleteChildren(item);
+    }
+    else if (result[0] == '<')
+    {
+
+        // XML is only sent by backends built for debugging.
+
+        wxStringInputStream stream(result.c_str());
+        wxXmlDocument document;
+
+        wxLogNull logNo;
+        
+        if (document.Load(stream))
+        {
+            AddCompoundExpression(item, document.GetRoot());
+        }
+        else
+        {
+            SetItemText(item, 1, "Improperly formatted XML data");
+            SetItemText(item, 2, "");
+        }
+
+    }
+    else
+    {
+
+        // The result is decoded straight into the tree. The ids are only
+        // meaningful within a single result.
+
+        m_tableItems.clear();
+
+        ValueReader reader(result.c_str(), result.length());
+        ValueTag tag;
+
+        if (!reader.ReadTag(tag) || !AddValue(item, reader, tag))
+        {
+            SetItemText(item, 1, "Improperly formatted data");
+            SetItemText(item, 2, "");
+        }
+
     }
 
 }
@@ -403,6 +1132,12 @@ wxString WatchCtrl::GetTableAsText(wxXmlNode* root)
 
     }
 
+    // Tables that weren't sent with the value have a handle but no elements.
+    if (numElements == 0 && FindChildNode(root, "handle") != NULL)
+    {
+        result += "...";
+    }
+
     result += "}";
 
     return result;
@@ -424,6 +1159,20 @@ wxString WatchCtrl::GetNodeAsText(wxXmlNode* node, wxString& type)
         {
             text = GetTableAsText(node);
         }
+        else if (node->GetName() == "reference")
+        {
+
+            wxXmlNode* child = node->GetChildren();
+
+            while (child != NULL)
+            {
+                ReadXmlNode(child, "type", type);
+                child = child->GetNext();
+            }
+
+            text = "{...}";
+
+        }
         else if (node->GetName() == "values")
         {
 
@@ -472,18 +1221,7 @@ wxString WatchCtrl::GetNodeAsText(wxXmlNode* node, wxString& type)
                 child = child->GetNext();
             }
 
-            text = "function";
-
-            DebugFrontend::Script* script = DebugFrontend::Get().GetScript(scriptIndex);
-
-            if (script != NULL)
-            {
-                text += " defined at ";
-                text += script->name;
-                text += ":";
-                text += wxString::Format("%d", lineNumber + 1);
-            }
-
+            text = GetFunctionAsText(scriptIndex, lineNumber);
             type = "function";
 
         }
@@ -24,7 +24,12 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 #define WATCH_CTRL_H
 
 #include <wx/wx.h>
+#include <vector>
+#include <string>
+#include <map>
+
 #include "treelistctrl.h"
+#include "ValueEncoding.h"
 
 //
 // Forward declarations.
@@ -55,6 +60,12 @@ public:
      */
     void UpdateItem(wxTreeItemId item);
 
+    /**
+     * Updates the values for a list of items, evaluating all of their
+     * expressions with a single request to the debugger.
+     */
+    void UpdateItems(const std::vector<wxTreeItemId>& items);
+
     /**
      * Sets the font used to display values.
      */
@@ -75,6 +86,12 @@ public:
      */
     void OnSize(wxSizeEvent& event);
 
+    /**
+     * Called when the user expands an item. Tables that weren't sent with the
+     * value are requested from the debugger at this point.
+     */
+    void OnItemExpanding(wxTreeEvent& event);
+
     /**
      * Collapses a node down into a single line of text.
      */
@@ -82,11 +99,34 @@ public:
 
     static wxString GetTableAsText(wxXmlNode* root);
 
+    /**
+     * Reads a value whose tag has already been read and collapses it down
+     * into a single line of text. Returns false if the data is invalid.
+     */
+    static bool ReadValueAsText(ValueReader& reader, ValueTag tag, wxString& text, wxString& type);
+
+    /**
+     * Collapses the result of evaluating an expression down into a single
+     * line of text. Returns false if the result couldn't be decoded.
+     */
+    static bool GetResultAsText(const std::string& result, wxString& text);
+
     DECLARE_EVENT_TABLE()
 
 private:
 
+    /**
+     * Stores the handle for the elements of a table the debugger hasn't sent
+     * us yet.
+     */
+    struct ItemData : public wxTreeItemData
+    {
+        unsigned int    handle;
+        unsigned int    offset;     // Index of the first element that hasn't been sent.
+    };
+
     static const unsigned int s_numColumns = 3;
+    static const unsigned int s_tablePageSize = 100;
 
     /**
      * Updates the variable that stores the proprotion of the first column
@@ -104,6 +144,64 @@ private:
      */
     void UpdateFont(wxTreeItemId item);
 
+    /**
+     * Displays the result of evaluating the expression for an item. The result
+     * is normally in the binary value encoding, but can also be XML.
+     */
+    void SetItemResult(wxTreeItemId item, const std::string& result);
+
+    /**
+     * Sets the value and type text for an item.
+     */
+    void SetItemValue(wxTreeItemId item, wxString text, const wxString& type);
+
+    /**
+     * Reads a value whose tag has already been read and displays it in the
+     * item, adding the elements of tables as children. Returns false if the
+     * data is invalid.
+     */
+    bool AddValue(wxTreeItemId item, ValueReader& reader, ValueTag tag);
+
+    /**
+     * Reads the elements of a table and adds them as children of the item in
+     * the same way as the XML version. The text for the table is returned.
+     */
+    bool AddTableElements(wxTreeItemId item, ValueReader& reader, wxTreeItemId first, wxString& text);
+
+    /**
+     * Adds a page of table elements returned by the debugger.
+     */
+    bool AddTablePage(wxTreeItemId item, const std::string& result, wxTreeItemId first);
+
+    /**
+     * Returns the expression for an item made from the names of the item
+     * and its parents. This is used to display references to tables.
+     */
+    wxString GetItemPath(wxTreeItemId item) const;
+
+    /**
+     * Returns the text used to display a function.
+     */
+    static wxString GetFunctionAsText(unsigned int scriptIndex, unsigned int lineNumber);
+
+    /**
+     * Adds the elements of a table as children of the item. If the table has
+     * more elements than were sent, the item is given a handle to get them
+     * when it's expanded. If first is valid, it's used for the first element
+     * instead of adding a new item.
+     */
+    void AddTableElements(wxTreeItemId item, wxXmlNode* root, wxTreeItemId first);
+
+    /**
+     * Sets the handle used to get the elements for an item when it's expanded.
+     */
+    void SetItemHandle(wxTreeItemId item, unsigned int handle, unsigned int offset);
+
+    /**
+     * Removes the handle from an item.
+     */
+    void ClearItemHandle(wxTreeItemId item);
+
 private:
 
     float                       m_columnSize[s_numColumns];
@@ -115,6 +213,8 @@ private:
 
     wxFont                      m_valueFont;
 
+    std::map<unsigned int, wxTreeItemId>    m_tableItems;   // Items for the table ids in the current result.
+
 };
 
 #endif
\ No newline at end of file
@@ -49,15 +49,21 @@ WatchWindow::WatchWindow(wxWindow* parent, wxWindowID winid)
 void WatchWindow::UpdateItems()
 {
 
+    // All of the watches are evaluated with one request to the debugger.
+
+    std::vector<wxTreeItemId> items;
+
     wxTreeItemIdValue cookie;
     wxTreeItemId item = GetFirstChild(m_root, cookie);
 
     while (item.IsOk())
     {
-        UpdateItem(item);        
+        items.push_back(item);
         item = GetNextSibling(item);
     }
 
+    WatchCtrl::UpdateItems(items);
+
 }
 
 void WatchWindow::AddWatch(const wxString& expression)
@@ -0,0 +1,256 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc.
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Stand-in for Channel.cpp which has no frontend on the other end. Messages
+// are still encoded and flushed so their cost is included in the benchmark,
+// but they're discarded instead of being written to a pipe. Reads block until
+// the channel is destroyed, as they would with a frontend that never sends a
+// command.
+
+#include "Channel.h"
+#include "CriticalSectionLock.h"
+
+#include <string.h>
+#include <assert.h>
+
+Channel::Channel()
+{
+    m_pipe      = INVALID_HANDLE_VALUE;
+    m_doneEvent = INVALID_HANDLE_VALUE;
+    m_readEvent = INVALID_HANDLE_VALUE;
+    m_creator   = false;
+
+    m_readBuffer            = new char[s_bufferSize];
+    m_readBufferPosition    = 0;
+    m_readBufferLength      = 0;
+
+    m_idleCallback  = NULL;
+    m_idleParam     = NULL;
+    m_idleInterval  = INFINITE;
+}
+
+Channel::~Channel()
+{
+
+    Destroy();
+
+    // The done event is kept until now, since a thread blocked in a read may
+    // still be waiting on it after the channel was destroyed.
+    if (m_doneEvent != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_doneEvent);
+    }
+
+    delete [] m_readBuffer;
+
+}
+
+bool Channel::Create(const char* name)
+{
+    m_creator = true;
+    return Connect(name);
+}
+
+bool Channel::Connect(const char* name)
+{
+
+    // There is no pipe, but the handle is used to tell whether or not the
+    // channel is open.
+    m_pipe = NULL;
+
+    if (m_doneEvent == INVALID_HANDLE_VALUE)
+    {
+        m_doneEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    }
+    else
+    {
+        ResetEvent(m_doneEvent);
+    }
+
+    return true;
+
+}
+
+bool Channel::WaitForConnection()
+{
+    return m_pipe != INVALID_HANDLE_VALUE;
+}
+
+void Channel::Destroy()
+{
+
+    if (m_doneEvent != INVALID_HANDLE_VALUE)
+    {
+        // Signal the done event so that if we're currently blocked reading,
+        // we'll stop.
+        SetEvent(m_doneEvent);
+    }
+
+    m_pipe      = INVALID_HANDLE_VALUE;
+    m_creator   = false;
+
+    {
+        CriticalSectionLock lock(m_writeCriticalSection);
+        m_writeBuffer.clear();
+    }
+
+    m_readBufferPosition    = 0;
+    m_readBufferLength      = 0;
+
+}
+
+bool Channel::Write(const void* buffer, unsigned int length)
+{
+
+    assert(m_pipe != INVALID_HANDLE_VALUE);
+
+    CriticalSectionLock lock(m_writeCriticalSection);
+    m_writeBuffer.append(static_cast<const char*>(buffer), length);
+
+    return true;
+
+}
+
+bool Channel::Send(const void* buffer, unsigned int length)
+{
+    return m_pipe != INVALID_HANDLE_VALUE;
+}
+
+void Channel::SetIdleCallback(IdleCallback callback, void* param, DWORD interval)
+{
+    m_idleCallback  = callback;
+    m_idleParam     = param;
+    m_idleInterval  = (callback != NULL) ? interval : INFINITE;
+}
+
+bool Channel::WriteUInt32(unsigned int value)
+{
+    DWORD temp = value;
+    return Write(&temp, 4);
+}
+
+bool Channel::WriteUInt64(ULONGLONG value)
+{
+    return Write(&value, 8);
+}
+
+bool Channel::WriteString(const char* value)
+{
+    unsigned int length = static_cast<int>(strlen(value));
+    if (!WriteUInt32(length))
+    {
+        return false;
+    }
+    if (length > 0)
+    {
+        return Write(value, length);
+    }
+    return true;
+}
+
+bool Channel::WriteString(const std::string& value)
+{
+    unsigned int length = value.length();
+    if (!WriteUInt32(length))
+    {
+        return false;
+    }
+    if (length > 0)
+    {
+        return Write(value.c_str(), length);
+    }
+    return true;
+}
+
+bool Channel::WriteBool(bool value)
+{
+    return WriteUInt32(value ? 1 : 0);
+}
+
+bool Channel::ReadUInt32(unsigned int& value)
+{
+    DWORD temp;
+    if (!Read(&temp, 4))
+    {
+        return false;
+    }
+    value = temp;
+    return true;
+}
+
+bool Channel::ReadUInt64(ULONGLONG& value)
+{
+    return Read(&value, 8);
+}
+
+bool Channel::ReadString(std::string& value)
+{
+    value.clear();
+    unsigned int length;
+    return ReadUInt32(length);
+}
+
+bool Channel::ReadBool(bool& value)
+{
+    unsigned int temp;
+    if (ReadUInt32(temp))
+    {
+        value = temp != 0;
+        return true;
+    }
+    return false;
+}
+
+bool Channel::Read(void* buffer, unsigned int length)
+{
+    return length == 0 || FillReadBuffer();
+}
+
+bool Channel::FillReadBuffer()
+{
+
+    // Nothing is ever sent to the channel, so this only returns once the
+    // channel has been destroyed.
+
+    if (m_doneEvent != INVALID_HANDLE_VALUE)
+    {
+        while (WaitForSingleObject(m_doneEvent, m_idleInterval) == WAIT_TIMEOUT)
+        {
+            m_idleCallback(m_idleParam);
+        }
+    }
+
+    return false;
+
+}
+
+bool Channel::Flush()
+{
+
+    CriticalSectionLock lock(m_writeCriticalSection);
+
+    bool result = Send(m_writeBuffer.c_str(), m_writeBuffer.length());
+    m_writeBuffer.clear();
+
+    return result;
+
+}
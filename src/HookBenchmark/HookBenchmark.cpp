@@ -0,0 +1,310 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc.
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Measures the cost of the debug hook by running a synthetic program on
+// stand-in Lua states and timing the backend's handling of its events. The
+// events are only delivered when they're in the mask the backend installed on
+// the state, so the time includes the backend switching between hook modes.
+// The backend talks to a stand-in channel which discards what it sends.
+
+#include "DebugBackend.h"
+#include "LuaDllStub.h"
+
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// The backend uses this to find files next to its module.
+HINSTANCE g_hInstance = NULL;
+
+static const unsigned long  s_api                   = 0;
+static const unsigned int   s_numScripts            = 8;
+static const unsigned int   s_functionsPerScript    = 16;
+static const unsigned int   s_numFunctions          = s_numScripts * s_functionsPerScript;
+static const unsigned int   s_linesPerFunction      = 20;
+static const unsigned int   s_executedLines         = 5;        // Lines executed by each call.
+static const unsigned int   s_numCalls              = 20000;    // Calls made by each VM for a configuration.
+static const unsigned int   s_numWarmUpCalls        = 1000;
+static const unsigned int   s_numRuns               = 5;        // Times each configuration is timed.
+static const unsigned int   s_hostDepth             = 8;        // Frames on the stack below the program.
+
+static const char*  s_mainScriptName        = "@benchmark/main.lua";
+
+static std::string  g_scriptNames[s_numScripts];
+static unsigned int g_numEvents     = 0;    // Calls, returns and lines executed.
+static unsigned int g_numHookCalls  = 0;    // Events that reached the hook.
+
+/**
+ * Sends an event for the function at the top of the stack to the hook if the
+ * mask currently installed on the state includes it. The mask is read for
+ * every event since the hook can change it.
+ */
+static void Hook(lua_State* L, int event)
+{
+
+    ++g_numEvents;
+
+    if (L->hookMask & (1 << event))
+    {
+        lua_Debug ar;
+        InitializeHookEvent(L, event, &ar);
+        DebugBackend::Get().HookCallback(s_api, L, &ar);
+        ++g_numHookCalls;
+    }
+
+}
+
+/**
+ * Runs one of the functions of the synthetic program. Each function executes
+ * every other line of its body, and calls the next function from the middle
+ * of its body when nested is true. The lines that aren't executed are the
+ * ones breakpoints are set on.
+ */
+static void Call(lua_State* L, unsigned int function, bool nested)
+{
+
+    StubFrame frame;
+
+    frame.source            = g_scriptNames[function / s_functionsPerScript].c_str();
+    frame.lineDefined       = (function % s_functionsPerScript) * s_linesPerFunction + 1;
+    frame.lastLineDefined   = frame.lineDefined + s_linesPerFunction - 1;
+    frame.currentLine       = -1;
+    frame.tailCalls         = 0;
+
+    L->frames.push_back(frame);
+    Hook(L, LUA_HOOKCALL);
+
+    for (unsigned int i = 0; i < s_executedLines; ++i)
+    {
+
+        L->frames.back().currentLine = frame.lineDefined + i * 2;
+        Hook(L, LUA_HOOKLINE);
+
+        if (nested && i == s_executedLines / 2)
+        {
+            Call(L, (function + 1) % s_numFunctions, false);
+        }
+
+    }
+
+    Hook(L, LUA_HOOKRET);
+    L->frames.pop_back();
+
+}
+
+/**
+ * Creates a stand-in state running a script which doesn't contain any of the
+ * functions, and attaches the backend to it. Lua gives a main chunk a last
+ * line of 0, so the backend keeps line events on while a main chunk with
+ * breakpoints is running.
+ */
+static lua_State* CreateState()
+{
+
+    lua_State* L = new lua_State;
+
+    L->top              = 0;
+    L->hookMask         = 0;
+    L->hookCount        = 0;
+    L->numHookChanges   = 0;
+
+    StubFrame frame;
+
+    frame.source            = s_mainScriptName;
+    frame.lineDefined       = 0;
+    frame.lastLineDefined   = 0;
+    frame.currentLine       = 1;
+    frame.tailCalls         = 0;
+
+    L->frames.push_back(frame);
+
+    // The program runs from a few levels down in the main script, as it would
+    // when called from an application's own Lua code.
+
+    for (unsigned int i = 0; i < s_hostDepth; ++i)
+    {
+        frame.lineDefined       = i * 2 + 1;
+        frame.lastLineDefined   = i * 2 + 2;
+        frame.currentLine       = frame.lineDefined;
+        L->frames.push_back(frame);
+    }
+
+    DebugBackend::Get().AttachState(s_api, L);
+
+    // Register the scripts up front, since scripts first seen by the hook
+    // would wait for the frontend to send their breakpoints.
+
+    bool waitForLoad;
+    DebugBackend::Get().RegisterScript(L, NULL, 0, s_mainScriptName, true, waitForLoad);
+
+    for (unsigned int i = 0; i < s_numScripts; ++i)
+    {
+        DebugBackend::Get().RegisterScript(L, NULL, 0, g_scriptNames[i].c_str(), true, waitForLoad);
+    }
+
+    return L;
+
+}
+
+/**
+ * Sets breakpoints on lines the program never executes. They're spread over
+ * the functions so that as many functions as possible have one.
+ */
+static void SetBreakpoints(lua_State* L, unsigned int numBreakpoints)
+{
+
+    DebugBackend::Get().DeleteAllBreakpoints();
+
+    for (unsigned int i = 0; i < numBreakpoints; ++i)
+    {
+
+        unsigned int function = i % s_numFunctions;
+        unsigned int offset   = (i / s_numFunctions) * 2 + 1;
+
+        if (offset >= s_linesPerFunction)
+        {
+            break;
+        }
+
+        int scriptIndex = DebugBackend::Get().GetScriptIndex(g_scriptNames[function / s_functionsPerScript].c_str());
+        unsigned int line = (function % s_functionsPerScript) * s_linesPerFunction + 1 + offset;
+
+        // Breakpoint lines are zero based.
+        DebugBackend::Get().ToggleBreakpoint(L, scriptIndex, line - 1);
+
+    }
+
+}
+
+/**
+ * Times the program running on the specified number of states. The states
+ * run one after another on this thread, which is how most applications with
+ * several states use them.
+ */
+static void Run(unsigned int numBreakpoints, unsigned int numVms)
+{
+
+    std::vector<lua_State*> states;
+
+    for (unsigned int i = 0; i < numVms; ++i)
+    {
+        states.push_back(CreateState());
+    }
+
+    SetBreakpoints(states[0], numBreakpoints);
+
+    for (unsigned int call = 0; call < s_numWarmUpCalls; ++call)
+    {
+        for (unsigned int i = 0; i < numVms; ++i)
+        {
+            Call(states[i], call % s_numFunctions, true);
+        }
+    }
+
+    // The program is timed several times and the fastest run is reported,
+    // which filters out most of the noise from the rest of the system.
+
+    double ns = 0;
+
+    for (unsigned int run = 0; run < s_numRuns; ++run)
+    {
+
+        g_numEvents     = 0;
+        g_numHookCalls  = 0;
+
+        for (unsigned int i = 0; i < numVms; ++i)
+        {
+            states[i]->numHookChanges = 0;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        for (unsigned int call = 0; call < s_numCalls; ++call)
+        {
+            for (unsigned int i = 0; i < numVms; ++i)
+            {
+                Call(states[i], call % s_numFunctions, true);
+            }
+        }
+
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        double runNs = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+        if (run == 0 || runNs < ns)
+        {
+            ns = runNs;
+        }
+
+    }
+
+    unsigned int numHookChanges = 0;
+
+    for (unsigned int i = 0; i < numVms; ++i)
+    {
+        numHookChanges += states[i]->numHookChanges;
+    }
+
+    printf("%11u %4u %10u %10u %12u %10.1f\n", numBreakpoints, numVms,
+        g_numEvents, g_numHookCalls, numHookChanges, ns / g_numEvents);
+
+    for (unsigned int i = 0; i < numVms; ++i)
+    {
+        DebugBackend::Get().DetachState(s_api, states[i]);
+        delete states[i];
+    }
+
+}
+
+int main(int argc, char* argv[])
+{
+
+    for (unsigned int i = 0; i < s_numScripts; ++i)
+    {
+        char name[64];
+        _snprintf(name, 64, "@benchmark/script%u.lua", i + 1);
+        g_scriptNames[i] = name;
+    }
+
+    if (!DebugBackend::Get().Initialize(g_hInstance))
+    {
+        fprintf(stderr, "Couldn't initialize the debugger backend\n");
+        return 1;
+    }
+
+    static const unsigned int   breakpoints[]   = { 0, 10, 1000 };
+    static const unsigned int   vms[]           = { 1, 2, 4, 8, 16 };
+
+    printf("%11s %4s %10s %10s %12s %10s\n", "Breakpoints", "VMs", "Events", "Hook calls", "Mode changes", "ns/event");
+
+    for (unsigned int b = 0; b < sizeof(breakpoints) / sizeof(breakpoints[0]); ++b)
+    {
+        for (unsigned int v = 0; v < sizeof(vms) / sizeof(vms[0]); ++v)
+        {
+            Run(breakpoints[b], vms[v]);
+        }
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,538 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc.
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Stand-in for LuaDll.cpp which lets the backend run without a Lua library
+// having been loaded into the process. The stand-in states behave like Lua 5.1.
+
+#include "LuaDllStub.h"
+
+#include <string.h>
+
+static const int s_registryIndex    = -10000;
+static const int s_globalsIndex     = -10002;
+
+static int  g_hookCount             = 0;
+static bool g_enableIntercepts      = true;
+
+int GetHookMask(HookMode mode)
+{
+    switch (mode)
+    {
+    case HookMode_CallsOnly:
+        return LUA_MASKCALL;
+    case HookMode_CallsAndReturns:
+        return LUA_MASKCALL | LUA_MASKRET;
+    case HookMode_Full:
+        return LUA_MASKCALL | LUA_MASKRET | LUA_MASKLINE;
+    }
+    return 0;
+}
+
+void InitializeHookEvent(lua_State* L, int event, lua_Debug* ar)
+{
+    memset(ar, 0, sizeof(lua_Debug));
+    ar->ld51.event  = event;
+    ar->ld51.i_ci   = static_cast<int>(L->frames.size()) - 1;
+}
+
+bool InstallLuaHooker(HINSTANCE hInstance, const char* symbolsDirectory)
+{
+    return true;
+}
+
+bool GetIsLuaLoaded()
+{
+    return true;
+}
+
+void RegisterDebugLibrary(unsigned long api, lua_State* L)
+{
+}
+
+int GetRegistryIndex(unsigned long api)
+{
+    return s_registryIndex;
+}
+
+void EnableIntercepts(bool enableIntercepts)
+{
+    g_enableIntercepts = enableIntercepts;
+}
+
+bool GetAreInterceptsEnabled()
+{
+    return g_enableIntercepts;
+}
+
+bool GetIsStdCall(unsigned long api)
+{
+    return false;
+}
+
+void SetHookMode(unsigned long api, lua_State* L, HookMode mode)
+{
+
+    int mask = GetHookMask(mode);
+
+    if (g_hookCount > 0)
+    {
+        mask |= LUA_MASKCOUNT;
+    }
+
+    if (mask != L->hookMask)
+    {
+        ++L->numHookChanges;
+    }
+
+    L->hookMask  = mask;
+    L->hookCount = g_hookCount;
+
+}
+
+HookMode GetHookMode(unsigned long api, lua_State* L)
+{
+
+    int mask = L->hookMask & ~LUA_MASKCOUNT;
+
+    if (mask == 0)
+    {
+        return HookMode_None;
+    }
+    else if (mask == LUA_MASKCALL)
+    {
+        return HookMode_CallsOnly;
+    }
+    else if (mask == (LUA_MASKCALL | LUA_MASKRET))
+    {
+        return HookMode_CallsAndReturns;
+    }
+
+    return HookMode_Full;
+
+}
+
+void SetHookCount(int count)
+{
+    g_hookCount = count;
+}
+
+int GetHookCount()
+{
+    return g_hookCount;
+}
+
+void SetCountHook(unsigned long api, lua_State* L, int count)
+{
+    if (L->hookMask != LUA_MASKCOUNT)
+    {
+        ++L->numHookChanges;
+    }
+    L->hookMask  = LUA_MASKCOUNT;
+    L->hookCount = count;
+}
+
+bool GetIsHookEventRet(unsigned long api, int event)
+{
+    return event == LUA_HOOKRET || event == LUA_HOOKTAILRET;
+}
+
+bool GetIsHookEventCall(unsigned long api, int event)
+{
+    return event == LUA_HOOKCALL;
+}
+
+int GetEvent(unsigned long api, const lua_Debug* ar)
+{
+    return ar->ld51.event;
+}
+
+int GetCurrentLine(unsigned long api, const lua_Debug* ar)
+{
+    return ar->ld51.currentline;
+}
+
+int GetLineDefined(unsigned long api, const lua_Debug* ar)
+{
+    return ar->ld51.linedefined;
+}
+
+int GetLastLineDefined(unsigned long api, const lua_Debug* ar)
+{
+    return ar->ld51.lastlinedefined;
+}
+
+const char* GetSource(unsigned long api, const lua_Debug* ar)
+{
+    return ar->ld51.source;
+}
+
+const char* GetWhat(unsigned long api, const lua_Debug* ar)
+{
+    return ar->ld51.what;
+}
+
+const char* GetName(unsigned long api, const lua_Debug* ar)
+{
+    return ar->ld51.name;
+}
+
+const char* GetHookEventName(unsigned long api, const lua_Debug* ar)
+{
+    switch (ar->ld51.event)
+    {
+    case LUA_HOOKCALL:
+        return "LUA_HOOKCALL";
+    case LUA_HOOKRET:
+        return "LUA_HOOKRET";
+    case LUA_HOOKLINE:
+        return "LUA_HOOKLINE";
+    case LUA_HOOKTAILRET:
+        return "LUA_HOOKTAILRET";
+    }
+    return "Unknown";
+}
+
+lua_CFunction CreateCFunction(unsigned long api, lua_CFunction_dll function)
+{
+    return NULL;
+}
+
+int lua_getstack_dll(unsigned long api, lua_State* L, int level, lua_Debug* ar)
+{
+
+    // Lua 5.1 finds a level by walking down from the top of the stack, so the
+    // cost of getting a level grows with it. Do the same so the hook has the
+    // same costs it has with a real state.
+
+    int ci = static_cast<int>(L->frames.size()) - 1;
+
+    for (; level > 0 && ci > 0; --ci)
+    {
+        level -= 1 + L->frames[ci].tailCalls;
+    }
+
+    if (level != 0 || ci < 0)
+    {
+        return 0;
+    }
+
+    ar->ld51.i_ci = ci;
+    return 1;
+
+}
+
+int lua_getinfo_dll(unsigned long api, lua_State* L, const char* what, lua_Debug* ar)
+{
+
+    const StubFrame& frame = L->frames[ar->ld51.i_ci];
+
+    ar->ld51.source             = frame.source;
+    ar->ld51.linedefined        = frame.lineDefined;
+    ar->ld51.lastlinedefined    = frame.lastLineDefined;
+    ar->ld51.currentline        = frame.currentLine;
+    ar->ld51.what               = frame.lineDefined == 0 ? "main" : "Lua";
+    ar->ld51.name               = NULL;
+    ar->ld51.namewhat           = "";
+
+    return 1;
+
+}
+
+const char* lua_getlocal_dll(unsigned long api, lua_State* L, const lua_Debug* ar, int n)
+{
+    return NULL;
+}
+
+const char* lua_setlocal_dll(unsigned long api, lua_State* L, const lua_Debug* ar, int n)
+{
+    return NULL;
+}
+
+const char* lua_getupvalue_dll(unsigned long api, lua_State* L, int funcindex, int n)
+{
+    return NULL;
+}
+
+const char* lua_setupvalue_dll(unsigned long api, lua_State* L, int funcindex, int n)
+{
+    return NULL;
+}
+
+int lua_upvalueindex_dll(unsigned long api, int i)
+{
+    return s_globalsIndex - i;
+}
+
+int lua_checkstack_dll(unsigned long api, lua_State* L, int extra)
+{
+    return 1;
+}
+
+int lua_gettop_dll(unsigned long api, lua_State* L)
+{
+    return L->top;
+}
+
+void lua_settop_dll(unsigned long api, lua_State* L, int index)
+{
+    if (index >= 0)
+    {
+        L->top = index;
+    }
+    else
+    {
+        L->top += index + 1;
+    }
+}
+
+int lua_absindex_dll(unsigned long api, lua_State* L, int index)
+{
+    if (index > 0 || index <= s_registryIndex)
+    {
+        return index;
+    }
+    return L->top + index + 1;
+}
+
+void lua_remove_dll(unsigned long api, lua_State* L, int index)
+{
+    --L->top;
+}
+
+void lua_insert_dll(unsigned long api, lua_State* L, int index)
+{
+}
+
+void lua_pushnil_dll(unsigned long api, lua_State* L)
+{
+    ++L->top;
+}
+
+void lua_pushvalue_dll(unsigned long api, lua_State* L, int index)
+{
+    ++L->top;
+}
+
+void lua_pushstring_dll(unsigned long api, lua_State* L, const char* s)
+{
+    ++L->top;
+}
+
+void lua_pushlstring_dll(unsigned long api, lua_State* L, const char* s, size_t length)
+{
+    ++L->top;
+}
+
+void lua_pushinteger_dll(unsigned long api, lua_State* L, int value)
+{
+    ++L->top;
+}
+
+void lua_pushlightuserdata_dll(unsigned long api, lua_State* L, void* p)
+{
+    ++L->top;
+}
+
+void lua_pushcclosure_dll(unsigned long api, lua_State* L, lua_CFunction f, int n)
+{
+    L->top += 1 - n;
+}
+
+void lua_pushglobaltable_dll(unsigned long api, lua_State* L)
+{
+    ++L->top;
+}
+
+bool lua_pushthread_dll(unsigned long api, lua_State* L)
+{
+    // There are no thread values, so the backend doesn't try to find out when
+    // the state is collected.
+    return false;
+}
+
+void lua_newtable_dll(unsigned long api, lua_State* L)
+{
+    ++L->top;
+}
+
+void* lua_newuserdata_dll(unsigned long api, lua_State* L, size_t size)
+{
+    ++L->top;
+    return NULL;
+}
+
+void lua_rawgetglobal_dll(unsigned long api, lua_State* L, const char* s)
+{
+    ++L->top;
+}
+
+void lua_gettable_dll(unsigned long api, lua_State* L, int index)
+{
+}
+
+void lua_rawget_dll(unsigned long api, lua_State* L, int index)
+{
+}
+
+void lua_rawgeti_dll(unsigned long api, lua_State* L, int index, int n)
+{
+    ++L->top;
+}
+
+void lua_settable_dll(unsigned long api, lua_State* L, int index)
+{
+    L->top -= 2;
+}
+
+void lua_rawset_dll(unsigned long api, lua_State* L, int index)
+{
+    L->top -= 2;
+}
+
+int lua_next_dll(unsigned long api, lua_State* L, int index)
+{
+    --L->top;
+    return 0;
+}
+
+void lua_getfenv_dll(unsigned long api, lua_State* L, int index)
+{
+    ++L->top;
+}
+
+int lua_setfenv_dll(unsigned long api, lua_State* L, int index)
+{
+    --L->top;
+    return 0;
+}
+
+int lua_getmetatable_dll(unsigned long api, lua_State* L, int index)
+{
+    return 0;
+}
+
+int lua_setmetatable_dll(unsigned long api, lua_State* L, int index)
+{
+    --L->top;
+    return 1;
+}
+
+int lua_type_dll(unsigned long api, lua_State* L, int index)
+{
+    return LUA_TNIL;
+}
+
+const char* lua_typename_dll(unsigned long api, lua_State* L, int type)
+{
+    return "nil";
+}
+
+const char* lua_tostring_dll(unsigned long api, lua_State* L, int index)
+{
+    return NULL;
+}
+
+const char* lua_tolstring_dll(unsigned long api, lua_State* L, int index, size_t* length)
+{
+    if (length != NULL)
+    {
+        *length = 0;
+    }
+    return NULL;
+}
+
+const lua_WChar* lua_towstring_dll(unsigned long api, lua_State* L, int index)
+{
+    return NULL;
+}
+
+int lua_toboolean_dll(unsigned long api, lua_State* L, int index)
+{
+    return 0;
+}
+
+int lua_tointeger_dll(unsigned long api, lua_State* L, int index)
+{
+    return 0;
+}
+
+lua_Number lua_tonumber_dll(unsigned long api, lua_State* L, int index)
+{
+    return 0;
+}
+
+void* lua_touserdata_dll(unsigned long api, lua_State* L, int index)
+{
+    return NULL;
+}
+
+lua_CFunction lua_tocfunction_dll(unsigned long api, lua_State* L, int index)
+{
+    return NULL;
+}
+
+const void* lua_topointer_dll(unsigned long api, lua_State* L, int index)
+{
+    return NULL;
+}
+
+int lua_rawequal_dll(unsigned long api, lua_State* L, int index1, int index2)
+{
+    return 0;
+}
+
+int luaL_ref_dll(unsigned long api, lua_State* L, int t)
+{
+    --L->top;
+    return LUA_REFNIL;
+}
+
+void luaL_unref_dll(unsigned long api, lua_State* L, int t, int ref)
+{
+}
+
+int lua_loadbuffer_dll(unsigned long api, lua_State* L, const char* buffer, size_t size, const char* name, const char* mode)
+{
+    ++L->top;
+    return 0;
+}
+
+void lua_call_dll(unsigned long api, lua_State* L, int nargs, int nresults)
+{
+    L->top -= nargs + 1;
+    if (nresults != LUA_MULTRET)
+    {
+        L->top += nresults;
+    }
+}
+
+int lua_pcall_dll(unsigned long api, lua_State* L, int nargs, int nresults, int errfunc)
+{
+    lua_call_dll(api, L, nargs, nresults);
+    return 0;
+}
+
+int lua_error_dll(unsigned long api, lua_State* L)
+{
+    --L->top;
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc.
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef LUA_DLL_STUB_H
+#define LUA_DLL_STUB_H
+
+#include "LuaDll.h"
+
+#include <vector>
+
+/**
+ * Function activation in a stand-in Lua state.
+ */
+struct StubFrame
+{
+    const char*     source;
+    int             lineDefined;
+    int             lastLineDefined;
+    int             currentLine;
+    int             tailCalls;      // Tail calls made from the frame, always 0.
+};
+
+/**
+ * Stand-in for a Lua state used by the hook benchmark in place of a real Lua
+ * library. Only the call stack and the hook are modelled; every value pushed
+ * onto the stack is nil, which is enough for the paths the hook takes when it
+ * doesn't stop.
+ */
+struct lua_State
+{
+    int                     top;        // Number of values on the stack.
+    int                     hookMask;
+    int                     hookCount;
+    unsigned int            numHookChanges; // Times the backend changed the mask.
+    std::vector<StubFrame>  frames;     // The last frame is at level 0.
+};
+
+/**
+ * Returns the hook mask Lua would be given for the specified hook mode.
+ */
+int GetHookMask(HookMode mode);
+
+/**
+ * Fills in a hook event for the function at the top of the call stack of the
+ * stand-in state, the way Lua does before calling the hook.
+ */
+void InitializeHookEvent(lua_State* L, int event, lua_Debug* ar);
+
+#endif
@@ -0,0 +1,55 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc.
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Stand-in for DebugHelp.cpp on platforms without the Debug Help library. The
+// functions are never loaded, so native stacks are always empty.
+
+#include "DebugHelp.h"
+
+SymEnumSymbols_t            SymEnumSymbols_dll              = NULL;
+SymInitialize_t             SymInitialize_dll               = NULL;
+SymCleanup_t                SymCleanup_dll                  = NULL;
+SymLoadModule64_t           SymLoadModule64_dll             = NULL;
+SymUnloadModule64_t         SymUnloadModule64_dll           = NULL;
+SymGetModuleInfo64_t        SymGetModuleInfo64_dll          = NULL;
+StackWalk64_t               StackWalk64_dll                 = NULL;
+SymFunctionTableAccess64_t  SymFunctionTableAccess64_dll    = NULL;
+SymGetSymFromAddr64_t       SymGetSymFromAddr64_dll         = NULL;
+SymGetModuleBase64_t        SymGetModuleBase64_dll          = NULL;
+
+RtlCaptureContext_t         RtlCaptureContext_dll           = NULL;
+RtlCaptureStackBackTrace_t  RtlCaptureStackBackTrace_dll    = NULL;
+
+bool LoadDebugHelp(HINSTANCE hInstance)
+{
+    return false;
+}
+
+unsigned int GetCStack(STACKFRAME64 stack[], unsigned int maxStackSize)
+{
+    return 0;
+}
+
+unsigned int GetCStack(HANDLE hThread, STACKFRAME64 stack[], unsigned int maxStackSize)
+{
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc.
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// The parts of TinyXML used by the backend, for platforms the prebuilt library
+// isn't available on. Documents can be built but are printed as empty
+// strings, since the benchmark never sends one to the frontend.
+
+#include "tinyxml.h"
+
+TiXmlNode::TiXmlNode(NodeType _type) : TiXmlBase()
+{
+    parent      = 0;
+    type        = _type;
+    firstChild  = 0;
+    lastChild   = 0;
+    prev        = 0;
+    next        = 0;
+}
+
+TiXmlNode::~TiXmlNode()
+{
+    TiXmlNode* node = firstChild;
+    while (node != 0)
+    {
+        TiXmlNode* temp = node;
+        node = node->next;
+        delete temp;
+    }
+}
+
+TiXmlNode* TiXmlNode::LinkEndChild(TiXmlNode* node)
+{
+
+    node->parent = this;
+    node->prev   = lastChild;
+    node->next   = 0;
+
+    if (lastChild != 0)
+    {
+        lastChild->next = node;
+    }
+    else
+    {
+        firstChild = node;
+    }
+
+    lastChild = node;
+    return node;
+
+}
+
+const char* TiXmlAttribute::Parse(const char* p, TiXmlParsingData* data, TiXmlEncoding)  { return 0; }
+void TiXmlAttribute::Print(FILE* cfile, int depth, TIXML_STRING* str) const             { }
+
+TiXmlAttributeSet::TiXmlAttributeSet()
+{
+    sentinel.next = &sentinel;
+    sentinel.prev = &sentinel;
+}
+
+TiXmlAttributeSet::~TiXmlAttributeSet()
+{
+}
+
+TiXmlElement::TiXmlElement(const char* _value) : TiXmlNode(TiXmlNode::TINYXML_ELEMENT)
+{
+    firstChild = lastChild = 0;
+    value = _value;
+}
+
+TiXmlElement::TiXmlElement(const std::string& _value) : TiXmlNode(TiXmlNode::TINYXML_ELEMENT)
+{
+    firstChild = lastChild = 0;
+    value = _value;
+}
+
+TiXmlElement::~TiXmlElement()
+{
+}
+
+TiXmlNode* TiXmlElement::Clone() const                                                  { return 0; }
+void TiXmlElement::Print(FILE* cfile, int depth) const                                  { }
+const char* TiXmlElement::Parse(const char* p, TiXmlParsingData* data, TiXmlEncoding)   { return 0; }
+bool TiXmlElement::Accept(TiXmlVisitor* visitor) const                                  { return true; }
+void TiXmlElement::StreamIn(std::istream* in, TIXML_STRING* tag)                        { }
+
+TiXmlNode* TiXmlText::Clone() const                                                     { return 0; }
+void TiXmlText::Print(FILE* cfile, int depth) const                                     { }
+const char* TiXmlText::Parse(const char* p, TiXmlParsingData* data, TiXmlEncoding)      { return 0; }
+bool TiXmlText::Accept(TiXmlVisitor* visitor) const                                     { return true; }
+void TiXmlText::StreamIn(std::istream* in, TIXML_STRING* tag)                           { }
+
+TiXmlDocument::TiXmlDocument() : TiXmlNode(TiXmlNode::TINYXML_DOCUMENT)
+{
+    tabsize         = 4;
+    useMicrosoftBOM = false;
+    error           = false;
+    errorId         = 0;
+}
+
+TiXmlNode* TiXmlDocument::Clone() const                                                 { return 0; }
+void TiXmlDocument::Print(FILE* cfile, int depth) const                                 { }
+const char* TiXmlDocument::Parse(const char* p, TiXmlParsingData* data, TiXmlEncoding)  { return 0; }
+bool TiXmlDocument::Accept(TiXmlVisitor* visitor) const                                 { return true; }
+void TiXmlDocument::StreamIn(std::istream* in, TIXML_STRING* tag)                       { }
+
+bool TiXmlPrinter::VisitEnter(const TiXmlDocument& doc)                                 { return true; }
+bool TiXmlPrinter::VisitExit(const TiXmlDocument& doc)                                  { return true; }
+bool TiXmlPrinter::VisitEnter(const TiXmlElement& element, const TiXmlAttribute*)       { return true; }
+bool TiXmlPrinter::VisitExit(const TiXmlElement& element)                               { return true; }
+bool TiXmlPrinter::Visit(const TiXmlDeclaration& declaration)                           { return true; }
+bool TiXmlPrinter::Visit(const TiXmlText& text)                                         { return true; }
+bool TiXmlPrinter::Visit(const TiXmlComment& comment)                                   { return true; }
+bool TiXmlPrinter::Visit(const TiXmlUnknown& unknown)                                   { return true; }
@@ -0,0 +1,723 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc.
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <windows.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+// Events and threads are both waitable objects. All of them share one lock
+// and condition variable, which keeps waiting on several objects simple. The
+// backend only waits when it's blocked on the frontend, so this is never
+// contended while the hook is running.
+
+enum ObjectType
+{
+    ObjectType_Waitable,
+    ObjectType_Pipe,
+};
+
+struct WaitableObject
+{
+    ObjectType type;
+    bool    signaled;
+    bool    manualReset;
+    int     refCount;       // Threads hold a reference until they exit.
+};
+
+static const HANDLE s_currentThread  = reinterpret_cast<HANDLE>(static_cast<intptr_t>(-2));
+static const HANDLE s_currentProcess = reinterpret_cast<HANDLE>(static_cast<intptr_t>(-1));
+
+// These are never destroyed, since threads can still be waiting on them while
+// the process exits.
+
+static std::mutex& GetWaitMutex()
+{
+    static std::mutex* mutex = new std::mutex;
+    return *mutex;
+}
+
+static std::condition_variable& GetWaitCondition()
+{
+    static std::condition_variable* condition = new std::condition_variable;
+    return *condition;
+}
+
+static bool GetIsObject(HANDLE handle)
+{
+    return handle != NULL && handle != INVALID_HANDLE_VALUE && handle != s_currentThread && handle != s_currentProcess;
+}
+
+static bool GetIsWaitable(HANDLE handle)
+{
+    return GetIsObject(handle) && *static_cast<ObjectType*>(handle) == ObjectType_Waitable;
+}
+
+static void Release(WaitableObject* object)
+{
+    if (--object->refCount == 0)
+    {
+        delete object;
+    }
+}
+
+HANDLE CreateEvent(void* attributes, BOOL manualReset, BOOL initialState, const char* name)
+{
+    WaitableObject* object = new WaitableObject;
+    object->type        = ObjectType_Waitable;
+    object->signaled    = initialState != FALSE;
+    object->manualReset = manualReset != FALSE;
+    object->refCount    = 1;
+    return object;
+}
+
+BOOL SetEvent(HANDLE hEvent)
+{
+
+    if (!GetIsWaitable(hEvent))
+    {
+        return FALSE;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(GetWaitMutex());
+        static_cast<WaitableObject*>(hEvent)->signaled = true;
+    }
+
+    GetWaitCondition().notify_all();
+    return TRUE;
+
+}
+
+BOOL ResetEvent(HANDLE hEvent)
+{
+
+    if (!GetIsWaitable(hEvent))
+    {
+        return FALSE;
+    }
+
+    std::lock_guard<std::mutex> lock(GetWaitMutex());
+    static_cast<WaitableObject*>(hEvent)->signaled = false;
+    return TRUE;
+
+}
+
+static void ClosePipe(HANDLE hPipe);
+
+BOOL CloseHandle(HANDLE hObject)
+{
+
+    if (!GetIsObject(hObject))
+    {
+        return hObject != NULL;
+    }
+
+    if (!GetIsWaitable(hObject))
+    {
+        ClosePipe(hObject);
+        return TRUE;
+    }
+
+    std::lock_guard<std::mutex> lock(GetWaitMutex());
+    Release(static_cast<WaitableObject*>(hObject));
+    return TRUE;
+
+}
+
+DWORD WaitForMultipleObjects(DWORD count, const HANDLE* handles, BOOL waitAll, DWORD milliseconds)
+{
+
+    for (DWORD i = 0; i < count; ++i)
+    {
+        if (!GetIsWaitable(handles[i]))
+        {
+            return WAIT_FAILED;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(GetWaitMutex());
+
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+
+    while (true)
+    {
+
+        DWORD numSignaled = 0;
+        DWORD first = count;
+
+        for (DWORD i = 0; i < count; ++i)
+        {
+            if (static_cast<WaitableObject*>(handles[i])->signaled)
+            {
+                ++numSignaled;
+                first = std::min(first, i);
+            }
+        }
+
+        if (waitAll ? numSignaled == count : numSignaled > 0)
+        {
+            for (DWORD i = 0; i < count; ++i)
+            {
+                WaitableObject* object = static_cast<WaitableObject*>(handles[i]);
+                if (!object->manualReset && (waitAll || i == first))
+                {
+                    object->signaled = false;
+                }
+            }
+            return WAIT_OBJECT_0 + (waitAll ? 0 : first);
+        }
+
+        if (milliseconds == INFINITE)
+        {
+            GetWaitCondition().wait(lock);
+        }
+        else if (GetWaitCondition().wait_until(lock, end) == std::cv_status::timeout)
+        {
+            return WAIT_TIMEOUT;
+        }
+
+    }
+
+}
+
+DWORD WaitForSingleObject(HANDLE hHandle, DWORD milliseconds)
+{
+    return WaitForMultipleObjects(1, &hHandle, FALSE, milliseconds);
+}
+
+HANDLE CreateThread(void* attributes, size_t stackSize, LPTHREAD_START_ROUTINE startAddress, LPVOID parameter, DWORD flags, DWORD* threadId)
+{
+
+    // Threads are signaled when they exit, and can't be reset.
+    WaitableObject* object = new WaitableObject;
+    object->type        = ObjectType_Waitable;
+    object->signaled    = false;
+    object->manualReset = true;
+    object->refCount    = 2;
+
+    std::thread thread([=]()
+        {
+            startAddress(parameter);
+            {
+                std::lock_guard<std::mutex> lock(GetWaitMutex());
+                object->signaled = true;
+                Release(object);
+            }
+            GetWaitCondition().notify_all();
+        });
+
+    thread.detach();
+
+    if (threadId != NULL)
+    {
+        *threadId = 0;
+    }
+
+    return object;
+
+}
+
+HANDLE GetCurrentThread()
+{
+    return s_currentThread;
+}
+
+HANDLE GetCurrentProcess()
+{
+    return s_currentProcess;
+}
+
+DWORD GetCurrentProcessId()
+{
+    return static_cast<DWORD>(getpid());
+}
+
+void Sleep(DWORD milliseconds)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+}
+
+DWORD GetTickCount()
+{
+    return static_cast<DWORD>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+DWORD TlsAlloc()
+{
+    pthread_key_t key;
+    if (pthread_key_create(&key, NULL) != 0)
+    {
+        return TLS_OUT_OF_INDEXES;
+    }
+    return static_cast<DWORD>(key);
+}
+
+BOOL TlsFree(DWORD index)
+{
+    return pthread_key_delete(static_cast<pthread_key_t>(index)) == 0;
+}
+
+LPVOID TlsGetValue(DWORD index)
+{
+    return pthread_getspecific(static_cast<pthread_key_t>(index));
+}
+
+BOOL TlsSetValue(DWORD index, LPVOID value)
+{
+    return pthread_setspecific(static_cast<pthread_key_t>(index), value) == 0;
+}
+
+LONG InterlockedIncrement(volatile LONG* addend)
+{
+    return __sync_add_and_fetch(addend, 1);
+}
+
+LONG InterlockedDecrement(volatile LONG* addend)
+{
+    return __sync_sub_and_fetch(addend, 1);
+}
+
+LONG InterlockedExchange(volatile LONG* target, LONG value)
+{
+    return __sync_lock_test_and_set(target, value);
+}
+
+PVOID InterlockedExchangePointer(PVOID volatile* target, PVOID value)
+{
+    return __sync_lock_test_and_set(target, value);
+}
+
+void InitializeCriticalSection(CRITICAL_SECTION* criticalSection)
+{
+    // Critical sections can be entered again by the thread that owns them.
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&criticalSection->mutex, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+}
+
+void DeleteCriticalSection(CRITICAL_SECTION* criticalSection)
+{
+    pthread_mutex_destroy(&criticalSection->mutex);
+}
+
+void EnterCriticalSection(CRITICAL_SECTION* criticalSection)
+{
+    pthread_mutex_lock(&criticalSection->mutex);
+}
+
+void LeaveCriticalSection(CRITICAL_SECTION* criticalSection)
+{
+    pthread_mutex_unlock(&criticalSection->mutex);
+}
+
+BOOL TryEnterCriticalSection(CRITICAL_SECTION* criticalSection)
+{
+    return pthread_mutex_trylock(&criticalSection->mutex) == 0;
+}
+
+// Named pipes are Unix domain stream sockets in the abstract namespace. Each
+// message is sent with its length in front, so reads can return part of a
+// message with ERROR_MORE_DATA the way message mode pipes do. Operations
+// always complete before returning instead of being left pending, and the
+// event in the OVERLAPPED structure isn't signaled.
+
+struct PipeObject
+{
+    ObjectType      type;
+    int             listenSocket;   // Socket the creator accepts the connection on, or -1.
+    int             socket;         // Connected socket, or -1.
+    DWORD           readRemaining;  // Bytes left in the message that's being read.
+    std::mutex      writeMutex;
+};
+
+static thread_local DWORD s_lastError = ERROR_SUCCESS;
+
+DWORD GetLastError()
+{
+    return s_lastError;
+}
+
+static bool GetPipeAddress(const char* name, sockaddr_un& address, socklen_t& length)
+{
+
+    size_t nameLength = strlen(name);
+
+    if (nameLength + 1 > sizeof(address.sun_path))
+    {
+        return false;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path + 1, name, nameLength);
+
+    length = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + nameLength);
+    return true;
+
+}
+
+static PipeObject* CreatePipeObject(int listenSocket, int socket)
+{
+    PipeObject* pipe = new PipeObject;
+    pipe->type          = ObjectType_Pipe;
+    pipe->listenSocket  = listenSocket;
+    pipe->socket        = socket;
+    pipe->readRemaining = 0;
+    return pipe;
+}
+
+static BOOL CompleteOperation(OVERLAPPED* overlapped, DWORD* numBytesTransferred, DWORD error, DWORD numBytes)
+{
+
+    if (overlapped != NULL)
+    {
+        overlapped->Internal     = error;
+        overlapped->InternalHigh = numBytes;
+    }
+
+    if (numBytesTransferred != NULL)
+    {
+        *numBytesTransferred = numBytes;
+    }
+
+    s_lastError = error;
+    return error == ERROR_SUCCESS;
+
+}
+
+static bool ReceiveAll(int socket, void* buffer, size_t length)
+{
+
+    char* data = static_cast<char*>(buffer);
+
+    while (length > 0)
+    {
+        ssize_t result = recv(socket, data, length, 0);
+        if (result <= 0)
+        {
+            return false;
+        }
+        data   += result;
+        length -= result;
+    }
+
+    return true;
+
+}
+
+static void ClosePipe(HANDLE hPipe)
+{
+
+    PipeObject* pipe = static_cast<PipeObject*>(hPipe);
+
+    if (pipe->socket != -1)
+    {
+        close(pipe->socket);
+    }
+
+    if (pipe->listenSocket != -1)
+    {
+        close(pipe->listenSocket);
+    }
+
+    delete pipe;
+
+}
+
+HANDLE CreateNamedPipe(const char* name, DWORD openMode, DWORD pipeMode, DWORD maxInstances,
+    DWORD outBufferSize, DWORD inBufferSize, DWORD defaultTimeOut, void* attributes)
+{
+
+    sockaddr_un address;
+    socklen_t length;
+
+    if (!GetPipeAddress(name, address, length))
+    {
+        return INVALID_HANDLE_VALUE;
+    }
+
+    int listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (listenSocket == -1)
+    {
+        return INVALID_HANDLE_VALUE;
+    }
+
+    if (bind(listenSocket, reinterpret_cast<sockaddr*>(&address), length) != 0 || listen(listenSocket, 1) != 0)
+    {
+        close(listenSocket);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    return CreatePipeObject(listenSocket, -1);
+
+}
+
+HANDLE CreateFile(const char* fileName, DWORD desiredAccess, DWORD shareMode, void* attributes,
+    DWORD creationDisposition, DWORD flags, HANDLE templateFile)
+{
+
+    sockaddr_un address;
+    socklen_t length;
+
+    if (!GetPipeAddress(fileName, address, length))
+    {
+        return INVALID_HANDLE_VALUE;
+    }
+
+    int connectSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (connectSocket == -1)
+    {
+        return INVALID_HANDLE_VALUE;
+    }
+
+    if (connect(connectSocket, reinterpret_cast<sockaddr*>(&address), length) != 0)
+    {
+        close(connectSocket);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    return CreatePipeObject(-1, connectSocket);
+
+}
+
+BOOL SetNamedPipeHandleState(HANDLE hPipe, DWORD* mode, DWORD* maxCollectionCount, DWORD* collectDataTimeout)
+{
+    // Pipes are always in message mode.
+    return TRUE;
+}
+
+BOOL ConnectNamedPipe(HANDLE hPipe, OVERLAPPED* overlapped)
+{
+
+    PipeObject* pipe = static_cast<PipeObject*>(hPipe);
+
+    if (pipe->listenSocket == -1 || pipe->socket != -1)
+    {
+        return FALSE;
+    }
+
+    pipe->socket = accept(pipe->listenSocket, NULL, NULL);
+    return pipe->socket != -1;
+
+}
+
+BOOL DisconnectNamedPipe(HANDLE hPipe)
+{
+
+    PipeObject* pipe = static_cast<PipeObject*>(hPipe);
+
+    if (pipe->socket == -1)
+    {
+        return FALSE;
+    }
+
+    shutdown(pipe->socket, SHUT_RDWR);
+    return TRUE;
+
+}
+
+BOOL FlushFileBuffers(HANDLE hFile)
+{
+    // Sends complete before WriteFile returns, so there's nothing to flush.
+    return TRUE;
+}
+
+BOOL ReadFile(HANDLE hFile, void* buffer, DWORD numBytesToRead, DWORD* numBytesRead, OVERLAPPED* overlapped)
+{
+
+    PipeObject* pipe = static_cast<PipeObject*>(hFile);
+
+    if (pipe->readRemaining == 0)
+    {
+        uint32_t length;
+        if (!ReceiveAll(pipe->socket, &length, sizeof(length)))
+        {
+            return CompleteOperation(overlapped, numBytesRead, ERROR_BROKEN_PIPE, 0);
+        }
+        pipe->readRemaining = length;
+    }
+
+    DWORD numBytes = std::min(numBytesToRead, pipe->readRemaining);
+
+    if (!ReceiveAll(pipe->socket, buffer, numBytes))
+    {
+        return CompleteOperation(overlapped, numBytesRead, ERROR_BROKEN_PIPE, 0);
+    }
+
+    pipe->readRemaining -= numBytes;
+
+    DWORD error = (pipe->readRemaining > 0) ? ERROR_MORE_DATA : ERROR_SUCCESS;
+    return CompleteOperation(overlapped, numBytesRead, error, numBytes);
+
+}
+
+BOOL WriteFile(HANDLE hFile, const void* buffer, DWORD numBytesToWrite, DWORD* numBytesWritten, OVERLAPPED* overlapped)
+{
+
+    PipeObject* pipe = static_cast<PipeObject*>(hFile);
+
+    uint32_t length = numBytesToWrite;
+
+    // The length and the message are sent with one call, like a single write
+    // to a message mode pipe.
+
+    iovec parts[2];
+    parts[0].iov_base = &length;
+    parts[0].iov_len  = sizeof(length);
+    parts[1].iov_base = const_cast<void*>(buffer);
+    parts[1].iov_len  = numBytesToWrite;
+
+    msghdr message = { 0 };
+    message.msg_iov     = parts;
+    message.msg_iovlen  = 2;
+
+    size_t remaining = sizeof(length) + numBytesToWrite;
+
+    std::lock_guard<std::mutex> lock(pipe->writeMutex);
+
+    while (remaining > 0)
+    {
+
+        ssize_t result = sendmsg(pipe->socket, &message, MSG_NOSIGNAL);
+
+        if (result <= 0)
+        {
+            return CompleteOperation(overlapped, numBytesWritten, ERROR_BROKEN_PIPE, 0);
+        }
+
+        remaining -= result;
+
+        // Skip over the parts that were sent.
+        while (message.msg_iovlen > 0 && static_cast<size_t>(result) >= message.msg_iov->iov_len)
+        {
+            result -= message.msg_iov->iov_len;
+            ++message.msg_iov;
+            --message.msg_iovlen;
+        }
+
+        if (message.msg_iovlen > 0)
+        {
+            message.msg_iov->iov_base = static_cast<char*>(message.msg_iov->iov_base) + result;
+            message.msg_iov->iov_len -= result;
+        }
+
+    }
+
+    return CompleteOperation(overlapped, numBytesWritten, ERROR_SUCCESS, numBytesToWrite);
+
+}
+
+BOOL GetOverlappedResult(HANDLE hFile, OVERLAPPED* overlapped, DWORD* numBytesTransferred, BOOL wait)
+{
+    *numBytesTransferred = static_cast<DWORD>(overlapped->InternalHigh);
+    s_lastError = static_cast<DWORD>(overlapped->Internal);
+    return s_lastError == ERROR_SUCCESS;
+}
+
+DWORD GetModuleFileName(HMODULE hModule, char* fileName, DWORD size)
+{
+
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    ssize_t length = readlink("/proc/self/exe", fileName, size - 1);
+
+    if (length < 0)
+    {
+        return 0;
+    }
+
+    fileName[length] = 0;
+    return static_cast<DWORD>(length);
+
+}
+
+HMODULE GetModuleHandle(const char* moduleName)
+{
+    return NULL;
+}
+
+int WideCharToMultiByte(unsigned int codePage, DWORD flags, const wchar_t* wideString, int wideLength,
+    char* string, int length, const char* defaultChar, BOOL* usedDefaultChar)
+{
+
+    // Only characters in the basic multilingual plane are converted, which is
+    // all the UTF-16 strings from LuaPlus can hold without surrogates.
+
+    std::string result;
+
+    for (int i = 0; wideLength < 0 ? wideString[i] != 0 : i < wideLength; ++i)
+    {
+        unsigned int c = static_cast<unsigned int>(wideString[i]) & 0xFFFF;
+        if (c < 0x80)
+        {
+            result += static_cast<char>(c);
+        }
+        else if (c < 0x800)
+        {
+            result += static_cast<char>(0xC0 | (c >> 6));
+            result += static_cast<char>(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            result += static_cast<char>(0xE0 | (c >> 12));
+            result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            result += static_cast<char>(0x80 | (c & 0x3F));
+        }
+    }
+
+    if (wideLength < 0)
+    {
+        // The terminator is included in the length when the input length isn't
+        // given.
+        result += '\0';
+    }
+
+    if (length == 0)
+    {
+        return static_cast<int>(result.length());
+    }
+
+    if (static_cast<int>(result.length()) > length)
+    {
+        return 0;
+    }
+
+    memcpy(string, result.data(), result.length());
+    return static_cast<int>(result.length());
+
+}
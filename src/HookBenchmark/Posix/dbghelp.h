@@ -0,0 +1,70 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc.
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Types from the Debug Help library used in the declarations of DebugHelp.h.
+// The library itself isn't available, so the benchmark never walks C stacks.
+
+#ifndef POSIX_DBGHELP_H
+#define POSIX_DBGHELP_H
+
+#include <windows.h>
+
+#define __in
+#define __in_opt
+#define __out
+#define __out_opt
+#define __inout
+
+typedef struct
+{
+    DWORD64         Offset;
+} ADDRESS64;
+
+typedef struct
+{
+    ADDRESS64       AddrPC;
+    ADDRESS64       AddrFrame;
+    ADDRESS64       AddrStack;
+} STACKFRAME64, *LPSTACKFRAME64;
+
+typedef struct
+{
+    DWORD           SizeOfStruct;
+    DWORD64         BaseOfImage;
+    char            ModuleName[32];
+} IMAGEHLP_MODULE64, *PIMAGEHLP_MODULE64;
+
+typedef struct
+{
+    DWORD           SizeOfStruct;
+    DWORD64         Address;
+    DWORD           MaxNameLength;
+    char            Name[1];
+} IMAGEHLP_SYMBOL64, *PIMAGEHLP_SYMBOL64;
+
+typedef void*   PSYM_ENUMERATESYMBOLS_CALLBACK;
+typedef void*   PREAD_PROCESS_MEMORY_ROUTINE64;
+typedef void*   PFUNCTION_TABLE_ACCESS_ROUTINE64;
+typedef void*   PGET_MODULE_BASE_ROUTINE64;
+typedef void*   PTRANSLATE_ADDRESS_ROUTINE64;
+
+#endif
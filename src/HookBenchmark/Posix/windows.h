@@ -0,0 +1,181 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc.
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// The subset of the Win32 API used by the backend and the channel, implemented
+// on POSIX threads and sockets so that the benchmarks can be built on other
+// platforms. Only the calls the benchmarks can reach do real work.
+
+#ifndef POSIX_WINDOWS_H
+#define POSIX_WINDOWS_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <alloca.h>
+
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+typedef void*               HANDLE;
+typedef void*               HINSTANCE;
+typedef void*               HMODULE;
+typedef void*               LPVOID;
+typedef void*               PVOID;
+typedef void                VOID;
+typedef int                 BOOL;
+typedef unsigned char       BYTE;
+typedef unsigned short      USHORT;
+typedef uint32_t            DWORD;
+typedef int32_t             LONG;
+typedef uint32_t            ULONG;
+typedef uint64_t            DWORD64;
+typedef uint64_t            ULONG64;
+typedef int64_t             LONGLONG;
+typedef uint64_t            ULONGLONG;
+typedef uintptr_t           ULONG_PTR;
+typedef DWORD64*            PDWORD64;
+typedef ULONG*              PULONG;
+typedef BYTE*               PBYTE;
+typedef const char*         LPCSTR;
+typedef const char*         PCSTR;
+typedef char*               LPSTR;
+typedef char*               PSTR;
+typedef const wchar_t*      LPCWSTR;
+
+typedef union
+{
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef struct
+{
+    ULONG_PTR   Internal;       // Error code of the operation.
+    ULONG_PTR   InternalHigh;   // Number of bytes transferred.
+    DWORD       Offset;
+    DWORD       OffsetHigh;
+    HANDLE      hEvent;
+} OVERLAPPED;
+
+typedef struct
+{
+    int unused;
+} CONTEXT, *PCONTEXT;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+} CRITICAL_SECTION;
+
+typedef DWORD (*LPTHREAD_START_ROUTINE)(LPVOID);
+
+#define WINAPI
+#define __stdcall
+#define __cdecl
+
+#define TRUE                    1
+#define FALSE                   0
+#define INFINITE                0xFFFFFFFF
+#define WAIT_OBJECT_0           0
+#define WAIT_TIMEOUT            258
+#define WAIT_FAILED             0xFFFFFFFF
+#define TLS_OUT_OF_INDEXES      0xFFFFFFFF
+#define INVALID_HANDLE_VALUE    ((HANDLE)(intptr_t)-1)
+#define MAX_PATH                260
+#define _MAX_PATH               260
+#define CP_UTF8                 65001
+
+#define GENERIC_READ            0x80000000
+#define GENERIC_WRITE           0x40000000
+#define OPEN_EXISTING           3
+#define FILE_FLAG_OVERLAPPED    0x40000000
+#define PIPE_ACCESS_DUPLEX      0x00000003
+#define PIPE_TYPE_MESSAGE       0x00000004
+#define PIPE_READMODE_MESSAGE   0x00000002
+
+#define ERROR_SUCCESS           0
+#define ERROR_BROKEN_PIPE       109
+#define ERROR_MORE_DATA         234
+#define ERROR_IO_PENDING        997
+
+#define _snprintf               snprintf
+#define _vsnprintf              vsnprintf
+#define stricmp                 strcasecmp
+#define _stricmp                strcasecmp
+#define strnicmp                strncasecmp
+#define _strnicmp               strncasecmp
+
+HANDLE  CreateEvent(void* attributes, BOOL manualReset, BOOL initialState, const char* name);
+BOOL    SetEvent(HANDLE hEvent);
+BOOL    ResetEvent(HANDLE hEvent);
+BOOL    CloseHandle(HANDLE hObject);
+DWORD   WaitForSingleObject(HANDLE hHandle, DWORD milliseconds);
+DWORD   WaitForMultipleObjects(DWORD count, const HANDLE* handles, BOOL waitAll, DWORD milliseconds);
+
+HANDLE  CreateThread(void* attributes, size_t stackSize, LPTHREAD_START_ROUTINE startAddress, LPVOID parameter, DWORD flags, DWORD* threadId);
+HANDLE  GetCurrentThread();
+HANDLE  GetCurrentProcess();
+DWORD   GetCurrentProcessId();
+void    Sleep(DWORD milliseconds);
+DWORD   GetTickCount();
+
+DWORD   TlsAlloc();
+BOOL    TlsFree(DWORD index);
+LPVOID  TlsGetValue(DWORD index);
+BOOL    TlsSetValue(DWORD index, LPVOID value);
+
+LONG    InterlockedIncrement(volatile LONG* addend);
+LONG    InterlockedDecrement(volatile LONG* addend);
+LONG    InterlockedExchange(volatile LONG* target, LONG value);
+PVOID   InterlockedExchangePointer(PVOID volatile* target, PVOID value);
+
+void    InitializeCriticalSection(CRITICAL_SECTION* criticalSection);
+void    DeleteCriticalSection(CRITICAL_SECTION* criticalSection);
+void    EnterCriticalSection(CRITICAL_SECTION* criticalSection);
+void    LeaveCriticalSection(CRITICAL_SECTION* criticalSection);
+BOOL    TryEnterCriticalSection(CRITICAL_SECTION* criticalSection);
+
+DWORD   GetLastError();
+
+HANDLE  CreateNamedPipe(const char* name, DWORD openMode, DWORD pipeMode, DWORD maxInstances,
+            DWORD outBufferSize, DWORD inBufferSize, DWORD defaultTimeOut, void* attributes);
+HANDLE  CreateFile(const char* fileName, DWORD desiredAccess, DWORD shareMode, void* attributes,
+            DWORD creationDisposition, DWORD flags, HANDLE templateFile);
+BOOL    SetNamedPipeHandleState(HANDLE hPipe, DWORD* mode, DWORD* maxCollectionCount, DWORD* collectDataTimeout);
+BOOL    ConnectNamedPipe(HANDLE hPipe, OVERLAPPED* overlapped);
+BOOL    DisconnectNamedPipe(HANDLE hPipe);
+BOOL    FlushFileBuffers(HANDLE hFile);
+BOOL    ReadFile(HANDLE hFile, void* buffer, DWORD numBytesToRead, DWORD* numBytesRead, OVERLAPPED* overlapped);
+BOOL    WriteFile(HANDLE hFile, const void* buffer, DWORD numBytesToWrite, DWORD* numBytesWritten, OVERLAPPED* overlapped);
+BOOL    GetOverlappedResult(HANDLE hFile, OVERLAPPED* overlapped, DWORD* numBytesTransferred, BOOL wait);
+
+DWORD   GetModuleFileName(HMODULE hModule, char* fileName, DWORD size);
+HMODULE GetModuleHandle(const char* moduleName);
+int     WideCharToMultiByte(unsigned int codePage, DWORD flags, const wchar_t* wideString, int wideLength,
+            char* string, int length, const char* defaultChar, BOOL* usedDefaultChar);
+
+#endif
@@ -0,0 +1,116 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ChunkBuffer.h"
+
+#include <windows.h>
+#include <string.h>
+
+ChunkBuffer::ChunkBuffer()
+{
+    m_size = 0;
+}
+
+ChunkBuffer::~ChunkBuffer()
+{
+    for (unsigned int i = 0; i < m_segments.size(); ++i)
+    {
+        delete [] m_segments[i].data;
+    }
+}
+
+void ChunkBuffer::Append(const char* data, size_t size)
+{
+
+    m_size += size;
+
+    // Fill up the space left in the last segment first.
+
+    if (!m_segments.empty())
+    {
+
+        Segment& last = m_segments.back();
+        size_t copySize = min(size, last.capacity - last.size);
+
+        memcpy(last.data + last.size, data, copySize);
+        last.size += copySize;
+
+        data += copySize;
+        size -= copySize;
+
+    }
+
+    if (size > 0)
+    {
+
+        Segment segment;
+
+        segment.capacity    = max(size, s_segmentSize);
+        segment.data        = new char[segment.capacity];
+        segment.size        = size;
+
+        memcpy(segment.data, data, size);
+        m_segments.push_back(segment);
+
+    }
+
+}
+
+size_t ChunkBuffer::GetSize() const
+{
+    return m_size;
+}
+
+const char* ChunkBuffer::GetData()
+{
+
+    if (m_segments.empty())
+    {
+        return NULL;
+    }
+
+    if (m_segments.size() > 1)
+    {
+
+        // Combine all of the segments into one.
+
+        Segment combined;
+
+        combined.capacity   = m_size;
+        combined.data       = new char[combined.capacity];
+        combined.size       = 0;
+
+        for (unsigned int i = 0; i < m_segments.size(); ++i)
+        {
+            memcpy(combined.data + combined.size, m_segments[i].data, m_segments[i].size);
+            combined.size += m_segments[i].size;
+            delete [] m_segments[i].data;
+        }
+
+        m_segments.clear();
+        m_segments.push_back(combined);
+
+    }
+
+    return m_segments[0].data;
+
+}
@@ -0,0 +1,82 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef CHUNK_BUFFER_H
+#define CHUNK_BUFFER_H
+
+#include <vector>
+
+/**
+ * Buffer used to capture a chunk of code as it's read by a lua_Reader. The
+ * pieces are copied into fixed size segments so that appending never moves
+ * the data already captured, and a contiguous copy is only made when the
+ * data is requested.
+ */
+class ChunkBuffer
+{
+
+public:
+
+    /**
+     * Constructor.
+     */
+    ChunkBuffer();
+
+    /**
+     * Destructor.
+     */
+    ~ChunkBuffer();
+
+    /**
+     * Adds a copy of the data to the end of the buffer.
+     */
+    void Append(const char* data, size_t size);
+
+    /**
+     * Returns the total number of bytes in the buffer.
+     */
+    size_t GetSize() const;
+
+    /**
+     * Returns the contents of the buffer as one contiguous block, or NULL if
+     * the buffer is empty. If the data spans more than one segment they are
+     * combined into one. The pointer is valid until the buffer is modified.
+     */
+    const char* GetData();
+
+private:
+
+    static const size_t s_segmentSize = 64 * 1024;
+
+    struct Segment
+    {
+        char*       data;
+        size_t      size;
+        size_t      capacity;
+    };
+
+    std::vector<Segment>    m_segments;
+    size_t                  m_size;
+
+};
+
+#endif
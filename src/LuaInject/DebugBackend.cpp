@@ -26,13 +26,19 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 #include "CriticalSectionLock.h"
 #include "CriticalSectionTryLock.h"
 #include "StlUtility.h"
+#include "Hash.h"
 #include "XmlUtility.h"
 #include "DebugHelp.h"
 
 #include <assert.h>
 #include <algorithm>
+#include <map>
 #include <sstream>
 
+// When this is defined, the values of expressions are sent to the frontend as
+// XML instead of the binary encoding, which is easier to read when debugging.
+//#define XML_VALUES
+
 DebugBackend* DebugBackend::s_instance = NULL;
 
 extern HINSTANCE g_hInstance;
@@ -46,6 +52,33 @@ struct Memory
     size_t      size;
 };
 
+/**
+ * Records the breakpoint epoch in a VM while the hook is running in it, so
+ * the breakpoint sets the hook may be reading aren't freed.
+ */
+class HookEpochScope
+{
+
+public:
+
+    HookEpochScope(volatile LONG& hookEpoch, LONG epoch) : m_hookEpoch(hookEpoch)
+    {
+        // The exchange is a full barrier, so the epoch is visible to the
+        // command thread before any breakpoint sets are read.
+        InterlockedExchange(&m_hookEpoch, epoch);
+    }
+
+    ~HookEpochScope()
+    {
+        m_hookEpoch = 0;
+    }
+
+private:
+
+    volatile LONG&  m_hookEpoch;
+
+};
+
 /**
  * lua_Reader function used to read from a memory buffer.
  */
@@ -67,59 +100,248 @@ const char* MemoryReader(lua_State* L, void* data, size_t* size)
 
 }
 
+DebugBackend::Script::Script()
+{
+    index       = 0;
+    hash        = 0;
+    size        = 0;
+    memset(digest, 0, sizeof(digest));
+    source      = NULL;
+    excluded    = false;
+    breakpoints = new BreakpointSet;
+}
+
+DebugBackend::Script::~Script()
+{
+    delete breakpoints;
+    breakpoints = NULL;
+}
+
 bool DebugBackend::Script::GetHasBreakPoint(unsigned int line) const
+{
+    const BreakpointSet* set = breakpoints;
+    return line < set->bits.size() && set->bits[line];
+}
+
+bool DebugBackend::Script::HasBreakPointInRange(unsigned int start, unsigned int end) const
 {
     
-    for (size_t i = 0; i < breakpoints.size(); i++)
+    const BreakpointSet* set = breakpoints;
+
+    // The breakpoints are kept sorted, so the first breakpoint at or after the
+    // start of the range tells us if there are any inside it.
+    std::vector<unsigned int>::const_iterator result = std::lower_bound(set->lines.begin(), set->lines.end(), start);
+    return result != set->lines.end() && *result < end;
+
+}
+
+bool DebugBackend::Script::ToggleBreakpoint(unsigned int line)
+{
+
+    // Make the change on a copy so that hooks running on other threads never
+    // see a partially updated set.
+    BreakpointSet* set = new BreakpointSet(*breakpoints);
+
+    std::vector<unsigned int>::iterator result = std::lower_bound(set->lines.begin(), set->lines.end(), line);
+    bool breakpointSet;
+
+    if (result == set->lines.end() || *result != line)
     {
-        if(breakpoints[i] == line)
+        
+        set->lines.insert(result, line);
+        
+        if (line >= set->bits.size())
         {
-            return true;
+            set->bits.resize(line + 1, false);
         }
+        set->bits[line] = true;
+        
+        breakpointSet = true;
+
     }
-    
-    return false;
+    else
+    {
+        set->lines.erase(result);
+        set->bits[line] = false;
+        breakpointSet = false;
+    }
+
+    PublishBreakpoints(set);
+    return breakpointSet;
+
 }
 
-bool DebugBackend::Script::HasBreakPointInRange(unsigned int start, unsigned int end) const
+void DebugBackend::Script::ClearBreakpoints()
 {
-    
-    for (size_t i = 0; i < breakpoints.size(); i++)
+    if (!breakpoints->lines.empty())
+    {
+        PublishBreakpoints(new BreakpointSet);
+    }
+}
+
+bool DebugBackend::Script::HasBreakpointsActive() const
+{
+  return breakpoints->lines.size() != 0;
+}
+
+void DebugBackend::Script::PublishBreakpoints(BreakpointSet* set)
+{
+    const BreakpointSet* oldSet = static_cast<const BreakpointSet*>(InterlockedExchangePointer((PVOID volatile*)&breakpoints, set));
+    DebugBackend::Get().RetireBreakpoints(oldSet);
+}
+
+DebugBackend::NameToScriptMap::NameToScriptMap()
+{
+    m_table = CreateTable(64);
+    m_count = 0;
+}
+
+DebugBackend::NameToScriptMap::~NameToScriptMap()
+{
+    Clear();
+    delete [] m_table->slots;
+    delete m_table;
+}
+
+DebugBackend::Script* DebugBackend::NameToScriptMap::Find(const char* name) const
+{
+
+    if (name == NULL)
+    {
+        return NULL;
+    }
+
+    const Table* table = m_table;
+
+    unsigned int hash = HashName(name);
+    unsigned int mask = table->size - 1;
+
+    // Slots are filled in order and never emptied, so reaching an empty slot
+    // means the name isn't in the table.
+    for (unsigned int i = hash & mask; ; i = (i + 1) & mask)
     {
-        if(breakpoints[i] >= start && breakpoints[i] < end)
+        const Entry* entry = table->slots[i];
+        if (entry == NULL)
         {
-            return true;
+            return NULL;
+        }
+        if (entry->hash == hash && entry->name == name)
+        {
+            return entry->script;
         }
     }
-    
-    return false;
+
 }
 
-bool DebugBackend::Script::ToggleBreakpoint(unsigned int line)
+void DebugBackend::NameToScriptMap::Insert(const char* name, Script* script)
 {
 
-    std::vector<unsigned int>::iterator result = std::find(breakpoints.begin(), breakpoints.end(), line);
+    if (Find(name) != NULL)
+    {
+        return;
+    }
+
+    Table* table = m_table;
 
-    if (result == breakpoints.end())
+    // Keep the table at most half full. When it needs to grow, the new table is
+    // completely built before it's published and the old one is kept since
+    // readers may still be using it.
+    if ((m_count + 1) * 2 > table->size)
     {
-        breakpoints.push_back(line);
-        return true;
+
+        Table* newTable = CreateTable(table->size * 2);
+
+        for (unsigned int i = 0; i < table->size; ++i)
+        {
+            if (table->slots[i] != NULL)
+            {
+                InsertIntoTable(newTable, table->slots[i]);
+            }
+        }
+
+        InterlockedExchangePointer((PVOID volatile*)&m_table, newTable);
+        m_retiredTables.push_back(table);
+
+        table = newTable;
+
     }
-    else
+
+    Entry* entry = new Entry;
+    entry->name     = name;
+    entry->hash     = HashName(name);
+    entry->script   = script;
+
+    InsertIntoTable(table, entry);
+    ++m_count;
+
+}
+
+void DebugBackend::NameToScriptMap::Clear()
+{
+
+    Table* table = m_table;
+
+    for (unsigned int i = 0; i < table->size; ++i)
     {
-        breakpoints.erase(result);
-        return false;
+        delete table->slots[i];
+        table->slots[i] = NULL;
+    }
+
+    for (unsigned int i = 0; i < m_retiredTables.size(); ++i)
+    {
+        delete [] m_retiredTables[i]->slots;
+        delete m_retiredTables[i];
+    }
+
+    m_retiredTables.clear();
+    m_count = 0;
+
+}
+
+unsigned int DebugBackend::NameToScriptMap::HashName(const char* name)
+{
+
+    // FNV-1a
+    unsigned int hash = 2166136261U;
+
+    for (const char* c = name; *c != 0; ++c)
+    {
+        hash ^= static_cast<unsigned char>(*c);
+        hash *= 16777619U;
     }
+
+    return hash;
+
 }
 
-void DebugBackend::Script::ClearBreakpoints()
+DebugBackend::NameToScriptMap::Table* DebugBackend::NameToScriptMap::CreateTable(unsigned int size)
 {
-    breakpoints.resize(0);
+
+    Table* table = new Table;
+    table->size  = size;
+    table->slots = new Entry*[size];
+
+    memset((void*)table->slots, 0, sizeof(Entry*) * size);
+
+    return table;
+
 }
 
-bool DebugBackend::Script::HasBreakpointsActive()
+void DebugBackend::NameToScriptMap::InsertIntoTable(Table* table, Entry* entry)
 {
-  return breakpoints.size() != 0;
+
+    unsigned int mask = table->size - 1;
+    unsigned int i = entry->hash & mask;
+
+    while (table->slots[i] != NULL)
+    {
+        i = (i + 1) & mask;
+    }
+
+    // Use an interlocked write so the entry is completely visible before a
+    // reader can find it.
+    InterlockedExchangePointer((PVOID volatile*)&table->slots[i], entry);
+
 }
 
 DebugBackend& DebugBackend::Get()
@@ -146,6 +368,23 @@ DebugBackend::DebugBackend()
     m_mode                  = Mode_Continue;
     m_log                   = NULL;
     m_warnedAboutUserData   = false;
+    m_vmCacheTlsIndex       = TlsAlloc();
+    m_vmGeneration          = 0;
+    m_functionCacheGeneration = 0;
+    m_breakpointEpoch       = 1;
+    m_nextBreakpointOptionsId = 1;
+    m_haveBreakpointFiles   = false;
+    m_excludeStringScripts  = false;
+    m_maxScriptSize         = 0;
+    m_evaluateInstructionLimit = 10000000;
+    m_evaluateTimeLimit     = 1000;
+    m_evaluateSizeLimit     = 1024 * 1024;
+    m_evaluateVm            = NULL;
+    m_evaluateInstructions  = 0;
+    m_evaluateStartTime     = 0;
+    m_evaluateTimedOut      = false;
+    m_logBufferTime         = 0;
+    m_haveBufferedLog       = false;
 }
 
 DebugBackend::~DebugBackend()
@@ -196,7 +435,25 @@ DebugBackend::~DebugBackend()
     }
 
     m_scripts.clear();
-    m_nameToScript.clear();
+    ClearVector(m_excludedScripts);
+    m_nameToScript.Clear();
+
+    for (unsigned int i = 0; i < m_retiredBreakpoints.size(); ++i)
+    {
+        delete m_retiredBreakpoints[i].second;
+    }
+
+    m_retiredBreakpoints.clear();
+    m_hashToScript.clear();
+    m_sourceStore.Clear();
+
+    ClearVector(m_vmCaches);
+
+    if (m_vmCacheTlsIndex != TLS_OUT_OF_INDEXES)
+    {
+        TlsFree(m_vmCacheTlsIndex);
+        m_vmCacheTlsIndex = TLS_OUT_OF_INDEXES;
+    }
 
 }
 
@@ -274,6 +531,10 @@ bool DebugBackend::Initialize(HINSTANCE hInstance)
         return false;
     }
 
+    // Logpoint messages are sent from the command thread once they've waited
+    // long enough, so the hook doesn't have to check the time.
+    m_commandChannel.SetIdleCallback(StaticCommandIdleProc, this, s_logFlushInterval);
+
     // Create the event used to signal when we should stop "breaking"
     // and step to the next line.
     m_stepEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
@@ -300,7 +561,7 @@ bool DebugBackend::Initialize(HINSTANCE hInstance)
 
 }
 
-DebugBackend::VirtualMachine* DebugBackend::AttachState(unsigned long api, lua_State* L)
+DebugBackend::VirtualMachine* DebugBackend::AttachState(unsigned long api, lua_State* L, bool created, lua_State* parent)
 {
 
     if (!GetIsAttached())
@@ -326,15 +587,56 @@ DebugBackend::VirtualMachine* DebugBackend::AttachState(unsigned long api, lua_S
     vm->L                   = L;
     vm->hThread             = GetCurrentThread();
     vm->initialized         = false;
-    vm->callCount           = 0;
+    vm->stepDepth           = -1;
     vm->callStackDepth      = 0;
     vm->lastStepLine        = -2;
     vm->lastStepScript      = -1;
     vm->api                 = api;
+    vm->nameCheckCount      = 0;
     vm->stackTop            = 0;
     vm->luaJitWorkAround    = false;
-    vm->breakpointInStack   = true;// Force the stack tobe checked when the first script is entered
-    vm->haveActiveBreakpoints = false;
+    vm->breakpointStackValid = false;// Force the stack tobe checked when the first script is entered
+    vm->breakpointStackGeneration = 0;
+    vm->stackDepth          = 0;
+    vm->excludedDepth       = 0;
+    vm->hookEpoch           = 0;
+    vm->evaluateEnvironmentRef = LUA_NOREF;
+    vm->evaluateStackLevel  = -1;
+    vm->evaluateFunctionsRef = LUA_NOREF;
+    vm->valueHandlesRef     = LUA_NOREF;
+
+    // Threads share the scripts of the state they were created from.
+
+    StateToVmMap::iterator parentIterator = m_stateToVm.end();
+
+    if (parent != NULL)
+    {
+        parentIterator = m_stateToVm.find(parent);
+    }
+
+    if (parentIterator != m_stateToVm.end())
+    {
+        vm->loadedScripts = parentIterator->second->loadedScripts;
+        ++vm->loadedScripts->refCount;
+    }
+    else
+    {
+        vm->loadedScripts = new LoadedScripts;
+        vm->loadedScripts->all      = !created;
+        vm->loadedScripts->refCount = 1;
+    }
+
+    vm->haveActiveBreakpoints = GetHaveActiveBreakpoints(vm);
+
+    memset(vm->functionCache, 0, sizeof(vm->functionCache));
+    memset(vm->scriptCache, 0, sizeof(vm->scriptCache));
+    vm->scriptCacheHits     = 0;
+    vm->scriptCacheMisses   = 0;
+    vm->numProfileSamples   = 0;
+    vm->nextProfileSample   = 0;
+    vm->lastProfileSendTime = 0;
+
+    vm->profileSamples.resize(s_profileBufferSize);
     
     m_vms.push_back(vm);
     m_stateToVm.insert(std::make_pair(L, vm));
@@ -387,13 +689,13 @@ void DebugBackend::DetachState(unsigned long api, lua_State* L)
 
     // Remove all of the class names associated with this state.
 
-    std::list<ClassInfo>::iterator iterator = m_classInfos.begin();
+    MetatableToClassMap::iterator iterator = m_classInfos.begin();
 
     while (iterator != m_classInfos.end())
     {
-        if (iterator->L == L)
+        if (iterator->second.L == L)
         {
-            m_classInfos.erase(iterator++);
+            iterator = m_classInfos.erase(iterator);
         }
         else
         {
@@ -416,11 +718,26 @@ void DebugBackend::DetachState(unsigned long api, lua_State* L)
     
     }
 
+    // Invalidate the hook's cached lookups since the state may be reused.
+    InterlockedIncrement(&m_vmGeneration);
+
     for (unsigned int i = 0; i < m_vms.size(); ++i)
     {
         VirtualMachine* vm = m_vms[i];
         if (vm->L == L)
         {
+            SendProfileSamples(vm);
+            FlushLogMessages();
+            unsigned int lookups = vm->scriptCacheHits + vm->scriptCacheMisses;
+            if (lookups > 0)
+            {
+                Log("Script cache for VM 0x%p: %u hits, %u misses (%.1f%% hit rate)\n",
+                    L, vm->scriptCacheHits, vm->scriptCacheMisses, 100.0 * vm->scriptCacheHits / lookups);
+            }
+            if (--vm->loadedScripts->refCount == 0)
+            {
+                delete vm->loadedScripts;
+            }
             CloseHandle(vm->hThread);
             delete vm;
             m_vms.erase(m_vms.begin() + i);
@@ -437,14 +754,11 @@ int DebugBackend::PostLoadScript(unsigned long api, int result, lua_State* L, co
         return result;
     }
 
-    bool registered = false;
+    bool waitForLoad = false;
 
     // Register the script before dealing with errors, since the front end has enough
     // information to display the error.
-    if (RegisterScript(L, source, size, name, false) != -1)
-    {
-        registered = true;
-    }
+    RegisterScript(L, source, size, name, false, waitForLoad);
 
     if (result != 0)
     {
@@ -470,7 +784,7 @@ int DebugBackend::PostLoadScript(unsigned long api, int result, lua_State* L, co
         }
 
         // Wait for the front-end to tell use to continue.
-        WaitForContinue();
+        WaitForContinue(api, L);
 
     }
     /*
@@ -509,7 +823,7 @@ int DebugBackend::PostLoadScript(unsigned long api, int result, lua_State* L, co
     }
     */
 
-    if (registered)
+    if (waitForLoad)
     {
         // Stop execution so that the frontend has an opportunity to send us the break points
         // before we start executing the first line of the script.
@@ -520,11 +834,13 @@ int DebugBackend::PostLoadScript(unsigned long api, int result, lua_State* L, co
 
 }
 
-int DebugBackend::RegisterScript(lua_State* L, const char* source, size_t size, const char* name, bool unavailable)
+int DebugBackend::RegisterScript(lua_State* L, const char* source, size_t size, const char* name, bool unavailable, bool& waitForLoad)
 {
 
     CriticalSectionLock lock(m_criticalSection);
 
+    waitForLoad = false;
+
     bool freeName = false;
 
     // If no name was specified, use the source as the name. This is similar to what
@@ -542,8 +858,17 @@ int DebugBackend::RegisterScript(lua_State* L, const char* source, size_t size,
     // Check that we haven't already assigned this script an index. That happens
     // if the same script is loaded twice by the application.
 
-    if (GetScriptIndex(name) != -1)
+    const Script* existing = m_nameToScript.Find(name);
+
+    if (existing != NULL)
     {
+        // The chunk's name may have been put at the address of a name that
+        // was collected, so the lookups cached by address are invalidated.
+        InvalidateFunctionCache();
+        if (!existing->excluded)
+        {
+            SetScriptLoaded(L, existing->index);
+        }
         if (freeName)
         {
             delete [] name;
@@ -558,38 +883,98 @@ int DebugBackend::RegisterScript(lua_State* L, const char* source, size_t size,
     std::string title;
     GetFileTitle(name, title);
 
-    for (unsigned int i = 0; i < m_scripts.size(); ++i)
+    // Excluded scripts are remembered by name so that we don't have to check the
+    // rules again, but they don't get an index and the frontend never hears about
+    // them, so there's nothing to wait for.
+    if (GetIsScriptExcluded(freeName ? NULL : name, size))
+    {
+        Script* script = new Script;
+        script->name     = name;
+        script->title    = title;
+        script->size     = size;
+        script->excluded = true;
+        m_excludedScripts.push_back(script);
+
+        m_nameToScript.Insert(name, script);
+        InvalidateFunctionCache();
+        if (freeName)
+        {
+            delete [] name;
+            name = NULL;
+        }
+        return -1;
+    }
+
+    // Only scripts with the same source hash can match, so the source is only
+    // compared when the hashes collide. Once the frontend has taken the source
+    // of a script, its digest is compared instead. The digest of the new source
+    // is only computed if that's needed.
+
+    ULONGLONG hash = HashData(source, size);
+
+    unsigned char digest[DigestSize];
+    bool haveDigest = false;
+
+    std::pair<HashToScriptMap::const_iterator, HashToScriptMap::const_iterator> matches = m_hashToScript.equal_range(hash);
+
+    for (HashToScriptMap::const_iterator iterator = matches.first; iterator != matches.second; ++iterator)
     {   
-        if (m_scripts[i]->title == title)
+
+        Script* match = iterator->second;
+
+        if (match->title != title || match->size != size)
+        {
+            continue;
+        }
+
+        bool sameSource = size == 0;
+
+        if (!sameSource && match->source != NULL)
         {
-            // Check that the source matches.
-            if (m_scripts[i]->source == std::string(source, size))
+            sameSource = memcmp(match->source->text.c_str(), source, size) == 0;
+        }
+        else if (!sameSource)
+        {
+            if (!haveDigest)
             {
-                // Record the script index under this other name.
-                m_nameToScript.insert(std::make_pair(name, i));
-                if (freeName)
-                {
-                    delete [] name;
-                    name = NULL;
-                }
-                return -1;
+                DigestData(source, size, digest);
+                haveDigest = true;
             }
+            sameSource = memcmp(match->digest, digest, DigestSize) == 0;
+        }
+
+        if (sameSource)
+        {
+            // Record the script index under this other name.
+            m_nameToScript.Insert(name, match);
+            InvalidateFunctionCache();
+            SetScriptLoaded(L, match->index);
+            if (freeName)
+            {
+                delete [] name;
+                name = NULL;
+            }
+            return -1;
         }
     }
     
     Script* script = new Script;
     script->name    = name;
     script->title   = title;
+    script->hash    = hash;
+    script->size    = size;
 
-    if (size > 0 && source != NULL)
-    {
-        script->source = std::string(source, size);
-    }
+    // Scripts with different names can have the same source, so they share it.
+    script->source  = m_sourceStore.Acquire(source, size, hash);
     
     unsigned int scriptIndex = m_scripts.size();
+    script->index = scriptIndex;
     m_scripts.push_back(script);
 
-    m_nameToScript.insert(std::make_pair(name, scriptIndex));
+    m_nameToScript.Insert(name, script);
+    m_hashToScript.insert(std::make_pair(hash, script));
+    InvalidateFunctionCache();
+    SetScriptLoaded(L, scriptIndex);
 
     std::string fileName;
 
@@ -633,12 +1018,19 @@ int DebugBackend::RegisterScript(lua_State* L, const char* source, size_t size,
         }
     }
 
+    // Only wait for the frontend if it could have breakpoints in the script. Until
+    // it's told us which files it has breakpoints in, we have to assume it does.
+    waitForLoad = !m_haveBreakpointFiles || GetHasBreakpointFile(title);
+
+    // The source is sent when the frontend asks for it, which is usually only
+    // for the scripts the user opens or breaks in.
     m_eventChannel.WriteUInt32(EventId_LoadScript);
     m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
     m_eventChannel.WriteString(fileName);
-    m_eventChannel.WriteString(script->source);
-
+    m_eventChannel.WriteUInt64(script->hash);
+    m_eventChannel.WriteUInt32(script->size);
     m_eventChannel.WriteUInt32(state);
+    m_eventChannel.WriteBool(waitForLoad);
     m_eventChannel.Flush();
 
     if (freeName)
@@ -663,28 +1055,30 @@ int DebugBackend::RegisterScript(unsigned long api, lua_State* L, lua_Debug* ar)
         size   = strlen(source);
     }
   
-    int scriptIndex = RegisterScript(L, source, size, arsource, source == NULL);
-  
-    // We need to exit the critical section before waiting so that we don't
-    // monopolize it. Specifically, ToggleBreakpoint will need it.
-    m_criticalSection.Exit();
+    bool waitForLoad = false;
+    RegisterScript(L, source, size, arsource, source == NULL, waitForLoad);
   
-    if (scriptIndex != -1)
+    if (waitForLoad)
     {
         // Stop execution so that the frontend has an opportunity to send us the break points
         // before we start executing the first line of the script.
         WaitForEvent(m_loadEvent);
     }
   
-    m_criticalSection.Enter();
-  
-    // Since the script indices may have changed while we released the critical section,
-    // require the script index.
+    // The script may have been registered by another thread under a different index,
+    // so look up the index again.
     return GetScriptIndex(arsource);
 }
 
 void DebugBackend::Message(const char* message, MessageType type)
 {
+    
+    // The hook can send messages from any thread, so serialize access to the channel.
+    CriticalSectionLock lock(m_criticalSection);
+
+    // Keep the messages in order with the logpoint output.
+    FlushLogMessages();
+
     // Send a message.
     m_eventChannel.WriteUInt32(EventId_Message);
     m_eventChannel.WriteUInt32(0);
@@ -693,40 +1087,105 @@ void DebugBackend::Message(const char* message, MessageType type)
     m_eventChannel.Flush();
 }
 
-void DebugBackend::HookCallback(unsigned long api, lua_State* L, lua_Debug* ar)
+void DebugBackend::UpdateVmName(unsigned long api, lua_State* L)
 {
 
-    m_criticalSection.Enter(); 
-   
-    if (!lua_checkstack_dll(api, L, 2))
+    CriticalSectionLock lock(m_criticalSection);
+
+    // The state may not have been attached yet, in which case the name will
+    // be read when the hook first sees it.
+    StateToVmMap::iterator stateIterator = m_stateToVm.find(L);
+
+    if (stateIterator != m_stateToVm.end())
     {
-        m_criticalSection.Exit();
-        return;
+        UpdateVmName(api, L, stateIterator->second);
+    }
+
+}
+
+void DebugBackend::UpdateVmName(unsigned long api, lua_State* L, VirtualMachine* vm)
+{
+
+    lua_rawgetglobal_dll(api, L, "decoda_name");
+    const char* name = lua_tostring_dll(api, L, -1);
+
+    if (name == NULL)
+    {
+        name = "";
+    }
+
+    if (name != vm->name)
+    {
+        CriticalSectionLock lock(m_criticalSection);
+        vm->name = name;
+        m_eventChannel.WriteUInt32(EventId_NameVM);
+        m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
+        m_eventChannel.WriteString(vm->name);
+        m_eventChannel.Flush();
     }
 
+    lua_pop_dll(api, L, 1);
+
+}
+
+void DebugBackend::HookCallback(unsigned long api, lua_State* L, lua_Debug* ar)
+{
+
     // Note this executes in the thread of the script being debugged,
     // not our debugger, so we can block.
 
-    VirtualMachine* vm = NULL;
-    StateToVmMap::const_iterator iterator = m_stateToVm.find(L);
+    // The checks made here only read the published script and breakpoint
+    // tables, so we don't hold the critical section while making them. It's
+    // only entered when something needs to be changed or sent to the frontend.
 
-    if (iterator == m_stateToVm.end())
+    if (!lua_checkstack_dll(api, L, 2))
     {
-        // If somehow a thread was started without us intercepting the
-        // lua_newthread call, we can reach this point. If so, attach
-        // to the VM.
-        vm = AttachState(api, L);
+        return;
     }
-    else
+
+    VirtualMachine* vm = GetVmForHook(api, L);
+
+    if (vm == NULL)
     {
-        vm = iterator->second;
+        return;
     }
 
     assert(vm->api == api);
 
-    if (!vm->initialized && GetEvent(api, ar) == LUA_HOOKLINE)
+    if (GetEvent(api, ar) == LUA_HOOKCOUNT)
     {
-            
+        if (vm == m_evaluateVm)
+        {
+
+            // We're evaluating an expression for the frontend, so this is the
+            // count hook for the evaluation limits rather than the profiler.
+            m_evaluateInstructions += s_evaluateHookCount;
+
+            if (GetIsEvaluateTimedOut())
+            {
+                lua_pushstring_dll(api, L, "Evaluation timed out");
+                lua_error_dll(api, L);
+            }
+
+        }
+        else if (GetHookCount() == 0)
+        {
+            // Profiling was stopped while this state was changing its own
+            // hook, so the count hook was installed again. Remove it.
+            SetHookMode(api, L, GetHookMode(api, L));
+        }
+        else if (GetAreInterceptsEnabled())
+        {
+            SampleStack(api, L, vm);
+        }
+        return;
+    }
+
+    HookEpochScope epochScope(vm->hookEpoch, m_breakpointEpoch);
+
+    if (!vm->initialized && GetEvent(api, ar) == LUA_HOOKLINE)
+    {
+            
         // We do this initialization work here since we check for things that
         // are registered after the state is created.
 
@@ -758,34 +1217,27 @@ void DebugBackend::HookCallback(unsigned long api, lua_State* L, lua_Debug* ar)
 
     }
 
-    // Get the name of the VM. Polling like this is pretty excessive since the
-    // name won't change often, but it's the easiest way and works fine.
-
-    lua_rawgetglobal_dll(api, L, "decoda_name");
-    const char* name = lua_tostring_dll(api, L, -1);
-
-    if (name == NULL)
-    {
-        name = "";
-    }
+    // Get the name of the VM. The name won't change often so we only check
+    // the global periodically rather than on every event. Scripts can call
+    // decoda_setname to have a new name picked up immediately.
 
-    if (name != vm->name)
+    if (vm->nameCheckCount == 0)
     {
-        vm->name = name;
-        m_eventChannel.WriteUInt32(EventId_NameVM);
-        m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
-        m_eventChannel.WriteString(vm->name);
+        UpdateVmName(api, L, vm);
+        vm->nameCheckCount = s_nameCheckInterval;
     }
 
-    lua_pop_dll(api, L, 1);
+    --vm->nameCheckCount;
 
     // Log for debugging.
     //LogHookEvent(api, L, ar);
 
-    //Only try to downgrade the hook when the debugger is not stepping   
-    if(m_mode == Mode_Continue)
+    //Only try to downgrade the hook when the debugger is not stepping into
+    //functions. Stepping over and out only needs line events once the stack
+    //is back at the depth we're stepping to, which UpdateHookMode handles.
+    if(m_mode != Mode_StepInto)
     {
-        UpdateHookMode(api, L, ar);
+        UpdateHookMode(api, L, vm, ar);
     }
     else
     {
@@ -795,7 +1247,7 @@ void DebugBackend::HookCallback(unsigned long api, lua_State* L, lua_Debug* ar)
         }
         
         //Force UpdateHookMode to recheck the call stack for functions with breakpoints when switching back to Mode_Continue
-        vm->breakpointInStack = true;
+        vm->breakpointStackValid = false;
     }
 
     int arevent = GetEvent(api, ar);
@@ -805,17 +1257,22 @@ void DebugBackend::HookCallback(unsigned long api, lua_State* L, lua_Debug* ar)
         // Fill in the rest of the structure.
         lua_getinfo_dll(api, L, "Sl", ar);
         const char* arsource = GetSource(api, ar);
-        int scriptIndex = GetScriptIndex(arsource);
+        Script* script = FindScript(vm, arsource);
 
-        if (scriptIndex == -1)
+        if (script == NULL)
         {
             // This isn't a script we've seen before, so tell the debugger about it.
-            scriptIndex = RegisterScript( api, L, ar);
+            RegisterScript( api, L, ar);
+            script = FindScript(vm, arsource);
         }
 
+        int scriptIndex = (script != NULL && !script->excluded) ? script->index : -1;
+
         bool stop = false;
         bool onLastStepLine = false;
 
+        lua_Debug functionInfo;
+
         //Keep updating onLastStepLine even if the mode is Mode_Continue if were still on the same line so we don't trigger
         if (vm->luaJitWorkAround)
         {    
@@ -826,39 +1283,27 @@ void DebugBackend::HookCallback(unsigned long api, lua_State* L, lua_Debug* ar)
             {
                 onLastStepLine = vm->lastStepScript == scriptIndex && vm->callStackDepth != 0 && stackDepth == vm->callStackDepth;
             }
-            
-            // If we're stepping on each line or we just stepped out of a function that
-            // we were stepping over, break.
-            if (m_mode == Mode_StepOver && vm->callStackDepth > 0)
-            {
-                if (stackDepth < vm->callStackDepth || (stackDepth == vm->callStackDepth && !onLastStepLine))
-                {
-                    // We've returned to the level when the function was called.
-                    vm->callCount       = 0;   
-                    vm->callStackDepth  = 0;
-                }
-            }
         }
 
-        if (scriptIndex != -1)
+        if (script != NULL)
         {
             // Check to see if we're on a breakpoint and should break.
-            if (!onLastStepLine && m_scripts[scriptIndex]->GetHasBreakPoint(GetCurrentLine(api, ar) - 1))
+            unsigned int line = GetCurrentLine(api, ar) - 1;
+            if (!onLastStepLine && script->GetHasBreakPoint(line))
             {
-                stop = true;
+                stop = GetShouldStopAtBreakpoint(api, L, vm, script, line);
             }
         } 
         
-        //Break if were doing some kind of stepping 
-        if (!onLastStepLine && (m_mode == Mode_StepInto || (m_mode == Mode_StepOver && vm->callCount == 0)))
+        //Break if were doing some kind of stepping. When stepping over or out, the
+        //stack has to have unwound back to the target depth, i.e. there's no frame
+        //at that level. We never step into scripts that aren't being debugged.
+        bool excluded = script != NULL && script->excluded;
+        if (!onLastStepLine && !excluded && (m_mode == Mode_StepInto || (vm->stepDepth >= 0 && !lua_getstack_dll(api, L, vm->stepDepth, &functionInfo))))
         {
             stop = true;
         }
        
-        // We need to exit the critical section before waiting so that we don't
-        // monopolize it.
-        m_criticalSection.Exit();
-
         if (stop)
         {
             BreakFromScript(api, L);
@@ -872,33 +1317,155 @@ void DebugBackend::HookCallback(unsigned long api, lua_State* L, lua_Debug* ar)
         }
 
     }
-    else
+
+}
+
+void DebugBackend::SampleStack(unsigned long api, lua_State* L, VirtualMachine* vm)
+{
+
+    // The samples are sent from the command thread when profiling stops, so
+    // the buffer is protected by the critical section. This is only entered
+    // once every interval instructions.
+    CriticalSectionLock lock(m_criticalSection);
+
+    if (GetHookCount() == 0)
     {
-        if (m_mode == Mode_StepOver)
+        return;
+    }
+
+    ProfileSample& sample = vm->profileSamples[vm->nextProfileSample];
+    sample.numFrames = 0;
+
+    lua_Debug ar;
+
+    for (int level = 0; sample.numFrames < s_maxProfileDepth && lua_getstack_dll(api, L, level, &ar); ++level)
+    {
+
+        lua_getinfo_dll(api, L, "Sn", &ar);
+
+        ProfileFrame& frame = sample.frames[sample.numFrames];
+
+        const char* function = GetName(api, &ar);
+        const char* what     = GetWhat(api, &ar);
+
+        if (function == NULL || function[0] == '\0')
         {
-            if (GetIsHookEventRet( api, arevent)) // only LUA_HOOKRET for Lua 5.2, can also be LUA_HOOKTAILRET for older versions
-            {
-                if (vm->callCount > 0)
-                {
-                    --vm->callCount;
-                }
-            }
-            else if( GetIsHookEventCall( api, arevent)) // only LUA_HOOKCALL for Lua 5.1, can also be LUA_HOOKTAILCALL for newer versions
-            {
-                if (m_mode == Mode_StepOver)
-                {
-                    ++vm->callCount;
-                }
-            }
+            function = (what != NULL) ? what : "<Unknown>";
+        }
+
+        Script* script = NULL;
+        
+        if (GetLineDefined(api, &ar) != -1)
+        {
+            script = FindScript(vm, GetSource(api, &ar));
         }
 
-        m_criticalSection.Exit(); 
+        frame.scriptIndex = (script != NULL && !script->excluded) ? script->index : -1;
+        frame.line        = GetLineDefined(api, &ar) - 1;
+
+        strncpy(frame.function, function, s_maxProfileNameLength);
+        frame.function[s_maxProfileNameLength - 1] = 0;
+
+        ++sample.numFrames;
+
+    }
+
+    // The buffer is a ring, so if the samples couldn't be sent the oldest ones
+    // are overwritten.
+    vm->nextProfileSample = (vm->nextProfileSample + 1) % s_profileBufferSize;
+
+    if (vm->numProfileSamples < s_profileBufferSize)
+    {
+        ++vm->numProfileSamples;
+    }
+
+    DWORD time = GetTickCount();
+
+    if (vm->numProfileSamples == s_profileBufferSize || time - vm->lastProfileSendTime >= s_profileSendInterval)
+    {
+        SendProfileSamples(vm);
+        vm->lastProfileSendTime = time;
+    }
+
+}
+
+void DebugBackend::SendProfileSamples(VirtualMachine* vm)
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    if (vm->numProfileSamples == 0)
+    {
+        return;
+    }
+
+    // Combine identical call stacks so that we only send each one once.
+
+    typedef std::map<std::string, unsigned int> StackToIndexMap;
     
+    StackToIndexMap stackToIndex;
+    std::vector<unsigned int> stacks;   // Index of the first sample with each call stack.
+    std::vector<unsigned int> counts;   // Number of samples with each call stack.
+
+    unsigned int first = (vm->nextProfileSample + s_profileBufferSize - vm->numProfileSamples) % s_profileBufferSize;
+
+    for (unsigned int i = 0; i < vm->numProfileSamples; ++i)
+    {
+
+        unsigned int index = (first + i) % s_profileBufferSize;
+        const ProfileSample& sample = vm->profileSamples[index];
+        
+        std::string key;
+
+        for (unsigned int j = 0; j < sample.numFrames; ++j)
+        {
+            const ProfileFrame& frame = sample.frames[j];
+            key.append(reinterpret_cast<const char*>(&frame.scriptIndex), sizeof(frame.scriptIndex));
+            key.append(reinterpret_cast<const char*>(&frame.line), sizeof(frame.line));
+            key.append(frame.function, strlen(frame.function) + 1);
+        }
+
+        std::pair<StackToIndexMap::iterator, bool> result = stackToIndex.insert(std::make_pair(key, stacks.size()));
+        
+        if (result.second)
+        {
+            stacks.push_back(index);
+            counts.push_back(0);
+        }
+
+        ++counts[result.first->second];
+
+    }
+
+    m_eventChannel.WriteUInt32(EventId_ProfileSamples);
+    m_eventChannel.WriteUInt32(reinterpret_cast<int>(vm->L));
+    m_eventChannel.WriteUInt32(stacks.size());
+
+    for (unsigned int i = 0; i < stacks.size(); ++i)
+    {
+
+        const ProfileSample& sample = vm->profileSamples[stacks[i]];
+
+        m_eventChannel.WriteUInt32(counts[i]);
+        m_eventChannel.WriteUInt32(sample.numFrames);
+
+        for (unsigned int j = 0; j < sample.numFrames; ++j)
+        {
+            const ProfileFrame& frame = sample.frames[j];
+            m_eventChannel.WriteUInt32(frame.scriptIndex);
+            m_eventChannel.WriteUInt32(frame.line);
+            m_eventChannel.WriteString(frame.function);
+        }
+
     }
 
+    m_eventChannel.Flush();
+
+    vm->numProfileSamples = 0;
+
 }
 
-void DebugBackend::UpdateHookMode(unsigned long api, lua_State* L, lua_Debug* hookEvent)
+void DebugBackend::UpdateHookMode(unsigned long api, lua_State* L, VirtualMachine* vm, lua_Debug* hookEvent)
 {
     int arevent = GetEvent(api, hookEvent);
     //Only update the hook mode for call or return hook events 
@@ -907,48 +1474,88 @@ void DebugBackend::UpdateHookMode(unsigned long api, lua_State* L, lua_Debug* ho
         return;
     }
 
-    VirtualMachine* vm = GetVm(L);
-    HookMode mode = HookMode_CallsOnly;
-
     // Populate the line number and source name debug fields
     lua_getinfo_dll(api, L, "S", hookEvent);
     int linedefined = GetLineDefined(api, hookEvent);
 
+    bool hasBreakpoint = false;
+    bool excluded = false;
+
     if( GetIsHookEventCall( api, arevent) && linedefined != -1)
     {
-        vm->lastFunctions = GetSource(api, hookEvent);
+        hasBreakpoint = FunctionHasBreakpoint(api, L, vm, hookEvent, true, excluded);
+    }
 
-        int scriptIndex = GetScriptIndex(vm->lastFunctions.c_str());
+    // The depth of the stack is counted from the call and return events
+    // rather than found by walking the stack. Lua 5.1 counts each tail call
+    // as a level and sends a tail return for it, while Lua 5.2 replaces the
+    // frame and doesn't send a return, so a tail call event doesn't add a
+    // level. The count is reset when the breakpoint stack is rebuilt, which
+    // happens after frames were unwound by an error. LuaJIT doesn't send
+    // returns for C functions, so there we have to walk the stack.
 
-        if (scriptIndex == -1)
-        {
-            RegisterScript(api, L, hookEvent);
-            scriptIndex = GetScriptIndex(vm->lastFunctions.c_str());
-        }
+    bool rebuilt = false;
 
-        Script* script = scriptIndex != -1 ? m_scripts[scriptIndex] : NULL;
+    if (!vm->breakpointStackValid || vm->breakpointStackGeneration != m_functionCacheGeneration)
+    {
+        RebuildBreakpointStack(api, L, vm);
+        rebuilt = true;
+    }
+    else if (vm->luaJitWorkAround)
+    {
+        vm->stackDepth = GetStackDepth(api, L);
+    }
+    else if (arevent == LUA_HOOKCALL)
+    {
+        ++vm->stackDepth;
+    }
+
+    // Number of frames on the stack, including the function being called or
+    // returning from.
+    int stackDepth = vm->stackDepth;
+
+    if (GetIsHookEventRet(api, arevent))
+    {
+        --vm->stackDepth;
+    }
+
+    // Remove the frames that are no longer on the stack. On a return event the
+    // returning function is the last frame, so it's removed as well.
+
+    while (!vm->breakpointStack.empty() && vm->breakpointStack.back() >= stackDepth)
+    {
+        vm->breakpointStack.pop_back();
+    }
+
+    if (vm->excludedDepth >= stackDepth)
+    {
+        vm->excludedDepth = 0;
+    }
 
-        int lastlinedefined = GetLastLineDefined( api, hookEvent);
-        if(script != NULL && (script->HasBreakPointInRange(linedefined, lastlinedefined) ||
-           //Check if the function is the top level chunk of a script because they always have there lastlinedefined set to 0                  
-           (script->HasBreakpointsActive() && linedefined == 0 && lastlinedefined == 0)))
+    // A rebuild already included the function being called.
+    if (!rebuilt)
+    {
+        if (hasBreakpoint)
         {
-            mode = HookMode_Full;
-            vm->breakpointInStack = true;
+            vm->breakpointStack.push_back(stackDepth);
+        }
+        else if (excluded && vm->excludedDepth == 0)
+        {
+            vm->excludedDepth = stackDepth;
         }
     }
 
-    //Keep the hook in Full mode while theres a function in the stack somewhere that has a breakpoint in it
-    if(mode != HookMode_Full && vm->breakpointInStack)
+    // Keep the hook in Full mode while there's a function on the stack that has
+    // a breakpoint in it, unless it's below a function from a script that isn't
+    // being debugged. Otherwise we only need the calls, and the returns to keep
+    // the depth up to date and to know when an excluded function returns. The
+    // hook can't be removed in an excluded function since nothing would turn it
+    // back on when it returns.
+    HookMode mode = HookMode_CallsAndReturns;
+
+    if (!vm->breakpointStack.empty() && vm->breakpointStack.back() > vm->excludedDepth)
     {
-      if(StackHasBreakpoint(api, L))
-      {
-          mode = HookMode_Full;
-      }
-      else
-      {
-          vm->breakpointInStack = false;
-      }
+        mode = HookMode_Full;
     }
 
     HookMode currentMode = GetHookMode(api, L);
@@ -958,25 +1565,61 @@ void DebugBackend::UpdateHookMode(unsigned long api, lua_State* L, lua_Debug* ho
         mode = HookMode_None;
     }
 
-    if(currentMode != mode)
+    if(vm->stepDepth >= 0)
     {
-        //Always switch to Full hook mode when stepping
-        if(m_mode != Mode_Continue)
+        // When stepping over or out we need line events once the stack has
+        // unwound to the target depth. On a return event the returning
+        // function is still on the stack, so check one level further down.
+        // LuaJIT doesn't reliably send returns for C functions, so keep all
+        // of the events with it.
+        int level = GetIsHookEventRet(api, arevent) ? vm->stepDepth + 1 : vm->stepDepth;
+
+        if (vm->luaJitWorkAround || stackDepth <= level)
         {
             mode = HookMode_Full;
         }
+        else if (mode == HookMode_None)
+        {
+            mode = HookMode_CallsAndReturns;
+        }
+    }
+
+    if(mode == HookMode_None)
+    {
+        // We won't see any calls until the hook is turned back on.
+        vm->breakpointStackValid = false;
+    }
+
+    if(currentMode != mode)
+    {
         SetHookMode(api, L, mode);
     }
 }
 
-bool DebugBackend::StackHasBreakpoint(unsigned long api, lua_State* L)
+void DebugBackend::RebuildBreakpointStack(unsigned long api, lua_State* L, VirtualMachine* vm)
 {
-    
+
+    // Read the generation before checking any functions so that a change
+    // made while we're walking the stack causes another rebuild.
+    vm->breakpointStackGeneration   = m_functionCacheGeneration;
+    vm->breakpointStackValid        = true;
+    vm->breakpointStack.clear();
+    vm->excludedDepth               = 0;
+
+    int stackDepth = GetStackDepth(api, L);
+    vm->stackDepth = stackDepth;
+
     lua_Debug functionInfo;
-    VirtualMachine* vm = GetVm(L);
 
-    for(int stackIndex = 0; lua_getstack_dll(api, L, stackIndex, &functionInfo) ;stackIndex++)
+    // Walk from the bottom of the stack so the depths are sorted.
+    for (int stackIndex = stackDepth - 1; stackIndex >= 0; --stackIndex)
     {
+
+        if (!lua_getstack_dll(api, L, stackIndex, &functionInfo))
+        {
+            continue;
+        }
+
         lua_getinfo_dll(api, L, "S", &functionInfo);
 
         int linedefined = GetLineDefined( api, &functionInfo);
@@ -986,109 +1629,396 @@ bool DebugBackend::StackHasBreakpoint(unsigned long api, lua_State* L)
             continue;
         }
 
-        vm->lastFunctions = GetSource( api, &functionInfo);
-
-        int scriptIndex = GetScriptIndex(vm->lastFunctions.c_str());
-        
-        Script* script = scriptIndex != -1 ? m_scripts[scriptIndex] : NULL;
+        bool excluded;
 
-        int lastlinedefined = GetLastLineDefined( api, &functionInfo);
-        if(script != NULL && (script->HasBreakPointInRange(linedefined, lastlinedefined) ||
-           //Check if the function is the top level chunk of a source file                       
-           (script->HasBreakpointsActive() && linedefined == 0 && lastlinedefined == 0)))
+        if (FunctionHasBreakpoint(api, L, vm, &functionInfo, false, excluded))
         {
-            return true;
+            vm->breakpointStack.push_back(stackDepth - stackIndex);
+        }
+        else if (excluded && vm->excludedDepth == 0)
+        {
+            vm->excludedDepth = stackDepth - stackIndex;
         }
 
     }
 
-    return false;            
 }
 
-int DebugBackend::GetScriptIndex(const char* name) const
+bool DebugBackend::FunctionHasBreakpoint(unsigned long api, lua_State* L, VirtualMachine* vm, lua_Debug* ar, bool registerScript, bool& excluded)
 {
-    if (name == NULL) 
+
+    excluded = false;
+
+    const char* source  = GetSource(api, ar);
+    int linedefined     = GetLineDefined(api, ar);
+    int lastlinedefined = GetLastLineDefined(api, ar);
+
+    // The source string is shared by all of the functions in a chunk, so its
+    // address along with the line range identifies the function. The address
+    // can be reused once the chunk is collected, but loading another chunk
+    // registers it which invalidates the cache.
+
+    unsigned int slot = ((reinterpret_cast<size_t>(source) >> 2) + linedefined) % s_functionCacheSize;
+    FunctionCacheEntry& entry = vm->functionCache[slot];
+
+    LONG generation = m_functionCacheGeneration;
+
+    if (entry.source == source && entry.lineDefined == linedefined &&
+        entry.lastLineDefined == lastlinedefined && entry.generation == generation)
     {
-        return -1;
+        excluded = entry.excluded;
+        return entry.hasBreakpoint;
     }
 
-    NameToScriptMap::const_iterator iterator = m_nameToScript.find(name);
+    Script* script = FindScript(vm, source);
 
-    if (iterator == m_nameToScript.end())
+    if (script == NULL)
     {
-        return -1;
+        if (!registerScript)
+        {
+            // Don't cache the result so that the script is still registered
+            // the next time the function is called.
+            return false;
+        }
+        RegisterScript(api, L, ar);
+        script = FindScript(vm, source);
+        // Registering the script changed the generation.
+        generation = m_functionCacheGeneration;
     }
 
-    return iterator->second;
+    bool hasBreakpoint = script != NULL && (script->HasBreakPointInRange(linedefined, lastlinedefined) ||
+        //Check if the function is the top level chunk of a script because they always have there lastlinedefined set to 0
+        (script->HasBreakpointsActive() && linedefined == 0 && lastlinedefined == 0));
+
+    entry.source            = source;
+    entry.lineDefined       = linedefined;
+    entry.lastLineDefined   = lastlinedefined;
+    entry.generation        = generation;
+    entry.hasBreakpoint     = hasBreakpoint;
+    entry.excluded          = script != NULL && script->excluded;
+
+    excluded = entry.excluded;
+    return hasBreakpoint;
 
 }
 
-void DebugBackend::WaitForContinue()
+DebugBackend::Script* DebugBackend::FindScript(VirtualMachine* vm, const char* source)
 {
-    // Wait until the UI to tell us to step to the next line.
-    WaitForEvent(m_stepEvent);
+
+    unsigned int slot = (reinterpret_cast<size_t>(source) >> 2) % s_scriptCacheSize;
+    ScriptCacheEntry& entry = vm->scriptCache[slot];
+
+    // Scripts are never removed from the name map, so an entry can only be
+    // wrong if the string was collected and its address reused by another
+    // chunk. Loading that chunk registers it, which changes the generation.
+
+    LONG generation = m_functionCacheGeneration;
+
+    if (entry.source == source && entry.generation == generation)
+    {
+        ++vm->scriptCacheHits;
+        return entry.script;
+    }
+
+    ++vm->scriptCacheMisses;
+
+    Script* script = m_nameToScript.Find(source);
+
+    // Only cache scripts that were found, since a missing script is about to
+    // be registered.
+    if (script != NULL)
+    {
+        entry.source     = source;
+        entry.generation = generation;
+        entry.script     = script;
+    }
+
+    return script;
+
 }
 
-void DebugBackend::WaitForEvent(HANDLE hEvent)
+void DebugBackend::InvalidateFunctionCache()
 {
-    HANDLE hEvents[] = { hEvent, m_detachEvent };
-    WaitForMultipleObjects(2, hEvents, FALSE, INFINITE);
+    InterlockedIncrement(&m_functionCacheGeneration);
 }
 
-bool DebugBackend::GetIsAttached() const
+void DebugBackend::RetireBreakpoints(const BreakpointSet* set)
 {
-    return WaitForSingleObject(m_detachEvent, 0) != WAIT_OBJECT_0;
+    // The set was replaced before the epoch is incremented, so a hook entered
+    // in the new epoch can only see its replacement.
+    m_retiredBreakpoints.push_back(std::make_pair(InterlockedIncrement(&m_breakpointEpoch), set));
 }
 
-void DebugBackend::CommandThreadProc()
+void DebugBackend::FreeRetiredBreakpoints()
 {
 
-    unsigned int commandId;
+    LONG oldestEpoch = m_breakpointEpoch;
 
-    bool continueRunning = false;
+    for (unsigned int i = 0; i < m_vms.size(); ++i)
+    {
+        LONG hookEpoch = m_vms[i]->hookEpoch;
+        if (hookEpoch != 0 && hookEpoch < oldestEpoch)
+        {
+            oldestEpoch = hookEpoch;
+        }
+    }
 
-    while (m_commandChannel.ReadUInt32(commandId))
+    unsigned int numFreed = 0;
+
+    while (numFreed < m_retiredBreakpoints.size() && m_retiredBreakpoints[numFreed].first <= oldestEpoch)
     {
+        delete m_retiredBreakpoints[numFreed].second;
+        ++numFreed;
+    }
 
-        if (commandId == CommandId_Detach)
-        {
-            
-            m_commandChannel.ReadBool(continueRunning);
+    m_retiredBreakpoints.erase(m_retiredBreakpoints.begin(), m_retiredBreakpoints.begin() + numFreed);
 
-            // Detach the hook function from all of the script virtual machines.
+}
 
-            CriticalSectionLock lock(m_criticalSection);
+int DebugBackend::GetScriptIndex(const char* name) const
+{
 
-            for (unsigned int i = 0; i < m_vms.size(); ++i)
-            {
-                SetHookMode(m_vms[i]->api, m_vms[i]->L, HookMode_None);
-            }
+    const Script* script = m_nameToScript.Find(name);
 
-            // Signal that we're detached.
-            SetEvent(m_detachEvent);
+    if (script == NULL || script->excluded)
+    {
+        return -1;
+    }
 
-            // Note, we don't remove the vms here since they will be removed when
-            // lua_close is called by the host.
+    return script->index;
 
-            // If we're supposed to continue running the application after detaching,
-            // set the step event so that we don't stay broken forever.
-            if (continueRunning)
-            {
-                SetEvent(m_stepEvent);
-                SetEvent(m_loadEvent);
-            }
-            else
-            {
-                break;
-            }
-            
-        }
-        else if (commandId == CommandId_IgnoreException)
-        {
-            std::string message;
+}
+
+bool DebugBackend::GetNeedsScriptSource(const char* name) const
+{
+    // If there's no name the source is used as the name.
+    return GetIsAttached() && (name == NULL || m_nameToScript.Find(name) == NULL);
+}
+
+void DebugBackend::WaitForContinue(unsigned long api, lua_State* L)
+{
+
+    VirtualMachine* vm = NULL;
+    bool inHook = false;
+
+    {
+
+        CriticalSectionLock lock(m_criticalSection);
+        vm = GetVm(L);
+
+        // The hook doesn't read any breakpoints while it's waiting, so the
+        // sets retired before or during the break don't have to be kept for it.
+        if (vm != NULL)
+        {
+            inHook = vm->hookEpoch != 0;
+            vm->hookEpoch = 0;
+            FreeRetiredBreakpoints();
+        }
+
+    }
+
+    // Wait until the UI to tell us to step to the next line.
+    WaitForEvent(m_stepEvent);
+
+    // The values of the locals can change once we continue, so anything cached
+    // for evaluating expressions during the break has to be thrown away.
+
+    {
+        CriticalSectionLock lock(m_criticalSection);
+        vm = GetVm(L);
+    }
+
+    if (vm != NULL)
+    {
+        if (inHook)
+        {
+            InterlockedExchange(&vm->hookEpoch, m_breakpointEpoch);
+        }
+        ReleaseEvaluateCache(api, L, vm);
+    }
+
+}
+
+void DebugBackend::BeginStep(unsigned long api, lua_State* L)
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    StateToVmMap::iterator stateIterator = m_stateToVm.find(L);
+
+    if (stateIterator == m_stateToVm.end())
+    {
+        return;
+    }
+
+    VirtualMachine* vm = stateIterator->second;
+
+    // Stepping over stops at the next line executed at the current depth or
+    // above, and stepping out at the next line above the current function.
+
+    if (m_mode == Mode_StepOver)
+    {
+        vm->stepDepth = GetStackDepth(api, L);
+    }
+    else if (m_mode == Mode_StepOut)
+    {
+        vm->stepDepth = GetStackDepth(api, L) - 1;
+    }
+    else
+    {
+        vm->stepDepth = -1;
+        return;
+    }
+
+    // This is the thread running the state, so it's safe to change the hook.
+    // UpdateHookMode drops the line events when a function is called.
+    SetHookMode(api, L, HookMode_Full);
+
+}
+
+void DebugBackend::WaitForEvent(HANDLE hEvent)
+{
+    HANDLE hEvents[] = { hEvent, m_detachEvent };
+    WaitForMultipleObjects(2, hEvents, FALSE, INFINITE);
+}
+
+bool DebugBackend::GetIsAttached() const
+{
+    return WaitForSingleObject(m_detachEvent, 0) != WAIT_OBJECT_0;
+}
+
+void DebugBackend::CommandThreadProc()
+{
+
+    unsigned int commandId;
+
+    bool continueRunning = false;
+
+    while (m_commandChannel.ReadUInt32(commandId))
+    {
+
+        if (commandId == CommandId_Detach)
+        {
+            
+            m_commandChannel.ReadBool(continueRunning);
+
+            // Detach the hook function from all of the script virtual machines.
+
+            CriticalSectionLock lock(m_criticalSection);
+
+            SetHookCount(0);
+
+            for (unsigned int i = 0; i < m_vms.size(); ++i)
+            {
+                SetHookMode(m_vms[i]->api, m_vms[i]->L, HookMode_None);
+                m_vms[i]->breakpointStackValid = false;
+            }
+
+            // Signal that we're detached.
+            SetEvent(m_detachEvent);
+
+            // Note, we don't remove the vms here since they will be removed when
+            // lua_close is called by the host.
+
+            // If we're supposed to continue running the application after detaching,
+            // set the step event so that we don't stay broken forever.
+            if (continueRunning)
+            {
+                SetEvent(m_stepEvent);
+                SetEvent(m_loadEvent);
+            }
+            else
+            {
+                break;
+            }
+            
+        }
+        else if (commandId == CommandId_IgnoreException)
+        {
+            std::string message;
             m_commandChannel.ReadString(message);
             IgnoreException(message);
         }
+        else if (commandId == CommandId_StartProfile)
+        {
+            unsigned int interval;
+            m_commandChannel.ReadUInt32(interval);
+            StartProfiling(interval);
+        }
+        else if (commandId == CommandId_StopProfile)
+        {
+            StopProfiling();
+        }
+        else if (commandId == CommandId_GetSource)
+        {
+
+            unsigned int scriptIndex;
+            m_commandChannel.ReadUInt32(scriptIndex);
+
+            bool release;
+            m_commandChannel.ReadBool(release);
+
+            std::string source;
+            bool success = GetScriptSource(scriptIndex, release, source);
+
+            m_commandChannel.WriteUInt32(success);
+            m_commandChannel.WriteString(source);
+            m_commandChannel.Flush();
+
+        }
+        else if (commandId == CommandId_SetBreakpointFiles)
+        {
+
+            unsigned int numFiles;
+            m_commandChannel.ReadUInt32(numFiles);
+
+            std::vector<std::string> fileNames(numFiles);
+
+            for (unsigned int i = 0; i < numFiles; ++i)
+            {
+                m_commandChannel.ReadString(fileNames[i]);
+            }
+
+            SetBreakpointFiles(fileNames);
+
+        }
+        else if (commandId == CommandId_SetExclusionRules)
+        {
+
+            unsigned int numPatterns;
+            m_commandChannel.ReadUInt32(numPatterns);
+
+            std::vector<std::string> patterns(numPatterns);
+
+            for (unsigned int i = 0; i < numPatterns; ++i)
+            {
+                m_commandChannel.ReadString(patterns[i]);
+            }
+
+            bool excludeStringScripts;
+            m_commandChannel.ReadBool(excludeStringScripts);
+
+            unsigned int maxSize;
+            m_commandChannel.ReadUInt32(maxSize);
+
+            SetExclusionRules(patterns, excludeStringScripts, maxSize);
+
+        }
+        else if (commandId == CommandId_SetEvaluateLimits)
+        {
+
+            unsigned int instructions;
+            m_commandChannel.ReadUInt32(instructions);
+
+            unsigned int time;
+            m_commandChannel.ReadUInt32(time);
+
+            unsigned int size;
+            m_commandChannel.ReadUInt32(size);
+
+            SetEvaluateLimits(instructions, time, size);
+
+        }
         else
         {
 
@@ -1108,6 +2038,9 @@ void DebugBackend::CommandThreadProc()
             case CommandId_StepInto:
                 StepInto();
                 break;
+            case CommandId_StepOut:
+                StepOut();
+                break;
             case CommandId_DeleteAllBreakpoints:
                 DeleteAllBreakpoints();
                 break;
@@ -1122,6 +2055,51 @@ void DebugBackend::CommandThreadProc()
                     
                     ToggleBreakpoint(L, scriptIndex, line);
                 
+                }
+                break;
+            case CommandId_SetLogpoint:
+                {
+
+                    unsigned int scriptIndex;
+                    unsigned int line;
+                    std::string message;
+
+                    m_commandChannel.ReadUInt32(scriptIndex);
+                    m_commandChannel.ReadUInt32(line);
+                    m_commandChannel.ReadString(message);
+
+                    SetLogpoint(L, scriptIndex, line, message);
+
+                }
+                break;
+            case CommandId_SetBreakpointCondition:
+                {
+
+                    unsigned int scriptIndex;
+                    unsigned int line;
+                    std::string condition;
+                    unsigned int hitCount;
+
+                    m_commandChannel.ReadUInt32(scriptIndex);
+                    m_commandChannel.ReadUInt32(line);
+                    m_commandChannel.ReadString(condition);
+                    m_commandChannel.ReadUInt32(hitCount);
+
+                    SetBreakpointCondition(L, scriptIndex, line, condition, hitCount);
+
+                }
+                break;
+            case CommandId_ClearBreakpointCondition:
+                {
+
+                    unsigned int scriptIndex;
+                    unsigned int line;
+
+                    m_commandChannel.ReadUInt32(scriptIndex);
+                    m_commandChannel.ReadUInt32(line);
+
+                    ClearBreakpointCondition(scriptIndex, line);
+
                 }
                 break;
             case CommandId_Break:
@@ -1150,6 +2128,75 @@ void DebugBackend::CommandThreadProc()
                     m_commandChannel.WriteString(result);
                     m_commandChannel.Flush();
 
+                }
+                break;
+            case CommandId_EvaluateMultiple:
+                {
+
+                    unsigned int numExpressions;
+                    m_commandChannel.ReadUInt32(numExpressions);
+
+                    std::vector<std::string> expressions(numExpressions);
+
+                    for (unsigned int i = 0; i < numExpressions; ++i)
+                    {
+                        m_commandChannel.ReadString(expressions[i]);
+                    }
+
+                    unsigned int stackLevel;
+                    m_commandChannel.ReadUInt32(stackLevel);
+
+                    unsigned long api = GetApiForVm(L);
+
+                    // The expressions share the environment cached for the stack
+                    // level, so it's only created once for all of them.
+
+                    for (unsigned int i = 0; i < numExpressions; ++i)
+                    {
+
+                        std::string result;
+                        bool success = false;
+
+                        if (api != -1)
+                        {
+                            success = Evaluate(api, L, expressions[i], stackLevel, result);
+                        }
+
+                        m_commandChannel.WriteUInt32(success);
+                        m_commandChannel.WriteString(result);
+
+                    }
+
+                    m_commandChannel.Flush();
+
+                }
+                break;
+            case CommandId_ExpandValue:
+                {
+
+                    unsigned int handle;
+                    m_commandChannel.ReadUInt32(handle);
+
+                    unsigned int offset;
+                    m_commandChannel.ReadUInt32(offset);
+
+                    unsigned int limit;
+                    m_commandChannel.ReadUInt32(limit);
+
+                    unsigned long api = GetApiForVm(L);
+
+                    std::string result;
+                    bool success = false;
+
+                    if (api != -1)
+                    {
+                        success = ExpandValue(api, L, handle, offset, limit, result);
+                    }
+
+                    m_commandChannel.WriteUInt32(success);
+                    m_commandChannel.WriteString(result);
+                    m_commandChannel.Flush();
+
                 }
                 break;
             case CommandId_LoadDone:
@@ -1171,9 +2218,28 @@ void DebugBackend::CommandThreadProc()
         delete m_scripts[i];
     }
 
-    m_nameToScript.clear();
+    m_nameToScript.Clear();
+    m_hashToScript.clear();
+    m_sourceStore.Clear();
 
     m_scripts.clear();
+    ClearVector(m_excludedScripts);
+
+    for (unsigned int i = 0; i < m_retiredBreakpoints.size(); ++i)
+    {
+        delete m_retiredBreakpoints[i].second;
+    }
+
+    m_retiredBreakpoints.clear();
+
+    for (unsigned int i = 0; i < m_vms.size(); ++i)
+    {
+        if (--m_vms[i]->loadedScripts->refCount == 0)
+        {
+            delete m_vms[i]->loadedScripts;
+        }
+    }
+
     ClearVector(m_vms);
     m_stateToVm.clear();
 
@@ -1189,16 +2255,76 @@ DWORD WINAPI DebugBackend::StaticCommandThreadProc(LPVOID param)
     return 0;
 }
 
-void DebugBackend::ActiveLuaHookInAllVms()
+void DebugBackend::StaticCommandIdleProc(void* param)
 {
-    StateToVmMap::iterator end = m_stateToVm.end();
 
-    for (StateToVmMap::iterator it = m_stateToVm.begin(); it != end; it++)
+    DebugBackend* self = static_cast<DebugBackend*>(param);
+
+    // The flag is checked first so that the lock isn't taken when there
+    // aren't any messages.
+    if (self->m_haveBufferedLog)
     {
-      VirtualMachine* vm = it->second;
-      //May have issues with L not being the currently running thread
-      SetHookMode(vm->api, vm->L, HookMode_Full);
+        CriticalSectionLock lock(self->m_criticalSection);
+        if (GetTickCount() - self->m_logBufferTime >= s_logFlushInterval)
+        {
+            self->FlushLogMessages();
+        }
     }
+
+}
+
+void DebugBackend::ActiveLuaHookInAllVms()
+{
+    StateToVmMap::iterator end = m_stateToVm.end();
+
+    for (StateToVmMap::iterator it = m_stateToVm.begin(); it != end; it++)
+    {
+      VirtualMachine* vm = it->second;
+      //May have issues with L not being the currently running thread
+      SetHookMode(vm->api, vm->L, HookMode_Full);
+    }
+}
+
+void DebugBackend::StartProfiling(unsigned int interval)
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    if (interval == 0)
+    {
+        return;
+    }
+
+    SetHookCount(interval);
+
+    // Reinstall the hook with the same mode so that it includes the count. The
+    // hook can be changed from this thread while the state is running, the same
+    // as when breakpoints are activated.
+    for (unsigned int i = 0; i < m_vms.size(); ++i)
+    {
+        VirtualMachine* vm = m_vms[i];
+        vm->lastProfileSendTime = GetTickCount();
+        SetHookMode(vm->api, vm->L, GetHookMode(vm->api, vm->L));
+    }
+
+}
+
+void DebugBackend::StopProfiling()
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    SetHookCount(0);
+
+    // Reinstall the hook with the same mode so that the count is removed, the
+    // same way it was added in StartProfiling.
+    for (unsigned int i = 0; i < m_vms.size(); ++i)
+    {
+        VirtualMachine* vm = m_vms[i];
+        SetHookMode(vm->api, vm->L, GetHookMode(vm->api, vm->L));
+        SendProfileSamples(vm);
+    }
+
 }
 
 void DebugBackend::StepInto()
@@ -1208,7 +2334,7 @@ void DebugBackend::StepInto()
     
     for (unsigned int i = 0; i < m_vms.size(); ++i)
     {
-        m_vms[i]->callCount = 0;
+        m_vms[i]->stepDepth = -1;
     }
 
     m_mode = Mode_StepInto;
@@ -1224,13 +2350,29 @@ void DebugBackend::StepOver()
     
     for (unsigned int i = 0; i < m_vms.size(); ++i)
     {
-        m_vms[i]->callCount = 0;
+        m_vms[i]->stepDepth = -1;
     }
 
+    // The VM that's broken sets its step depth when it resumes. The other
+    // VMs keep running as if we were continuing.
     m_mode = Mode_StepOver;
     SetEvent(m_stepEvent);
 
-    ActiveLuaHookInAllVms();
+}
+
+void DebugBackend::StepOut()
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+    
+    for (unsigned int i = 0; i < m_vms.size(); ++i)
+    {
+        m_vms[i]->stepDepth = -1;
+    }
+
+    m_mode = Mode_StepOut;
+    SetEvent(m_stepEvent);
+
 }
 
 
@@ -1241,7 +2383,7 @@ void DebugBackend::Continue()
     
     for (unsigned int i = 0; i < m_vms.size(); ++i)
     {
-        m_vms[i]->callCount = 0;
+        m_vms[i]->stepDepth = -1;
     }
 
     m_mode = Mode_Continue;
@@ -1285,6 +2427,13 @@ void DebugBackend::ToggleBreakpoint(lua_State* L, unsigned int scriptIndex, unsi
     {
         
         bool breakpointSet = script->ToggleBreakpoint(line);
+        InvalidateFunctionCache();
+        FreeRetiredBreakpoints();
+
+        if (!breakpointSet)
+        {
+            script->breakpointOptions.erase(line);
+        }
 
         if(breakpointSet)
         {
@@ -1292,10 +2441,10 @@ void DebugBackend::ToggleBreakpoint(lua_State* L, unsigned int scriptIndex, unsi
         }
         else
         {
-            //Check to see if this was the last active breakpoint set if so switch back to fast mode
-            if(!GetHaveActiveBreakpoints())
+            //Check to see if this was the last active breakpoint in any of the vms if so switch them back to fast mode
+            for(StateToVmMap::iterator it = m_stateToVm.begin(); it != m_stateToVm.end(); it++)
             {
-                for(StateToVmMap::iterator it = m_stateToVm.begin(); it != m_stateToVm.end(); it++)
+                if(it->second->haveActiveBreakpoints && !GetHaveActiveBreakpoints(it->second))
                 {
                     it->second->haveActiveBreakpoints = false;
                 }
@@ -1314,1339 +2463,2614 @@ void DebugBackend::ToggleBreakpoint(lua_State* L, unsigned int scriptIndex, unsi
 
 }
 
-void DebugBackend::BreakpointsActiveForScript(int scriptIndex)
+void DebugBackend::SetBreakpointCondition(lua_State* L, unsigned int scriptIndex, unsigned int line, const std::string& condition, unsigned int hitCount)
 {
-    //TODO this per VM
-    SetHaveActiveBreakpoints(true);
-}
 
-bool DebugBackend::GetHaveActiveBreakpoints(){
+    CriticalSectionLock lock(m_criticalSection);
 
-    for(std::vector<Script*>::iterator it = m_scripts.begin(); it != m_scripts.end(); it++)
+    if (scriptIndex >= m_scripts.size())
     {
-        if((*it)->HasBreakpointsActive())
-        {
-            return true;
-        } 
+        return;
     }
 
-    return false;
-}
-
-void DebugBackend::SetHaveActiveBreakpoints(bool breakpointsActive)
-{
+    Script* script = m_scripts[scriptIndex];
 
-    //m_HookLock.Enter();
+    // Set the options before the breakpoint so that the hook never sees the
+    // breakpoint without its condition.
 
-    for(StateToVmMap::iterator it = m_stateToVm.begin(); it != m_stateToVm.end(); it++)
-    {
-        it->second->haveActiveBreakpoints = breakpointsActive;
-    }
-  
-    //We defer to UpdateHookMode to turn off the hook fully
-    if(breakpointsActive)
-    {
-        ActiveLuaHookInAllVms();
-    }
-}
+    BreakpointOptions& options = script->breakpointOptions[line];
 
-void DebugBackend::DeleteAllBreakpoints(){
+    options.id          = m_nextBreakpointOptionsId++;
+    options.condition   = condition;
+    options.hitCount    = hitCount;
+    options.hits        = 0;
 
-    for(std::vector<Script*>::iterator it = m_scripts.begin(); it != m_scripts.end(); it++)
+    if (!script->GetHasBreakPoint(line))
     {
-        (*it)->breakpoints.clear();
+        ToggleBreakpoint(L, scriptIndex, line);
     }
 
-    //Set all haveActiveBreakpoints for the vms back to false we leave to the hook being called for the vm
-    SetHaveActiveBreakpoints(false);
 }
 
-void DebugBackend::SendBreakEvent(unsigned long api, lua_State* L, int stackTop)
+void DebugBackend::ClearBreakpointCondition(unsigned int scriptIndex, unsigned int line)
 {
 
     CriticalSectionLock lock(m_criticalSection);
 
-    VirtualMachine* vm = GetVm(L);
+    if (scriptIndex < m_scripts.size())
+    {
+        m_scripts[scriptIndex]->breakpointOptions.erase(line);
+    }
 
-    // The C call stack will look something like this (may be any number of
-    // these stacked on top of each other):
-    //
-    //   +------+
-    //   |      | C function
-    //   +------+
-    //   |      |
-    //   | XXXX | Lua call mechanism (luaD_*, luaV_*, lua_*)
-    //   |      |
-    //   +------+
-    //   | XXXX | lua_call/lua_pcall/lua_load, etc.
-    //   +------+
-    //   |      |
-    //   |      | Pre-Lua code (main, etc.)
-    //   |      |
-    //   +------+
+}
 
-    StackEntry nativeStack[100];
-    unsigned int nativeStackSize = 0;
+void DebugBackend::SetBreakpointFiles(const std::vector<std::string>& fileNames)
+{
 
-    if (vm != NULL)
-    {
-        // Remember how many stack levels to skip so when we evaluate we can adjust
-        // the stack level accordingly.
-        vm->stackTop = stackTop;
-        nativeStackSize = GetCStack(vm->hThread, nativeStack, 100);
-    }
-    else
-    {
-        // For whatever reason we couldn't remember how many stack levels we want to skip,
-        // so don't skip any. This shouldn't happen under any normal circumstance since
-        // the state should have a corresponding VM.
-        stackTop = 0;
-    }
+    CriticalSectionLock lock(m_criticalSection);
 
-    m_eventChannel.WriteUInt32(EventId_Break);
-    m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
+    m_breakpointFiles.clear();
+    m_breakpointFiles.insert(fileNames.begin(), fileNames.end());
 
-    // Send the call stack.
+    m_haveBreakpointFiles = true;
 
-    lua_Debug scriptStack[s_maxStackSize];
-    unsigned int scriptStackSize = 0;
+}
 
-    for (int level = stackTop; scriptStackSize < s_maxStackSize && lua_getstack_dll(api, L, level, &scriptStack[scriptStackSize]); ++level)
-    {
-        lua_getinfo_dll(api, L, "nSlu", &scriptStack[scriptStackSize]);
-        ++scriptStackSize;
-    }
+void DebugBackend::SetExclusionRules(const std::vector<std::string>& patterns, bool excludeStringScripts, unsigned int maxSize)
+{
 
-    // Create a unified call stack.
-    StackEntry stack[s_maxStackSize];
-    unsigned int stackSize = GetUnifiedStack(api, nativeStack, nativeStackSize, scriptStack, scriptStackSize, stack);
+    CriticalSectionLock lock(m_criticalSection);
 
-    m_eventChannel.WriteUInt32(stackSize);
+    m_excludedPatterns.clear();
 
-    for (unsigned int i = 0; i < stackSize; ++i)
+    for (unsigned int i = 0; i < patterns.size(); ++i)
     {
-        unsigned int stackIndex = stackSize - i - 1;
-        m_eventChannel.WriteUInt32(stack[stackIndex].scriptIndex);
-        m_eventChannel.WriteUInt32(stack[stackIndex].line);
-        m_eventChannel.WriteString(stack[stackIndex].name);
+        if (!patterns[i].empty())
+        {
+            m_excludedPatterns.push_back(NormalizeScriptName(patterns[i].c_str()));
+        }
     }
 
-    m_eventChannel.Flush();
+    m_excludeStringScripts  = excludeStringScripts;
+    m_maxScriptSize         = maxSize;
 
 }
 
-void DebugBackend::SendExceptionEvent(lua_State* L, const char* message)
+void DebugBackend::SetEvaluateLimits(unsigned int instructions, unsigned int time, unsigned int size)
 {
-    m_eventChannel.WriteUInt32(EventId_Exception);
-    m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
-    m_eventChannel.WriteString(message);
-    m_eventChannel.Flush();
+    // Evaluations are also done on the command thread, so this can't happen
+    // in the middle of one.
+    m_evaluateInstructionLimit  = instructions;
+    m_evaluateTimeLimit         = time;
+    m_evaluateSizeLimit         = size;
 }
 
-void DebugBackend::BreakFromScript(unsigned long api, lua_State* L)
+void DebugBackend::BeginEvaluateLimits(unsigned long api, lua_State* L, VirtualMachine* vm)
 {
-    CriticalSectionLock lock(m_breakLock);
-
-    SendBreakEvent(api, L);
-    WaitForContinue();        
-}
 
-int DebugBackend::Call(unsigned long api, lua_State* L, int nargs, int nresults, int errorfunc)
-{
+    m_evaluateInstructions  = 0;
+    m_evaluateStartTime     = GetTickCount();
+    m_evaluateTimedOut      = false;
+    m_evaluateVm            = vm;
 
-    // Check it's not our error handler that's getting called (happens when there's an
-    // error). We also need to check that our error handler is not the error function,
-    // since that can happen if one of the Lua interfaces we hooked calls another one
-    // internally.
-    if (lua_tocfunction_dll(api, L, -1) == StaticErrorHandler || (errorfunc != 0 && lua_tocfunction_dll(api, L, errorfunc) == StaticErrorHandler))
+    if (m_evaluateInstructionLimit != 0 || m_evaluateTimeLimit != 0)
     {
-        return lua_pcall_dll(api, L, nargs, nresults, errorfunc);
+        SetCountHook(api, L, s_evaluateHookCount);
     }
     else
     {
+        SetHookMode(api, L, HookMode_None);
+    }
 
-        int result = 0;
+}
 
-        if (lua_gettop_dll(api, L) >= nargs + 1)
-        {
-            
-            // Push our error handler onto the stack before the function and the arguments.
-            if (errorfunc != 0)
-            {
-                lua_pushvalue_dll(api, L, errorfunc);
-            }
-            else
-            {
-                lua_pushnil_dll(api, L);
-            }
-            lua_pushcclosure_dll(api, L, StaticErrorHandler, 1);
+void DebugBackend::EndEvaluateLimits()
+{
+    m_evaluateVm        = NULL;
+    m_evaluateTimedOut  = false;
+}
 
-            int errorHandler = lua_gettop_dll(api, L) - (nargs + 1);
-            lua_insert_dll(api, L, errorHandler);
+bool DebugBackend::GetIsEvaluateTimedOut() const
+{
 
-            // Invoke the function
-            result = lua_pcall_dll(api, L, nargs, nresults, errorHandler);
+    if (m_evaluateVm == NULL)
+    {
+        return false;
+    }
 
-            // Remove our error handler from the stack.
-            lua_remove_dll(api, L, errorHandler);
-        
+    if (!m_evaluateTimedOut)
+    {
+        if (m_evaluateInstructionLimit != 0 && m_evaluateInstructions >= m_evaluateInstructionLimit)
+        {
+            m_evaluateTimedOut = true;
         }
-        else
+        else if (m_evaluateTimeLimit != 0 && GetTickCount() - m_evaluateStartTime >= m_evaluateTimeLimit)
         {
-            // In this case there wasn't a function on the top of the stack, so don't push our
-            // error handler there since it will get called instead.
-            result = lua_pcall_dll(api, L, nargs, nresults, errorfunc);
+            m_evaluateTimedOut = true;
         }
-
-        return result;
-
     }
 
+    return m_evaluateTimedOut;
+
 }
 
-int DebugBackend::StaticErrorHandler(lua_State* L)
+bool DebugBackend::GetIsEvaluateTooLarge(const ValueWriter& writer) const
 {
-    unsigned long api = s_instance->GetApiForVm(L);
-    return s_instance->ErrorHandler(api, L);
+    return m_evaluateSizeLimit != 0 && writer.GetData().length() > m_evaluateSizeLimit;
 }
 
-int DebugBackend::ErrorHandler(unsigned long api, lua_State* L)
+bool DebugBackend::GetScriptSource(unsigned int scriptIndex, bool release, std::string& source)
 {
 
-    int top = lua_gettop_dll(api, L);
-
-    // Get the error mesasge.
-    const char* message = lua_tostring_dll(api, L, -1);
+    CriticalSectionLock lock(m_criticalSection);
 
-    if (message == NULL)
+    if (scriptIndex >= m_scripts.size() || m_scripts[scriptIndex]->source == NULL)
     {
-        message = "No error message available";
+        return false;
     }
 
-    if (!GetIsExceptionIgnored(message))
-    {
+    Script* script = m_scripts[scriptIndex];
+    source = script->source->text;
 
-        // Send the exception event. Ignore the top of the stack when we send the
-        // call stack since the top of the call stack is this function.
+    if (release)
+    {
+        // The frontend keeps its own copy, so we don't need ours anymore. The
+        // digest lets us still recognize the script if it's loaded again
+        // under another name.
+        DigestData(script->source->text.c_str(), script->source->text.length(), script->digest);
+        m_sourceStore.Release(script->source);
+        script->source = NULL;
+    }
 
-        // Sometimes the break lock will already be held.  For example, consider
-        // the following sequence of events:
-        //   1) The main lua thread is stopped in the debugger, holding the
-        //      break lock in DebugBackend::BreakFromScript.
-        //   2) The decoda thread tries to evaluate a variable from the watch
-        //      window
-        //   3) The evaluation of __towatch or __tostring calls lua_error()
-        // That will lead us right here, unable to grab the break lock.  To avoid
-        // deadlocking in this case, just send an error message.
+    return true;
 
-        CriticalSectionTryLock lock(m_breakLock);
-        if (lock.IsHeld()) 
-        {
-            SendBreakEvent(api, L, 1);
-            SendExceptionEvent(L, message);
-            WaitForContinue();
-        } 
-        else 
-        {
-            Message(message, MessageType_Error);
-        }
+}
 
-    }
-        
-    // Try invoking the user specified error function.
+void DebugBackend::SetLogpoint(lua_State* L, unsigned int scriptIndex, unsigned int line, const std::string& message)
+{
 
-    lua_pushvalue_dll(api, L, lua_upvalueindex_dll(api, 1));
+    CriticalSectionLock lock(m_criticalSection);
 
-    if (!lua_isnil_dll(api, L, -1))
+    if (scriptIndex >= m_scripts.size())
     {
-        lua_pushvalue_dll(api, L, -2);
-        lua_pcall_dll(api, L, 1, 1, 0);
+        return;
     }
-    else
-    {
-        lua_pop_dll(api, L, 1);
-        // Push the original message back as the return so that it will be available
-        // to custom error handlers.
-        lua_pushvalue_dll(api, L, -1);
-    }
-        
-    return 1;
 
-}
+    Script* script = m_scripts[scriptIndex];
 
-bool DebugBackend::GetStartupDirectory(char* path, int maxPathLength)
-{
+    // This keeps the condition and hit count if the breakpoint already has
+    // them.
 
-    if (!GetModuleFileName(g_hInstance, path, maxPathLength))
+    bool newOptions = script->breakpointOptions.find(line) == script->breakpointOptions.end();
+    BreakpointOptions& options = script->breakpointOptions[line];
+
+    if (newOptions)
     {
-        return false;
+        options.hitCount = 0;
     }
 
-    char* lastSlash = strrchr(path, '\\');
+    options.id          = m_nextBreakpointOptionsId++;
+    options.hits        = 0;
+    options.logMessage  = message;
 
-    if (lastSlash == NULL)
+    if (!script->GetHasBreakPoint(line))
     {
-        return false;
+        ToggleBreakpoint(L, scriptIndex, line);
     }
 
-    // Terminate the path after the last slash.
-
-    lastSlash[1] = 0;
-    return true;
-
 }
 
-void DebugBackend::ChainTables(unsigned long api, lua_State* L, int child, int parent)
+bool DebugBackend::GetShouldStopAtBreakpoint(unsigned long api, lua_State* L, VirtualMachine* vm, Script* script, unsigned int line)
 {
-    
-    int t1 = lua_gettop_dll(api, L);
-
-    // Create the metatable to link them.
-    lua_newtable_dll(api, L);
-    int metaTable = lua_gettop_dll(api, L);
 
-    // Set the __index metamethod to point to the parent table.
-    lua_pushstring_dll(api, L, "__index");
-    lua_pushvalue_dll(api, L, parent);
-    lua_rawset_dll(api, L, metaTable);
+    CompiledBreakpoint* compiled = NULL;
+    unsigned int id;
+    bool hasCondition;
+    bool isLogpoint;
 
-    // Set the __newindex metamethod to point to the parent table.
-    lua_pushstring_dll(api, L, "__newindex");
-    lua_pushvalue_dll(api, L, parent);
-    lua_rawset_dll(api, L, metaTable);
+    {
 
-    // Set the child's metatable.
-    lua_setmetatable_dll(api, L, child);
+        CriticalSectionLock lock(m_criticalSection);
 
-    int t2 = lua_gettop_dll(api, L);
-    assert(t1 == t2);
+        std::map<unsigned int, BreakpointOptions>::const_iterator iterator = script->breakpointOptions.find(line);
 
-}
+        if (iterator == script->breakpointOptions.end())
+        {
+            // This is a plain breakpoint.
+            return true;
+        }
 
-bool DebugBackend::CreateEnvironment(unsigned long api, lua_State* L, int stackLevel, int nilSentinel)
-{
+        const BreakpointOptions& options = iterator->second;
+        
+        id           = options.id;
+        hasCondition = !options.condition.empty();
+        isLogpoint   = !options.logMessage.empty();
 
-    int t1 = lua_gettop_dll(api, L);
+        if (hasCondition || isLogpoint)
+        {
 
-    lua_Debug stackEntry = { 0 };
+            compiled = &vm->compiledBreakpoints[std::make_pair(script->index, line)];
 
-    if (lua_getstack_dll(api, L, stackLevel, &stackEntry) != 1)
-    {
-        return false;
-    }
+            // Compile the condition and message the first time they're needed in
+            // this VM, or if they've been changed since they were compiled. Ids
+            // start at 1, so a new entry always needs to be compiled.
 
-    const char* name = NULL;
+            if (compiled->id != id)
+            {
 
-    // Copy the local variables into a new table.
+                if (compiled->id != 0)
+                {
+                    luaL_unref_dll(api, L, GetRegistryIndex(api), compiled->conditionRef);
+                    luaL_unref_dll(api, L, GetRegistryIndex(api), compiled->logRef);
+                }
 
-    lua_newtable_dll(api, L);
-    int localTable = lua_gettop_dll(api, L);
+                compiled->id            = id;
+                compiled->conditionRef  = LUA_NOREF;
+                compiled->logRef        = LUA_NOREF;
+                compiled->logText.clear();
 
-    for (int local = 1; name = lua_getlocal_dll(api, L, &stackEntry, local); ++local) 
-    {
-        if (!GetIsInternalVariable(name))
-        {
-            // If the value is nil, we use the nil sentinel so we can differentiate
-            // between undeclared, and declared but set to nil for lexical scoping.
-            if (lua_isnil_dll(api, L, -1))
-            {
-                lua_pop_dll(api, L, 1);
-                lua_pushstring_dll(api, L, name);
-                lua_pushvalue_dll(api, L, nilSentinel);
-            }
-            else
-            {
-                lua_pushstring_dll(api, L, name);
-                lua_insert_dll(api, L, -2);
+                if (hasCondition)
+                {
+                    compiled->conditionRef = CompileBreakpointCondition(api, L, options.condition);
+                }
+                
+                if (isLogpoint)
+                {
+                    CompileLogMessage(api, L, options.logMessage, compiled);
+                }
+            
             }
-            lua_rawset_dll(api, L, localTable);
-        }
-        else
-        {
-            lua_pop_dll(api, L, 1);
+
         }
+
     }
 
-    // Copy the up values into a new table.
-    
-    lua_newtable_dll(api, L);
-    int upValueTable = lua_gettop_dll(api, L);
-    
-    // Get the function which is the call stack entry so that we can examine
-    // the up values and get the environment.
-    lua_getinfo_dll(api, L, "fu", &stackEntry);
-    int functionIndex = lua_gettop_dll(api, L);
+    // Evaluate the condition without holding the critical section since it
+    // can run arbitrary script code.
 
-    for (int upValue = 1; name = lua_getupvalue_dll(api, L, functionIndex, upValue); ++upValue) 
+    if (hasCondition && !EvaluateBreakpointCondition(api, L, compiled->conditionRef))
     {
-        // C function up values has no name, so skip those.
-        if( name && *name)
+        return false;
+    }
+
+    {
+
+        CriticalSectionLock lock(m_criticalSection);
+
+        std::map<unsigned int, BreakpointOptions>::iterator iterator = script->breakpointOptions.find(line);
+
+        if (iterator == script->breakpointOptions.end() || iterator->second.id != id)
         {
-            // If the value is nil, we use the nil sentinel so we can differentiate
-            // between undeclared, and declared but set to nil for lexical scoping.
-            if (lua_isnil_dll(api, L, -1))
-            {
-                lua_pop_dll(api, L, 1);
-                lua_pushstring_dll(api, L, name);
-                lua_pushvalue_dll(api, L, nilSentinel);
-            }
-            else
-            {
-                lua_pushstring_dll(api, L, name);
-                lua_insert_dll(api, L, -2);
-            }
-            lua_rawset_dll(api, L, upValueTable);
+            // The options were changed while we were evaluating the condition.
+            return true;
         }
-        else
+
+        BreakpointOptions& options = iterator->second;
+        ++options.hits;
+        
+        if (options.hits < options.hitCount)
         {
-            lua_pop_dll(api, L, 1);
+            return false;
         }
-    }
-
-    // Create an environment table that chains all three of the tables together.
-    // They are accessed like this: local -> upvalue -> global
-    
-    lua_getfenv_dll(api, L, functionIndex);
-    int globalTable = lua_gettop_dll(api, L);
 
-    CreateChainedTable(api, L, nilSentinel, localTable, upValueTable, globalTable);
+    }
 
-    // Remove the function and global table from the stack.
-    lua_remove_dll(api, L, globalTable);
-    lua_remove_dll(api, L, functionIndex);
+    if (isLogpoint)
+    {
+        LogBreakpointMessage(api, L, compiled);
+        return false;
+    }
 
-    int t2 = lua_gettop_dll(api, L);
-    assert(t2 - t1 == 3);
-    
     return true;
 
 }
 
-int DebugBackend::IndexChained(unsigned long api, lua_State* L)
+int DebugBackend::CompileBreakpointCondition(unsigned long api, lua_State* L, const std::string& condition)
 {
 
-    LUA_CHECK_STACK(api, L, 1)
+    // Turn the expression into a statement by making it a return.
 
-    int key = 2;
+    std::string statement;
 
-    int nilSentinel = lua_upvalueindex_dll(api, 1);
+    statement  = "return \n";
+    statement += condition;
 
-    int table[3];
-    table[0] = lua_upvalueindex_dll(api, 2); // Locals
-    table[1] = lua_upvalueindex_dll(api, 3); // Up values
-    table[2] = lua_upvalueindex_dll(api, 4); // Globals
+    EnableIntercepts(false);
+    int error = LoadScriptWithoutIntercept(api, L, statement);
+    EnableIntercepts(true);
 
-    // Get from the local table.
-    lua_pushvalue_dll(api, L, key);
-    lua_gettable_dll(api, L, table[0]);
-        
-    // If it wasn't found, get from the up value table.
-    if (lua_isnil_dll(api, L, -1))
-    {
-        lua_pop_dll(api, L, 1);
-        lua_pushvalue_dll(api, L, key);
-        lua_gettable_dll(api, L, table[1]);
-    }
-    
-    // If it wasn't found, get from the global table.
-    if (lua_isnil_dll(api, L, -1))
+    if (error != 0)
     {
-        lua_pop_dll(api, L, 1);
-        lua_pushvalue_dll(api, L, key);
-        lua_gettable_dll(api, L, table[2]);
-    }
 
-    // If the value is our nil sentinel, convert it to an actual nil.
-    if (lua_rawequal_dll(api, L, -1, nilSentinel))
-    {
+        std::string message = "Error in breakpoint condition '" + condition + "': ";
+        
+        const char* errorMessage = lua_tostring_dll(api, L, -1);
+        
+        if (errorMessage != NULL)
+        {
+            message += errorMessage;
+        }
+
+        Message(message.c_str(), MessageType_Error);
         lua_pop_dll(api, L, 1);
-        lua_pushnil_dll(api, L);
+
+        return LUA_NOREF;
+
     }
 
-    return 1;
+    return luaL_ref_dll(api, L, GetRegistryIndex(api));
 
 }
 
-int DebugBackend::NewIndexChained(unsigned long api, lua_State* L)
+bool DebugBackend::EvaluateBreakpointCondition(unsigned long api, lua_State* L, int functionRef)
 {
 
-    LUA_CHECK_STACK(api, L, 0)
+    if (functionRef == LUA_NOREF)
+    {
+        // The condition didn't compile, so always break.
+        return true;
+    }
 
-    int key   = 2;
-    int value = 3;
+    int t1 = lua_gettop_dll(api, L);
 
-    int nilSentinel = lua_upvalueindex_dll(api, 1);
-    
-    int table[3];
-    table[0] = lua_upvalueindex_dll(api, 2); // Locals
-    table[1] = lua_upvalueindex_dll(api, 3); // Up values
-    table[2] = lua_upvalueindex_dll(api, 4); // Globals
+    // Create a sentinel value used in place of nil in the local and upvalue tables.
 
-    // Try to set the value in the local table.
-    
-    for (int i = 0; i < 2; ++i)
+    lua_newuserdata_dll(api, L, 0);
+    int nilSentinel = lua_gettop_dll(api, L);
+
+    // The hook isn't a Lua function, so the function executing the line is at
+    // level 0 of the stack.
+
+    if (!CreateEnvironment(api, L, 0, nilSentinel))
     {
-    
-        lua_pushvalue_dll(api, L, key);
-        lua_rawget_dll(api, L, table[i]); 
+        lua_settop_dll(api, L, t1);
+        return true;
+    }
 
-        bool exists = !lua_isnil_dll(api, L, -1);
-        lua_pop_dll(api, L, 1);
+    int envTable = lua_gettop_dll(api, L);
+
+    lua_rawgeti_dll(api, L, GetRegistryIndex(api), functionRef);
+    lua_pushvalue_dll(api, L, envTable);
+    lua_setfenv_dll(api, L, -2);
+
+    bool result = true;
+
+    if (lua_pcall_dll(api, L, 0, 1, 0) == 0)
+    {
+        result = lua_toboolean_dll(api, L, -1) != 0;
+    }
+    else
+    {
+
+        std::string message = "Error evaluating breakpoint condition: ";
         
-        if (exists)
+        const char* errorMessage = lua_tostring_dll(api, L, -1);
+        
+        if (errorMessage != NULL)
         {
-            
-            lua_pushvalue_dll(api, L, key);
-            
-            // Convert from nils to sentinel nils if necessary.
-            if (lua_isnil_dll(api, L, value))
-            {
-                lua_pushvalue_dll(api, L, nilSentinel);
-            }
-            else
-            {
-                lua_pushvalue_dll(api, L, value);
-            }
-            
-            lua_settable_dll(api, L, table[i]);
-            return 0;
-
+            message += errorMessage;
         }
 
+        Message(message.c_str(), MessageType_Error);
+    
     }
 
-    // Set on the global table.
-    lua_pushvalue_dll(api, L, key);
-    lua_pushvalue_dll(api, L, value);
-    lua_settable_dll(api, L, table[2]);
+    // Changes the condition makes to the locals and up values are not copied
+    // back since conditions shouldn't have side effects.
 
-    return 0;
+    lua_settop_dll(api, L, t1);
+    return result;
 
 }
 
-void DebugBackend::CreateChainedTable(unsigned long api, lua_State* L, int nilSentinel, int localTable, int upValueTable, int globalTable)
+void DebugBackend::CompileLogMessage(unsigned long api, lua_State* L, const std::string& message, CompiledBreakpoint* compiled)
 {
 
-    lua_newtable_dll(api, L);
-    int metaTable = lua_gettop_dll(api, L);
+    // Split the message into the text and the expressions in braces. There is
+    // always one more piece of text than there are expressions.
 
-    // Set the __index method of the metatable.
+    std::vector<std::string> expressions;
+    std::string text;
 
-    lua_pushstring_dll(api, L, "__index");
-    
-    lua_pushvalue_dll(api, L, nilSentinel);
-    lua_pushvalue_dll(api, L, localTable);
-    lua_pushvalue_dll(api, L, upValueTable);
-    lua_pushvalue_dll(api, L, globalTable);
-    
-    lua_pushcclosure_dll(api, L, m_apis[api].IndexChained, 4);
-    lua_settable_dll(api, L, metaTable);
-    
-    // Set the __newindex method of the metatable.
+    for (size_t i = 0; i < message.length(); ++i)
+    {
+        if ((message[i] == '{' || message[i] == '}') && i + 1 < message.length() && message[i + 1] == message[i])
+        {
+            text += message[i];
+            ++i;
+        }
+        else if (message[i] == '{')
+        {
 
-    lua_pushstring_dll(api, L, "__newindex");
-    
-    lua_pushvalue_dll(api, L, nilSentinel);
-    lua_pushvalue_dll(api, L, localTable);
-    lua_pushvalue_dll(api, L, upValueTable);
-    lua_pushvalue_dll(api, L, globalTable);
-    
-    lua_pushcclosure_dll(api, L, m_apis[api].NewIndexChained, 4);
-    lua_settable_dll(api, L, metaTable);
+            size_t end = message.find('}', i + 1);
 
-    // Set the table's metatable to be itself so we don't need an extra table
-    // to act as the proxy.
+            if (end == std::string::npos)
+            {
+                // Treat an unterminated expression as text.
+                text += message.substr(i);
+                break;
+            }
 
-    lua_pushvalue_dll(api, L, metaTable);
-    lua_setmetatable_dll(api, L, -1);
+            compiled->logText.push_back(text);
+            expressions.push_back(message.substr(i + 1, end - i - 1));
 
-}
+            text.clear();
+            i = end;
 
-void DebugBackend::SetLocals(unsigned long api, lua_State* L, int stackLevel, int localTable, int nilSentinel)
-{
+        }
+        else
+        {
+            text += message[i];
+        }
+    }
 
-    lua_Debug stackEntry;
+    compiled->logText.push_back(text);
 
-    int result = lua_getstack_dll(api, L, stackLevel, &stackEntry);
-    assert(result);        
+    if (expressions.empty())
+    {
+        return;
+    }
 
-    const char* name = NULL;
+    // Compile all of the expressions into one function that returns a value
+    // for each of them. The parentheses limit each expression to one value.
 
-    for (int local = 1; name = lua_getlocal_dll(api, L, &stackEntry, local); ++local) 
-    {
-        
-        // Drop the local value, we don't need it.
-        lua_pop_dll(api, L, 1);
+    std::string statement = "return \n";
 
-        if (!GetIsInternalVariable(name))
+    for (unsigned int i = 0; i < expressions.size(); ++i)
+    {
+        if (i > 0)
         {
+            statement += ", ";
+        }
+        statement += "(" + expressions[i] + ")";
+    }
 
-            // Get the new value for the local from the same named global.
-            lua_pushstring_dll(api, L, name);
-            lua_rawget_dll(api, L, localTable);
+    EnableIntercepts(false);
+    int error = LoadScriptWithoutIntercept(api, L, statement);
+    EnableIntercepts(true);
 
-            // Convert from nil sentinels to real nils.
-            if (lua_rawequal_dll(api, L, -1, nilSentinel))
-            {
-                lua_pop_dll(api, L, 1);
-                lua_pushnil_dll(api, L);
-            }
-            
-            // Update the local with this value.
-            lua_setlocal_dll(api, L, &stackEntry, local);
+    if (error != 0)
+    {
 
+        std::string errorText = "Error in logpoint message '" + message + "': ";
+        
+        const char* errorMessage = lua_tostring_dll(api, L, -1);
+        
+        if (errorMessage != NULL)
+        {
+            errorText += errorMessage;
         }
 
-    }              
+        Message(errorText.c_str(), MessageType_Error);
+        lua_pop_dll(api, L, 1);
 
-}
+        // Log the message as it was written.
+        compiled->logText.clear();
+        compiled->logText.push_back(message);
 
-void DebugBackend::SetUpValues(unsigned long api, lua_State* L, int stackLevel, int upValueTable, int nilSentinel)
-{
+        return;
 
-    lua_Debug stackEntry;
+    }
 
-    int result = lua_getstack_dll(api, L, stackLevel, &stackEntry);
-    assert(result);        
+    compiled->logRef = luaL_ref_dll(api, L, GetRegistryIndex(api));
 
-    // Get the function at the stack level.
-    lua_getinfo_dll(api, L, "f", &stackEntry);
-    int functionIndex = lua_gettop_dll(api, L);
+}
 
-    const char* name = NULL;
+void DebugBackend::LogBreakpointMessage(unsigned long api, lua_State* L, const CompiledBreakpoint* compiled)
+{
 
-    for (int upValue = 1; name = lua_getupvalue_dll(api, L, functionIndex, upValue); ++upValue)
+    std::string message = compiled->logText[0];
+
+    if (compiled->logRef != LUA_NOREF)
     {
-        
-        // Drop the up value value, we don't need it.
-        lua_pop_dll(api, L, 1);
 
-        if (strlen(name) > 0)
+        int t1 = lua_gettop_dll(api, L);
+        int numValues = compiled->logText.size() - 1;
+
+        lua_newuserdata_dll(api, L, 0);
+        int nilSentinel = lua_gettop_dll(api, L);
+
+        if (CreateEnvironment(api, L, 0, nilSentinel))
         {
 
-            // Get the new value for the local from the same named global.
-            lua_pushstring_dll(api, L, name);
-            lua_rawget_dll(api, L, upValueTable);
+            int envTable = lua_gettop_dll(api, L);
 
-            // Convert from nil sentinels to real nils.
-            if (lua_rawequal_dll(api, L, -1, nilSentinel))
+            lua_rawgeti_dll(api, L, GetRegistryIndex(api), compiled->logRef);
+            lua_pushvalue_dll(api, L, envTable);
+            lua_setfenv_dll(api, L, -2);
+
+            if (lua_pcall_dll(api, L, 0, numValues, 0) == 0)
             {
-                lua_pop_dll(api, L, 1);
-                lua_pushnil_dll(api, L);
+
+                for (int i = 0; i < numValues; ++i)
+                {
+
+                    int value = lua_gettop_dll(api, L) - numValues + 1 + i;
+                    int type  = lua_type_dll(api, L, value);
+
+                    if (type == LUA_TSTRING || type == LUA_TNUMBER)
+                    {
+                        size_t length;
+                        const char* string = lua_tolstring_dll(api, L, value, &length);
+                        message.append(string, length);
+                    }
+                    else if (type == LUA_TBOOLEAN)
+                    {
+                        message += lua_toboolean_dll(api, L, value) ? "true" : "false";
+                    }
+                    else
+                    {
+                        message += lua_typename_dll(api, L, type);
+                    }
+
+                    message += compiled->logText[i + 1];
+
+                }
+
             }
+            else
+            {
 
-            // Update the up value with this value.
-            lua_setupvalue_dll(api, L, functionIndex, upValue);
+                const char* errorMessage = lua_tostring_dll(api, L, -1);
+                
+                message += "<error: ";
+                message += errorMessage != NULL ? errorMessage : "unknown";
+                message += ">";
+            
+            }
 
         }
 
-    }    
+        lua_settop_dll(api, L, t1);
 
-    // Remove the function from the stack.
-    lua_pop_dll(api, L, 1);
+    }
+
+    BufferLogMessage(message);
 
 }
 
-bool DebugBackend::Evaluate(unsigned long api, lua_State* L, const std::string& expression, int stackLevel, std::string& result)
+void DebugBackend::BufferLogMessage(const std::string& message)
 {
 
-    if (!GetIsLuaLoaded())
+    CriticalSectionLock lock(m_criticalSection);
+
+    if (!m_haveBufferedLog)
     {
-        return false;
+        m_logBufferTime = GetTickCount();
     }
-            
-    // Adjust the desired stack level based on the number of stack levels we skipped when
-    // we sent the front end the call stack.
-
+    else
     {
-
-        CriticalSectionLock lock(m_criticalSection);
-
-        StateToVmMap::iterator stateIterator = m_stateToVm.find(L);
-        assert(stateIterator != m_stateToVm.end());
-
-        if (stateIterator != m_stateToVm.end())
-        {
-            stackLevel += stateIterator->second->stackTop;
-        }
-    
+        m_logBuffer += "\n";
     }
 
-    int t1 = lua_gettop_dll(api, L);
+    m_logBuffer += message;
+    m_haveBufferedLog = true;
 
-    // Create a sentinel value used in place of nil in the local and upvalue tables.
-    // We do this since we can't store a nil value in a table, but we need to preserve
-    // the fact that those variables were declared.
-    
-    lua_newuserdata_dll(api, L, 0);
-    int nilSentinel = lua_gettop_dll(api, L);    
-    
-    if (!CreateEnvironment(api, L, stackLevel, nilSentinel))
+    if (m_logBuffer.length() >= s_maxLogBufferSize || GetTickCount() - m_logBufferTime >= s_logFlushInterval)
     {
-        lua_pop_dll(api, L, 1);
-        return false;
+        FlushLogMessages();
     }
 
-    int envTable     = lua_gettop_dll(api, L);
-    int upValueTable = envTable - 1;
-    int localTable   = envTable - 2;
-
-    // Disable the debugger hook so that we don't try to debug the expression.
-    SetHookMode(api, L, HookMode_None);
-    EnableIntercepts(false);
-    
-    int stackTop = lua_gettop_dll(api, L);    
-    
-    // Turn the expression into a statement by making it a return.
-
-    std::string statement;
+}
 
-    statement  = "return \n";
-    statement += expression;
-    
-    int error = LoadScriptWithoutIntercept(api, L, statement.c_str());
+void DebugBackend::FlushLogMessages()
+{
 
-    if (error == LUA_ERRSYNTAX)
+    if (!m_haveBufferedLog)
     {
-        // The original expression may be a statement, so try loading it that way.
-        lua_pop_dll(api, L, 1);
-        error = LoadScriptWithoutIntercept(api, L, expression.c_str());
+        return;
     }
 
-    if (error == 0)
-    {
-        lua_pushvalue_dll(api, L, envTable);
-        lua_setfenv_dll(api, L, -2);
-        error = lua_pcall_dll(api, L, 0, LUA_MULTRET, 0);
-    }
+    m_eventChannel.WriteUInt32(EventId_Message);
+    m_eventChannel.WriteUInt32(0);
+    m_eventChannel.WriteUInt32(MessageType_Normal);
+    m_eventChannel.WriteString(m_logBuffer);
+    m_eventChannel.Flush();
 
-    TiXmlDocument document;
-        
-    if (error == 0)
-    {
+    m_logBuffer.clear();
+    m_haveBufferedLog = false;
 
-        // Figure out how many values were pushed into the stack when we evaluated the
-        // expression.
-        int nresults = lua_gettop_dll(api, L) - stackTop;
+}
 
-        TiXmlNode* root = NULL;
+void DebugBackend::BreakpointsActiveForScript(int scriptIndex)
+{
 
-        // If there are multiple results, create a root "values" node.
+    // Only VMs that have loaded the script can reach the breakpoint, so the
+    // others can keep running without the hook.
 
-        if (nresults > 1)
-        {
-            root = new TiXmlElement("values");
-            document.LinkEndChild(root);
-        }
-        else
+    for(StateToVmMap::iterator it = m_stateToVm.begin(); it != m_stateToVm.end(); it++)
+    {
+        VirtualMachine* vm = it->second;
+        if(GetHasLoadedScript(vm, scriptIndex))
         {
-            root = &document;
+            vm->haveActiveBreakpoints = true;
+            //May have issues with L not being the currently running thread
+            SetHookMode(vm->api, vm->L, HookMode_Full);
         }
+    }
 
-        for (int i = 0; i < nresults; ++i)
+}
+
+bool DebugBackend::GetHaveActiveBreakpoints(VirtualMachine* vm){
+
+    for(unsigned int i = 0; i < m_scripts.size(); ++i)
+    {
+        if(m_scripts[i]->HasBreakpointsActive() && GetHasLoadedScript(vm, i))
         {
+            return true;
+        } 
+    }
+
+    return false;
+}
 
-            TiXmlNode* node = GetValueAsText(api, L, -1 - (nresults - 1 - i));
+void DebugBackend::SetScriptLoaded(lua_State* L, unsigned int scriptIndex)
+{
 
-            if (node != NULL)
-            {
-                root->LinkEndChild(node);
-            }
-        
-        }
+    StateToVmMap::iterator stateIterator = m_stateToVm.find(L);
 
-        // Remove the results from the stack.
-        lua_pop_dll(api, L, nresults);
+    if (stateIterator == m_stateToVm.end())
+    {
+        return;
+    }
+
+    LoadedScripts* loadedScripts = stateIterator->second->loadedScripts;
 
+    if (scriptIndex >= loadedScripts->scripts.size())
+    {
+        loadedScripts->scripts.resize(scriptIndex + 1, false);
     }
-    else
+
+    if (!loadedScripts->scripts[scriptIndex])
     {
         
-        // The error message will have the form "junk:2: message" so remove the first bit
-        // that isn't useful.
-
-        const char* wholeMessage = lua_tostring_dll(api, L, -1);
-        const char* errorMessage = strstr(wholeMessage, ":2: ");
+        loadedScripts->scripts[scriptIndex] = true;
         
-        if (errorMessage == NULL)
-        {
-            errorMessage = wholeMessage;
-        }
-        else
+        // The script may have been loaded into another VM and had breakpoints
+        // set in it already.
+        if (m_scripts[scriptIndex]->HasBreakpointsActive())
         {
-            // Skip over the ":2: " part.
-            errorMessage += 4;
+            BreakpointsActiveForScript(scriptIndex);
+        }
+    
+    }
+
+}
+
+bool DebugBackend::GetHasLoadedScript(const VirtualMachine* vm, unsigned int scriptIndex) const
+{
+    const LoadedScripts* loadedScripts = vm->loadedScripts;
+    return loadedScripts->all || (scriptIndex < loadedScripts->scripts.size() && loadedScripts->scripts[scriptIndex]);
+}
+
+void DebugBackend::SetHaveActiveBreakpoints(bool breakpointsActive)
+{
+
+    //m_HookLock.Enter();
+
+    for(StateToVmMap::iterator it = m_stateToVm.begin(); it != m_stateToVm.end(); it++)
+    {
+        it->second->haveActiveBreakpoints = breakpointsActive;
+    }
+  
+    //We defer to UpdateHookMode to turn off the hook fully
+    if(breakpointsActive)
+    {
+        ActiveLuaHookInAllVms();
+    }
+}
+
+void DebugBackend::DeleteAllBreakpoints(){
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    for(std::vector<Script*>::iterator it = m_scripts.begin(); it != m_scripts.end(); it++)
+    {
+        (*it)->ClearBreakpoints();
+        (*it)->breakpointOptions.clear();
+    }
+
+    InvalidateFunctionCache();
+    FreeRetiredBreakpoints();
+
+    //Set all haveActiveBreakpoints for the vms back to false we leave to the hook being called for the vm
+    SetHaveActiveBreakpoints(false);
+}
+
+void DebugBackend::SendBreakEvent(unsigned long api, lua_State* L, int stackTop)
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    // Send the logpoint output from before the break first.
+    FlushLogMessages();
+
+    VirtualMachine* vm = GetVm(L);
+
+    // The C call stack will look something like this (may be any number of
+    // these stacked on top of each other):
+    //
+    //   +------+
+    //   |      | C function
+    //   +------+
+    //   |      |
+    //   | XXXX | Lua call mechanism (luaD_*, luaV_*, lua_*)
+    //   |      |
+    //   +------+
+    //   | XXXX | lua_call/lua_pcall/lua_load, etc.
+    //   +------+
+    //   |      |
+    //   |      | Pre-Lua code (main, etc.)
+    //   |      |
+    //   +------+
+
+    StackEntry nativeStack[100];
+    unsigned int nativeStackSize = 0;
+
+    if (vm != NULL)
+    {
+
+        // Make sure the front end shows the current name for the VM we're
+        // breaking in, since it's only polled periodically by the hook.
+        UpdateVmName(api, L, vm);
+
+        // Remember how many stack levels to skip so when we evaluate we can adjust
+        // the stack level accordingly.
+        vm->stackTop = stackTop;
+        nativeStackSize = GetCStack(vm->hThread, nativeStack, 100);
+    }
+    else
+    {
+        // For whatever reason we couldn't remember how many stack levels we want to skip,
+        // so don't skip any. This shouldn't happen under any normal circumstance since
+        // the state should have a corresponding VM.
+        stackTop = 0;
+    }
+
+    m_eventChannel.WriteUInt32(EventId_Break);
+    m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
+
+    // Send the call stack.
+
+    lua_Debug scriptStack[s_maxStackSize];
+    unsigned int scriptStackSize = 0;
+
+    for (int level = stackTop; scriptStackSize < s_maxStackSize && lua_getstack_dll(api, L, level, &scriptStack[scriptStackSize]); ++level)
+    {
+        lua_getinfo_dll(api, L, "nSlu", &scriptStack[scriptStackSize]);
+        ++scriptStackSize;
+    }
+
+    // Create a unified call stack.
+    StackEntry stack[s_maxStackSize];
+    unsigned int stackSize = GetUnifiedStack(api, vm, nativeStack, nativeStackSize, scriptStack, scriptStackSize, stack);
+
+    m_eventChannel.WriteUInt32(stackSize);
+
+    for (unsigned int i = 0; i < stackSize; ++i)
+    {
+        unsigned int stackIndex = stackSize - i - 1;
+        m_eventChannel.WriteUInt32(stack[stackIndex].scriptIndex);
+        m_eventChannel.WriteUInt32(stack[stackIndex].line);
+        m_eventChannel.WriteString(stack[stackIndex].name);
+    }
+
+    m_eventChannel.Flush();
+
+}
+
+void DebugBackend::SendExceptionEvent(lua_State* L, const char* message)
+{
+    m_eventChannel.WriteUInt32(EventId_Exception);
+    m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
+    m_eventChannel.WriteString(message);
+    m_eventChannel.Flush();
+}
+
+void DebugBackend::BreakFromScript(unsigned long api, lua_State* L)
+{
+    CriticalSectionLock lock(m_breakLock);
+
+    SendBreakEvent(api, L);
+    WaitForContinue(api, L);        
+    BeginStep(api, L);
+}
+
+int DebugBackend::Call(unsigned long api, lua_State* L, int nargs, int nresults, int errorfunc)
+{
+
+    // Check it's not our error handler that's getting called (happens when there's an
+    // error). We also need to check that our error handler is not the error function,
+    // since that can happen if one of the Lua interfaces we hooked calls another one
+    // internally.
+    int result = 0;
+
+    if (lua_tocfunction_dll(api, L, -1) == StaticErrorHandler || (errorfunc != 0 && lua_tocfunction_dll(api, L, errorfunc) == StaticErrorHandler))
+    {
+        result = lua_pcall_dll(api, L, nargs, nresults, errorfunc);
+    }
+    else
+    {
+
+        if (lua_gettop_dll(api, L) >= nargs + 1)
+        {
+            
+            // Push our error handler onto the stack before the function and the arguments.
+            if (errorfunc != 0)
+            {
+                lua_pushvalue_dll(api, L, errorfunc);
+            }
+            else
+            {
+                lua_pushnil_dll(api, L);
+            }
+            lua_pushcclosure_dll(api, L, StaticErrorHandler, 1);
+
+            int errorHandler = lua_gettop_dll(api, L) - (nargs + 1);
+            lua_insert_dll(api, L, errorHandler);
+
+            // Invoke the function
+            result = lua_pcall_dll(api, L, nargs, nresults, errorHandler);
+
+            // Remove our error handler from the stack.
+            lua_remove_dll(api, L, errorHandler);
+        
+        }
+        else
+        {
+            // In this case there wasn't a function on the top of the stack, so don't push our
+            // error handler there since it will get called instead.
+            result = lua_pcall_dll(api, L, nargs, nresults, errorfunc);
+        }
+
+    }
+
+    if (result != 0)
+    {
+        // The frames unwound by the error didn't send return events, so the
+        // hook needs to find the depth of the stack again.
+        CriticalSectionLock lock(m_criticalSection);
+        StateToVmMap::iterator stateIterator = m_stateToVm.find(L);
+        if (stateIterator != m_stateToVm.end())
+        {
+            stateIterator->second->breakpointStackValid = false;
+        }
+    }
+
+    return result;
+
+}
+
+int DebugBackend::StaticErrorHandler(lua_State* L)
+{
+    unsigned long api = s_instance->GetApiForVm(L);
+    return s_instance->ErrorHandler(api, L);
+}
+
+int DebugBackend::ErrorHandler(unsigned long api, lua_State* L)
+{
+
+    int top = lua_gettop_dll(api, L);
+
+    // Get the error mesasge.
+    const char* message = lua_tostring_dll(api, L, -1);
+
+    if (message == NULL)
+    {
+        message = "No error message available";
+    }
+
+    if (!GetIsExceptionIgnored(message))
+    {
+
+        // Send the exception event. Ignore the top of the stack when we send the
+        // call stack since the top of the call stack is this function.
+
+        // Sometimes the break lock will already be held.  For example, consider
+        // the following sequence of events:
+        //   1) The main lua thread is stopped in the debugger, holding the
+        //      break lock in DebugBackend::BreakFromScript.
+        //   2) The decoda thread tries to evaluate a variable from the watch
+        //      window
+        //   3) The evaluation of __towatch or __tostring calls lua_error()
+        // That will lead us right here, unable to grab the break lock.  To avoid
+        // deadlocking in this case, just send an error message.
+
+        CriticalSectionTryLock lock(m_breakLock);
+        if (lock.IsHeld()) 
+        {
+            SendBreakEvent(api, L, 1);
+            SendExceptionEvent(L, message);
+            WaitForContinue(api, L);
+            BeginStep(api, L);
+        } 
+        else 
+        {
+            Message(message, MessageType_Error);
+        }
+
+    }
+        
+    // Try invoking the user specified error function.
+
+    lua_pushvalue_dll(api, L, lua_upvalueindex_dll(api, 1));
+
+    if (!lua_isnil_dll(api, L, -1))
+    {
+        lua_pushvalue_dll(api, L, -2);
+        lua_pcall_dll(api, L, 1, 1, 0);
+    }
+    else
+    {
+        lua_pop_dll(api, L, 1);
+        // Push the original message back as the return so that it will be available
+        // to custom error handlers.
+        lua_pushvalue_dll(api, L, -1);
+    }
+        
+    return 1;
+
+}
+
+bool DebugBackend::GetStartupDirectory(char* path, int maxPathLength)
+{
+
+    if (!GetModuleFileName(g_hInstance, path, maxPathLength))
+    {
+        return false;
+    }
+
+    char* lastSlash = strrchr(path, '\\');
+
+    if (lastSlash == NULL)
+    {
+        return false;
+    }
+
+    // Terminate the path after the last slash.
+
+    lastSlash[1] = 0;
+    return true;
+
+}
+
+void DebugBackend::ChainTables(unsigned long api, lua_State* L, int child, int parent)
+{
+    
+    int t1 = lua_gettop_dll(api, L);
+
+    // Create the metatable to link them.
+    lua_newtable_dll(api, L);
+    int metaTable = lua_gettop_dll(api, L);
+
+    // Set the __index metamethod to point to the parent table.
+    lua_pushstring_dll(api, L, "__index");
+    lua_pushvalue_dll(api, L, parent);
+    lua_rawset_dll(api, L, metaTable);
+
+    // Set the __newindex metamethod to point to the parent table.
+    lua_pushstring_dll(api, L, "__newindex");
+    lua_pushvalue_dll(api, L, parent);
+    lua_rawset_dll(api, L, metaTable);
+
+    // Set the child's metatable.
+    lua_setmetatable_dll(api, L, child);
+
+    int t2 = lua_gettop_dll(api, L);
+    assert(t1 == t2);
+
+}
+
+bool DebugBackend::CreateEnvironment(unsigned long api, lua_State* L, int stackLevel, int nilSentinel)
+{
+
+    int t1 = lua_gettop_dll(api, L);
+
+    lua_Debug stackEntry = { 0 };
+
+    if (lua_getstack_dll(api, L, stackLevel, &stackEntry) != 1)
+    {
+        return false;
+    }
+
+    const char* name = NULL;
+
+    // Copy the local variables into a new table.
+
+    lua_newtable_dll(api, L);
+    int localTable = lua_gettop_dll(api, L);
+
+    for (int local = 1; name = lua_getlocal_dll(api, L, &stackEntry, local); ++local) 
+    {
+        if (!GetIsInternalVariable(name))
+        {
+            // If the value is nil, we use the nil sentinel so we can differentiate
+            // between undeclared, and declared but set to nil for lexical scoping.
+            if (lua_isnil_dll(api, L, -1))
+            {
+                lua_pop_dll(api, L, 1);
+                lua_pushstring_dll(api, L, name);
+                lua_pushvalue_dll(api, L, nilSentinel);
+            }
+            else
+            {
+                lua_pushstring_dll(api, L, name);
+                lua_insert_dll(api, L, -2);
+            }
+            lua_rawset_dll(api, L, localTable);
+        }
+        else
+        {
+            lua_pop_dll(api, L, 1);
+        }
+    }
+
+    // Copy the up values into a new table.
+    
+    lua_newtable_dll(api, L);
+    int upValueTable = lua_gettop_dll(api, L);
+    
+    // Get the function which is the call stack entry so that we can examine
+    // the up values and get the environment.
+    lua_getinfo_dll(api, L, "fu", &stackEntry);
+    int functionIndex = lua_gettop_dll(api, L);
+
+    for (int upValue = 1; name = lua_getupvalue_dll(api, L, functionIndex, upValue); ++upValue) 
+    {
+        // C function up values has no name, so skip those.
+        if( name && *name)
+        {
+            // If the value is nil, we use the nil sentinel so we can differentiate
+            // between undeclared, and declared but set to nil for lexical scoping.
+            if (lua_isnil_dll(api, L, -1))
+            {
+                lua_pop_dll(api, L, 1);
+                lua_pushstring_dll(api, L, name);
+                lua_pushvalue_dll(api, L, nilSentinel);
+            }
+            else
+            {
+                lua_pushstring_dll(api, L, name);
+                lua_insert_dll(api, L, -2);
+            }
+            lua_rawset_dll(api, L, upValueTable);
+        }
+        else
+        {
+            lua_pop_dll(api, L, 1);
+        }
+    }
+
+    // Create an environment table that chains all three of the tables together.
+    // They are accessed like this: local -> upvalue -> global
+    
+    lua_getfenv_dll(api, L, functionIndex);
+    int globalTable = lua_gettop_dll(api, L);
+
+    CreateChainedTable(api, L, nilSentinel, localTable, upValueTable, globalTable);
+
+    // Remove the function and global table from the stack.
+    lua_remove_dll(api, L, globalTable);
+    lua_remove_dll(api, L, functionIndex);
+
+    int t2 = lua_gettop_dll(api, L);
+    assert(t2 - t1 == 3);
+    
+    return true;
+
+}
+
+int DebugBackend::IndexChained(unsigned long api, lua_State* L)
+{
+
+    LUA_CHECK_STACK(api, L, 1)
+
+    int key = 2;
+
+    int nilSentinel = lua_upvalueindex_dll(api, 1);
+
+    int table[3];
+    table[0] = lua_upvalueindex_dll(api, 2); // Locals
+    table[1] = lua_upvalueindex_dll(api, 3); // Up values
+    table[2] = lua_upvalueindex_dll(api, 4); // Globals
+
+    // Get from the local table.
+    lua_pushvalue_dll(api, L, key);
+    lua_gettable_dll(api, L, table[0]);
+        
+    // If it wasn't found, get from the up value table.
+    if (lua_isnil_dll(api, L, -1))
+    {
+        lua_pop_dll(api, L, 1);
+        lua_pushvalue_dll(api, L, key);
+        lua_gettable_dll(api, L, table[1]);
+    }
+    
+    // If it wasn't found, get from the global table.
+    if (lua_isnil_dll(api, L, -1))
+    {
+        lua_pop_dll(api, L, 1);
+        lua_pushvalue_dll(api, L, key);
+        lua_gettable_dll(api, L, table[2]);
+    }
+
+    // If the value is our nil sentinel, convert it to an actual nil.
+    if (lua_rawequal_dll(api, L, -1, nilSentinel))
+    {
+        lua_pop_dll(api, L, 1);
+        lua_pushnil_dll(api, L);
+    }
+
+    return 1;
+
+}
+
+int DebugBackend::NewIndexChained(unsigned long api, lua_State* L)
+{
+
+    LUA_CHECK_STACK(api, L, 0)
+
+    int key   = 2;
+    int value = 3;
+
+    int nilSentinel = lua_upvalueindex_dll(api, 1);
+    
+    int table[3];
+    table[0] = lua_upvalueindex_dll(api, 2); // Locals
+    table[1] = lua_upvalueindex_dll(api, 3); // Up values
+    table[2] = lua_upvalueindex_dll(api, 4); // Globals
+
+    // Try to set the value in the local table.
+    
+    for (int i = 0; i < 2; ++i)
+    {
+    
+        lua_pushvalue_dll(api, L, key);
+        lua_rawget_dll(api, L, table[i]); 
+
+        bool exists = !lua_isnil_dll(api, L, -1);
+        lua_pop_dll(api, L, 1);
+        
+        if (exists)
+        {
+            
+            lua_pushvalue_dll(api, L, key);
+            
+            // Convert from nils to sentinel nils if necessary.
+            if (lua_isnil_dll(api, L, value))
+            {
+                lua_pushvalue_dll(api, L, nilSentinel);
+            }
+            else
+            {
+                lua_pushvalue_dll(api, L, value);
+            }
+            
+            lua_settable_dll(api, L, table[i]);
+            return 0;
+
+        }
+
+    }
+
+    // Set on the global table.
+    lua_pushvalue_dll(api, L, key);
+    lua_pushvalue_dll(api, L, value);
+    lua_settable_dll(api, L, table[2]);
+
+    return 0;
+
+}
+
+void DebugBackend::CreateChainedTable(unsigned long api, lua_State* L, int nilSentinel, int localTable, int upValueTable, int globalTable)
+{
+
+    lua_newtable_dll(api, L);
+    int metaTable = lua_gettop_dll(api, L);
+
+    // Set the __index method of the metatable.
+
+    lua_pushstring_dll(api, L, "__index");
+    
+    lua_pushvalue_dll(api, L, nilSentinel);
+    lua_pushvalue_dll(api, L, localTable);
+    lua_pushvalue_dll(api, L, upValueTable);
+    lua_pushvalue_dll(api, L, globalTable);
+    
+    lua_pushcclosure_dll(api, L, m_apis[api].IndexChained, 4);
+    lua_settable_dll(api, L, metaTable);
+    
+    // Set the __newindex method of the metatable.
+
+    lua_pushstring_dll(api, L, "__newindex");
+    
+    lua_pushvalue_dll(api, L, nilSentinel);
+    lua_pushvalue_dll(api, L, localTable);
+    lua_pushvalue_dll(api, L, upValueTable);
+    lua_pushvalue_dll(api, L, globalTable);
+    
+    lua_pushcclosure_dll(api, L, m_apis[api].NewIndexChained, 4);
+    lua_settable_dll(api, L, metaTable);
+
+    // Set the table's metatable to be itself so we don't need an extra table
+    // to act as the proxy.
+
+    lua_pushvalue_dll(api, L, metaTable);
+    lua_setmetatable_dll(api, L, -1);
+
+}
+
+void DebugBackend::SetLocals(unsigned long api, lua_State* L, int stackLevel, int localTable, int nilSentinel)
+{
+
+    lua_Debug stackEntry;
+
+    int result = lua_getstack_dll(api, L, stackLevel, &stackEntry);
+    assert(result);        
+
+    const char* name = NULL;
+
+    for (int local = 1; name = lua_getlocal_dll(api, L, &stackEntry, local); ++local) 
+    {
+        
+        // Drop the local value, we don't need it.
+        lua_pop_dll(api, L, 1);
+
+        if (!GetIsInternalVariable(name))
+        {
+
+            // Get the new value for the local from the same named global.
+            lua_pushstring_dll(api, L, name);
+            lua_rawget_dll(api, L, localTable);
+
+            // Convert from nil sentinels to real nils.
+            if (lua_rawequal_dll(api, L, -1, nilSentinel))
+            {
+                lua_pop_dll(api, L, 1);
+                lua_pushnil_dll(api, L);
+            }
+            
+            // Update the local with this value.
+            lua_setlocal_dll(api, L, &stackEntry, local);
+
+        }
+
+    }              
+
+}
+
+void DebugBackend::SetUpValues(unsigned long api, lua_State* L, int stackLevel, int upValueTable, int nilSentinel)
+{
+
+    lua_Debug stackEntry;
+
+    int result = lua_getstack_dll(api, L, stackLevel, &stackEntry);
+    assert(result);        
+
+    // Get the function at the stack level.
+    lua_getinfo_dll(api, L, "f", &stackEntry);
+    int functionIndex = lua_gettop_dll(api, L);
+
+    const char* name = NULL;
+
+    for (int upValue = 1; name = lua_getupvalue_dll(api, L, functionIndex, upValue); ++upValue)
+    {
+        
+        // Drop the up value value, we don't need it.
+        lua_pop_dll(api, L, 1);
+
+        if (strlen(name) > 0)
+        {
+
+            // Get the new value for the local from the same named global.
+            lua_pushstring_dll(api, L, name);
+            lua_rawget_dll(api, L, upValueTable);
+
+            // Convert from nil sentinels to real nils.
+            if (lua_rawequal_dll(api, L, -1, nilSentinel))
+            {
+                lua_pop_dll(api, L, 1);
+                lua_pushnil_dll(api, L);
+            }
+
+            // Update the up value with this value.
+            lua_setupvalue_dll(api, L, functionIndex, upValue);
+
+        }
+
+    }    
+
+    // Remove the function from the stack.
+    lua_pop_dll(api, L, 1);
+
+}
+
+bool DebugBackend::Evaluate(unsigned long api, lua_State* L, const std::string& expression, int stackLevel, std::string& result)
+{
+
+    if (!GetIsLuaLoaded())
+    {
+        return false;
+    }
+            
+    // Adjust the desired stack level based on the number of stack levels we skipped when
+    // we sent the front end the call stack.
+
+    VirtualMachine* vm = NULL;
+
+    {
+
+        CriticalSectionLock lock(m_criticalSection);
+
+        StateToVmMap::iterator stateIterator = m_stateToVm.find(L);
+        assert(stateIterator != m_stateToVm.end());
+
+        if (stateIterator == m_stateToVm.end())
+        {
+            return false;
+        }
+
+        vm = stateIterator->second;
+        stackLevel += vm->stackTop;
+    
+    }
+
+    int t1 = lua_gettop_dll(api, L);
+
+    // The watch window evaluates all of its expressions at the same stack level
+    // each time we break, so the environment is only created once for them.
+
+    if (!PushEvaluateEnvironment(api, L, vm, stackLevel))
+    {
+        return false;
+    }
+
+    int envTable     = lua_gettop_dll(api, L);
+    int upValueTable = envTable - 1;
+    int localTable   = envTable - 2;
+    int nilSentinel  = envTable - 3;
+
+    // Tables in the results are given handles so the frontend can expand them
+    // later instead of us sending everything inside them now.
+    PushValueHandles(api, L, vm);
+    int handles = lua_gettop_dll(api, L);
+
+    // Tables we've already written in this result, and their handles.
+    lua_newtable_dll(api, L);
+    int visited = lua_gettop_dll(api, L);
+
+    // Disable the debugger hook so that we don't try to debug the expression.
+    // It's replaced by a count hook that stops expressions that run too long.
+    BeginEvaluateLimits(api, L, vm);
+    EnableIntercepts(false);
+    
+    int stackTop = lua_gettop_dll(api, L);    
+    
+    int error = PushEvaluateFunction(api, L, vm, expression);
+
+    if (error == 0)
+    {
+        lua_pushvalue_dll(api, L, envTable);
+        lua_setfenv_dll(api, L, -2);
+        error = lua_pcall_dll(api, L, 0, LUA_MULTRET, 0);
+    }
+
+    ValueWriter writer;
+        
+    if (error == 0)
+    {
+
+        // Figure out how many values were pushed into the stack when we evaluated the
+        // expression.
+        int nresults = lua_gettop_dll(api, L) - stackTop;
+
+        // If there are multiple results, they're written as a list of values.
+
+        if (nresults > 1)
+        {
+            writer.BeginValues();
+        }
+
+        for (int i = 0; i < nresults; ++i)
+        {
+            // Only the first level of tables is expanded.
+            WriteValue(api, L, -1 - (nresults - 1 - i), writer, 2, NULL, false, handles, visited);
+        }
+
+        if (nresults > 1)
+        {
+            writer.EndValues();
+        }
+
+        // Remove the results from the stack.
+        lua_pop_dll(api, L, nresults);
+
+    }
+    else
+    {
+        
+        // The error message will have the form "junk:2: message" so remove the first bit
+        // that isn't useful.
+
+        const char* wholeMessage = lua_tostring_dll(api, L, -1);
+        const char* errorMessage = strstr(wholeMessage, ":2: ");
+        
+        if (errorMessage == NULL)
+        {
+            errorMessage = wholeMessage;
+        }
+        else
+        {
+            // Skip over the ":2: " part.
+            errorMessage += 4;
         }
 
         std::string text;
 
-        text = "Error: ";
-        text += errorMessage;
+        text = "Error: ";
+        text += errorMessage;
+
+        writer.WriteError(text);
+
+        lua_pop_dll(api, L, 1);
+
+    }
+
+    // Copy any changes to the up values due to evaluating the watch back.
+    SetLocals(api, L, stackLevel, localTable, nilSentinel);
+    SetUpValues(api, L, stackLevel, upValueTable, nilSentinel);
+
+    // Remove the nil sentinel, local, up value, environment, handle and visited
+    // tables from the stack. All but the last are still referenced by the cache.
+    lua_pop_dll(api, L, 6);
+
+#ifdef XML_VALUES
+    result = GetValuesAsXml(writer.GetData());
+#else
+    result = writer.GetData();
+#endif
+
+    // Reenable the debugger hook
+    EndEvaluateLimits();
+    EnableIntercepts(true);
+    SetHookMode(api, L, HookMode_Full);
+
+    int t2 = lua_gettop_dll(api, L);
+    assert(t1 == t2);
+
+    return error == 0;
+
+}
+
+bool DebugBackend::PushEvaluateEnvironment(unsigned long api, lua_State* L, VirtualMachine* vm, int stackLevel)
+{
+
+    if (vm->evaluateEnvironmentRef != LUA_NOREF && vm->evaluateStackLevel == stackLevel)
+    {
+
+        lua_rawgeti_dll(api, L, GetRegistryIndex(api), vm->evaluateEnvironmentRef);
+        int holder = lua_gettop_dll(api, L);
+
+        for (int i = 1; i <= 4; ++i)
+        {
+            lua_rawgeti_dll(api, L, holder, i);
+        }
+
+        lua_remove_dll(api, L, holder);
+        return true;
+
+    }
+
+    // Only one stack level is cached, since evaluating at one level can change
+    // the up values shared with another.
+    if (vm->evaluateEnvironmentRef != LUA_NOREF)
+    {
+        luaL_unref_dll(api, L, GetRegistryIndex(api), vm->evaluateEnvironmentRef);
+        vm->evaluateEnvironmentRef = LUA_NOREF;
+    }
+
+    // Create a sentinel value used in place of nil in the local and upvalue tables.
+    // We do this since we can't store a nil value in a table, but we need to preserve
+    // the fact that those variables were declared.
+    
+    lua_newuserdata_dll(api, L, 0);
+    int nilSentinel = lua_gettop_dll(api, L);    
+    
+    if (!CreateEnvironment(api, L, stackLevel, nilSentinel))
+    {
+        lua_pop_dll(api, L, 1);
+        return false;
+    }
+
+    // Keep the four values in a table in the registry.
+
+    lua_newtable_dll(api, L);
+    int holder = lua_gettop_dll(api, L);
+
+    for (int i = 1; i <= 4; ++i)
+    {
+        lua_pushinteger_dll(api, L, i);
+        lua_pushvalue_dll(api, L, nilSentinel + i - 1);
+        lua_rawset_dll(api, L, holder);
+    }
+
+    vm->evaluateEnvironmentRef  = luaL_ref_dll(api, L, GetRegistryIndex(api));
+    vm->evaluateStackLevel      = stackLevel;
+
+    return true;
+
+}
+
+int DebugBackend::PushEvaluateFunction(unsigned long api, lua_State* L, VirtualMachine* vm, const std::string& expression)
+{
+
+    if (vm->evaluateFunctionsRef == LUA_NOREF)
+    {
+        lua_newtable_dll(api, L);
+        vm->evaluateFunctionsRef = luaL_ref_dll(api, L, GetRegistryIndex(api));
+    }
+
+    lua_rawgeti_dll(api, L, GetRegistryIndex(api), vm->evaluateFunctionsRef);
+    int functions = lua_gettop_dll(api, L);
+
+    lua_pushlstring_dll(api, L, expression.c_str(), expression.length());
+    lua_rawget_dll(api, L, functions);
+
+    if (!lua_isnil_dll(api, L, -1))
+    {
+        lua_remove_dll(api, L, functions);
+        return 0;
+    }
+
+    lua_pop_dll(api, L, 1);
+
+    // Turn the expression into a statement by making it a return.
+
+    std::string statement;
+
+    statement  = "return \n";
+    statement += expression;
+    
+    int error = LoadScriptWithoutIntercept(api, L, statement.c_str());
+
+    if (error == LUA_ERRSYNTAX)
+    {
+        // The original expression may be a statement, so try loading it that way.
+        lua_pop_dll(api, L, 1);
+        error = LoadScriptWithoutIntercept(api, L, expression.c_str());
+    }
+
+    if (error == 0)
+    {
+        // Remember the function for the next time the expression is evaluated.
+        lua_pushlstring_dll(api, L, expression.c_str(), expression.length());
+        lua_pushvalue_dll(api, L, -2);
+        lua_rawset_dll(api, L, functions);
+    }
+
+    // Leave the function or error message on the stack.
+    lua_remove_dll(api, L, functions);
+
+    return error;
+
+}
+
+void DebugBackend::ReleaseEvaluateCache(unsigned long api, lua_State* L, VirtualMachine* vm)
+{
+
+    if (vm->evaluateEnvironmentRef != LUA_NOREF)
+    {
+        luaL_unref_dll(api, L, GetRegistryIndex(api), vm->evaluateEnvironmentRef);
+        vm->evaluateEnvironmentRef = LUA_NOREF;
+    }
+
+    if (vm->evaluateFunctionsRef != LUA_NOREF)
+    {
+        luaL_unref_dll(api, L, GetRegistryIndex(api), vm->evaluateFunctionsRef);
+        vm->evaluateFunctionsRef = LUA_NOREF;
+    }
+
+    if (vm->valueHandlesRef != LUA_NOREF)
+    {
+        luaL_unref_dll(api, L, GetRegistryIndex(api), vm->valueHandlesRef);
+        vm->valueHandlesRef = LUA_NOREF;
+    }
+
+    vm->evaluateStackLevel = -1;
+
+}
+
+bool DebugBackend::CallMetaMethod(unsigned long api, lua_State* L, int valueIndex, const char* method, int numResults, int& result) const
+{
+
+    if (!lua_checkstack_dll(api, L, 3))
+    {
+        return false;
+    }
+
+    // Once an evaluation has timed out, values are written without calling
+    // any more code.
+    if (GetIsEvaluateTimedOut())
+    {
+        return false;
+    }
+
+    if (lua_getmetatable_dll(api, L, valueIndex))
+    {
+
+        int metaTableIndex = lua_gettop_dll(api, L);
+
+        if (!lua_isnil_dll(api, L, metaTableIndex))
+        {
+
+            lua_pushstring_dll(api, L, method);
+            lua_gettable_dll(api, L, metaTableIndex);
+
+            if (lua_isnil_dll(api, L, -1))
+            {
+                // The meta-method doesn't exist.
+                lua_pop_dll(api, L, 1);
+                lua_remove_dll(api, L, metaTableIndex);
+                return false;
+            }
+            else
+            {
+                lua_pushvalue_dll(api, L, valueIndex);
+                result = lua_pcall_dll(api, L, 1, numResults, 0);
+            }
+
+        }
+
+        lua_remove_dll(api, L, metaTableIndex);
+        return true;
+
+    }
+
+    return false;
+
+}
+
+void DebugBackend::MergeTables(unsigned long api, lua_State* L, unsigned int tableIndex1, unsigned int tableIndex2) const
+{
+    
+    if (!lua_checkstack_dll(api, L, 3))
+    {
+        return;
+    }
+
+    tableIndex1 = lua_absindex_dll(api, L, tableIndex1);
+    tableIndex2 = lua_absindex_dll(api, L, tableIndex2);
+
+    lua_newtable_dll(api, L);
+    int dstTableIndex = lua_gettop_dll(api, L);
+
+    // Iterate over the keys in table 1, inserting them into the
+    // target table.
+
+    lua_pushnil_dll(api, L);
+
+    while (lua_next_dll(api, L, tableIndex1) != 0)
+    {
+        lua_pushvalue_dll(api, L, -2);
+        lua_insert_dll(api, L, -2);
+        lua_rawset_dll(api, L, dstTableIndex);
+    }
+
+    // Iterate over the keys in table 2, inserting them into the
+    // target table.
+
+    lua_pushnil_dll(api, L);
+
+    while (lua_next_dll(api, L, tableIndex2) != 0)
+    {
+        lua_pushvalue_dll(api, L, -2);
+        lua_insert_dll(api, L, -2);
+        lua_rawset_dll(api, L, dstTableIndex);
+    }
+
+}
+
+bool DebugBackend::WriteLuaBindClassValue(unsigned long api, lua_State* L, ValueWriter& writer, unsigned int maxDepth, bool displayAsKey) const
+{
+
+    if (!lua_checkstack_dll(api, L, 3))
+    {
+        return false;
+    }
+
+    if (lua_getmetatable_dll(api, L, -1))
+    {
+        
+        lua_pushstring_dll(api, L, "__luabind_class");
+        lua_rawget_dll(api, L, -2);
+
+        bool luabindClass = !lua_isnil_dll(api, L, -1);
+
+        // Remove the value and the metatable from the stack.
+        lua_pop_dll(api, L, 2);
+
+        if (!luabindClass)
+        {
+            // This userdata doesn't have the luabind class signature in its
+            // metatable.
+            return false;
+        }
+
+    }
+
+    const char* className = "luabind";
+
+    // Luabind stores the accessible methods in the environment for the userdata
+    // so we can directly convert that into the value.
+    lua_getfenv_dll(api, L, -1);
+
+    // If the environment has a metatable, those are the class methods and we
+    // need to merge them into the 
+    if (lua_getmetatable_dll(api, L, -1))
+    {
+
+        MergeTables(api, L, -1, -2);
+
+        int tableIndex = lua_gettop_dll(api, L);
+        WriteValue(api, L, tableIndex, writer, maxDepth, className, displayAsKey); 
+
+        lua_pop_dll(api, L, 2);
+
+    }
+    else
+    {
+        int tableIndex = lua_gettop_dll(api, L);
+        WriteValue(api, L, tableIndex, writer, maxDepth, className, displayAsKey); 
+    }
+
+    // Remove the value from the stack.
+    lua_pop_dll(api, L, 1);
+
+    return true;
+
+}
+
+void DebugBackend::WriteValue(unsigned long api, lua_State* L, int n, ValueWriter& writer, int maxDepth, const char* typeNameOverride, bool displayAsKey, int handles, int visited) const
+{
+
+    int t1 = lua_gettop_dll(api, L);
+
+    if (!lua_checkstack_dll(api, L, 1))
+    {
+        writer.WriteError("Stack overflow");
+        return;
+    }
+
+    // Duplicate the item since calling to* can modify the value.
+    lua_pushvalue_dll(api, L, n);
+
+    int type = lua_type_dll(api, L, -1);
+    const char* typeName = lua_typename_dll(api, L, type);
+
+    if (typeNameOverride == NULL)
+    {
+        typeNameOverride = typeName;
+    }
+
+    if (strcmp(typeName, "table") == 0)
+    {
+        bool written = false;
+        int stackStart = lua_gettop_dll(api, L);
+        int result = 0;
+        std::string className;
+        if (CallMetaMethod(api, L, stackStart, "__towatch", LUA_MULTRET, result))
+        {
+            if (result == 0)
+            {
+                int numResults = lua_gettop_dll(api, L) - stackStart;
+
+                if( numResults == 0)
+                {
+                    lua_pushnil_dll( api, L);
+                    numResults = 1;
+                }
+                else if (numResults > 1)
+                {
+                    // First result is the class name if multiple results are 
+                    // returned.
+                    className = lua_tostring_dll(api, L, -numResults);
+                }
+
+                WriteValue(api, L, -1, writer, maxDepth, className.c_str(), displayAsKey, handles, visited);
+                written = true;
+
+                // Remove the table value.
+                lua_pop_dll(api, L, numResults);
+
+            }
+        }
+        if (!written)
+        {
+            WriteTable(api, L, -1, writer, maxDepth - 1, typeNameOverride, handles, visited);
+        }
+        // Remove the duplicated value.
+        lua_pop_dll(api, L, 1);
+    }
+    else if (strcmp(typeName, "function") == 0)
+    {
+
+        lua_Debug ar;
+        lua_getinfo_dll(api, L, ">Sn", &ar);
+
+        int scriptIndex = GetScriptIndex(GetSource(api, &ar));
+
+        writer.WriteFunction(scriptIndex, GetLineDefined(api, &ar) - 1);
+    
+    }
+    else
+    {
+        if (strcmp(typeName, "wstring") == 0)
+        {
+
+            size_t length = 0;
+            const lua_WChar* string = lua_towstring_dll(api, L, -1); 
+            
+            if (string != NULL)
+            {
+                length = wcslen(reinterpret_cast<const wchar_t*>(string)) * sizeof(lua_WChar);
+            }
+
+            std::string text;
+            bool wide;
+
+            if (!displayAsKey)
+            {
+                text += "L\"";
+            }
+            
+            text += GetAsciiString(string, length, wide, true);
+            
+            if (!displayAsKey)
+            {
+                text += "\"";
+            }
+
+            writer.WriteValue(text, typeNameOverride);
+
+        }
+        else if (strcmp(typeName, "string") == 0)
+        {
+
+            size_t length;
+            const char* string = lua_tolstring_dll(api, L, -1, &length); 
+
+            bool wide;
+            std::string result = GetAsciiString(string, length, wide);
+
+            if (m_evaluateSizeLimit != 0 && result.length() > m_evaluateSizeLimit)
+            {
+                result.resize(m_evaluateSizeLimit);
+                result += "...";
+            }
+
+            std::string text;
+
+            if (!displayAsKey)
+            {
+                if (wide)
+                {
+                    text += "L"; 
+                }
+                text += "\"";
+            }
+
+            text += result;
+
+            if (!displayAsKey)
+            {
+                text += "\"";
+            }
+
+            writer.WriteValue(text, typeNameOverride);
+
+        }
+        else if (strcmp(typeName, "userdata") == 0)
+        {
+
+            const char* temp = GetClassNameForUserdata(api, L, -1);
+            std::string className;
+
+            if (temp != NULL)
+            {
+                className = temp;
+            }
+
+            int valueIndex = lua_gettop_dll(api, L);
+            bool written = false;
+
+            if (className.empty())
+            {
+                className = "userdata";
+            }
+
+            // Check if this is a luabind class instance.
+            //written = WriteLuaBindClassValue(api, L, writer, maxDepth, displayAsKey);
 
-        document.LinkEndChild(WriteXmlNode("error", text));
+            if (!written)
+            {
 
-        lua_pop_dll(api, L, 1);
+                // Check to see if the user data's metatable has a __towatch method. This is
+                // a custom method used to provide data to the watch window.
 
-    }
+                int result = 0;
+                int stackStart = lua_gettop_dll(api, L);
 
-    // Copy any changes to the up values due to evaluating the watch back.
-    SetLocals(api, L, stackLevel, localTable, nilSentinel);
-    SetUpValues(api, L, stackLevel, upValueTable, nilSentinel);
+                if (CallMetaMethod(api, L, valueIndex, "__towatch", LUA_MULTRET, result))
+                {
+                    if (result == 0)
+                    {
+                       
+                        int tableIndex = lua_gettop_dll(api, L);
+                        int numResults = tableIndex - stackStart;
 
-    // Remove the local, up value and environment tables from the stack.
-    lua_pop_dll(api, L, 3);
+                        if( numResults == 0)
+                        {
+                            lua_pushnil_dll( api, L);
+                            ++ tableIndex;
+                            numResults = 1;
+                        }
+                        else if (numResults > 1)
+                        {
+                            // First result is the class name if multiple results are 
+                            // returned.
+                            className = lua_tostring_dll(api, L, -numResults);
+                        }
 
-    // Remove the nil sentinel.
-    lua_pop_dll(api, L, 1);
+                        WriteValue(api, L, tableIndex, writer, maxDepth, className.c_str(), displayAsKey, handles, visited); 
+                        written = true;
 
-    // Convert from XML to a string.
+                        // Remove the table value.
+                        lua_pop_dll(api, L, numResults);
 
-    TiXmlPrinter printer;
-    printer.SetIndent("\t");
+                    }
+                }
+                else if (CallMetaMethod(api, L, valueIndex, "__tostring", 1, result))
+                {
+                    if (result == 0)
+                    {
 
-    document.Accept( &printer );
-    result = printer.Str();
+                        const char* string = lua_tostring_dll(api, L, -1);
+                        
+                        if (string != NULL)
+                        {
+                            writer.WriteValue(string, className);
+                            written = true;
+                        }
 
-    // Reenable the debugger hook
-    EnableIntercepts(true);
-    SetHookMode(api, L, HookMode_Full);
-    if(GetVm(L)->haveActiveBreakpoints || m_mode == Mode_StepInto || m_mode == Mode_StepOver){
-    }
+                        // Remove the string value.
+                        lua_pop_dll(api, L, 1);
 
-    int t2 = lua_gettop_dll(api, L);
-    assert(t1 == t2);
+                    }
+                }
 
-    return error == 0;
+                // Check to see if we called a meta-method and got an error back.
+                if (result != 0)
+                {
 
-}
+                    const char* error = lua_tostring_dll(api, L, -1);
 
-bool DebugBackend::CallMetaMethod(unsigned long api, lua_State* L, int valueIndex, const char* method, int numResults, int& result) const
-{
+                    if (error == NULL)
+                    {
+                        // This shouldn't happen, but we check just to make it a little
+                        // more robust.
+                        error = "Error executing __tostring";
+                    }
 
-    if (!lua_checkstack_dll(api, L, 3))
-    {
-        return false;
-    }
+                    writer.WriteError(error);
+                    written = true;
+                
+                    // Remove the error message.
+                    lua_pop_dll(api, L, 1);
 
-    if (lua_getmetatable_dll(api, L, valueIndex))
-    {
+                }
 
-        int metaTableIndex = lua_gettop_dll(api, L);
+            }
 
-        if (!lua_isnil_dll(api, L, metaTableIndex))
+            // If we did't find a way to display the user data, just display the class name.
+            if (!written)
+            {
+
+                if (!m_warnedAboutUserData)
+                {
+                    DebugBackend::Get().Message("Warning 1008: No __tostring or __towatch metamethod was provided for userdata", MessageType_Warning);
+                    m_warnedAboutUserData = true;
+                }
+        
+                void* p = lua_touserdata_dll(api, L, valueIndex);
+
+                char buffer[32];
+
+                if (displayAsKey)
+                {
+                    sprintf(buffer, "[0x%p]", p);
+                }
+                else
+                {
+                    sprintf(buffer, "0x%p", p);
+                }
+
+                writer.WriteValue(buffer, className);
+
+            }
+
+        }
+        else
         {
 
-            lua_pushstring_dll(api, L, method);
-            lua_gettable_dll(api, L, metaTableIndex);
+            const char* string = lua_tostring_dll(api, L, -1);
+            std::string result;
 
-            if (lua_isnil_dll(api, L, -1))
+            if (string == NULL)
             {
-                // The meta-method doesn't exist.
-                lua_pop_dll(api, L, 1);
-                lua_remove_dll(api, L, metaTableIndex);
-                return false;
+            
+                // If tostring failed for some reason, fallback to our own version.
+                char value[64] = { 0 };
+
+                if (strcmp(typeName, "nil") == 0)
+                {
+                    _snprintf(value, 64, "%s", "nil");
+                }
+                else if (strcmp(typeName, "number") == 0)
+                {
+                    _snprintf(value, 64, "%0.2f", lua_tonumber_dll(api, L, -1));
+                }
+                else if (strcmp(typeName, "boolean") == 0)
+                {
+                    _snprintf(value, 64, "%s", lua_toboolean_dll(api, L, -1) ? "true" : "false");
+                }
+                else if (strcmp(typeName, "thread") == 0)
+                {
+                    _snprintf(value, 64, "%s", "thread");
+                }
+
+                result = value;
+
             }
             else
             {
-                lua_pushvalue_dll(api, L, valueIndex);
-                result = lua_pcall_dll(api, L, 1, numResults, 0);
+                result = string;
+            }
+
+            if (displayAsKey)
+            {
+                result = "[" + result + "]"; 
             }
 
+            writer.WriteValue(result, typeNameOverride);
+
         }
 
-        lua_remove_dll(api, L, metaTableIndex);
-        return true;
+        // Remove the duplicated value.
+        lua_pop_dll(api, L, 1);
 
     }
 
-    return false;
+    int t2 = lua_gettop_dll(api, L);
+    assert(t2 - t1 == 0);
 
 }
 
-void DebugBackend::MergeTables(unsigned long api, lua_State* L, unsigned int tableIndex1, unsigned int tableIndex2) const
+void DebugBackend::WriteTable(unsigned long api, lua_State* L, int t, ValueWriter& writer, int maxDepth, const char* typeNameOverride, int handles, int visited) const
 {
-    
+
     if (!lua_checkstack_dll(api, L, 3))
     {
+        writer.WriteError("Stack overflow");
         return;
-    }
-
-    tableIndex1 = lua_absindex_dll(api, L, tableIndex1);
-    tableIndex2 = lua_absindex_dll(api, L, tableIndex2);
+    }    
+    
+    int t1 = lua_gettop_dll(api, L);
 
-    lua_newtable_dll(api, L);
-    int dstTableIndex = lua_gettop_dll(api, L);
+    // Get the absolute index since we need to refer to the table position
+    // later once we've put additional stuff on the stack.
+    t = lua_absindex_dll(api, L, t);
 
-    // Iterate over the keys in table 1, inserting them into the
-    // target table.
+    const char* typeName = typeNameOverride != NULL ? typeNameOverride : "";
 
-    lua_pushnil_dll(api, L);
+    unsigned int id = 0;
 
-    while (lua_next_dll(api, L, tableIndex1) != 0)
+    if (handles != 0)
     {
-        lua_pushvalue_dll(api, L, -2);
-        lua_insert_dll(api, L, -2);
-        lua_rawset_dll(api, L, dstTableIndex);
+
+        // Tables that are referenced from more than one place (or from inside
+        // themselves) are only written the first time, so the size of the
+        // result is bounded by the number of distinct tables.
+
+        lua_pushvalue_dll(api, L, t);
+        lua_rawget_dll(api, L, visited);
+
+        if (!lua_isnil_dll(api, L, -1))
+        {
+            id = lua_tointeger_dll(api, L, -1);
+            lua_pop_dll(api, L, 1);
+            writer.WriteReference(id, typeName);
+            return;
+        }
+
+        lua_pop_dll(api, L, 1);
+
+        // The id is a handle so the frontend can also expand the references.
+        id = CreateValueHandle(api, L, t, handles);
+
+        lua_pushvalue_dll(api, L, t);
+        lua_pushinteger_dll(api, L, id);
+        lua_rawset_dll(api, L, visited);
+
     }
 
-    // Iterate over the keys in table 2, inserting them into the
-    // target table.
+    writer.BeginTable(id, typeName);
 
-    lua_pushnil_dll(api, L);
+    unsigned int offset = 0;
+    bool more = false;
 
-    while (lua_next_dll(api, L, tableIndex2) != 0)
+    if (maxDepth > 0)
     {
-        lua_pushvalue_dll(api, L, -2);
-        lua_insert_dll(api, L, -2);
-        lua_rawset_dll(api, L, dstTableIndex);
+        // Large tables are sent a page at a time.
+        more = WriteTableElements(api, L, t, 0, writer, maxDepth, 0, s_tablePageSize, handles, visited, offset);
+    }
+    else
+    {
+        // Empty tables don't need to be expanded.
+        lua_pushnil_dll(api, L);
+        if (lua_next_dll(api, L, t) != 0)
+        {
+            lua_pop_dll(api, L, 2);
+            more = true;
+        }
     }
 
+    writer.EndTable(more ? id : 0, offset);
+
+    int t2 = lua_gettop_dll(api, L);
+    assert(t2 - t1 == 0);
+
 }
 
-TiXmlNode* DebugBackend::GetLuaBindClassValue(unsigned long api, lua_State* L, unsigned int maxDepth, bool displayAsKey) const
+bool DebugBackend::WriteTableElements(unsigned long api, lua_State* L, int t, int keys, ValueWriter& writer, int maxDepth, unsigned int offset, unsigned int limit, int handles, int visited, unsigned int& end) const
 {
 
-    if (!lua_checkstack_dll(api, L, 3))
+    end = offset;
+
+    if (!lua_checkstack_dll(api, L, 2))
     {
-        return NULL;
-    }
+        return false;
+    }    
 
-    if (lua_getmetatable_dll(api, L, -1))
+    unsigned int index = 0;
+    bool more = false;
+
+    if (keys != 0)
     {
-        
-        lua_pushstring_dll(api, L, "__luabind_class");
-        lua_rawget_dll(api, L, -2);
 
-        bool luabindClass = !lua_isnil_dll(api, L, -1);
+        lua_pushinteger_dll(api, L, 0);
+        lua_rawget_dll(api, L, keys);
+        unsigned int numKeys = lua_tointeger_dll(api, L, -1);
+        lua_pop_dll(api, L, 1);
 
-        // Remove the value and the metatable from the stack.
-        lua_pop_dll(api, L, 2);
+        for (index = offset; index < numKeys; ++index)
+        {
 
-        if (!luabindClass)
+            if (index >= offset + limit ||
+                (index > offset && (GetIsEvaluateTimedOut() || GetIsEvaluateTooLarge(writer))))
+            {
+                more = true;
+                break;
+            }
+
+            lua_rawgeti_dll(api, L, keys, index + 1);
+            lua_pushvalue_dll(api, L, -1);
+            lua_rawget_dll(api, L, t);
+
+            // Elements removed since the keys were copied are skipped.
+            if (!lua_isnil_dll(api, L, -1))
+            {
+                WriteValue(api, L, -2, writer, maxDepth - 1, NULL, true, handles, visited);
+                WriteValue(api, L, -1, writer, maxDepth - 1, NULL, false, handles, visited);
+            }
+
+            lua_pop_dll(api, L, 2);
+
+        }
+
+        end = index;
+        return more;
+
+    }
+
+    // Lua doesn't have a way to start iterating from the middle of a table,
+    // so we skip over the elements before the offset.
+
+    // First key.
+    lua_pushnil_dll(api, L);
+
+    while (lua_next_dll(api, L, t) != 0)
+    {
+
+        // If we run over the limits, the rest of the elements are left for
+        // the frontend to request in the same way as the next page.
+        if (index >= offset + limit ||
+            (index > offset && (GetIsEvaluateTimedOut() || GetIsEvaluateTooLarge(writer))))
         {
-            // This userdata doesn't have the luabind class signature in its
-            // metatable.
-            return NULL;
+            // Remove the key and value.
+            lua_pop_dll(api, L, 2);
+            more = true;
+            break;
+        }
+
+        if (index >= offset)
+        {
+            WriteValue(api, L, -2, writer, maxDepth - 1, NULL, true, handles, visited);
+            WriteValue(api, L, -1, writer, maxDepth - 1, NULL, false, handles, visited);
         }
+            
+        // Leave the key on the stack for the next call to lua_next.
+        lua_pop_dll(api, L, 1);
+        ++index;
+    
+    }    
 
-    }
+    end = index;
+    return more;
 
-    const char* className = "luabind";
+}
 
-    // Luabind stores the accessible methods in the environment for the userdata
-    // so we can directly convert that into the value.
-    lua_getfenv_dll(api, L, -1);
+void DebugBackend::PushTableKeys(unsigned long api, lua_State* L, int t, int handles, int handle) const
+{
 
-    TiXmlNode* node = NULL;
+    // The keys are stored at the negative of the handle, which luaL_ref
+    // never uses.
+    lua_rawgeti_dll(api, L, handles, -handle);
 
-    // If the environment has a metatable, those are the class methods and we
-    // need to merge them into the 
-    if (lua_getmetatable_dll(api, L, -1))
+    if (!lua_isnil_dll(api, L, -1))
     {
+        return;
+    }
 
-        MergeTables(api, L, -1, -2);
+    lua_pop_dll(api, L, 1);
 
-        int tableIndex = lua_gettop_dll(api, L);
-        node = GetValueAsText(api, L, tableIndex, maxDepth, className, displayAsKey); 
+    lua_newtable_dll(api, L);
+    int keys = lua_gettop_dll(api, L);
 
-        lua_pop_dll(api, L, 2);
+    int numKeys = 0;
 
-    }
-    else
+    lua_pushnil_dll(api, L);
+
+    while (lua_next_dll(api, L, t) != 0)
     {
-        int tableIndex = lua_gettop_dll(api, L);
-        node = GetValueAsText(api, L, tableIndex, maxDepth, className, displayAsKey); 
+        // Replace the value with the index of the key.
+        lua_pop_dll(api, L, 1);
+        lua_pushinteger_dll(api, L, ++numKeys);
+        lua_pushvalue_dll(api, L, -2);
+        lua_rawset_dll(api, L, keys);
     }
 
-    // Remove the value from the stack.
-    lua_pop_dll(api, L, 1);
+    // The number of keys is stored at 0.
+    lua_pushinteger_dll(api, L, 0);
+    lua_pushinteger_dll(api, L, numKeys);
+    lua_rawset_dll(api, L, keys);
 
-    return node;
+    lua_pushinteger_dll(api, L, -handle);
+    lua_pushvalue_dll(api, L, keys);
+    lua_rawset_dll(api, L, handles);
 
 }
 
-TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n, int maxDepth, const char* typeNameOverride, bool displayAsKey) const
+int DebugBackend::CreateValueHandle(unsigned long api, lua_State* L, int t, int handles) const
 {
+    lua_pushvalue_dll(api, L, t);
+    return luaL_ref_dll(api, L, handles);
+}
 
-    int t1 = lua_gettop_dll(api, L);
+void DebugBackend::PushValueHandles(unsigned long api, lua_State* L, VirtualMachine* vm)
+{
 
-    if (!lua_checkstack_dll(api, L, 1))
+    if (vm->valueHandlesRef == LUA_NOREF)
     {
-        return NULL;
+        lua_newtable_dll(api, L);
+        vm->valueHandlesRef = luaL_ref_dll(api, L, GetRegistryIndex(api));
     }
 
-    // Duplicate the item since calling to* can modify the value.
-    lua_pushvalue_dll(api, L, n);
+    lua_rawgeti_dll(api, L, GetRegistryIndex(api), vm->valueHandlesRef);
 
-    int type = lua_type_dll(api, L, -1);
-    const char* typeName = lua_typename_dll(api, L, type);
+}
 
-    if (typeNameOverride == NULL)
+bool DebugBackend::ExpandValue(unsigned long api, lua_State* L, int handle, unsigned int offset, unsigned int limit, std::string& result)
+{
+
+    if (!GetIsLuaLoaded())
     {
-        typeNameOverride = typeName;
+        return false;
     }
 
-    TiXmlNode* node = NULL;
+    VirtualMachine* vm = NULL;
 
-    if (strcmp(typeName, "table") == 0)
     {
-        int stackStart = lua_gettop_dll(api, L);
-        int result = 0;
-        std::string className;
-        if (CallMetaMethod(api, L, stackStart, "__towatch", LUA_MULTRET, result))
-        {
-            if (result == 0)
-            {
-                int numResults = lua_gettop_dll(api, L) - stackStart;
-
-                if( numResults == 0)
-                {
-                    lua_pushnil_dll( api, L);
-                    numResults = 1;
-                }
-                else if (numResults > 1)
-                {
-                    // First result is the class name if multiple results are 
-                    // returned.
-                    className = lua_tostring_dll(api, L, -numResults);
-                }
 
-                node = GetValueAsText(api, L, -1, maxDepth, className.c_str(), displayAsKey);
+        CriticalSectionLock lock(m_criticalSection);
 
-                // Remove the table value.
-                lua_pop_dll(api, L, numResults);
+        StateToVmMap::iterator stateIterator = m_stateToVm.find(L);
 
-            }
-        }
-        if( node == NULL)
+        if (stateIterator == m_stateToVm.end())
         {
-        node = GetTableAsText(api, L, -1, maxDepth - 1, typeNameOverride);
+            return false;
         }
-        // Remove the duplicated value.
-        lua_pop_dll(api, L, 1);
-    }
-    else if (strcmp(typeName, "function") == 0)
-    {
-
-        lua_Debug ar;
-        lua_getinfo_dll(api, L, ">Sn", &ar);
 
-        int scriptIndex = GetScriptIndex(GetSource(api, &ar));
+        vm = stateIterator->second;
 
-        node = new TiXmlElement("function");
-        node->LinkEndChild(WriteXmlNode("script", scriptIndex));
-        node->LinkEndChild(WriteXmlNode("line",   GetLineDefined(api, &ar) - 1));
-    
     }
-    else
-    {
-        if (strcmp(typeName, "wstring") == 0)
-        {
-
-            size_t length = 0;
-            const lua_WChar* string = lua_towstring_dll(api, L, -1); 
-            
-            if (string != NULL)
-            {
-                length = wcslen(reinterpret_cast<const wchar_t*>(string)) * sizeof(lua_WChar);
-            }
 
-            std::string text;
-            bool wide;
+    // The handles are only valid until execution resumes.
+    if (vm->valueHandlesRef == LUA_NOREF || handle <= 0)
+    {
+        return false;
+    }
 
-            if (!displayAsKey)
-            {
-                text += "L\"";
-            }
-            
-            text += GetAsciiString(string, length, wide, true);
-            
-            if (!displayAsKey)
-            {
-                text += "\"";
-            }
+    int t1 = lua_gettop_dll(api, L);
 
-            node = new TiXmlElement("value");
-            node->LinkEndChild( WriteXmlNode("data", text) );
-            node->LinkEndChild( WriteXmlNode("type", typeNameOverride) );
+    PushValueHandles(api, L, vm);
+    int handles = lua_gettop_dll(api, L);
 
-        }
-        else if (strcmp(typeName, "string") == 0)
-        {
+    lua_rawgeti_dll(api, L, handles, handle);
+    int table = lua_gettop_dll(api, L);
 
-            size_t length;
-            const char* string = lua_tolstring_dll(api, L, -1, &length); 
+    if (lua_type_dll(api, L, table) != LUA_TTABLE)
+    {
+        lua_pop_dll(api, L, 2);
+        return false;
+    }
 
-            bool wide;
-            std::string result = GetAsciiString(string, length, wide);
+    // References back to the table we're expanding use its handle.
+    lua_newtable_dll(api, L);
+    int visited = lua_gettop_dll(api, L);
 
-            std::string text;
+    lua_pushvalue_dll(api, L, table);
+    lua_pushinteger_dll(api, L, handle);
+    lua_rawset_dll(api, L, visited);
 
-            if (!displayAsKey)
-            {
-                if (wide)
-                {
-                    text += "L"; 
-                }
-                text += "\"";
-            }
+    if (!lua_checkstack_dll(api, L, 5))
+    {
+        lua_pop_dll(api, L, 3);
+        return false;
+    }
 
-            text += result;
+    PushTableKeys(api, L, table, handles, handle);
+    int keys = lua_gettop_dll(api, L);
 
-            if (!displayAsKey)
-            {
-                text += "\"";
-            }
+    // Disable the debugger hook since getting the values can call metamethods.
+    BeginEvaluateLimits(api, L, vm);
+    EnableIntercepts(false);
 
-            node = new TiXmlElement("value");
-            node->LinkEndChild( WriteXmlNode("data", text) );
-            node->LinkEndChild( WriteXmlNode("type", typeNameOverride) );
+    ValueWriter writer;
+    writer.BeginTable(handle, "");
 
-        }
-        else if (strcmp(typeName, "userdata") == 0)
-        {
+    unsigned int end;
+    bool more = WriteTableElements(api, L, table, keys, writer, 1, offset, limit, handles, visited, end);
+    writer.EndTable(more ? handle : 0, end);
 
-            const char* temp = GetClassNameForUserdata(api, L, -1);
-            std::string className;
+    // Remove the keys, the visited table, the table and the handle table.
+    lua_pop_dll(api, L, 4);
 
-            if (temp != NULL)
-            {
-                className = temp;
-            }
+#ifdef XML_VALUES
+    result = GetValuesAsXml(writer.GetData());
+#else
+    result = writer.GetData();
+#endif
 
-            int valueIndex = lua_gettop_dll(api, L);
+    // Reenable the debugger hook
+    EndEvaluateLimits();
+    EnableIntercepts(true);
+    SetHookMode(api, L, HookMode_Full);
 
-            if (className.empty())
-            {
-                className = "userdata";
-            }
+    int t2 = lua_gettop_dll(api, L);
+    assert(t1 == t2);
 
-            // Check if this is a luabind class instance.
-            //node = GetLuaBindClassValue(api, L, maxDepth, displayAsKey);
+    return true;
 
-            if (node == NULL)
-            {
+}
 
-                // Check to see if the user data's metatable has a __towatch method. This is
-                // a custom method used to provide data to the watch window.
+std::string DebugBackend::GetValuesAsXml(const std::string& data) const
+{
 
-                int result = 0;
-                int stackStart = lua_gettop_dll(api, L);
+    ValueReader reader(data.c_str(), data.length());
+    TiXmlDocument document;
 
-                if (CallMetaMethod(api, L, valueIndex, "__towatch", LUA_MULTRET, result))
-                {
-                    if (result == 0)
-                    {
-                       
-                        int tableIndex = lua_gettop_dll(api, L);
-                        int numResults = tableIndex - stackStart;
+    ValueTag tag;
 
-                        if( numResults == 0)
-                        {
-                            lua_pushnil_dll( api, L);
-                            ++ tableIndex;
-                            numResults = 1;
-                        }
-                        else if (numResults > 1)
-                        {
-                            // First result is the class name if multiple results are 
-                            // returned.
-                            className = lua_tostring_dll(api, L, -numResults);
-                        }
+    while (reader.ReadTag(tag))
+    {
+        TiXmlNode* node = ReadValueAsXml(reader, tag);
+        if (node == NULL)
+        {
+            break;
+        }
+        document.LinkEndChild(node);
+    }
 
-                        node = GetValueAsText(api, L, tableIndex, maxDepth, className.c_str(), displayAsKey); 
+    TiXmlPrinter printer;
+    printer.SetIndent("\t");
 
-                        // Remove the table value.
-                        lua_pop_dll(api, L, numResults);
+    document.Accept( &printer );
+    return printer.Str();
 
-                    }
-                }
-                else if (CallMetaMethod(api, L, valueIndex, "__tostring", 1, result))
-                {
-                    if (result == 0)
-                    {
+}
 
-                        const char* string = lua_tostring_dll(api, L, -1);
-                        
-                        if (string != NULL)
-                        {
-                            node = new TiXmlElement("value");
-                            node->LinkEndChild( WriteXmlNode("data", string) );
-                            node->LinkEndChild( WriteXmlNode("type", className) );
-                        }
+TiXmlNode* DebugBackend::ReadValueAsXml(ValueReader& reader, ValueTag tag) const
+{
 
-                        // Remove the string value.
-                        lua_pop_dll(api, L, 1);
+    if (tag == ValueTag_Value)
+    {
 
-                    }
-                }
+        std::string data;
+        std::string type;
 
-                // Check to see if we called a meta-method and got an error back.
-                if (result != 0)
-                {
+        if (!reader.ReadString(data) || !reader.ReadString(type))
+        {
+            return NULL;
+        }
 
-                    const char* error = lua_tostring_dll(api, L, -1);
+        TiXmlNode* node = new TiXmlElement("value");
+        node->LinkEndChild( WriteXmlNode("data", data) );
+        node->LinkEndChild( WriteXmlNode("type", type) );
+        return node;
 
-                    if (error == NULL)
-                    {
-                        // This shouldn't happen, but we check just to make it a little
-                        // more robust.
-                        error = "Error executing __tostring";
-                    }
+    }
+    else if (tag == ValueTag_Function)
+    {
 
-                    node = WriteXmlNode("error", error);
-                
-                    // Remove the error message.
-                    lua_pop_dll(api, L, 1);
+        unsigned int scriptIndex;
+        unsigned int line;
 
-                }
+        if (!reader.ReadUInt32(scriptIndex) || !reader.ReadUInt32(line))
+        {
+            return NULL;
+        }
 
-            }
+        TiXmlNode* node = new TiXmlElement("function");
+        node->LinkEndChild( WriteXmlNode("script", scriptIndex) );
+        node->LinkEndChild( WriteXmlNode("line",   line) );
+        return node;
 
-            // If we did't find a way to display the user data, just display the class name.
-            if (node == NULL)
-            {
+    }
+    else if (tag == ValueTag_Error)
+    {
 
-                if (!m_warnedAboutUserData)
-                {
-                    DebugBackend::Get().Message("Warning 1008: No __tostring or __towatch metamethod was provided for userdata", MessageType_Warning);
-                    m_warnedAboutUserData = true;
-                }
-        
-                void* p = lua_touserdata_dll(api, L, valueIndex);
+        std::string message;
 
-                char buffer[32];
+        if (!reader.ReadString(message))
+        {
+            return NULL;
+        }
 
-                if (displayAsKey)
-                {
-                    sprintf(buffer, "[0x%p]", p);
-                }
-                else
-                {
-                    sprintf(buffer, "0x%p", p);
-                }
+        return WriteXmlNode("error", message);
 
-                node = new TiXmlElement("value");
-                node->LinkEndChild( WriteXmlNode("data", buffer) );
-                node->LinkEndChild( WriteXmlNode("type", className) );
+    }
+    else if (tag == ValueTag_Reference)
+    {
 
-            }
+        unsigned int id;
+        std::string type;
 
-        }
-        else
+        if (!reader.ReadUInt32(id) || !reader.ReadString(type))
         {
+            return NULL;
+        }
 
-            const char* string = lua_tostring_dll(api, L, -1);
-            std::string result;
-
-            if (string == NULL)
-            {
-            
-                // If tostring failed for some reason, fallback to our own version.
-                char value[64] = { 0 };
+        TiXmlNode* node = new TiXmlElement("reference");
+        node->LinkEndChild( WriteXmlNode("id", id) );
+        if (!type.empty())
+        {
+            node->LinkEndChild( WriteXmlNode("type", type) );
+        }
+        return node;
 
-                if (strcmp(typeName, "nil") == 0)
-                {
-                    _snprintf(value, 64, "%s", "nil");
-                }
-                else if (strcmp(typeName, "number") == 0)
-                {
-                    _snprintf(value, 64, "%0.2f", lua_tonumber_dll(api, L, -1));
-                }
-                else if (strcmp(typeName, "boolean") == 0)
-                {
-                    _snprintf(value, 64, "%s", lua_toboolean_dll(api, L, -1) ? "true" : "false");
-                }
-                else if (strcmp(typeName, "thread") == 0)
-                {
-                    _snprintf(value, 64, "%s", "thread");
-                }
+    }
+    else if (tag == ValueTag_Table || tag == ValueTag_Values)
+    {
 
-                result = value;
+        TiXmlNode* node = new TiXmlElement(tag == ValueTag_Table ? "table" : "values");
 
+        if (tag == ValueTag_Table)
+        {
+            unsigned int id;
+            std::string type;
+            if (!reader.ReadUInt32(id) || !reader.ReadString(type))
+            {
+                delete node;
+                return NULL;
             }
-            else
+            if (id != 0)
             {
-                result = string;
+                node->LinkEndChild( WriteXmlNode("id", id) );
             }
-
-            node = new TiXmlElement("value");
-
-            if (displayAsKey)
+            if (!type.empty())
             {
-                result = "[" + result + "]"; 
+                node->LinkEndChild( WriteXmlNode("type", type) );
             }
+        }
 
-            node->LinkEndChild( WriteXmlNode("data", result) );
-            node->LinkEndChild( WriteXmlNode("type", typeNameOverride) );
+        ValueTag childTag;
 
-        }
+        while (reader.ReadTag(childTag) && childTag != ValueTag_End)
+        {
 
-        // Remove the duplicated value.
-        lua_pop_dll(api, L, 1);
+            TiXmlNode* child = ReadValueAsXml(reader, childTag);
 
-    }
+            if (child != NULL && tag == ValueTag_Table)
+            {
 
-    int t2 = lua_gettop_dll(api, L);
-    assert(t2 - t1 == 0);
+                // Tables are made of pairs of keys and data.
 
-    return node;
+                TiXmlNode* data = NULL;
 
-}
+                if (reader.ReadTag(childTag))
+                {
+                    data = ReadValueAsXml(reader, childTag);
+                }
 
-TiXmlNode* DebugBackend::GetTableAsText(unsigned long api, lua_State* L, int t, int maxDepth, const char* typeNameOverride) const
-{
+                if (data == NULL)
+                {
+                    delete child;
+                    child = NULL;
+                }
+                else
+                {
 
-    if (!lua_checkstack_dll(api, L, 2))
-    {
-        return NULL;
-    }    
-    
-    int t1 = lua_gettop_dll(api, L);
+                    TiXmlNode* element = new TiXmlElement("element");
 
-    // Get the absolute index since we need to refer to the table position
-    // later once we've put additional stuff on the stack.
-    t = lua_absindex_dll(api, L, t);
+                    TiXmlNode* key = new TiXmlElement("key");
+                    key->LinkEndChild(child);
+                    element->LinkEndChild(key);
 
-    TiXmlNode* node = new TiXmlElement("table");
+                    TiXmlNode* value = new TiXmlElement("data");
+                    value->LinkEndChild(data);
+                    element->LinkEndChild(value);
 
-    if (typeNameOverride)
-    {
-        node->LinkEndChild( WriteXmlNode("type", typeNameOverride) );
-    }
+                    child = element;
 
-    if (maxDepth > 0)
-    {
+                }
 
-        // First key.
-        lua_pushnil_dll(api, L);
+            }
+
+            if (child == NULL)
+            {
+                delete node;
+                return NULL;
+            }
 
-        while (lua_next_dll(api, L, t) != 0)
+            node->LinkEndChild(child);
+
+        }
+
+        if (tag == ValueTag_Table)
         {
 
-            TiXmlNode* key = new TiXmlElement("key");
-            key->LinkEndChild( GetValueAsText(api, L, -2, maxDepth - 1, NULL, true) );
+            unsigned int handle;
+            unsigned int offset;
+
+            if (!reader.ReadUInt32(handle) || !reader.ReadUInt32(offset))
+            {
+                delete node;
+                return NULL;
+            }
 
-            TiXmlNode* value = new TiXmlElement("data");
-            value->LinkEndChild( GetValueAsText(api, L, -1, maxDepth - 1) );
+            if (handle != 0)
+            {
+                node->LinkEndChild( WriteXmlNode("handle", handle) );
+                node->LinkEndChild( WriteXmlNode("offset", offset) );
+            }
 
-            TiXmlNode* element = new TiXmlElement("element");
+        }
 
-            element->LinkEndChild(key);
-            element->LinkEndChild(value);
-            node->LinkEndChild(element);
-            
-            // Leave the key on the stack for the next call to lua_next.
-            lua_pop_dll(api, L, 1);
-        
-        }    
-    
-    }
+        return node;
 
-    int t2 = lua_gettop_dll(api, L);
-    assert(t2 - t1 == 0);
+    }
 
-    return node;
+    return NULL;
 
 }
 
@@ -2722,30 +5146,32 @@ const char* DebugBackend::GetClassNameForUserdata(unsigned long api, lua_State*
         return NULL;
     }
 
-    bool result = false;
-
     if (lua_getmetatable_dll(api, L, ud))
     {
 
-        std::list<ClassInfo>::const_iterator iterator = m_classInfos.begin();
+        // Only the class infos registered with this metatable pointer need to be
+        // checked. The reference check guards against a pointer that has been
+        // reused by a different table.
+
+        std::pair<MetatableToClassMap::const_iterator, MetatableToClassMap::const_iterator> range;
+        range = m_classInfos.equal_range(lua_topointer_dll(api, L, -1));
 
-        while (iterator != m_classInfos.end())
+        for (MetatableToClassMap::const_iterator iterator = range.first; iterator != range.second; ++iterator)
         {
-            if (iterator->L == L)
+            if (iterator->second.L == L)
             {
 
-                lua_rawgeti_dll(api, L, GetRegistryIndex(api), iterator->metaTableRef);
+                lua_rawgeti_dll(api, L, GetRegistryIndex(api), iterator->second.metaTableRef);
 
                 if (lua_rawequal_dll(api, L, -1, -2))
                 {
                     lua_pop_dll(api, L, 2);
-                    return iterator->name.c_str();
+                    return iterator->second.name.c_str();
                 }
         
                 lua_pop_dll(api, L, 1);
 
             }
-            ++iterator;
         }
 
         lua_pop_dll(api, L, 1);
@@ -2766,10 +5192,12 @@ void DebugBackend::RegisterClassName(unsigned long api, lua_State* L, const char
     classInfo.L             = L;
     classInfo.name          = name;
 
+    const void* pointer = lua_topointer_dll(api, L, metaTable);
+
     lua_pushvalue_dll(api, L, metaTable);
     classInfo.metaTableRef  = luaL_ref_dll(api, L, GetRegistryIndex(api));
 
-    m_classInfos.push_back(classInfo);
+    m_classInfos.insert(MetatableToClassMap::value_type(pointer, classInfo));
 
 }
 
@@ -3063,6 +5491,150 @@ void DebugBackend::GetFileTitle(const char* name, std::string& title) const
 
 }
 
+bool DebugBackend::GetHasBreakpointFile(const std::string& title) const
+{
+
+    // The frontend gets the file name from the script name without the @ sign
+    // and compares it ignoring case.
+
+    std::string fileName = title;
+
+    if (!fileName.empty() && fileName[0] == '@')
+    {
+        fileName.erase(0, 1);
+    }
+
+    for (unsigned int i = 0; i < fileName.length(); ++i)
+    {
+        fileName[i] = tolower(fileName[i]);
+    }
+
+    return m_breakpointFiles.find(fileName) != m_breakpointFiles.end();
+
+}
+
+bool DebugBackend::GetIsScriptExcluded(const char* name, size_t size) const
+{
+
+    // Scripts loaded from files have names starting with an @ sign, anything
+    // else was loaded from a string.
+    if (m_excludeStringScripts && (name == NULL || name[0] != '@'))
+    {
+        return true;
+    }
+
+    if (m_maxScriptSize > 0 && size > m_maxScriptSize)
+    {
+        return true;
+    }
+
+    if (m_excludedPatterns.empty() || name == NULL)
+    {
+        return false;
+    }
+
+    std::string fileName = NormalizeScriptName(name);
+
+    const char* title = strrchr(fileName.c_str(), '/');
+    title = (title != NULL) ? title + 1 : fileName.c_str();
+
+    for (unsigned int i = 0; i < m_excludedPatterns.size(); ++i)
+    {
+
+        const std::string& pattern = m_excludedPatterns[i];
+
+        if (pattern[pattern.length() - 1] == '/')
+        {
+            // Directory patterns exclude everything underneath the directory.
+            if (fileName.compare(0, pattern.length(), pattern) == 0)
+            {
+                return true;
+            }
+        }
+        else if (pattern.find('/') == std::string::npos)
+        {
+            // Patterns without a path only have to match the file name.
+            if (GetMatchesPattern(pattern.c_str(), title))
+            {
+                return true;
+            }
+        }
+        else if (GetMatchesPattern(pattern.c_str(), fileName.c_str()))
+        {
+            return true;
+        }
+
+    }
+
+    return false;
+
+}
+
+std::string DebugBackend::NormalizeScriptName(const char* name)
+{
+
+    if (name[0] == '@')
+    {
+        ++name;
+    }
+
+    std::string result = name;
+
+    for (unsigned int i = 0; i < result.length(); ++i)
+    {
+        if (result[i] == '\\')
+        {
+            result[i] = '/';
+        }
+        else
+        {
+            result[i] = tolower(result[i]);
+        }
+    }
+
+    return result;
+
+}
+
+bool DebugBackend::GetMatchesPattern(const char* pattern, const char* string)
+{
+
+    // Position to resume from if the last * needs to match more characters.
+    const char* starPattern = NULL;
+    const char* starString  = NULL;
+
+    while (*string != 0)
+    {
+        if (*pattern == '*')
+        {
+            starPattern = ++pattern;
+            starString  = string;
+        }
+        else if (*pattern == '?' || *pattern == *string)
+        {
+            ++pattern;
+            ++string;
+        }
+        else if (starPattern != NULL)
+        {
+            pattern = starPattern;
+            string  = ++starString;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (*pattern == '*')
+    {
+        ++pattern;
+    }
+
+    return *pattern == 0;
+
+}
+
 bool DebugBackend::EnableJit(unsigned long api, lua_State* L, bool enable)
 {
 
@@ -3176,13 +5748,33 @@ int DebugBackend::GetStackDepth(unsigned long api, lua_State* L) const
 
     lua_Debug ar;
 
-    int level = 0;
-    while (lua_getstack_dll(api, L, level, &ar))
+    // Since getting a stack level walks the stack up to that level, find the
+    // depth with a binary search rather than checking every level.
+
+    int low  = 0;
+    int high = 1;
+
+    while (lua_getstack_dll(api, L, high - 1, &ar))
+    {
+        low   = high;
+        high *= 2;
+    }
+
+    // Levels below low exist and level high - 1 doesn't.
+    while (low + 1 < high)
     {
-        ++level;
+        int mid = (low + high) / 2;
+        if (lua_getstack_dll(api, L, mid - 1, &ar))
+        {
+            low = mid;
+        }
+        else
+        {
+            high = mid;
+        }
     }
 
-    return level;
+    return low;
 
 }
 
@@ -3202,7 +5794,65 @@ DebugBackend::VirtualMachine* DebugBackend::GetVm(lua_State* L)
 
 }
 
-unsigned int DebugBackend::GetUnifiedStack(unsigned long api, const StackEntry nativeStack[], unsigned int nativeStackSize, const lua_Debug scriptStack[], unsigned int scriptStackSize, StackEntry stack[])
+DebugBackend::VirtualMachine* DebugBackend::GetVmForHook(unsigned long api, lua_State* L)
+{
+
+    VmCache* cache = static_cast<VmCache*>(TlsGetValue(m_vmCacheTlsIndex));
+
+    if (cache == NULL)
+    {
+        
+        cache = new VmCache;
+        memset(cache, 0, sizeof(VmCache));
+        
+        TlsSetValue(m_vmCacheTlsIndex, cache);
+
+        CriticalSectionLock lock(m_criticalSection);
+        m_vmCaches.push_back(cache);
+
+    }
+
+    const unsigned int numEntries = sizeof(cache->entries) / sizeof(cache->entries[0]);
+    VmCacheEntry& entry = cache->entries[(reinterpret_cast<size_t>(L) >> 4) % numEntries];
+
+    LONG generation = m_vmGeneration;
+
+    if (entry.L == L && entry.vm != NULL && entry.generation == generation)
+    {
+        return entry.vm;
+    }
+
+    VirtualMachine* vm = NULL;
+
+    {
+
+        CriticalSectionLock lock(m_criticalSection);
+
+        StateToVmMap::const_iterator iterator = m_stateToVm.find(L);
+
+        if (iterator == m_stateToVm.end())
+        {
+            // If somehow a thread was started without us intercepting the
+            // lua_newthread call, we can reach this point. If so, attach
+            // to the VM.
+            vm = AttachState(api, L);
+        }
+        else
+        {
+            vm = iterator->second;
+        }
+
+    }
+
+    entry.L          = L;
+    entry.vm         = vm;
+    entry.generation = generation;
+
+    return vm;
+
+}
+
+unsigned int DebugBackend::GetUnifiedStack(unsigned long api, VirtualMachine* vm, const StackEntry nativeStack[], unsigned int nativeStackSize, const lua_Debug scriptStack[], unsigned int scriptStackSize, StackEntry stack[])
 {
 
     // Print out the unified call stack.
@@ -3257,7 +5907,15 @@ unsigned int DebugBackend::GetUnifiedStack(unsigned long api, const StackEntry n
                 break;
             }
 
-            stack[stackSize].scriptIndex = GetScriptIndex(GetSource(api, ar));
+            if (vm != NULL)
+            {
+                Script* script = FindScript(vm, GetSource(api, ar));
+                stack[stackSize].scriptIndex = (script != NULL && !script->excluded) ? script->index : -1;
+            }
+            else
+            {
+                stack[stackSize].scriptIndex = GetScriptIndex(GetSource(api, ar));
+            }
             stack[stackSize].line        = GetCurrentLine(api, ar) - 1;
             
             strncpy(stack[stackSize].name, function, s_maxEntryNameLength);
@@ -25,12 +25,16 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "Channel.h"
 #include "Protocol.h"
+#include "Hash.h"
 #include "CriticalSection.h"
+#include "SourceStore.h"
+#include "ValueEncoding.h"
 #include "LuaDll.h"
 
 #include <vector>
 #include <string>
 #include <list>
+#include <map>
 #include <hash_set>
 #include <hash_map>
 
@@ -74,9 +78,13 @@ public:
     bool Initialize(HINSTANCE hInstance);
 
     /**
-     * Attaches the debugger to the state.
+     * Attaches the debugger to the state. If the state was just created, created
+     * should be true and parent should be the state a new thread was created from
+     * (or NULL for a new state). States that the debugger didn't see created may
+     * have loaded scripts before it was attached, so they are assumed to be able
+     * to run any script.
      */
-    VirtualMachine* AttachState(unsigned long api, lua_State* L);
+    VirtualMachine* AttachState(unsigned long api, lua_State* L, bool created = false, lua_State* parent = NULL);
     
     void VMInitialize(unsigned long api, lua_State* L, VirtualMachine* vm);
 
@@ -96,9 +104,11 @@ public:
      * and send notification to the front end about it. If the script is already
      * loaded the method returns -1. The unavailable flag specifies that the code
      * was not available for the script. This should be set if the script was encountered
-     * through a call other than the load function.
+     * through a call other than the load function. waitForLoad is set to true if the
+     * frontend may have breakpoints for the script, in which case the caller must wait
+     * for it to finish processing the load before running the script.
      */
-    int RegisterScript(lua_State* L, const char* source, size_t size, const char* name, bool unavailable);
+    int RegisterScript(lua_State* L, const char* source, size_t size, const char* name, bool unavailable, bool& waitForLoad);
 
     int RegisterScript(unsigned long api, lua_State* L, lua_Debug* ar);
 
@@ -114,6 +124,12 @@ public:
      */
     void StepOver();
 
+    /**
+     * Continues execution of a "broken" script until the current function
+     * returns, then breaks on the next line in the calling function.
+     */
+    void StepOut();
+
     /**
      * Continues execution until a breakpoint is hit.
      */
@@ -127,12 +143,33 @@ public:
 
     void ActiveLuaHookInAllVms();
 
+    /**
+     * Starts sampling the call stack of every virtual machine once every
+     * interval instructions. The samples are sent to the front end in
+     * batches.
+     */
+    void StartProfiling(unsigned int interval);
+
+    /**
+     * Stops sampling and sends the samples that haven't been sent yet.
+     */
+    void StopProfiling();
+
     /**
      * Evalates the expression. If there was an error evaluating the expression the
      * method returns false and the error message is stored in the result.
      */
     bool Evaluate(unsigned long api, lua_State* L, const std::string& expression, int stackLevel, std::string& result);
 
+    /**
+     * Gets the elements of a table returned by an earlier evaluation in the
+     * same break. The handle identifies the table, and the elements from
+     * offset to offset + limit are returned. Tables inside the elements aren't
+     * expanded but have their own handles. Returns false if the handle isn't
+     * valid anymore.
+     */
+    bool ExpandValue(unsigned long api, lua_State* L, int handle, unsigned int offset, unsigned int limit, std::string& result);
+
     /**
      * Evalates the expression. If there was an error evaluating the expression the
      * method returns false and the error message is stored in the result.
@@ -155,13 +192,74 @@ public:
      * Toggles a breakpoint on the line on or off.
      */
     void ToggleBreakpoint(lua_State* L, unsigned int scriptIndex, unsigned int line);
+
+    /**
+     * Sets the condition and hit count for the breakpoint on the line, adding
+     * the breakpoint if there isn't one. The breakpoint only stops execution
+     * when the condition is true, and only once the condition has been true
+     * at least hitCount times. An empty condition is always true.
+     */
+    void SetBreakpointCondition(lua_State* L, unsigned int scriptIndex, unsigned int line, const std::string& condition, unsigned int hitCount);
+
+    /**
+     * Removes the condition, hit count and log message from the breakpoint on
+     * the line.
+     */
+    void ClearBreakpointCondition(unsigned int scriptIndex, unsigned int line);
+
+    /**
+     * Sets the names of the files the frontend has breakpoints in. Scripts
+     * with other names are run without waiting for the frontend when they're
+     * loaded. The names are file names without a path, in lower case.
+     */
+    void SetBreakpointFiles(const std::vector<std::string>& fileNames);
+
+    /**
+     * Gets the source code for a script. If release is true the backend's copy
+     * of the source is freed afterwards, so this will fail if it's called for
+     * the script again. Returns false if the index is not valid or the source
+     * has been released.
+     */
+    bool GetScriptSource(unsigned int scriptIndex, bool release, std::string& source);
+
+    /**
+     * Sets the rules for the scripts that aren't debugged. Patterns ending
+     * in a slash exclude the scripts in a directory, others are matched
+     * against the script name (or just the file name if the pattern doesn't
+     * have a path) and can contain * and ? wildcards. If excludeStringScripts
+     * is true, scripts that weren't loaded from a file are excluded. Scripts
+     * larger than maxSize are excluded unless it's 0. The rules only apply to
+     * scripts loaded after they are set.
+     */
+    void SetExclusionRules(const std::vector<std::string>& patterns, bool excludeStringScripts, unsigned int maxSize);
+
+    /**
+     * Sets the limits for evaluating expressions for the frontend. Evaluation
+     * is stopped after the number of instructions or the time in milliseconds,
+     * and tables stop being written when the result is larger than size bytes.
+     * A limit of 0 means there is no limit.
+     */
+    void SetEvaluateLimits(unsigned int instructions, unsigned int time, unsigned int size);
+
+    /**
+     * Turns the breakpoint on the line into a logpoint, adding the breakpoint
+     * if there isn't one. Instead of stopping, the breakpoint writes the message
+     * to the output with each {expression} in it replaced by its value. {{ and }}
+     * are written as single braces. An empty message makes the logpoint a normal
+     * breakpoint again.
+     */
+    void SetLogpoint(lua_State* L, unsigned int scriptIndex, unsigned int line, const std::string& message);
     
+    /**
+     * Turns on the hook for the VMs that have loaded the script, since they
+     * can now reach a breakpoint.
+     */
     void BreakpointsActiveForScript(int scriptIndex);
     
     /**
-     * Returns whether any loaded script still have any breakpoints set
+     * Returns whether any script loaded into the VM still has any breakpoints set.
      */
-    bool GetHaveActiveBreakpoints();
+    bool GetHaveActiveBreakpoints(VirtualMachine* vm);
 
     void SetHaveActiveBreakpoints(bool breakpointsActive);
 
@@ -179,7 +277,21 @@ public:
      */
     int GetScriptIndex(const char* name) const;
 
-    bool StackHasBreakpoint(unsigned long api, lua_State* L);
+    /**
+     * Returns true if the source of a chunk being loaded with the specified
+     * name should be passed to PostLoadScript. This is false when we're not
+     * attached or the name has already been registered, since the script is
+     * then identified by its name alone.
+     */
+    bool GetNeedsScriptSource(const char* name) const;
+
+    /**
+     * Rebuilds the list of frames on the stack that contain breakpoints by
+     * walking the entire stack. This is only necessary when hook events may
+     * have been missed, otherwise the list is updated as functions are called
+     * and return.
+     */
+    void RebuildBreakpointStack(unsigned long api, lua_State* L, VirtualMachine* vm);
 
     /**
      * Returns the class name associated with the metatable index. This makes
@@ -189,7 +301,7 @@ public:
     bool GetClassNameForMetatable(unsigned long api, lua_State* L, int mt) const;
 
     /**
-     * Pushes onto the stack the class name for a userdata.
+     * Returns the class name for a userdata, or NULL if it doesn't have one.
      */
     const char* GetClassNameForUserdata(unsigned long api, lua_State* L, int ud) const;
 
@@ -204,6 +316,13 @@ public:
      */
     void Message(const char* message, MessageType type = MessageType_Normal);
 
+    /**
+     * Rereads the decoda_name global for the state and sends the new name
+     * to the front end if it has changed. This is called by decoda_setname
+     * so that the name is picked up without waiting for the next poll.
+     */
+    void UpdateVmName(unsigned long api, lua_State* L);
+
     /**
      * Ignores the specified exception whenever it occurs.
      */
@@ -234,28 +353,147 @@ public:
 
 private:
 
+    /**
+     * Set of lines in a script that have breakpoints. Once a set has been
+     * published to a Script it is never modified, so the hook can read it
+     * without holding the critical section.
+     */
+    struct BreakpointSet
+    {
+        std::vector<unsigned int>   lines;          // Lines that have breakpoints on them (sorted).
+        std::vector<bool>           bits;           // Indexed by line, true if the line has a breakpoint.
+    };
+
+    /**
+     * Condition and hit count attached to a breakpoint. The condition is
+     * compiled separately in each VM the first time the breakpoint is hit.
+     */
+    struct BreakpointOptions
+    {
+        unsigned int    id;             // Unique id, changed whenever the options are modified.
+        std::string     condition;      // Lua expression, or empty to always break.
+        unsigned int    hitCount;       // Number of times the condition must be true before breaking.
+        unsigned int    hits;           // Number of times the condition has been true.
+        std::string     logMessage;     // Message to log instead of breaking, or empty to break.
+    };
+
     struct Script
     {
 
+        /**
+         * Constructor.
+         */
+        Script();
+
+        /**
+         * Destructor.
+         */
+        ~Script();
+
         /**
          * Returns true if there is a break point on the specified line
          * of the script.
          */
         bool GetHasBreakPoint(unsigned int line) const;
         
+        /**
+         * Returns true if there is a break point on any line in the range
+         * [start, end).
+         */
         bool HasBreakPointInRange(unsigned int start, unsigned int end) const;
 
+        /**
+         * Toggles the breakpoint on the line and returns true if it is now set.
+         * Changes to the breakpoints must be made while holding the critical
+         * section.
+         */
         bool ToggleBreakpoint(unsigned int line);
 
-        bool HasBreakpointsActive();
+        bool HasBreakpointsActive() const;
 
         void ClearBreakpoints();
 
+        /**
+         * Replaces the published breakpoint set. The old set is retired
+         * rather than deleted since a hook may still be reading it.
+         */
+        void PublishBreakpoints(BreakpointSet* set);
+
         std::string                 name;
-        std::string                 source;
+        const SourceStore::Source*  source;         // Shared with other scripts, NULL if it was released to the frontend.
         std::string                 title;
-        std::vector<unsigned int>   breakpoints;    // Lines that have breakpoints on them.
+        ULONGLONG                   hash;           // Hash of the source, used to find scripts loaded under other names.
+        size_t                      size;           // Length of the source, kept after it's released.
+        unsigned char               digest[DigestSize]; // Digest of the source, computed when it's released.
+        bool                        excluded;       // Excluded scripts aren't sent to the frontend and have no index.
+        unsigned int                index;          // Index of the script in the scripts array, unused if it's excluded.
+        const BreakpointSet* volatile breakpoints;  // Current breakpoints, replaced rather than modified.
         std::vector<unsigned int>   validLines;     // Lines that can have breakpoints on them.
+        std::map<unsigned int, BreakpointOptions> breakpointOptions;  // Keyed by line, modified while holding the critical section.
+
+    };
+
+    /**
+     * Hash table from script names to scripts. Lookups don't take a lock and
+     * can run at the same time as an insert, which lets the hook find scripts
+     * without entering the critical section. Inserts and clears must be
+     * serialized by the caller, and entries are never removed individually.
+     */
+    class NameToScriptMap
+    {
+
+    public:
+
+        NameToScriptMap();
+        ~NameToScriptMap();
+
+        /**
+         * Returns the script registered under the name, or NULL if there
+         * isn't one.
+         */
+        Script* Find(const char* name) const;
+
+        /**
+         * Registers the script under the name. If the name is already in the
+         * table the existing mapping is kept.
+         */
+        void Insert(const char* name, Script* script);
+
+        /**
+         * Removes all of the entries. This must not be called while another
+         * thread could be reading the table.
+         */
+        void Clear();
+
+    private:
+
+        struct Entry
+        {
+            std::string     name;
+            unsigned int    hash;
+            Script*         script;
+        };
+
+        struct Table
+        {
+            unsigned int    size;                   // Number of slots, always a power of 2.
+            Entry* volatile* slots;
+        };
+
+        static unsigned int HashName(const char* name);
+
+        static Table* CreateTable(unsigned int size);
+
+        static void InsertIntoTable(Table* table, Entry* entry);
+
+        NameToScriptMap(const NameToScriptMap&);
+        NameToScriptMap& operator=(const NameToScriptMap&);
+
+    private:
+
+        Table* volatile             m_table;
+        unsigned int                m_count;
+        std::vector<Table*>         m_retiredTables;    // Smaller tables readers may still be probing.
 
     };
 
@@ -278,9 +516,17 @@ private:
 
     /**
      * Blocks execution until the the debugger is instructed to continue
-     * executing.
+     * executing. Anything cached for evaluating expressions during the break
+     * is released before returning.
      */
-    void WaitForContinue();
+    void WaitForContinue(unsigned long api, lua_State* L);
+
+    /**
+     * Records the depth the stack has to unwind to before the step that was
+     * just requested stops. This is called by the thread that was broken
+     * once it resumes.
+     */
+    void BeginStep(unsigned long api, lua_State* L);
 
     /**
      * Entry point into the command handling thread.
@@ -293,6 +539,12 @@ private:
      */
     static DWORD WINAPI StaticCommandThreadProc(LPVOID param);
 
+    /**
+     * Called by the command thread while it's waiting for a command. This
+     * sends the logpoint messages that have been buffered for too long.
+     */
+    static void StaticCommandIdleProc(void* param);
+
     /**
      * Breaks from inside the script code. This will block until execution
      * is resumed.
@@ -331,22 +583,62 @@ private:
     bool GetStartupDirectory(char* path, int maxPathLength);
 
     /**
-     * Gets the value at location n on the stack as text. If expandTable is true
-     * then tables will be returned in their expanded form (i.e. "{ ... }")
+     * Writes the value at location n on the stack for display in the frontend.
+     * Tables are expanded until the depth reaches zero. Exactly one value is
+     * always written, which is an error if the value couldn't be converted.
+     */
+    void WriteValue(unsigned long api, lua_State* L, int n, ValueWriter& writer, int maxDepth = 10, const char* typeNameOverride = NULL, bool displayAsKey = false, int handles = 0, int visited = 0) const;
+
+    /**
+     * Writes the luabind class instance on the top of the stack. Returns false
+     * and writes nothing if the value isn't a luabind class instance.
+     */
+    bool WriteLuaBindClassValue(unsigned long api, lua_State* L, ValueWriter& writer, unsigned int maxDepth, bool displayAsKey = false) const;
+
+    /**
+     * Writes the table value at location n on the stack. Nested tables are
+     * not expanded. If handles is the stack index of the handle table, each
+     * table is given a handle so the frontend can get the rest of the elements
+     * later. In that case visited is the stack index of the table mapping the
+     * tables already written to their handles, and those are written as
+     * references instead.
      */
-    TiXmlNode* GetValueAsText(unsigned long api, lua_State* L, int n, int maxDepth = 10, const char* typeNameOverride = NULL, bool displayAsKey = false) const;
+    void WriteTable(unsigned long api, lua_State* L, int t, ValueWriter& writer, int maxDepth = 10, const char* typeNameOverride = NULL, int handles = 0, int visited = 0) const;
 
     /**
-     * Gets the value at location n on the stack as text. If expandTable is true
-     * then tables will be returned in their expanded form (i.e. "{ ... }")
+     * Writes the keys and values of the elements of the table at index t from
+     * offset to offset + limit, stopping early if the evaluation runs over its
+     * limits. Returns true if the table has more elements after the ones that
+     * were written, and sets end to the index of the first one. If keys is
+     * non-zero, it's the stack index of the table's keys from PushTableKeys,
+     * which are used to go directly to the offset.
      */
-    TiXmlNode* GetLuaBindClassValue(unsigned long api, lua_State* L, unsigned int maxDepth, bool displayAsKey = false) const;
+    bool WriteTableElements(unsigned long api, lua_State* L, int t, int keys, ValueWriter& writer, int maxDepth, unsigned int offset, unsigned int limit, int handles, int visited, unsigned int& end) const;
 
     /**
-     * Gets the table value at location n on the stack as text. Nested tables are
-     * not expanded.
+     * Pushes an array of the keys of the table with the handle onto the stack.
+     * The keys are copied from the table at index t the first time, and kept
+     * with the handle so that each page of a large table doesn't have to skip
+     * over the elements before it.
      */
-    TiXmlNode* GetTableAsText(unsigned long api, lua_State* L, int t, int maxDepth = 10, const char* typeNameOverride = NULL) const;
+    void PushTableKeys(unsigned long api, lua_State* L, int t, int handles, int handle) const;
+
+    /**
+     * Converts values in the binary encoding into the XML format.
+     */
+    std::string GetValuesAsXml(const std::string& data) const;
+
+    /**
+     * Reads a value whose tag has already been read as XML. Returns NULL if
+     * the data is invalid.
+     */
+    TiXmlNode* ReadValueAsXml(ValueReader& reader, ValueTag tag) const;
+
+    /**
+     * Adds a handle to the table at index t to the table in the handles stack
+     * index and returns it.
+     */
+    int CreateValueHandle(unsigned long api, lua_State* L, int t, int handles) const;
 
     /**
      * Returns true if the name belongs to a Lua internal variable that we
@@ -381,6 +673,7 @@ private:
     {
         Mode_Continue,
         Mode_StepOver,
+        Mode_StepOut,
         Mode_StepInto,
     };
     
@@ -398,22 +691,142 @@ private:
         std::string     name;
     };
 
+    // Class infos are keyed by the metatable pointer (or NULL if lua_topointer
+    // isn't available), so the lookup still needs to check the reference.
+    typedef stdext::hash_multimap<const void*, ClassInfo>   MetatableToClassMap;
+
+    /**
+     * Cached result of checking whether a function has a breakpoint in it.
+     * Functions are identified by their source string and the line they
+     * were defined on.
+     */
+    struct FunctionCacheEntry
+    {
+        const char*     source;
+        int             lineDefined;
+        int             lastLineDefined;
+        LONG            generation;
+        bool            hasBreakpoint;
+        bool            excluded;
+    };
+
+    static const unsigned int s_functionCacheSize = 64;
+
+    static const unsigned int s_tablePageSize = 100;    // Number of table elements sent before the frontend asks for more.
+    static const int s_evaluateHookCount = 1000;        // Instructions between checks of the evaluation limits.
+
+    /**
+     * Cached result of looking up a script by its source string. Lua interns
+     * the strings, so the same pointer is passed to the hook over and over.
+     */
+    struct ScriptCacheEntry
+    {
+        const char*     source;
+        LONG            generation;
+        Script*         script;
+    };
+
+    static const unsigned int s_scriptCacheSize = 64;
+
+    /**
+     * Breakpoint condition and log message compiled into functions stored in
+     * the registry of a VM.
+     */
+    struct CompiledBreakpoint
+    {
+        unsigned int    id;             // Id of the options the functions were compiled from.
+        int             conditionRef;   // Registry reference to the condition, or LUA_NOREF if there isn't one.
+        int             logRef;         // Registry reference to the function returning the log values, or LUA_NOREF.
+        std::vector<std::string> logText;   // Text of the log message before, between and after the values.
+    };
+
+    typedef std::map<std::pair<unsigned int, unsigned int>, CompiledBreakpoint> CompiledBreakpointMap;
+
+    static const unsigned int s_maxLogBufferSize    = 4096;
+    static const unsigned int s_logFlushInterval    = 100;  // Milliseconds messages are buffered for.
+
+    static const unsigned int s_maxProfileDepth         = 32;
+    static const unsigned int s_maxProfileNameLength    = 32;
+    static const unsigned int s_profileBufferSize       = 128;
+    static const unsigned int s_profileSendInterval     = 500;  // Milliseconds between batches of samples.
+
+    struct ProfileFrame
+    {
+        int             scriptIndex;
+        int             line;           // Line the function was defined on.
+        char            function[s_maxProfileNameLength];
+    };
+
+    /**
+     * Call stack captured by the profiler. Frame 0 is the top of the stack.
+     */
+    struct ProfileSample
+    {
+        unsigned int    numFrames;
+        ProfileFrame    frames[s_maxProfileDepth];
+    };
+
+    /**
+     * Scripts that have been loaded into a state. Threads share the set of the
+     * state they were created from since they can run any of its functions.
+     */
+    struct LoadedScripts
+    {
+        std::vector<bool> scripts;      // Indexed by script index.
+        bool            all;            // True if the scripts loaded before we attached are unknown.
+        unsigned int    refCount;
+    };
+
     struct VirtualMachine
     {
         lua_State*      L;
         HANDLE          hThread;
         bool            initialized;
-        int             callCount;
+        int             stepDepth;      // Stack depth execution must unwind to before stepping over or out stops, or -1.
         int             callStackDepth;
         int             lastStepLine;
         int             lastStepScript;
         unsigned long   api;
         std::string     name;
+        unsigned int    nameCheckCount; // Number of hook events until decoda_name is checked again.
         unsigned int    stackTop;
         bool            luaJitWorkAround;
-        bool            breakpointInStack;
-        bool            haveActiveBreakpoints;
-        std::string     lastFunctions;
+        bool            breakpointStackValid;   // False if call or return events may have been missed.
+        LONG            breakpointStackGeneration;
+        std::vector<int> breakpointStack;       // Depths of the frames on the stack that contain breakpoints.
+        int             stackDepth;             // Depth of the stack after the last call or return, valid with the breakpoint stack.
+        int             excludedDepth;          // Depth of the outermost frame in an excluded script, or 0 if there isn't one.
+        volatile LONG   hookEpoch;              // Breakpoint epoch when the hook was entered, or 0 if it isn't running.
+        bool            haveActiveBreakpoints;  // True if a script loaded into the VM has breakpoints.
+        LoadedScripts*  loadedScripts;
+        FunctionCacheEntry functionCache[s_functionCacheSize];
+        ScriptCacheEntry scriptCache[s_scriptCacheSize];
+        unsigned int    scriptCacheHits;
+        unsigned int    scriptCacheMisses;
+        std::vector<ProfileSample> profileSamples;  // Ring buffer of s_profileBufferSize samples.
+        unsigned int    numProfileSamples;      // Samples in the ring that haven't been sent.
+        unsigned int    nextProfileSample;      // Index in the ring the next sample is written to.
+        DWORD           lastProfileSendTime;
+        CompiledBreakpointMap compiledBreakpoints;  // Keyed by script index and line.
+        int             evaluateEnvironmentRef; // Tables used to evaluate expressions during the current break, or LUA_NOREF.
+        int             evaluateStackLevel;     // Stack level the cached environment was created for.
+        int             evaluateFunctionsRef;   // Expressions compiled during the current break keyed by their text, or LUA_NOREF.
+        int             valueHandlesRef;        // Values the frontend can expand during the current break, or LUA_NOREF.
+    };
+
+    struct VmCacheEntry
+    {
+        lua_State*      L;
+        VirtualMachine* vm;
+        LONG            generation;
+    };
+
+    /**
+     * Per-thread cache of the state to virtual machine map used by the hook.
+     */
+    struct VmCache
+    {
+        VmCacheEntry    entries[16];
     };
 
     struct StackEntry
@@ -452,6 +865,34 @@ private:
      */
     bool CreateEnvironment(unsigned long api, lua_State* L, int stackLevel, int nilSentinel);
 
+    /**
+     * Pushes the nil sentinel, local table, up value table and environment
+     * table used to evaluate expressions at the specified stack level. These
+     * are reused by the evaluations at the same level until execution resumes.
+     * Returns false and pushes nothing if the stack level is invalid.
+     */
+    bool PushEvaluateEnvironment(unsigned long api, lua_State* L, VirtualMachine* vm, int stackLevel);
+
+    /**
+     * Pushes the compiled function for an expression, compiling it the first
+     * time it's evaluated during a break. Returns the Lua error code, in which
+     * case the error message is pushed instead.
+     */
+    int PushEvaluateFunction(unsigned long api, lua_State* L, VirtualMachine* vm, const std::string& expression);
+
+    /**
+     * Pushes the table holding the values the frontend has handles for during
+     * the current break, creating it if necessary.
+     */
+    void PushValueHandles(unsigned long api, lua_State* L, VirtualMachine* vm);
+
+    /**
+     * Releases the environment, compiled expressions and value handles cached
+     * for evaluating expressions during a break. This is called by WaitForContinue
+     * since the locals may change once execution resumes.
+     */
+    void ReleaseEvaluateCache(unsigned long api, lua_State* L, VirtualMachine* vm);
+
     /**
      * Chains two tables together so that accessing members of a child table that don't exist
      * will then attempt to access them on the parent table.
@@ -535,12 +976,151 @@ private:
      */
     void GetFileTitle(const char* name, std::string& title) const;
 
+    /**
+     * Returns true if the frontend may have breakpoints for the script with the
+     * specified title. This must be called while holding the critical section.
+     */
+    bool GetHasBreakpointFile(const std::string& title) const;
+
+    /**
+     * Returns true if the exclusion rules say the script shouldn't be debugged.
+     * This must be called while holding the critical section.
+     */
+    bool GetIsScriptExcluded(const char* name, size_t size) const;
+
+    /**
+     * Converts a script name or pattern into the form used to compare them,
+     * which is in lower case with forward slashes and no @ sign.
+     */
+    static std::string NormalizeScriptName(const char* name);
+
+    /**
+     * Returns true if the string matches the pattern, which can contain * and
+     * ? wildcards.
+     */
+    static bool GetMatchesPattern(const char* pattern, const char* string);
+
     /**
      * Logs information about a hook callback event. This is used for debugging.
      */
     void LogHookEvent(unsigned long api, lua_State* L, lua_Debug* ar);
 
-    void UpdateHookMode(unsigned long api, lua_State* L, lua_Debug* hookEvent);
+    void UpdateHookMode(unsigned long api, lua_State* L, VirtualMachine* vm, lua_Debug* hookEvent);
+
+    /**
+     * Records the current call stack for the profiler. This is called from
+     * the count hook.
+     */
+    void SampleStack(unsigned long api, lua_State* L, VirtualMachine* vm);
+
+    /**
+     * Sends the samples collected for the virtual machine to the front end,
+     * combining identical call stacks.
+     */
+    void SendProfileSamples(VirtualMachine* vm);
+
+    /**
+     * Returns true if the function described by the debug info (which must
+     * have the "S" fields filled in) contains a breakpoint. The result is
+     * cached per VM until the breakpoints or the set of scripts change. If
+     * registerScript is true, unknown scripts are registered with the backend.
+     * excluded is set to true if the function is in a script that isn't being
+     * debugged.
+     */
+    bool FunctionHasBreakpoint(unsigned long api, lua_State* L, VirtualMachine* vm, lua_Debug* ar, bool registerScript, bool& excluded);
+
+    /**
+     * Returns the script with the source name, or NULL if it hasn't been
+     * registered. This checks a per VM cache keyed by the address of the
+     * string before looking up the name.
+     */
+    Script* FindScript(VirtualMachine* vm, const char* source);
+
+    /**
+     * Returns true if execution should stop at the breakpoint on the line.
+     * This evaluates the breakpoint's condition (if it has one) in the scope
+     * of the function on the top of the stack, updates the hit count and
+     * logs the message if the breakpoint is a logpoint.
+     */
+    bool GetShouldStopAtBreakpoint(unsigned long api, lua_State* L, VirtualMachine* vm, Script* script, unsigned int line);
+
+    /**
+     * Compiles a breakpoint condition into a function and returns a reference
+     * to it in the registry. If the condition has a syntax error, an error
+     * message is sent to the front end and LUA_NOREF is returned.
+     */
+    int CompileBreakpointCondition(unsigned long api, lua_State* L, const std::string& condition);
+
+    /**
+     * Calls the compiled condition with the locals, up values and globals of
+     * the function on the top of the stack and returns the result. If the
+     * condition generates an error the result is true so that the user can
+     * see where the error occurred.
+     */
+    bool EvaluateBreakpointCondition(unsigned long api, lua_State* L, int functionRef);
+
+    /**
+     * Splits a logpoint message into its text and expressions and compiles the
+     * expressions into a function that returns their values. The pieces of text
+     * are stored in the compiled breakpoint.
+     */
+    void CompileLogMessage(unsigned long api, lua_State* L, const std::string& message, CompiledBreakpoint* compiled);
+
+    /**
+     * Evaluates the expressions in a compiled logpoint message in the scope of
+     * the function on the top of the stack and buffers the resulting message.
+     */
+    void LogBreakpointMessage(unsigned long api, lua_State* L, const CompiledBreakpoint* compiled);
+
+    /**
+     * Adds a logpoint message to the buffer, sending the buffer to the front
+     * end if it's full.
+     */
+    void BufferLogMessage(const std::string& message);
+
+    /**
+     * Sends the buffered logpoint messages to the front end as a single message.
+     * The critical section must be held when calling this.
+     */
+    void FlushLogMessages();
+
+    /**
+     * Records that the script has been loaded into the state. If the script
+     * already has breakpoints, the hook is turned on for the state.
+     */
+    void SetScriptLoaded(lua_State* L, unsigned int scriptIndex);
+
+    /**
+     * Returns true if the VM has loaded the script, or may have loaded it
+     * before the debugger was attached.
+     */
+    bool GetHasLoadedScript(const VirtualMachine* vm, unsigned int scriptIndex) const;
+
+    /**
+     * Invalidates the cached FunctionHasBreakpoint results and script lookups
+     * in all of the VMs.
+     */
+    void InvalidateFunctionCache();
+
+    /**
+     * Takes ownership of a breakpoint set that was replaced. It's deleted by
+     * FreeRetiredBreakpoints once no hook can be reading it. The critical
+     * section must be held when calling this.
+     */
+    void RetireBreakpoints(const BreakpointSet* set);
+
+    /**
+     * Deletes the retired breakpoint sets that were replaced before each of
+     * the hooks that are running was entered. The critical section must be
+     * held when calling this.
+     */
+    void FreeRetiredBreakpoints();
+
+    /**
+     * Reads the decoda_name global and notifies the front end if the name of
+     * the virtual machine has changed.
+     */
+    void UpdateVmName(unsigned long api, lua_State* L, VirtualMachine* vm);
 
     /**
      * Calls the named meta-method for the specified value. If the value does
@@ -550,6 +1130,29 @@ private:
      */
     bool CallMetaMethod(unsigned long api, lua_State* L, int valueIndex, const char* method, int numResults, int& result) const;
 
+    /**
+     * Starts applying the evaluation limits to the VM. This replaces the hooks
+     * for the state with a count hook until EndEvaluateLimits is called, after
+     * which the hook mode needs to be restored.
+     */
+    void BeginEvaluateLimits(unsigned long api, lua_State* L, VirtualMachine* vm);
+
+    /**
+     * Stops applying the evaluation limits.
+     */
+    void EndEvaluateLimits();
+
+    /**
+     * Returns true if the current evaluation has used up its time or
+     * instructions. Once this happens, no more code is run for it.
+     */
+    bool GetIsEvaluateTimedOut() const;
+
+    /**
+     * Returns true if the result being written is larger than the size limit.
+     */
+    bool GetIsEvaluateTooLarge(const ValueWriter& writer) const;
+
     /**
      * Gets the current C/C++ call stack.
      */
@@ -572,25 +1175,34 @@ private:
      */
     VirtualMachine* GetVm(lua_State* L);
 
+    /**
+     * Returns the virtual machine for the state from the hook. This checks a
+     * small per-thread cache first so that the common case doesn't need the
+     * critical section. If the state isn't known yet it is attached.
+     */
+    VirtualMachine* GetVmForHook(unsigned long api, lua_State* L);
+
     /**
      * Creates a call stack that unifies the native call stack and the script
-     * call stack.
+     * call stack. Scripts are looked up through the cache of the VM if there
+     * is one.
      */
-    unsigned int GetUnifiedStack(unsigned long api, const StackEntry nativeStack[], unsigned int nativeStackSize,
+    unsigned int GetUnifiedStack(unsigned long api, VirtualMachine* vm, const StackEntry nativeStack[], unsigned int nativeStackSize,
         const lua_Debug scriptStack[], unsigned int scriptStackSize,
         StackEntry unifiedStack[]);
 
 private:
 
     typedef stdext::hash_map<lua_State*, VirtualMachine*>   StateToVmMap;
-    typedef stdext::hash_map<std::string, unsigned int>     NameToScriptMap;
+    typedef stdext::hash_multimap<ULONGLONG, Script*>       HashToScriptMap;
 
     static DebugBackend*            s_instance;
     static const unsigned int       s_maxStackSize  = 100;
+    static const unsigned int       s_nameCheckInterval = 4096;
 
     FILE*                           m_log;
 
-    Mode                            m_mode;
+    volatile Mode                   m_mode;
     HANDLE                          m_stepEvent;
     HANDLE                          m_loadEvent;
     HANDLE                          m_detachEvent;
@@ -600,15 +1212,47 @@ private:
 
     std::vector<Script*>            m_scripts;
     NameToScriptMap                 m_nameToScript;
+    HashToScriptMap                 m_hashToScript;
+    SourceStore                     m_sourceStore;      // Source code of the scripts, modified while holding the critical section.
 
     Channel                         m_eventChannel;
 
     HANDLE                          m_commandThread;
     Channel                         m_commandChannel;
 
-    std::list<ClassInfo>            m_classInfos;
+    MetatableToClassMap             m_classInfos;
     std::vector<VirtualMachine*>    m_vms;
     StateToVmMap                    m_stateToVm;
+
+    DWORD                           m_vmCacheTlsIndex;
+    volatile LONG                   m_vmGeneration;     // Incremented whenever a VM is detached.
+    volatile LONG                   m_functionCacheGeneration;
+    unsigned int                    m_nextBreakpointOptionsId;
+
+    stdext::hash_set<std::string>   m_breakpointFiles;  // Lower case names of the files the frontend has breakpoints in.
+    bool                            m_haveBreakpointFiles;
+
+    std::vector<std::string>        m_excludedPatterns; // Normalized patterns for the scripts that aren't debugged.
+    bool                            m_excludeStringScripts;
+    unsigned int                    m_maxScriptSize;
+    std::vector<Script*>            m_excludedScripts;  // Scripts the rules excluded, which aren't in m_scripts.
+
+    volatile LONG                   m_breakpointEpoch;  // Incremented whenever a breakpoint set is retired.
+    std::vector<std::pair<LONG, const BreakpointSet*> > m_retiredBreakpoints;   // Ordered by the epoch they were retired in.
+
+    unsigned int                    m_evaluateInstructionLimit;
+    unsigned int                    m_evaluateTimeLimit;        // In milliseconds.
+    unsigned int                    m_evaluateSizeLimit;        // In bytes.
+
+    VirtualMachine* volatile        m_evaluateVm;               // VM the limits are being applied to, or NULL.
+    unsigned int                    m_evaluateInstructions;
+    DWORD                           m_evaluateStartTime;
+    mutable bool                    m_evaluateTimedOut;
+
+    std::string                     m_logBuffer;        // Logpoint messages that haven't been sent yet.
+    DWORD                           m_logBufferTime;    // Time the first message in the buffer was added.
+    volatile bool                   m_haveBufferedLog;
+    std::vector<VmCache*>           m_vmCaches;
     
     mutable CriticalSection         m_exceptionCriticalSection; // Controls access to ignoreExceptions 
     stdext::hash_set<std::string>   m_ignoreExceptions;
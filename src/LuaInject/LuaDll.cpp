@@ -27,6 +27,7 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 #include "CriticalSection.h"
 #include "CriticalSectionLock.h"
 #include "DebugHelp.h"
+#include "ChunkBuffer.h"
 
 #include <windows.h>
 #include <tlhelp32.h>
@@ -103,6 +104,7 @@ typedef void            (*lua_newtable_cdecl_t)         (lua_State*);
 typedef void            (*lua_createtable_cdecl_t)      (lua_State*, int, int);
 typedef int             (*lua_next_cdecl_t)             (lua_State*, int);
 typedef int             (*lua_rawequal_cdecl_t)         (lua_State *L, int idx1, int idx2);
+typedef const void*     (*lua_topointer_cdecl_t)        (lua_State *L, int index);
 typedef int             (*lua_getmetatable_cdecl_t)     (lua_State*, int objindex);
 typedef int             (*lua_setmetatable_cdecl_t)     (lua_State*, int objindex);
 typedef int             (*luaL_ref_cdecl_t)             (lua_State *L, int t);
@@ -176,6 +178,7 @@ typedef void            (__stdcall *lua_newtable_stdcall_t)       (lua_State*);
 typedef void            (__stdcall *lua_createtable_stdcall_t)    (lua_State*, int, int);
 typedef int             (__stdcall *lua_next_stdcall_t)           (lua_State*, int);
 typedef int             (__stdcall *lua_rawequal_stdcall_t)       (lua_State *L, int idx1, int idx2);
+typedef const void*     (__stdcall *lua_topointer_stdcall_t)      (lua_State *L, int index);
 typedef int             (__stdcall *lua_getmetatable_stdcall_t)   (lua_State*, int objindex);
 typedef int             (__stdcall *lua_setmetatable_stdcall_t)   (lua_State*, int objindex);
 typedef int             (__stdcall *luaL_ref_stdcall_t)           (lua_State *L, int t);
@@ -273,6 +276,7 @@ struct LuaInterface
     lua_createtable_cdecl_t      lua_createtable_dll_cdecl;
     lua_next_cdecl_t             lua_next_dll_cdecl;
     lua_rawequal_cdecl_t         lua_rawequal_dll_cdecl;
+    lua_topointer_cdecl_t        lua_topointer_dll_cdecl;
     lua_getmetatable_cdecl_t     lua_getmetatable_dll_cdecl;
     lua_setmetatable_cdecl_t     lua_setmetatable_dll_cdecl;
     luaL_ref_cdecl_t             luaL_ref_dll_cdecl;
@@ -347,6 +351,7 @@ struct LuaInterface
     lua_createtable_stdcall_t    lua_createtable_dll_stdcall;
     lua_next_stdcall_t           lua_next_dll_stdcall;
     lua_rawequal_stdcall_t       lua_rawequal_dll_stdcall;
+    lua_topointer_stdcall_t      lua_topointer_dll_stdcall;
     lua_getmetatable_stdcall_t   lua_getmetatable_dll_stdcall;
     lua_setmetatable_stdcall_t   lua_setmetatable_dll_stdcall;
     luaL_ref_stdcall_t           luaL_ref_dll_stdcall;
@@ -369,6 +374,7 @@ struct LuaInterface
     lua_checkstack_stdcall_t     lua_checkstack_dll_stdcall;
 
     lua_CFunction                DecodaOutput;
+    lua_CFunction                DecodaSetName;
     lua_CFunction                CPCallHandler;
     lua_Hook                     HookHandler;
 
@@ -451,6 +457,7 @@ bool                            g_warnedAboutJit     = false;
 
 std::string                     g_symbolsDirectory;
 static DWORD                    g_disableInterceptIndex = 0;
+volatile int                    g_hookCount = 0;    // Instructions between count hook events, or 0 for none.
 bool                            g_initializedDebugHelp = false; 
 
 /**
@@ -510,6 +517,78 @@ const char* __stdcall MemoryReader_stdcall(lua_State* L, void* data, size_t* siz
 
 }
 
+/**
+ * Data structure passed into the CaptureReader function.
+ */
+struct Capture
+{
+    lua_Reader      reader;         // Reader the chunk is actually read from.
+    void*           data;
+    bool            stdcall;        // Calling convention of the reader.
+    bool            haveFirstChunk; // Whether the reader was called before the load started.
+    const char*     firstChunk;     // Piece returned by that call.
+    size_t          firstChunkSize;
+    size_t          size;           // Number of bytes read so far.
+    ChunkBuffer*    buffer;         // Buffer the pieces are copied into, or NULL if they aren't needed.
+};
+
+/**
+ * Reads the next piece of a chunk from the reader in the capture, copying it
+ * into the capture buffer.
+ */
+const char* CaptureReader(lua_State* L, Capture* capture, size_t* size)
+{
+
+    const char* chunk;
+    
+    if (capture->haveFirstChunk)
+    {
+        chunk = capture->firstChunk;
+        *size = capture->firstChunkSize;
+        capture->haveFirstChunk = false;
+    }
+    else if (capture->stdcall)
+    {
+        chunk = reinterpret_cast<lua_Reader_stdcall>(capture->reader)(L, capture->data, size);
+    }
+    else
+    {
+        chunk = capture->reader(L, capture->data, size);
+    }
+
+    // We allow the reader to return 0 for the chunk size since Lua supports
+    // that, although according to the manual it should return NULL to signal
+    // the end of the data.
+
+    if (chunk != NULL && *size > 0)
+    {
+        capture->size += *size;
+        if (capture->buffer != NULL)
+        {
+            capture->buffer->Append(chunk, *size);
+        }
+    }
+
+    return chunk;
+
+}
+
+/**
+ * lua_Reader function used to capture a chunk while it's loaded.
+ */
+const char* CaptureReader_cdecl(lua_State* L, void* data, size_t* size)
+{
+    return CaptureReader(L, static_cast<Capture*>(data), size);
+}
+
+/**
+ * lua_Reader function used to capture a chunk while it's loaded.
+ */
+const char* __stdcall CaptureReader_stdcall(lua_State* L, void* data, size_t* size)
+{
+    return CaptureReader(L, static_cast<Capture*>(data), size);
+}
+
 #pragma auto_inline(off)
 int DecodaOutputWorker(unsigned long api, lua_State* L, bool& stdcall)
 {
@@ -538,6 +617,41 @@ __declspec(naked) int DecodaOutput(unsigned long api, lua_State* L)
 
 }
 
+#pragma auto_inline(off)
+int DecodaSetNameWorker(unsigned long api, lua_State* L, bool& stdcall)
+{
+
+    stdcall = g_interfaces[api].stdcall;
+
+    // Store the name in the decoda_name global so that it's the same as if
+    // the script had set it directly.
+    lua_pushglobaltable_dll(api, L);
+    lua_pushstring_dll(api, L, "decoda_name");
+    lua_pushvalue_dll(api, L, 1);
+    lua_rawset_dll(api, L, -3);
+    lua_pop_dll(api, L, 1);
+
+    DebugBackend::Get().UpdateVmName(api, L);
+    
+    return 0;
+
+}
+#pragma auto_inline()
+
+__declspec(naked) int DecodaSetName(unsigned long api, lua_State* L)
+{
+
+    int result;
+    bool stdcall;
+
+    INTERCEPT_PROLOG()
+
+    result = DecodaSetNameWorker(api, L, stdcall);
+
+    INTERCEPT_EPILOG(4)
+
+}
+
 #pragma auto_inline(off)
 int CPCallHandlerWorker(unsigned long api, lua_State* L, bool& stdcall)
 {
@@ -606,13 +720,15 @@ __declspec(naked) void HookHandler(unsigned long api, lua_State* L, lua_Debug* a
 void SetHookMode(unsigned long api, lua_State* L, HookMode mode)
 {
 
-  if(mode == HookMode_None)
+  int count = g_hookCount;
+
+  if(mode == HookMode_None && count == 0)
   {
       lua_sethook_dll(api, L, NULL, 0, 0);
   }
   else
   {
-      int mask;
+      int mask = 0;
 
       switch (mode)
       {
@@ -627,12 +743,32 @@ void SetHookMode(unsigned long api, lua_State* L, HookMode mode)
         break;
       }
 
-      lua_sethook_dll(api, L, g_interfaces[api].HookHandler, mask, 0);
+      if (count > 0)
+      {
+          mask |= LUA_MASKCOUNT;
+      }
+
+      lua_sethook_dll(api, L, g_interfaces[api].HookHandler, mask, count);
   }
 
   
 }
 
+void SetCountHook(unsigned long api, lua_State* L, int count)
+{
+    lua_sethook_dll(api, L, g_interfaces[api].HookHandler, LUA_MASKCOUNT, count);
+}
+
+void SetHookCount(int count)
+{
+    g_hookCount = count;
+}
+
+int GetHookCount()
+{
+    return g_hookCount;
+}
+
 int lua_gethookmask(unsigned long api, lua_State *L)
 {
     if (g_interfaces[api].lua_gethookmask_dll_cdecl != NULL)
@@ -648,7 +784,8 @@ int lua_gethookmask(unsigned long api, lua_State *L)
 HookMode GetHookMode(unsigned long api, lua_State* L)
 {
 
-  int mask = lua_gethookmask(api, L);
+  // The count hook is used for profiling and is independent of the mode.
+  int mask = lua_gethookmask(api, L) & ~LUA_MASKCOUNT;
 
   if(mask == 0)
   {
@@ -946,6 +1083,7 @@ bool GetAreInterceptsEnabled()
 void RegisterDebugLibrary(unsigned long api, lua_State* L)
 {
     lua_register_dll(api, L, "decoda_output", g_interfaces[api].DecodaOutput);
+    lua_register_dll(api, L, "decoda_setname", g_interfaces[api].DecodaSetName);
 }
 
 int GetGlobalsIndex(unsigned long api)
@@ -1630,35 +1768,46 @@ int lua_gettop_dll(unsigned long api, lua_State* L)
     }
 }
 
-int lua_loadbuffer_dll(unsigned long api, lua_State* L, const char* buffer, size_t size, const char* chunkname, const char* mode)
+/**
+ * Loads a chunk using whichever version of lua_load the API has. The reader
+ * with the matching calling convention is passed to it.
+ */
+int lua_load_dll(unsigned long api, lua_State* L, lua_Reader reader_cdecl, lua_Reader_stdcall reader_stdcall, void* data, const char* chunkname, const char* mode)
 {
 
-    Memory memory;
-
-    memory.buffer   = buffer;
-    memory.size     = size;
-
     if (g_interfaces[api].lua_load_dll_cdecl != NULL)
     {
-        return g_interfaces[api].lua_load_dll_cdecl(L, MemoryReader_cdecl, &memory, chunkname, mode);
+        return g_interfaces[api].lua_load_dll_cdecl(L, reader_cdecl, data, chunkname, mode);
     }
     else if (g_interfaces[api].lua_load_dll_stdcall != NULL)
     {
-        return g_interfaces[api].lua_load_dll_stdcall(L, MemoryReader_stdcall, &memory, chunkname, mode);
+        return g_interfaces[api].lua_load_dll_stdcall(L, reader_stdcall, data, chunkname, mode);
     }
     else if (g_interfaces[api].lua_load_510_dll_cdecl != NULL)
     {
-        return g_interfaces[api].lua_load_510_dll_cdecl(L, MemoryReader_cdecl, &memory, chunkname);
+        return g_interfaces[api].lua_load_510_dll_cdecl(L, reader_cdecl, data, chunkname);
     }
     else if (g_interfaces[api].lua_load_510_dll_stdcall != NULL)
     {
-        return g_interfaces[api].lua_load_510_dll_stdcall(L, MemoryReader_stdcall, &memory, chunkname);
+        return g_interfaces[api].lua_load_510_dll_stdcall(L, reader_stdcall, data, chunkname);
     }
 
     assert(0);
     return 0;
 }
 
+int lua_loadbuffer_dll(unsigned long api, lua_State* L, const char* buffer, size_t size, const char* chunkname, const char* mode)
+{
+
+    Memory memory;
+
+    memory.buffer   = buffer;
+    memory.size     = size;
+
+    return lua_load_dll(api, L, MemoryReader_cdecl, MemoryReader_stdcall, &memory, chunkname, mode);
+
+}
+
 void lua_call_dll(unsigned long api, lua_State* L, int nargs, int nresults)
 {
     if (g_interfaces[api].lua_call_dll_cdecl != NULL)
@@ -1757,6 +1906,22 @@ int lua_rawequal_dll(unsigned long api, lua_State *L, int idx1, int idx2)
     }
 }
 
+const void* lua_topointer_dll(unsigned long api, lua_State *L, int index)
+{
+    if (g_interfaces[api].lua_topointer_dll_cdecl != NULL)
+    {
+        return g_interfaces[api].lua_topointer_dll_cdecl(L, index);
+    }
+    else if (g_interfaces[api].lua_topointer_dll_stdcall != NULL)
+    {
+        return g_interfaces[api].lua_topointer_dll_stdcall(L, index);
+    }
+    else // lua_topointer isn't used by many applications, so it may have been stripped.
+    {
+        return NULL;
+    }
+}
+
 int lua_getmetatable_dll(unsigned long api, lua_State* L, int index)
 {
     if (g_interfaces[api].lua_getmetatable_dll_cdecl != NULL)
@@ -2111,6 +2276,7 @@ void FinishLoadingLua(unsigned long api, bool stdcall)
         SET_STDCALL(lua_load_510);
         SET_STDCALL(lua_next);
         SET_STDCALL(lua_rawequal);
+        SET_STDCALL(lua_topointer);
         SET_STDCALL(lua_getmetatable);
         SET_STDCALL(lua_setmetatable);
         SET_STDCALL(luaL_ref);
@@ -2422,7 +2588,7 @@ lua_State* lua_newstate_worker(unsigned long api, lua_Alloc f, void* ud, bool& s
     
     if (result != NULL)
     {
-        DebugBackend::Get().AttachState(api, result);
+        DebugBackend::Get().AttachState(api, result, true);
     }
 
     return result;
@@ -2473,7 +2639,7 @@ lua_State* lua_newthread_worker(unsigned long api, lua_State* L, bool& stdcall)
     
     if (result != NULL)
     {
-        DebugBackend::Get().AttachState(api, result);
+        DebugBackend::Get().AttachState(api, result, true, L);
     }
 
     return result;
@@ -2524,7 +2690,7 @@ lua_State* lua_open_worker(unsigned long api, int stacksize, bool& stdcall)
     
     if (result != NULL)
     {
-        DebugBackend::Get().AttachState(api, result);
+        DebugBackend::Get().AttachState(api, result, true);
     }
 
     return result;
@@ -2564,7 +2730,7 @@ lua_State* lua_open_500_worker(unsigned long api, bool& stdcall)
     
     if (result != NULL)
     {
-        DebugBackend::Get().AttachState(api, result);
+        DebugBackend::Get().AttachState(api, result, true);
     }
 
     return result;
@@ -2618,51 +2784,20 @@ int lua_load_worker(unsigned long api, lua_State* L, lua_Reader reader, void* da
     // when we access the reader function.
     stdcall = (g_interfaces[api].lua_load_dll_stdcall != NULL);
 
-    // Read all of the data out of the reader and into a big buffer.
-
-    std::vector<char> buffer;
-
-    const char* chunk;
-    size_t chunkSize;
-
-    do
-    {
-
-        if (!g_interfaces[api].finishedLoading)
-        {
-            // In this case we must have attached the debugger so we're intercepting a lua_load
-            // function before we've initialized.
-            stdcall = GetIsStdCallConvention(reader, L, data, &chunkSize, (void**)&chunk);
-            FinishLoadingLua(api, stdcall);
-        }
-        else if (stdcall)
-        {
-            // We assume that since the lua_load function is stdcall the reader function is as well.
-            chunk = reinterpret_cast<lua_Reader_stdcall>(reader)(L, data, &chunkSize);
-        }
-        else
-        {
-            // We assume that since the lua_load function is cdecl the reader function is as well.
-            chunk = reader(L, data, &chunkSize);
-        }
-
-        // We allow the reader to return 0 for the chunk size since Lua supports
-        // that, although according to the manual it should return NULL to signal
-        // the end of the data.
-
-        if (chunk != NULL && chunkSize > 0)
-        {
-            buffer.insert(buffer.end(), chunk, chunk + chunkSize);
-        }
+    Capture capture;
 
-    }
-    while (chunk != NULL && chunkSize > 0);
+    capture.haveFirstChunk  = false;
+    capture.firstChunk      = NULL;
+    capture.firstChunkSize  = 0;
 
-    const char* source = NULL;
-    
-    if (!buffer.empty())
+    if (!g_interfaces[api].finishedLoading)
     {
-        source = &buffer[0];
+        // In this case we must have attached the debugger so we're intercepting a lua_load
+        // function before we've initialized. Determining the calling convention reads the
+        // first piece of the chunk, so we hold onto it for the load.
+        stdcall = GetIsStdCallConvention(reader, L, data, &capture.firstChunkSize, (void**)&capture.firstChunk);
+        capture.haveFirstChunk = true;
+        FinishLoadingLua(api, stdcall);
     }
 
     // Make sure the debugger knows about this state. This is necessary since we might have
@@ -2680,11 +2815,24 @@ int lua_load_worker(unsigned long api, lua_State* L, lua_Reader reader, void* da
         }
     }
 
-    int result = lua_loadbuffer_dll(api, L, source, buffer.size(), name, mode);
+    // The chunk is read straight from the reader by the load. We only keep a copy of
+    // it when the debugger will need the source, which isn't the case when a script
+    // is loaded again.
+
+    ChunkBuffer buffer;
+    bool needSource = DebugBackend::Get().GetNeedsScriptSource(name);
+
+    capture.reader          = reader;
+    capture.data            = data;
+    capture.stdcall         = stdcall;
+    capture.size            = 0;
+    capture.buffer          = needSource ? &buffer : NULL;
+
+    int result = lua_load_dll(api, L, CaptureReader_cdecl, CaptureReader_stdcall, &capture, name, mode);
 
-    if (!buffer.empty())
+    if (capture.size > 0)
     {
-        result = DebugBackend::Get().PostLoadScript(api, result, L, source, buffer.size(), name);
+        result = DebugBackend::Get().PostLoadScript(api, result, L, buffer.GetData(), buffer.GetSize(), name);
     }
 
     return result;
@@ -3087,7 +3235,7 @@ lua_State* luaL_newstate_worker(unsigned long api, bool& stdcall)
     
     if (result != NULL)
     {
-        DebugBackend::Get().AttachState(api, result);
+        DebugBackend::Get().AttachState(api, result, true);
     }
 
     return result;
@@ -3328,6 +3476,7 @@ bool LoadLuaFunctions(const stdext::hash_map<std::string, DWORD64>& symbols, HAN
     GET_FUNCTION(lua_load);
     GET_FUNCTION(lua_next);
     GET_FUNCTION(lua_rawequal);
+    GET_FUNCTION_OPTIONAL(lua_topointer);
     GET_FUNCTION(lua_getmetatable);
     GET_FUNCTION(lua_setmetatable);
     GET_FUNCTION_OPTIONAL(luaL_ref);
@@ -3403,6 +3552,7 @@ bool LoadLuaFunctions(const stdext::hash_map<std::string, DWORD64>& symbols, HAN
     // Setup our API.
 
     luaInterface.DecodaOutput  = (lua_CFunction)InstanceFunction(DecodaOutput, api);
+    luaInterface.DecodaSetName = (lua_CFunction)InstanceFunction(DecodaSetName, api);
     luaInterface.CPCallHandler = (lua_CFunction)InstanceFunction(CPCallHandler, api);
     luaInterface.HookHandler   = (lua_Hook)InstanceFunction(HookHandler, api);
 
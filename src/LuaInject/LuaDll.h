@@ -78,6 +78,7 @@ int             lua_pcall_dll           (unsigned long api, lua_State*, int, int
 void            lua_newtable_dll        (unsigned long api, lua_State*);
 int             lua_next_dll            (unsigned long api, lua_State*, int);
 int             lua_rawequal_dll        (unsigned long api, lua_State *L, int idx1, int idx2);
+const void*     lua_topointer_dll       (unsigned long api, lua_State *L, int index);
 int             lua_getmetatable_dll    (unsigned long api, lua_State*, int objindex);
 int             lua_setmetatable_dll    (unsigned long api, lua_State* L, int index);
 int             luaL_loadfile_dll       (unsigned long api, lua_State*, const char*);
@@ -176,6 +177,28 @@ void SetHookMode(unsigned long api, lua_State* L, HookMode mode);
  */
 HookMode GetHookMode(unsigned long api, lua_State* L);
 
+/**
+ * Sets the number of instructions between count hook events. When this is
+ * non-zero, SetHookMode also installs a count hook (used for profiling)
+ * regardless of the mode. States only pick up the change the next time
+ * SetHookMode is called for them.
+ */
+void SetHookCount(int count);
+
+/**
+ * Returns the number of instructions between count hook events, or 0 if the
+ * count hook is not being used.
+ */
+int GetHookCount();
+
+/**
+ * Installs only a count hook for the specified state, called every count
+ * instructions. This replaces the debug and profiling hooks until the next
+ * call to SetHookMode, and is used to limit the time spent evaluating
+ * expressions.
+ */
+void SetCountHook(unsigned long api, lua_State* L, int count);
+
 bool GetIsHookEventRet(unsigned long api, int event);
 bool GetIsHookEventCall(unsigned long api, int event);
 int GetEvent(unsigned long api, const lua_Debug* ar);
@@ -21,7 +21,10 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "Channel.h"
+#include "CriticalSectionLock.h"
+
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 
 Channel::Channel()
@@ -30,11 +33,20 @@ Channel::Channel()
     m_doneEvent = INVALID_HANDLE_VALUE;
     m_readEvent = INVALID_HANDLE_VALUE;
     m_creator   = false;
+
+    m_readBuffer            = new char[s_bufferSize];
+    m_readBufferPosition    = 0;
+    m_readBufferLength      = 0;
+
+    m_idleCallback  = NULL;
+    m_idleParam     = NULL;
+    m_idleInterval  = INFINITE;
 }
 
 Channel::~Channel()
 {
     Destroy();
+    delete [] m_readBuffer;
 }
 
 bool Channel::Create(const char* name)
@@ -43,7 +55,7 @@ bool Channel::Create(const char* name)
     char pipeName[256];
     _snprintf(pipeName, 256, "\\\\.\\pipe\\%s", name);
 
-    DWORD bufferSize = 2048;
+    DWORD bufferSize = s_bufferSize;
 
     m_pipe = CreateNamedPipe(pipeName, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
         PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE, 1, bufferSize, bufferSize, 0, NULL);
@@ -125,6 +137,14 @@ void Channel::Destroy()
         m_pipe = INVALID_HANDLE_VALUE;
     }
 
+    {
+        CriticalSectionLock lock(m_writeCriticalSection);
+        m_writeBuffer.clear();
+    }
+
+    m_readBufferPosition    = 0;
+    m_readBufferLength      = 0;
+
 }
 
 bool Channel::Write(const void* buffer, unsigned int length)
@@ -132,6 +152,18 @@ bool Channel::Write(const void* buffer, unsigned int length)
 
     assert(m_pipe != INVALID_HANDLE_VALUE);
 
+    // Several threads can write to the same channel, so the buffer is
+    // protected in the same way writing to the pipe would be.
+    CriticalSectionLock lock(m_writeCriticalSection);
+    m_writeBuffer.append(static_cast<const char*>(buffer), length);
+
+    return true;
+
+}
+
+bool Channel::Send(const void* buffer, unsigned int length)
+{
+
     if (length == 0)
     {
         // Because of the way message pipes work, writing 0 is different than
@@ -167,12 +199,24 @@ bool Channel::Write(const void* buffer, unsigned int length)
 
 }
 
+void Channel::SetIdleCallback(IdleCallback callback, void* param, DWORD interval)
+{
+    m_idleCallback  = callback;
+    m_idleParam     = param;
+    m_idleInterval  = (callback != NULL) ? interval : INFINITE;
+}
+
 bool Channel::WriteUInt32(unsigned int value)
 {
     DWORD temp = value;
     return Write(&temp, 4);
 }
 
+bool Channel::WriteUInt64(ULONGLONG value)
+{
+    return Write(&value, 8);
+}
+
 bool Channel::WriteString(const char* value)
 {
     unsigned int length = static_cast<int>(strlen(value));
@@ -217,6 +261,11 @@ bool Channel::ReadUInt32(unsigned int& value)
     return true;
 }
 
+bool Channel::ReadUInt64(ULONGLONG& value)
+{
+    return Read(&value, 8);
+}
+
 bool Channel::ReadString(std::string& value)
 {
     
@@ -230,19 +279,16 @@ bool Channel::ReadString(std::string& value)
     if (length != 0)
     {
 
-        char* buffer = new char[length + 1];
+        // The string can contain zeros, so use the length instead of
+        // looking for the terminator.
+        value.resize(length);
 
-        if (!Read(buffer, length))
+        if (!Read(&value[0], length))
         {
-            delete [] buffer;
+            value.clear();
             return false;
         }
 
-        buffer[length] = 0;
-        value = buffer;
-        
-        delete [] buffer;
-
     }
     else
     {
@@ -272,19 +318,49 @@ bool Channel::Read(void* buffer, unsigned int length)
 {
 
     assert(m_pipe != INVALID_HANDLE_VALUE);
-    
-    if (length == 0)
+
+    char* data = static_cast<char*>(buffer);
+
+    while (length > 0)
     {
-        // Because of the way message pipes work, reading 0 is different than
-        // reading nothing.
-        return true;
+
+        if (m_readBufferPosition == m_readBufferLength)
+        {
+            if (!FillReadBuffer())
+            {
+                return false;
+            }
+        }
+
+        unsigned int size = m_readBufferLength - m_readBufferPosition;
+
+        if (size > length)
+        {
+            size = length;
+        }
+
+        memcpy(data, m_readBuffer + m_readBufferPosition, size);
+        
+        m_readBufferPosition += size;
+        data   += size;
+        length -= size;
+
     }
 
+    return true;
+
+}
+
+bool Channel::FillReadBuffer()
+{
+
+    m_readBufferPosition = 0;
+    m_readBufferLength   = 0;
+
     OVERLAPPED overlapped = { 0 };
     overlapped.hEvent = m_readEvent;
 
-    DWORD numBytesRead;
-    BOOL result = ReadFile(m_pipe, buffer, length, &numBytesRead, &overlapped);
+    BOOL result = ReadFile(m_pipe, m_readBuffer, s_bufferSize, NULL, &overlapped);
 
     if (result == FALSE)
     {
@@ -302,27 +378,48 @@ bool Channel::Read(void* buffer, unsigned int length)
                     m_doneEvent,
                 };
 
-            WaitForMultipleObjects(2, events, FALSE, INFINITE);
+            while (WaitForMultipleObjects(2, events, FALSE, m_idleInterval) == WAIT_TIMEOUT)
+            {
+                m_idleCallback(m_idleParam);
+            }
 
             if (WaitForSingleObject(m_doneEvent, 0) == WAIT_OBJECT_0)
             {
                 // The pipe has been closed.
-                result = FALSE;
-            }
-            else if (GetOverlappedResult(m_pipe, &overlapped, &numBytesRead, FALSE))
-            {
-                result = (numBytesRead == length);
+                return false;
             }
         
         }
+        else if (error != ERROR_MORE_DATA)
+        {
+            return false;
+        }
 
     }
 
-    return result == TRUE;
+    DWORD numBytesRead = 0;
+
+    // If the message is larger than our buffer, we get the first part of it
+    // now and the rest on the next read.
+    if (!GetOverlappedResult(m_pipe, &overlapped, &numBytesRead, FALSE) &&
+        GetLastError() != ERROR_MORE_DATA)
+    {
+        return false;
+    }
+
+    m_readBufferLength = numBytesRead;
+    return true;
 
 }
 
-void Channel::Flush()
+bool Channel::Flush()
 {
-    //FlushFileBuffers(m_pipe);
+
+    CriticalSectionLock lock(m_writeCriticalSection);
+
+    bool result = Send(m_writeBuffer.c_str(), m_writeBuffer.length());
+    m_writeBuffer.clear();
+
+    return result;
+
 }
@@ -26,16 +26,24 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 #include <windows.h>
 #include <string>
 
+#include "CriticalSection.h"
+
 /**
  * Communication channel used to between two processess. The current
  * implementation uses pipes, however in the future we may expand this
  * to include sockets for communictating across a network.
+ *
+ * Written data is buffered until Flush is called, so each command or event
+ * is sent as a single message. Reads are also buffered, so the fields of a
+ * message don't each require a separate read from the pipe.
  */
 class Channel
 {
 
 public:
 
+    typedef void (*IdleCallback)(void* param);
+
     /**
      * Constructor. Create must be called on the channel before it can be used.
      */
@@ -67,22 +75,39 @@ public:
     void Destroy();
 
     /**
-     * Writes a 32-bit unsigned integer to the channel and returns immediately.
+     * Sets a function that's called every interval milliseconds while a read
+     * is blocked waiting for data, so the reading thread can do periodic work.
+     * Passing NULL for the callback removes it.
+     */
+    void SetIdleCallback(IdleCallback callback, void* param, DWORD interval);
+
+    /**
+     * Writes a 32-bit unsigned integer to the channel. The data isn't sent
+     * until Flush is called.
      */
     bool WriteUInt32(unsigned int value);
 
     /**
-     * Writes a string to the channel and returns immediately.
+     * Writes a 64-bit unsigned integer to the channel. The data isn't sent
+     * until Flush is called.
+     */
+    bool WriteUInt64(ULONGLONG value);
+
+    /**
+     * Writes a string to the channel. The data isn't sent until Flush is
+     * called.
      */
     bool WriteString(const char* value);
 
     /**
-     * Writes a string to the channel and returns immediately.
+     * Writes a string to the channel. The data isn't sent until Flush is
+     * called.
      */
     bool WriteString(const std::string& value);
 
     /**
-     * Writes a boolean to the channel and returns immediately.
+     * Writes a boolean to the channel. The data isn't sent until Flush is
+     * called.
      */
     bool WriteBool(bool value);
 
@@ -92,6 +117,12 @@ public:
      */
     bool ReadUInt32(unsigned int& value);
 
+    /**
+     * Reads a 64-bit unsigned integer from the channel. This operation blocks
+     * until the data is available.
+     */
+    bool ReadUInt64(ULONGLONG& value);
+
     /**
      * Reads a string from the channel. This operation blocks until the
      * data is available.
@@ -105,30 +136,56 @@ public:
     bool ReadBool(bool& value);
 
     /**
-     * Flushes the buffers, causing any written data to be sent.
+     * Flushes the buffers, sending all of the data written since the last
+     * flush as one message. Returns false if the data couldn't be sent.
      */
-    void Flush();
+    bool Flush();
 
 private:
 
     /**
-     * Writes data to the channel and returns immediately.
+     * Adds data to the write buffer.
      */
     bool Write(const void* buffer, unsigned int length);
 
     /**
-     * Reads data to the channel. Returns when the specified amount has been
+     * Reads data from the channel. Returns when the specified amount has been
      * read or when an error occurs.
      */
     bool Read(void* buffer, unsigned int length);
 
+    /**
+     * Sends data through the pipe, waiting for the write to complete.
+     */
+    bool Send(const void* buffer, unsigned int length);
+
+    /**
+     * Reads as much data as is available (up to the size of the read buffer)
+     * from the pipe into the read buffer. This blocks until some data is
+     * available.
+     */
+    bool FillReadBuffer();
+
 private:
 
-    HANDLE  m_pipe;
-    HANDLE  m_doneEvent;
-    HANDLE  m_readEvent;
+    static const unsigned int s_bufferSize = 64 * 1024;
+
+    HANDLE          m_pipe;
+    HANDLE          m_doneEvent;
+    HANDLE          m_readEvent;
+
+    bool            m_creator;
+
+    CriticalSection m_writeCriticalSection;
+    std::string     m_writeBuffer;
+
+    char*           m_readBuffer;
+    unsigned int    m_readBufferPosition;
+    unsigned int    m_readBufferLength;
 
-    bool    m_creator;
+    IdleCallback    m_idleCallback;
+    void*           m_idleParam;
+    DWORD           m_idleInterval;
 
 };
 
@@ -0,0 +1,167 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "Hash.h"
+
+#include <string.h>
+
+ULONGLONG HashData(const char* data, size_t length)
+{
+
+    ULONGLONG hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+
+}
+
+static const unsigned int s_digestRoundConstants[64] =
+    {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+
+static inline unsigned int RotateRight(unsigned int value, unsigned int bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+/**
+ * Mixes one 64 byte block of data into the state of a SHA-256 digest.
+ */
+static void DigestBlock(unsigned int state[8], const unsigned char block[64])
+{
+
+    unsigned int w[64];
+
+    for (unsigned int i = 0; i < 16; ++i)
+    {
+        w[i] = (block[i * 4] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+
+    for (unsigned int i = 16; i < 64; ++i)
+    {
+        unsigned int s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        unsigned int s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    unsigned int a = state[0];
+    unsigned int b = state[1];
+    unsigned int c = state[2];
+    unsigned int d = state[3];
+    unsigned int e = state[4];
+    unsigned int f = state[5];
+    unsigned int g = state[6];
+    unsigned int h = state[7];
+
+    for (unsigned int i = 0; i < 64; ++i)
+    {
+
+        unsigned int s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+        unsigned int ch = (e & f) ^ (~e & g);
+        unsigned int t1 = h + s1 + ch + s_digestRoundConstants[i] + w[i];
+        unsigned int s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+        unsigned int maj = (a & b) ^ (a & c) ^ (b & c);
+        unsigned int t2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+
+}
+
+void DigestData(const char* data, size_t length, unsigned char digest[DigestSize])
+{
+
+    unsigned int state[8] =
+        {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+        };
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+
+    size_t position = 0;
+
+    for (; position + 64 <= length; position += 64)
+    {
+        DigestBlock(state, bytes + position);
+    }
+
+    // The last block is padded with a one bit, zeros and the length in bits,
+    // which takes an extra block if there isn't room for them.
+
+    unsigned char block[128] = { 0 };
+    size_t remaining = length - position;
+
+    memcpy(block, bytes + position, remaining);
+    block[remaining] = 0x80;
+
+    size_t paddedLength = remaining + 9 <= 64 ? 64 : 128;
+    ULONGLONG numBits = static_cast<ULONGLONG>(length) * 8;
+
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+        block[paddedLength - 1 - i] = static_cast<unsigned char>(numBits >> (i * 8));
+    }
+
+    for (size_t i = 0; i < paddedLength; i += 64)
+    {
+        DigestBlock(state, block + i);
+    }
+
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+        digest[i * 4]     = static_cast<unsigned char>(state[i] >> 24);
+        digest[i * 4 + 1] = static_cast<unsigned char>(state[i] >> 16);
+        digest[i * 4 + 2] = static_cast<unsigned char>(state[i] >> 8);
+        digest[i * 4 + 3] = static_cast<unsigned char>(state[i]);
+    }
+
+}
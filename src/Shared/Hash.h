@@ -0,0 +1,48 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <windows.h>
+
+/**
+ * Computes a 64-bit FNV-1a hash of a block of data. This is used to identify
+ * script source code without transferring or comparing it, so the frontend
+ * and backend must use the same function.
+ */
+ULONGLONG HashData(const char* data, size_t length);
+
+/**
+ * Size in bytes of the digest computed by DigestData.
+ */
+const unsigned int DigestSize = 32;
+
+/**
+ * Computes the SHA-256 digest of a block of data. Unlike HashData this is
+ * strong enough that two blocks with the same digest can be treated as
+ * identical, so it's used when the data itself is no longer available to
+ * compare.
+ */
+void DigestData(const char* data, size_t length, unsigned char digest[DigestSize]);
+
+#endif
@@ -42,7 +42,7 @@ enum EventId
     EventId_Initialize          = 11,   // Sent when the backend is ready to have its initialize function called
     EventId_CreateVM            = 1,    // Sent when a script VM is created.
     EventId_DestroyVM           = 2,    // Sent when a script VM is destroyed.
-    EventId_LoadScript          = 3,    // Sent when script data is loaded into the VM.
+    EventId_LoadScript          = 3,    // Sent when script data is loaded into the VM. Only the hash and size of the source are sent.
     EventId_Break               = 4,    // Sent when the debugger breaks on a line.
     EventId_SetBreakpoint       = 5,    // Sent when a breakpoint has been added in the debugger.
     EventId_Exception           = 6,    // Sent when the script encounters an exception (e.g. crash).
@@ -50,6 +50,7 @@ enum EventId
     EventId_Message             = 9,    // Event containing a string message from the debugger.
     EventId_SessionEnd          = 8,    // This is used internally and shouldn't be sent.
     EventId_NameVM              = 10,   // Sent when the name of a VM is set.
+    EventId_ProfileSamples      = 12,   // Sent periodically while profiling with counts of the sampled call stacks.
 };
 
 enum CommandId
@@ -64,9 +65,21 @@ enum CommandId
     CommandId_PatchReplaceLine  = 9,    // Replaces a line of code with a new line.
     CommandId_PatchInsertLine   = 10,   // Adds a new line of code.
     CommandId_PatchDeleteLine   = 11,   // Deletes a line of code.
-    CommandId_LoadDone          = 12,   // Signals to the backend that the frontend has finished processing a load.
+    CommandId_LoadDone          = 12,   // Signals to the backend that the frontend has finished processing a load it's waiting on.
     CommandId_IgnoreException   = 13,   // Instructs the backend to ignore the specified exception message in the future.
     CommandId_DeleteAllBreakpoints = 14,// Instructs the backend to clear all breakpoints set
+    CommandId_StartProfile      = 15,   // Starts sampling the call stacks of all VMs every N instructions.
+    CommandId_StopProfile       = 16,   // Stops sampling and sends the remaining samples.
+    CommandId_SetBreakpointCondition = 17,   // Sets the condition and hit count for a breakpoint.
+    CommandId_ClearBreakpointCondition = 18, // Removes the condition and hit count from a breakpoint.
+    CommandId_SetLogpoint       = 19,   // Sets the message a breakpoint logs instead of stopping.
+    CommandId_StepOut           = 20,   // Continues until the current function returns.
+    CommandId_GetSource         = 21,   // Requests the source code for a script. The reply is a success flag followed by the source.
+    CommandId_SetBreakpointFiles = 22,  // Sets the names of the files the frontend has breakpoints in.
+    CommandId_SetExclusionRules = 23,   // Sets the rules for the scripts that aren't debugged.
+    CommandId_EvaluateMultiple  = 24,   // Evaluates a list of expressions in the same context and returns all of the values.
+    CommandId_ExpandValue       = 25,   // Gets a page of the elements of a table returned by an evaluation.
+    CommandId_SetEvaluateLimits = 26,   // Sets the time, instruction and size limits for evaluating expressions.
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,103 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "SourceStore.h"
+#include "Hash.h"
+
+#include <string.h>
+
+SourceStore::~SourceStore()
+{
+    Clear();
+}
+
+const SourceStore::Source* SourceStore::Acquire(const char* text, size_t length, ULONGLONG hash)
+{
+
+    std::pair<HashToSourceMap::iterator, HashToSourceMap::iterator> matches = m_sources.equal_range(hash);
+
+    for (HashToSourceMap::iterator iterator = matches.first; iterator != matches.second; ++iterator)
+    {
+        Source* source = iterator->second;
+        if (source->text.length() == length && (length == 0 || memcmp(source->text.c_str(), text, length) == 0))
+        {
+            ++source->refCount;
+            return source;
+        }
+    }
+
+    Source* source = new Source;
+
+    if (length > 0)
+    {
+        source->text.assign(text, length);
+    }
+
+    source->hash        = hash;
+    source->refCount    = 1;
+
+    m_sources.insert(std::make_pair(hash, source));
+    return source;
+
+}
+
+const SourceStore::Source* SourceStore::Acquire(const std::string& text)
+{
+    return Acquire(text.c_str(), text.length(), HashData(text.c_str(), text.length()));
+}
+
+void SourceStore::Release(const Source* source)
+{
+
+    if (source == NULL)
+    {
+        return;
+    }
+
+    std::pair<HashToSourceMap::iterator, HashToSourceMap::iterator> matches = m_sources.equal_range(source->hash);
+
+    for (HashToSourceMap::iterator iterator = matches.first; iterator != matches.second; ++iterator)
+    {
+        if (iterator->second == source)
+        {
+            if (--iterator->second->refCount == 0)
+            {
+                delete iterator->second;
+                m_sources.erase(iterator);
+            }
+            break;
+        }
+    }
+
+}
+
+void SourceStore::Clear()
+{
+
+    for (HashToSourceMap::iterator iterator = m_sources.begin(); iterator != m_sources.end(); ++iterator)
+    {
+        delete iterator->second;
+    }
+
+    m_sources.clear();
+
+}
@@ -0,0 +1,88 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SOURCE_STORE_H
+#define SOURCE_STORE_H
+
+#include <windows.h>
+#include <string>
+#include <hash_map>
+
+/**
+ * Holds one copy of the source code for each unique script. Scripts with the
+ * same code share the copy, which is freed when the last of them releases
+ * it. The store isn't thread safe, so the owner must serialize access.
+ */
+class SourceStore
+{
+
+public:
+
+    /**
+     * Source code shared between scripts. The text must not be modified
+     * since other scripts may be referencing it.
+     */
+    struct Source
+    {
+        std::string     text;
+        ULONGLONG       hash;
+        unsigned int    refCount;
+    };
+
+    /**
+     * Destructor.
+     */
+    ~SourceStore();
+
+    /**
+     * Returns the shared copy of the source, adding it to the store if it
+     * isn't already there. The hash must be the HashData of the source.
+     * Each call must be matched by a call to Release.
+     */
+    const Source* Acquire(const char* text, size_t length, ULONGLONG hash);
+
+    /**
+     * Returns the shared copy of the source, adding it to the store if it
+     * isn't already there.
+     */
+    const Source* Acquire(const std::string& text);
+
+    /**
+     * Releases a reference to the source returned by Acquire. NULL is
+     * ignored.
+     */
+    void Release(const Source* source);
+
+    /**
+     * Frees all of the sources regardless of their reference counts.
+     */
+    void Clear();
+
+private:
+
+    typedef stdext::hash_multimap<ULONGLONG, Source*> HashToSourceMap;
+
+    HashToSourceMap     m_sources;
+
+};
+
+#endif
@@ -0,0 +1,151 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ValueEncoding.h"
+
+#include <string.h>
+
+void ValueWriter::WriteValue(const std::string& data, const std::string& type)
+{
+    WriteTag(ValueTag_Value);
+    WriteString(data);
+    WriteString(type);
+}
+
+void ValueWriter::WriteFunction(int scriptIndex, int line)
+{
+    WriteTag(ValueTag_Function);
+    WriteUInt32(scriptIndex);
+    WriteUInt32(line);
+}
+
+void ValueWriter::WriteError(const std::string& message)
+{
+    WriteTag(ValueTag_Error);
+    WriteString(message);
+}
+
+void ValueWriter::BeginTable(unsigned int id, const std::string& type)
+{
+    WriteTag(ValueTag_Table);
+    WriteUInt32(id);
+    WriteString(type);
+}
+
+void ValueWriter::EndTable(unsigned int handle, unsigned int offset)
+{
+    WriteTag(ValueTag_End);
+    WriteUInt32(handle);
+    WriteUInt32(offset);
+}
+
+void ValueWriter::WriteReference(unsigned int id, const std::string& type)
+{
+    WriteTag(ValueTag_Reference);
+    WriteUInt32(id);
+    WriteString(type);
+}
+
+void ValueWriter::BeginValues()
+{
+    WriteTag(ValueTag_Values);
+}
+
+void ValueWriter::EndValues()
+{
+    WriteTag(ValueTag_End);
+}
+
+const std::string& ValueWriter::GetData() const
+{
+    return m_data;
+}
+
+void ValueWriter::WriteTag(ValueTag tag)
+{
+    m_data += static_cast<char>(tag);
+}
+
+void ValueWriter::WriteUInt32(unsigned int value)
+{
+    m_data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void ValueWriter::WriteString(const std::string& value)
+{
+    WriteUInt32(value.length());
+    m_data.append(value);
+}
+
+ValueReader::ValueReader(const char* data, size_t length)
+{
+    m_data      = data;
+    m_length    = length;
+    m_position  = 0;
+}
+
+bool ValueReader::ReadTag(ValueTag& tag)
+{
+
+    if (m_position >= m_length)
+    {
+        return false;
+    }
+
+    tag = static_cast<ValueTag>(m_data[m_position]);
+    ++m_position;
+
+    return true;
+
+}
+
+bool ValueReader::ReadUInt32(unsigned int& value)
+{
+
+    if (m_length - m_position < sizeof(value))
+    {
+        return false;
+    }
+
+    memcpy(&value, m_data + m_position, sizeof(value));
+    m_position += sizeof(value);
+
+    return true;
+
+}
+
+bool ValueReader::ReadString(std::string& value)
+{
+
+    unsigned int length;
+
+    if (!ReadUInt32(length) || m_length - m_position < length)
+    {
+        return false;
+    }
+
+    value.assign(m_data + m_position, length);
+    m_position += length;
+
+    return true;
+
+}
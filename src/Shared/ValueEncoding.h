@@ -0,0 +1,158 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef VALUE_ENCODING_H
+#define VALUE_ENCODING_H
+
+#include <string>
+
+/**
+ * Tags for the values in the binary encoding used to send the results of
+ * evaluating expressions. Each value starts with its tag:
+ *
+ *  ValueTag_Value      data string, type string
+ *  ValueTag_Table      id, type string, key/data value pairs, ValueTag_End,
+ *                      handle and offset of the elements that weren't sent
+ *                      (handle 0 if they all were)
+ *  ValueTag_Function   script index, line
+ *  ValueTag_Error      message string
+ *  ValueTag_Values     values, ValueTag_End
+ *  ValueTag_Reference  id, type string
+ *
+ * Each table is only written once in a result. Later occurrences of it are
+ * written as a reference to the id of the first one (which is also a handle
+ * that can be used to get its elements).
+ *
+ * Strings are a 32-bit length followed by the characters, and numbers are
+ * 32-bit. XML results start with a '<' which isn't a valid tag.
+ */
+enum ValueTag
+{
+    ValueTag_End            = 0,
+    ValueTag_Value          = 1,
+    ValueTag_Table          = 2,
+    ValueTag_Function       = 3,
+    ValueTag_Error          = 4,
+    ValueTag_Values         = 5,
+    ValueTag_Reference      = 6,
+};
+
+/**
+ * Writes values in the binary encoding into a buffer.
+ */
+class ValueWriter
+{
+
+public:
+
+    /**
+     * Writes a simple value with its text and type name.
+     */
+    void WriteValue(const std::string& data, const std::string& type);
+
+    /**
+     * Writes a function value.
+     */
+    void WriteFunction(int scriptIndex, int line);
+
+    /**
+     * Writes an error message in place of a value.
+     */
+    void WriteError(const std::string& message);
+
+    /**
+     * Starts a table. The elements are written as pairs of values for the key
+     * and data, and must be followed by a call to EndTable.
+     */
+    void BeginTable(unsigned int id, const std::string& type);
+
+    /**
+     * Ends a table. If not all of the elements were written, the handle and
+     * offset are used to get the rest of them.
+     */
+    void EndTable(unsigned int handle, unsigned int offset);
+
+    /**
+     * Writes a reference to a table that was already written.
+     */
+    void WriteReference(unsigned int id, const std::string& type);
+
+    /**
+     * Starts a list of values. This is used when an expression has multiple
+     * results, and must be followed by a call to EndValues.
+     */
+    void BeginValues();
+
+    /**
+     * Ends a list of values.
+     */
+    void EndValues();
+
+    /**
+     * Returns the encoded values.
+     */
+    const std::string& GetData() const;
+
+private:
+
+    void WriteTag(ValueTag tag);
+    void WriteUInt32(unsigned int value);
+    void WriteString(const std::string& value);
+
+private:
+
+    std::string     m_data;
+
+};
+
+/**
+ * Reads values in the binary encoding. All of the methods return false if
+ * there isn't enough data left.
+ */
+class ValueReader
+{
+
+public:
+
+    /**
+     * Constructor. The data must stay valid while the reader is used.
+     */
+    ValueReader(const char* data, size_t length);
+
+    /**
+     * Reads the tag at the start of a value or the end of a table or list.
+     */
+    bool ReadTag(ValueTag& tag);
+
+    bool ReadUInt32(unsigned int& value);
+
+    bool ReadString(std::string& value);
+
+private:
+
+    const char*     m_data;
+    size_t          m_length;
+    size_t          m_position;
+
+};
+
+#endif